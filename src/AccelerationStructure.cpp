@@ -1,7 +1,39 @@
 #include "AccelerationStructure.h"
+#include "RayPacket.h"
+#include "Intersection.h"
+#include "Shape.h"
 
 namespace actracer
 {
 
+/*
+ * Surface attributes are computed only once, for the closest hit
+ */
+void AccelerationStructure::Intersect(Ray &cameraRay, SurfaceIntersection &intersectedSurfaceInformation, float intersectionTestEpsilon) const
+{
+    HitRecord closestHit{};
+    IntersectClosestHit(cameraRay, closestHit, intersectionTestEpsilon);
+
+    if (closestHit.IsValid())
+        closestHit.shape->Finalize(cameraRay, closestHit, intersectedSurfaceInformation, intersectionTestEpsilon);
+}
+
+void AccelerationStructure::IntersectPacket(RayPacket &packet, SurfaceIntersection *intersectedSurfaceInformations, float intersectionTestEpsilon) const
+{
+    HitRecord closestHits[RayPacket::size]{};
+    IntersectClosestHits(packet, closestHits, intersectionTestEpsilon);
+
+    for (int i = 0; i < packet.GetRayCount(); ++i)
+    {
+        if (closestHits[i].IsValid())
+            closestHits[i].shape->Finalize(packet.GetRay(i), closestHits[i], intersectedSurfaceInformations[i], intersectionTestEpsilon);
+    }
+}
+
+void AccelerationStructure::IntersectClosestHits(RayPacket &packet, HitRecord *closestHits, float intersectionTestEpsilon) const
+{
+    for (int i = 0; i < packet.GetRayCount(); ++i)
+        IntersectClosestHit(packet.GetRay(i), closestHits[i], intersectionTestEpsilon);
+}
 
-}
\ No newline at end of file
+}
@@ -8,17 +8,42 @@ namespace actracer
 class Primitive;
 class Ray;
 class SurfaceIntersection;
+class HitRecord;
+class RayPacket;
 
 class AccelerationStructure
 {
 public:
-    enum class AccelerationStructureAlgorithmCode { BVH };
+    enum class AccelerationStructureAlgorithmCode { BVH, MOTION_BVH, SBVH };
 public:
+    virtual ~AccelerationStructure() = default;
+
     /*
      * Checks if given ray intersects with any of the primitives exist in the scene.
      * If so, puts the closest "Valid" SurfaceIntersection information into passed parameter
      */ 
-    virtual void Intersect(Ray &cameraRay, SurfaceIntersection& intersectedSurfaceInformation, float intersectionTestEpsilon) const = 0;
+    void Intersect(Ray &cameraRay, SurfaceIntersection& intersectedSurfaceInformation, float intersectionTestEpsilon) const;
+    /*
+     * Intersect for each ray of the packet, result of the ith ray is put into intersectedSurfaceInformations[i]
+     */
+    void IntersectPacket(RayPacket &packet, SurfaceIntersection *intersectedSurfaceInformations, float intersectionTestEpsilon) const;
+
+    /*
+     * Finds the closest hit of the ray without computing its surface attributes,
+     * enough for occlusion tests. closestHit is left invalid if the ray hits nothing
+     */
+    virtual void IntersectClosestHit(Ray &cameraRay, HitRecord &closestHit, float intersectionTestEpsilon) const = 0;
+    /*
+     * IntersectClosestHit for each ray of the packet, result of the ith ray is put into closestHits[i].
+     * Default implementation intersects the rays one by one
+     */
+    virtual void IntersectClosestHits(RayPacket &packet, HitRecord *closestHits, float intersectionTestEpsilon) const;
+
+    /*
+     * Updates the structure after the primitives moved, boxes are refit from the primitives
+     * and the parts whose SAH cost degraded too far are rebuilt. Returns the number of rebuilt parts
+     */
+    virtual int Refit() = 0;
 protected:
     AccelerationStructure() { }
 protected:
@@ -1,18 +1,26 @@
 #include "AccelerationStructureFactory.h"
 #include "BVHTree.h"
+#include "MotionBVHTree.h"
+#include "SBVHTree.h"
 
 #include <vector>
 
 namespace actracer
 {
     AccelerationStructure *AccelerationStructureFactory::CreateAccelerationStructure(AccelerationStructure::AccelerationStructureAlgorithmCode algorithmCode,
-                                                                                     const std::vector<Primitive *> &primitives)
+                                                                                     const std::vector<Primitive *> &primitives,
+                                                                                     float maxReferenceGrowth,
+                                                                                     AccelerationStructure::AccelerationStructureAlgorithmCode staticAlgorithmCode)
     {
 
         switch (algorithmCode)
         {
         case AccelerationStructure::AccelerationStructureAlgorithmCode::BVH:
             return new BVHTree(1, 10000, primitives);
+        case AccelerationStructure::AccelerationStructureAlgorithmCode::MOTION_BVH:
+            return new MotionBVHTree(1, primitives, staticAlgorithmCode, maxReferenceGrowth);
+        case AccelerationStructure::AccelerationStructureAlgorithmCode::SBVH:
+            return new SBVHTree(1, maxReferenceGrowth, primitives);
         default:
             break;
         }
@@ -12,7 +12,9 @@ class AccelerationStructureFactory
 {
 public:
     static AccelerationStructure *CreateAccelerationStructure(AccelerationStructure::AccelerationStructureAlgorithmCode algorithmCode, 
-                                                              const std::vector<Primitive *> &primitives);
+                                                              const std::vector<Primitive *> &primitives,
+                                                              float maxReferenceGrowth = 1.5f, // Only used by SBVH, bounds the references to the primitives
+                                                              AccelerationStructure::AccelerationStructureAlgorithmCode staticAlgorithmCode = AccelerationStructure::AccelerationStructureAlgorithmCode::BVH); // Only used by the motion BVH, structure of its static primitives
 };
 
 }
\ No newline at end of file
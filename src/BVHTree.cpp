@@ -1,14 +1,18 @@
 #include <algorithm>
 #include <thread>
 #include <future>
+#include <bitset>
 
 #include "BVHTree.h"
 #include "Primitive.h"
+#include "RayPacket.h"
+#include "Intersection.h"
+#include "RenderStatistics.h"
 
 namespace actracer {
 
     BVHTree::BVHTree(int mpc, int pc, const std::vector<Primitive *> &prims)
-        : maxPrimitiveCountInLeaf(mpc), primitives(prims)
+        : maxPrimitiveCountInLeaf(mpc), primitives(prims), root(nullptr)
     {
         if (prims.size() == 0)
             return;
@@ -33,6 +37,55 @@ namespace actracer {
         delete head;
     }
 
+    int BVHTree::Refit()
+    {
+        if(!root)
+            return 0;
+
+        return RefitBranch(root, 0);
+    }
+
+    int BVHTree::RefitBranch(BVHNode *head, int depth)
+    {
+        if(head->IsLeaf())
+        {
+            BoundingVolume3f leafVolume{};
+            for(int i = head->startIndex; i < head->endIndex; ++i)
+            {
+                primitives[i]->UpdateBoundingBox();
+                leafVolume = Merge(leafVolume, primitives[i]->bbox);
+            }
+
+            head->bbox = leafVolume;
+            return 0;
+        }
+
+        int rebuiltBranchCount;
+        if(depth < parallelRefitDepth && head->endIndex - head->startIndex > parallelRefitPrimitiveCount)
+        {
+            // Branches cover disjoint intervals of the primitives, so they are refit and rebuilt independently
+            std::future<int> leftRebuiltBranchCount = std::async(std::launch::async, &BVHTree::RefitBranch, this, head->left, depth + 1);
+            rebuiltBranchCount = RefitBranch(head->right, depth + 1);
+            rebuiltBranchCount += leftRebuiltBranchCount.get();
+        }
+        else
+            rebuiltBranchCount = RefitBranch(head->left, depth + 1) + RefitBranch(head->right, depth + 1);
+
+        head->bbox = Merge(head->left->bbox, head->right->bbox);
+        head->UpdateSahCost();
+
+        if(head->sahCost > head->builtSahCost * refitRebuildRatio)
+        {
+            Clear(head->left);
+            Clear(head->right);
+            BuildTree(head->startIndex, head->endIndex, head);
+
+            return 1; // Replaces the branches rebuilt under it
+        }
+
+        return rebuiltBranchCount;
+    }
+
     /*
      * TODO: Decompose into smaller functions
      */ 
@@ -152,56 +205,136 @@ namespace actracer {
         return currentNode;
     }
 
-    void BVHTree::Intersect(Ray &cameraRay, SurfaceIntersection &intersectedSurfaceInformation, float intersectionTestEpsilon) const
+    void BVHTree::IntersectClosestHit(Ray &cameraRay, HitRecord &closestHit, float intersectionTestEpsilon) const
     {
-        IntersectThroughHierarchy(this->root, cameraRay, intersectedSurfaceInformation, intersectionTestEpsilon);
+        IntersectThroughHierarchy(this->root, cameraRay, closestHit, intersectionTestEpsilon);
     }
 
-    void BVHTree::IntersectThroughHierarchy(BVHNode *head, Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) const
+    void BVHTree::IntersectThroughHierarchy(BVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const
     {
         if(head == nullptr)
             return;
         float tn = 0, tf;
+        ACTRACER_STATS_INCREMENT(BOX_TESTS, 1);
         if(head->bbox.Intersect(r, tn, tf)) // Test if ray intersects with the bounding box
         {
+            ACTRACER_STATS_INCREMENT(NODE_VISITS, 1);
             if(head->IsLeaf())
-                ProcessIntersectionForLeafNode(head, r, rt, intersectionTestEpsilon);
+                ProcessIntersectionForLeafNode(head, r, hit, intersectionTestEpsilon);
             else
-                ProcessIntersectionForInternalNode(head, r, rt, intersectionTestEpsilon);
+                ProcessIntersectionForInternalNode(head, r, hit, intersectionTestEpsilon);
         }
     }
 
     /*
      * Loops through all primitives that are contained in this leaf node and picks the closest one
      */
-    void BVHTree::ProcessIntersectionForLeafNode(const BVHNode *head, Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) const
+    void BVHTree::ProcessIntersectionForLeafNode(const BVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const
     {
         for (int i = head->startIndex; i < head->endIndex; ++i)
         {
-            SurfaceIntersection t{};
-            primitives[i]->Intersect(r, t, intersectionTestEpsilon);
+            HitRecord candidate{};
+            primitives[i]->Intersect(r, candidate, intersectionTestEpsilon);
 
-            if (t.IsValid() && 
-                t.t > 0 && t.t < rt.t - 0.001f) // Closer
+            if (candidate.IsValid() && 
+                candidate.t > 0 && candidate.t < hit.t - 0.001f) // Closer
             {
-                rt = t;
+                hit = candidate;
             }
         }
     }
 
-    void BVHTree::ProcessIntersectionForInternalNode(const BVHNode *head, Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) const
+    void BVHTree::ProcessIntersectionForInternalNode(const BVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const
     {
-        SurfaceIntersection leftIntersection{};
-        SurfaceIntersection rightIntersection{};
-        IntersectThroughHierarchy(head->left, r, leftIntersection, intersectionTestEpsilon); // Check left node
-        IntersectThroughHierarchy(head->right, r, rightIntersection, intersectionTestEpsilon); // Check right node
-
-        // Pick the closest
-        if (leftIntersection.IsValid() && rightIntersection.IsValid())
-            rt = leftIntersection.t < rightIntersection.t ? leftIntersection : rightIntersection;
-        else if (leftIntersection.IsValid())
-            rt = leftIntersection;
-        else if (rightIntersection.IsValid())
-            rt = rightIntersection;
+        HitRecord leftHit{};
+        HitRecord rightHit{};
+        IntersectThroughHierarchy(head->left, r, leftHit, intersectionTestEpsilon); // Check left node
+        IntersectThroughHierarchy(head->right, r, rightHit, intersectionTestEpsilon); // Check right node
+
+        PickCloserHit(leftHit, rightHit, hit);
+    }
+
+    void BVHTree::PickCloserHit(const HitRecord &leftHit, const HitRecord &rightHit, HitRecord &hit)
+    {
+        if (leftHit.IsValid() && rightHit.IsValid())
+            hit = leftHit.t < rightHit.t ? leftHit : rightHit;
+        else if (leftHit.IsValid())
+            hit = leftHit;
+        else if (rightHit.IsValid())
+            hit = rightHit;
+    }
+
+    void BVHTree::IntersectClosestHits(RayPacket &packet, HitRecord *closestHits, float intersectionTestEpsilon) const
+    {
+        IntersectPacketThroughHierarchy(this->root, packet, packet.GetAllRaysMask(), closestHits, intersectionTestEpsilon);
+    }
+
+    void BVHTree::IntersectPacketThroughHierarchy(BVHNode *head, RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon) const
+    {
+        if(head == nullptr)
+            return;
+
+        unsigned hitRays = packet.IntersectBox(head->bbox, activeRays);
+        ACTRACER_STATS_INCREMENT(BOX_TESTS, std::bitset<RayPacket::size>(activeRays).count());
+        if(hitRays == 0)
+            return;
+        ACTRACER_STATS_INCREMENT(NODE_VISITS, std::bitset<RayPacket::size>(hitRays).count());
+
+        // Rays that are left alone continue without the packet
+        bool isSingleRay = (hitRays & (hitRays - 1)) == 0;
+
+        if(isSingleRay)
+        {
+            for (int i = 0; i < RayPacket::size; ++i)
+            {
+                if(!(hitRays & (1u << i)))
+                    continue;
+
+                if(head->IsLeaf())
+                    ProcessIntersectionForLeafNode(head, packet.GetRay(i), hits[i], intersectionTestEpsilon);
+                else
+                    ProcessIntersectionForInternalNode(head, packet.GetRay(i), hits[i], intersectionTestEpsilon);
+            }
+        }
+        else if(head->IsLeaf())
+            ProcessPacketIntersectionForLeafNode(head, packet, hitRays, hits, intersectionTestEpsilon);
+        else
+            ProcessPacketIntersectionForInternalNode(head, packet, hitRays, hits, intersectionTestEpsilon);
+    }
+
+    /*
+     * Each primitive of the leaf is tested against all active rays at once,
+     * a ray keeps the candidate under the same condition as in ProcessIntersectionForLeafNode
+     */
+    void BVHTree::ProcessPacketIntersectionForLeafNode(const BVHNode *head, RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon) const
+    {
+        HitRecord candidates[RayPacket::size];
+        for (int i = head->startIndex; i < head->endIndex; ++i)
+        {
+            unsigned candidateRays = primitives[i]->IntersectPacket(packet, activeRays, candidates, intersectionTestEpsilon);
+
+            for (int j = 0; j < RayPacket::size; ++j)
+            {
+                if ((candidateRays & (1u << j)) &&
+                    candidates[j].t > 0 && candidates[j].t < hits[j].t - 0.001f) // Closer
+                {
+                    hits[j] = candidates[j];
+                }
+            }
+        }
+    }
+
+    void BVHTree::ProcessPacketIntersectionForInternalNode(const BVHNode *head, RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon) const
+    {
+        HitRecord leftHits[RayPacket::size]{};
+        HitRecord rightHits[RayPacket::size]{};
+        IntersectPacketThroughHierarchy(head->left, packet, activeRays, leftHits, intersectionTestEpsilon);
+        IntersectPacketThroughHierarchy(head->right, packet, activeRays, rightHits, intersectionTestEpsilon);
+
+        for (int i = 0; i < RayPacket::size; ++i)
+        {
+            if(activeRays & (1u << i))
+                PickCloserHit(leftHits[i], rightHits[i], hits[i]);
+        }
     }
 }
\ No newline at end of file
@@ -10,7 +10,8 @@
 namespace actracer {
 
 class Primitive;
-class SurfaceIntersection;
+class HitRecord;
+class RayPacket;
 
 class BVHTree : public AccelerationStructure {
 private:
@@ -20,6 +21,8 @@ private:
         BoundingVolume3f bbox; // Combined bounding box of the node
         int axis; // The axis the volume is split upon, can be [0,1,2]
         int startIndex, endIndex; // The interval of the primitives contained in this branch
+        float sahCost; // SAH cost of the branch relative to the surface area of its box
+        float builtSahCost; // sahCost when the branch was built, the branch is rebuilt by a refit if it degrades too far from it
 
         bool IsLeaf() const
         {
@@ -36,6 +39,8 @@ private:
             left = right = nullptr;
 
             bbox = box;
+
+            sahCost = builtSahCost = end - start;
         }
         // Fill the info for an internal node
         void BuildInternal(int ax, int start, int end, BVHNode* l, BVHNode* r)
@@ -48,6 +53,18 @@ private:
             right = r;
 
             bbox = Merge(l->bbox, r->bbox);
+
+            UpdateSahCost();
+            builtSahCost = sahCost;
+        }
+        // Computes sahCost of an internal node from the costs of its children
+        void UpdateSahCost()
+        {
+            float area = bbox.SA();
+            if(area > 0)
+                sahCost = 0.125f + (left->sahCost * left->bbox.SA() + right->sahCost * right->bbox.SA()) / area;
+            else // Flat children of a flat box
+                sahCost = 0.125f + left->sahCost + right->sahCost;
         }
     };
 
@@ -55,24 +72,43 @@ private:
 private:
     const int maxPrimitiveCountInLeaf;
     static constexpr int partitionCount = 4; // Number of partitions that will be used to divide the box 
+    static constexpr float refitRebuildRatio = 1.3f; // Branches whose SAH cost grows past this ratio by a refit are rebuilt
+    static constexpr int parallelRefitDepth = 4; // Branches above this depth are refit on threads of their own
+    static constexpr int parallelRefitPrimitiveCount = 4096; // Smaller branches are refit on the thread of their parent
 
     std::vector<Primitive* > primitives;
 private:
     BVHNode* BuildTree(int start, int end, BVHNode*);
     void Clear(BVHNode *head);
+    /*
+     * Refits the boxes of the branch bottom-up and rebuilds the branch if its SAH cost degraded past refitRebuildRatio,
+     * returns the number of rebuilt branches in it
+     */
+    int RefitBranch(BVHNode *head, int depth);
     
 public:
-    virtual void Intersect(Ray &cameraRay, SurfaceIntersection &intersectedSurfaceInformation, float intersectionTestEpsilon) const override;
+    virtual void IntersectClosestHit(Ray &cameraRay, HitRecord &closestHit, float intersectionTestEpsilon) const override;
+    virtual void IntersectClosestHits(RayPacket &packet, HitRecord *closestHits, float intersectionTestEpsilon) const override;
+    virtual int Refit() override;
 
     BVHTree(int mpc, int pc, const std::vector<Primitive*>& prims);
     ~BVHTree();
 
 private:
     BVHNode *root;
-    void IntersectThroughHierarchy(BVHNode *head, Ray &cameraRay, SurfaceIntersection &intersectedSurfaceInformation, float intersectionTestEpsilon) const;
+    void IntersectThroughHierarchy(BVHNode *head, Ray &cameraRay, HitRecord &closestHit, float intersectionTestEpsilon) const;
     // No need for polymorphic node structure, only two exists
-    void ProcessIntersectionForLeafNode(const BVHNode *head, Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) const;
-    void ProcessIntersectionForInternalNode(const BVHNode *head, Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) const;
+    void ProcessIntersectionForLeafNode(const BVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const;
+    void ProcessIntersectionForInternalNode(const BVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const;
+
+    /*
+     * Traverses the hierarchy with the rays of activeRays mask together,
+     * each ray ends up with the same intersection it would find through IntersectThroughHierarchy
+     */
+    void IntersectPacketThroughHierarchy(BVHNode *head, RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon) const;
+    void ProcessPacketIntersectionForLeafNode(const BVHNode *head, RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon) const;
+    void ProcessPacketIntersectionForInternalNode(const BVHNode *head, RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon) const;
+    static void PickCloserHit(const HitRecord &leftHit, const HitRecord &rightHit, HitRecord &hit);
 };
 
 }
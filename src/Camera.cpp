@@ -1,9 +1,11 @@
 #include "Camera.h"
 
 #include <string.h>
+#include <cstdio>
 #include <iostream>
 
 #include <cmath>
+#include <algorithm>
 #include <chrono>
 #include "Random.h"
 #include "Scene.h"
@@ -28,6 +30,30 @@ Camera::Camera(int id, const char *imageName, const Vector3f &pos, const Vector3
     camRandom = Random<double>{};
 }
 
+void Camera::ScaleWorkload(float resolutionScale, float sampleScale)
+{
+    imgPlane.nx = std::max(1, (int)std::round(imgPlane.nx * resolutionScale));
+    imgPlane.ny = std::max(1, (int)std::round(imgPlane.ny * resolutionScale));
+
+    mSinglePixelWidth = (imgPlane.right - imgPlane.left) / imgPlane.nx;
+    mSinglePixelHeight = (imgPlane.top - imgPlane.bottom) / imgPlane.ny;
+
+    int sampleGridSize = std::max(1, (int)std::round(std::sqrt(nSamples * sampleScale)));
+    nSamples = sampleGridSize * sampleGridSize;
+
+    mSampler->Init(*this);
+}
+
+void Camera::SetCostHeatmapMetric(CostHeatmapMetric metric)
+{
+    mCostHeatmapMetric = metric;
+}
+
+void Camera::SetGeneratesRayDifferentials(bool generatesRayDifferentials)
+{
+    mGeneratesRayDifferentials = generatesRayDifferentials;
+}
+
 void Camera::SetImageName(const char* imageName)
 {
     const char *c = imageName;
@@ -43,6 +69,21 @@ void Camera::SetImageName(const char* imageName)
     }
 
     *f = '\0';
+
+    mBaseImageName = this->imageName;
+}
+
+void Camera::SetFrameIndex(int frameIndex)
+{
+    char frameSuffix[16];
+    snprintf(frameSuffix, sizeof(frameSuffix), "_%04d", frameIndex);
+
+    std::string frameImageName = mBaseImageName;
+    size_t extensionStart = frameImageName.find_last_of('.');
+    frameImageName.insert(extensionStart == std::string::npos ? frameImageName.size() : extensionStart, frameSuffix);
+
+    strncpy(imageName, frameImageName.c_str(), sizeof(imageName) - 1);
+    imageName[sizeof(imageName) - 1] = '\0';
 }
 
 void Camera::SetupCameraCoordinateAxes()
@@ -75,7 +116,12 @@ Camera::~Camera()
  */
 Ray Camera::GenerateRay(int row, int col) const
 {
-    return Ray(m_Pos, CalculateRayDirectionFor(row, col, 0.5f, 0.5f)); // No need for time no sampling motion blur would be sluggy
+    Ray cameraRay(m_Pos, CalculateRayDirectionFor(row, col, 0.5f, 0.5f)); // No need for time no sampling motion blur would be sluggy
+
+    if (mGeneratesRayDifferentials)
+        SetRayDifferentials(cameraRay, row, col, 0.5f, 0.5f);
+
+    return cameraRay;
 }
 
 /*
@@ -89,11 +135,28 @@ Ray Camera::GenerateRayForPixelSample(const Pixel &px, int sampleId) const
     Vector3f rayDirection = CalculateRayDirectionFor(px.row, px.col, samplePositionOffset.first, samplePositionOffset.second);
     Ray cameraRay(m_Pos, rayDirection); // Standard ray ( without any tilt by lens )
 
+    if (mGeneratesRayDifferentials)
+        SetRayDifferentials(cameraRay, px.row, px.col, samplePositionOffset.first, samplePositionOffset.second);
+
     ApplyLensTilt(cameraRay);
 
     return cameraRay; 
 }
 
+/*
+ * Differentials go through the sample moved by a pixel to the right and to the bottom,
+ * the move shrinks with the sample count since each sample covers a smaller part of the pixel
+ */
+void Camera::SetRayDifferentials(Ray &cameraRay, int row, int col, float horizontalOffset, float verticalOffset) const
+{
+    float differentialScale = std::max(0.125f, 1.0f / std::sqrt((float)nSamples));
+
+    cameraRay.rxo = cameraRay.ryo = m_Pos;
+    cameraRay.rxd = CalculateRayDirectionFor(row, col, horizontalOffset + differentialScale, verticalOffset);
+    cameraRay.ryd = CalculateRayDirectionFor(row, col, horizontalOffset, verticalOffset + differentialScale);
+    cameraRay.hasDifferentials = true;
+}
+
 /*
  * Moves mGaze * imgPlane.distance on z-axis
  * Moves mRight * horizontalMove on x-axis
@@ -142,7 +205,19 @@ void Camera::ApplyLensTilt(Ray &standardRay) const
         Vector3f p = standardRay(td);  // Hit point on the plane at focal distance from camera
         Vector3f tiltedDirection = Normalize(p - movedPointInAperture);
 
-        standardRay = Ray(movedPointInAperture, tiltedDirection); // Tilted ray
+        // Differentials pass through the same point in the aperture
+        if (standardRay.hasDifferentials)
+        {
+            Vector3f px = standardRay.rxo + standardRay.rxd * (focusDistance / Dot(standardRay.rxd, m_Gaze));
+            Vector3f py = standardRay.ryo + standardRay.ryd * (focusDistance / Dot(standardRay.ryd, m_Gaze));
+
+            standardRay.rxo = standardRay.ryo = movedPointInAperture;
+            standardRay.rxd = Normalize(px - movedPointInAperture);
+            standardRay.ryd = Normalize(py - movedPointInAperture);
+        }
+
+        standardRay.o = movedPointInAperture; // Tilted ray
+        standardRay.d = tiltedDirection;
     }
 }
 
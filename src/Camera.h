@@ -4,6 +4,9 @@
 #include "acmath.h"
 #include "Random.h"
 #include "PixelSampler.h"
+#include "CostHeatmap.h"
+
+#include <string>
 
 namespace actracer {
 
@@ -49,8 +52,27 @@ public:
     Pixel GeneratePixelDataAt(int row, int col) const;
 
     bool IsMultiSamplingOn() const;
+
+    /*
+     * Scales the resolution and the sample count of the camera to shorten or lengthen renders,
+     * sample count is kept a perfect square for jittered sampling
+     */
+    void ScaleWorkload(float resolutionScale, float sampleScale);
+    /*
+     * Renderers that support it write the chosen cost of each pixel into a second image
+     */
+    void SetCostHeatmapMetric(CostHeatmapMetric metric);
+    /*
+     * Sample rays carry differentials towards the neighbouring pixels, used to filter textures by their footprint
+     */
+    void SetGeneratesRayDifferentials(bool generatesRayDifferentials);
+    /*
+     * Inserts the frame index before the extension of the image name, for the scenes rendered as a sequence of frames
+     */
+    void SetFrameIndex(int frameIndex);
 public:
     int GetID() const;
+    CostHeatmapMetric GetCostHeatmapMetric() const;
     int GetSampleCount() const;
     const char* GetImageName() const;
 private:
@@ -58,6 +80,7 @@ private:
     float CalculateHorizontalPositionOnImagePlane(int col, float horizontalOffset) const;
     float CalculateVerticalPositionOnImagePlane(int row, float verticalOffset) const;
 
+    void SetRayDifferentials(Ray &cameraRay, int row, int col, float horizontalOffset, float verticalOffset) const;
     void ApplyLensTilt(Ray& standardRay) const;
 private:
     void SetImageName(const char *imageName);
@@ -68,6 +91,7 @@ private:
 
 private:
     char imageName[64]; // Target file name
+    std::string mBaseImageName; // Image name without the frame index
     int m_Id;           // Camera id in the scene
 
     Vector3f m_Pos;   // Camera position
@@ -82,6 +106,9 @@ private:
 
     mutable Random<double> camRandom;
     PixelSampler *mSampler;
+
+    CostHeatmapMetric mCostHeatmapMetric = CostHeatmapMetric::NONE;
+    bool mGeneratesRayDifferentials = false;
 };
 
 inline int Camera::GetID() const 
@@ -89,6 +116,11 @@ inline int Camera::GetID() const
     return m_Id;
 }
 
+inline CostHeatmapMetric Camera::GetCostHeatmapMetric() const
+{
+    return mCostHeatmapMetric;
+}
+
 inline int Camera::GetSampleCount() const
 { 
      return nSamples; 
@@ -0,0 +1,111 @@
+#include "CostHeatmap.h"
+#include "RenderStatistics.h"
+#include "Tonemapper.h"
+#include "Image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace actracer
+{
+
+CostHeatmap::CostHeatmap(int width, int height, CostHeatmapMetric metric, const char *imageName, const Tonemapper *tonemapper)
+    : mWidth(width), mHeight(height), mMetric(metric), mImageName(CreateHeatmapImageName(imageName)), mTonemapper(tonemapper),
+      mPixelCosts(width * height, 0.0f)
+{
+#if !defined(ACTRACER_STATS)
+    if (mMetric == CostHeatmapMetric::NODE_VISITS || mMetric == CostHeatmapMetric::PRIMITIVE_TESTS)
+    {
+        std::cout << "Heatmap counters need a build with ACTRACER_STATS, " << mImageName << " shows time instead\n";
+        mMetric = CostHeatmapMetric::TIME;
+    }
+#endif
+}
+
+uint64_t CostHeatmap::ReadCost() const
+{
+    switch (mMetric)
+    {
+    case CostHeatmapMetric::NODE_VISITS:
+        return RenderStatistics::GetThreadCounter(RenderStatistics::Counter::NODE_VISITS);
+    case CostHeatmapMetric::PRIMITIVE_TESTS:
+        return RenderStatistics::GetThreadCounter(RenderStatistics::Counter::TRIANGLE_TESTS) +
+               RenderStatistics::GetThreadCounter(RenderStatistics::Counter::SPHERE_TESTS);
+    case CostHeatmapMetric::TIME:
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    default:
+        return 0;
+    }
+}
+
+void CostHeatmap::SetPixelCost(int col, int row, uint64_t cost)
+{
+    mPixelCosts[row * mWidth + col] = cost;
+}
+
+void CostHeatmap::Save() const
+{
+    if (mTonemapper)
+        SaveAsEXR();
+    else
+        SaveAsFalseColor();
+}
+
+/*
+ * Cost is written into all channels without tonemapping
+ */
+void CostHeatmap::SaveAsEXR() const
+{
+    std::vector<float> rgb(mPixelCosts.size() * 3);
+    for (size_t i = 0; i < mPixelCosts.size(); ++i)
+        rgb[3 * i + 0] = rgb[3 * i + 1] = rgb[3 * i + 2] = mPixelCosts[i];
+
+    Tonemapper::SaveEXR(rgb.data(), mWidth, mHeight, mImageName.c_str());
+}
+
+void CostHeatmap::SaveAsFalseColor() const
+{
+    // Blue -> cyan -> green -> yellow -> red
+    static const float palette[5][3] = {{0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}};
+
+    float maximumCost = *std::max_element(mPixelCosts.begin(), mPixelCosts.end());
+    if (maximumCost <= 0)
+        maximumCost = 1;
+
+    Image heatmapImage(mWidth, mHeight, mImageName.c_str());
+    for (int row = 0; row < mHeight; ++row)
+    {
+        for (int col = 0; col < mWidth; ++col)
+        {
+            float position = mPixelCosts[row * mWidth + col] / maximumCost * 4;
+            int segment = std::min((int)position, 3);
+            float fraction = position - segment;
+
+            unsigned char channels[3];
+            for (int c = 0; c < 3; ++c)
+                channels[c] = 255 * (palette[segment][c] + (palette[segment + 1][c] - palette[segment][c]) * fraction);
+
+            heatmapImage.SetPixelColor(col, row, Color{channels[0], channels[1], channels[2]});
+        }
+    }
+
+    heatmapImage.SaveImage();
+}
+
+std::string CostHeatmap::CreateHeatmapImageName(const char *imageName)
+{
+    std::string heatmapImageName = imageName;
+
+    // Only a dot in the file name starts the extension, not one in a directory name
+    size_t fileNameStart = heatmapImageName.find_last_of('/');
+    fileNameStart = fileNameStart == std::string::npos ? 0 : fileNameStart + 1;
+
+    size_t extensionStart = heatmapImageName.find_last_of('.');
+    if (extensionStart == std::string::npos || extensionStart < fileNameStart)
+        return heatmapImageName + "_heatmap";
+
+    return heatmapImageName.insert(extensionStart, "_heatmap");
+}
+
+}
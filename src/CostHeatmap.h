@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace actracer
+{
+
+class Tonemapper;
+
+enum class CostHeatmapMetric { NONE, NODE_VISITS, PRIMITIVE_TESTS, TIME };
+
+/*
+ * Render cost of each pixel, written as a second image next to the image of the camera.
+ * With a tonemapper raw costs are saved as EXR, otherwise costs are normalized by the highest cost
+ * and saved in false colors from blue (cheap) to red (expensive).
+ * Node visits and primitive tests are read from the RenderStatistics counters which exist only
+ * if ACTRACER_STATS is defined, time is measured instead if they are missing
+ */
+class CostHeatmap
+{
+public:
+    CostHeatmap(int width, int height, CostHeatmapMetric metric, const char *imageName, const Tonemapper *tonemapper);
+
+    /*
+     * Cost accumulated by the calling thread,
+     * difference of two reads on the same thread is the cost of the work between them
+     */
+    uint64_t ReadCost() const;
+    void SetPixelCost(int col, int row, uint64_t cost);
+
+    void Save() const;
+
+public:
+    /*
+     * Inserts "_heatmap" before the extension of imageName
+     */
+    static std::string CreateHeatmapImageName(const char *imageName);
+
+private:
+    void SaveAsEXR() const;
+    void SaveAsFalseColor() const;
+
+private:
+    int mWidth;
+    int mHeight;
+    CostHeatmapMetric mMetric;
+    std::string mImageName;
+    const Tonemapper *mTonemapper;
+
+    std::vector<float> mPixelCosts;
+};
+
+}
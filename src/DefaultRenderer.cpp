@@ -6,30 +6,27 @@
 #include "Timer.h"
 #include "Material.h"
 #include "MultiSampledRayGenerator.h"
-#include "AccelerationStructureFactory.h"
 #include "AccelerationStructure.h"
 #include "LightContributionCalculator.h"
+#include "LightBVH.h"
+#include "RayPacket.h"
+#include "RenderStatistics.h"
+#include "TextureCache.h"
+#include "CostHeatmap.h"
+#include "Tracer.h"
 
 #include <thread>
+#include <algorithm>
 
 namespace actracer
 {
 
-static Color ObtainColorFromUnclampedVector(const Vector3f &unclampedColor)
-{
-    // Clamp the raw values between 0 - 255
-    unsigned char colorRed = unclampedColor.x > 255.0f ? 255 : unclampedColor.x;
-    unsigned char colorGreen = unclampedColor.y > 255.0f ? 255 : unclampedColor.y;
-    unsigned char colorBlue = unclampedColor.z > 255.0f ? 255 : unclampedColor.z;
-    // --
-
-    return {colorRed, colorGreen, colorBlue};
-}
-
 DefaultRenderer::~DefaultRenderer()
 {
     if(accelerator)
         delete accelerator;
+    if(mLightBVH)
+        delete mLightBVH;
 }
 
 void DefaultRenderer::RenderSceneIntoPPM(Scene* scene)
@@ -38,15 +35,28 @@ void DefaultRenderer::RenderSceneIntoPPM(Scene* scene)
 
     RetrieveRenderingParamsFromScene(scene);
 
-    for (Camera* camera : scene->GetAllCameras())
+    for (int frameIndex = 0; frameIndex < scene->GetFrameCount(); ++frameIndex)
     {
-        RenderCamera(camera);
+        // Only a few transforms change between the frames, the structure is refit instead of built again
+        if (frameIndex > 0)
+        {
+            scene->AdvanceFrame();
+            RefitAccelerationStructure(accelerator);
+        }
+
+        for (Camera* camera : scene->GetAllCameras())
+        {
+            RenderCamera(camera);
+        }
     }
 }
 
 void DefaultRenderer::RetrieveRenderingParamsFromScene(Scene *scene)
 {
-    accelerator = AccelerationStructureFactory::CreateAccelerationStructure(AccelerationStructure::AccelerationStructureAlgorithmCode::BVH, scene->GetAllPrimitives());
+    if(accelerator)
+        delete accelerator;
+
+    accelerator = BuildAccelerationStructure(scene);
     maximumRecursionDepth = scene->GetMaximumRecursionDepth();
     intersectionTestEpsilon = scene->GetIntersectionTestEpsilon();
     shadowRayEpsilon = scene->GetShadowRayEpsilon();
@@ -54,14 +64,27 @@ void DefaultRenderer::RetrieveRenderingParamsFromScene(Scene *scene)
     ambientColor = scene->GetAmbientColor();
 
     tonemapper = scene->GetTonemapper();
+
+    delete mLightBVH;
+    mLightBVH = nullptr;
+    if(scene->GetLightSampleCount() > 0)
+        mLightBVH = new LightBVH(scene->GetAllLights());
 }
 
 void DefaultRenderer::RenderCamera(const Camera *camera)
 {
     Timer cameraRenderTimer{camera->GetImageName()};
+    TraceScope traceScope{"Render camera", camera->GetID()};
+
+    int fresnelBranchSelectionThreshold = mCurrentRenderedScene->GetFresnelBranchSelectionThreshold();
+    mSelectFresnelBranch = fresnelBranchSelectionThreshold > 0 && camera->GetSampleCount() > fresnelBranchSelectionThreshold;
 
     Image sceneImage(camera->imgPlane.nx, camera->imgPlane.ny, camera->GetImageName(), tonemapper);
 
+    mCostHeatmap = nullptr;
+    if (camera->GetCostHeatmapMetric() != CostHeatmapMetric::NONE)
+        mCostHeatmap = new CostHeatmap(camera->imgPlane.nx, camera->imgPlane.ny, camera->GetCostHeatmapMetric(), camera->GetImageName(), tonemapper);
+
     int rowDiff = camera->imgPlane.ny / 8; // Get row difference between successive chunks
     std::thread th1(&DefaultRenderer::RenderCameraViewOntoImage, this, camera, std::ref(sceneImage), 0, rowDiff);
     std::thread th2(&DefaultRenderer::RenderCameraViewOntoImage, this, camera, std::ref(sceneImage), rowDiff * 1, rowDiff * 2);
@@ -75,7 +98,17 @@ void DefaultRenderer::RenderCamera(const Camera *camera)
     th1.join(); th2.join(); th3.join(); th4.join(); th5.join(); th6.join(); th7.join(); th8.join();
 
     // RenderCameraViewOntoImage(camera, sceneImage, 0, camera->imgPlane.ny);
+    ACTRACER_STATS_REPORT(camera->GetImageName());
+    if (TextureCache *textureCache = mCurrentRenderedScene->GetTextureCache())
+        textureCache->Report(camera->GetImageName());
     sceneImage.SaveImage();
+
+    if (mCostHeatmap)
+    {
+        mCostHeatmap->Save();
+        delete mCostHeatmap;
+        mCostHeatmap = nullptr;
+    }
 }
 
 /*
@@ -84,37 +117,83 @@ void DefaultRenderer::RenderCamera(const Camera *camera)
  */ 
 Image &DefaultRenderer::RenderCameraViewOntoImage(const Camera *camera, Image &image, int startRowIndex, int endRowIndex)
 {
+    TraceScope traceScope{"Render rows", startRowIndex};
+
     bool isCameraMultiSampled = camera->IsMultiSamplingOn();
+    int segmentSize = mCostHeatmap ? 1 : RayPacket::size;
+
+    Random<double> randomGenerator{static_cast<unsigned>(startRowIndex)};
 
     for (int i = startRowIndex; i < endRowIndex; ++i)
     {
+        TraceScope rowTraceScope{"Render row", i};
+
+        if (!isCameraMultiSampled)
+        {
+            for (int j = 0; j < camera->imgPlane.nx; j += segmentSize)
+            {
+                uint64_t costBefore = mCostHeatmap ? mCostHeatmap->ReadCost() : 0;
+                RenderRowSegmentWithOneSample(camera, image, i, j, std::min(j + segmentSize, camera->imgPlane.nx), randomGenerator);
+
+                if (mCostHeatmap)
+                    mCostHeatmap->SetPixelCost(j, i, mCostHeatmap->ReadCost() - costBefore);
+            }
+
+            continue;
+        }
+
         for (int j = 0; j < camera->imgPlane.nx; ++j)
         {
-            Color res = Color(0, 0, 0);
-            if (isCameraMultiSampled)
-                res = RenderMultiSampled(camera, i, j);
-            else
-                res = RenderWithOneSample(camera, i, j);
+            uint64_t costBefore = mCostHeatmap ? mCostHeatmap->ReadCost() : 0;
+            image.SetPixelColor(j, i, RenderMultiSampled(camera, i, j, randomGenerator));
 
-            image.SetPixelColor(j, i, res);
+            if (mCostHeatmap)
+                mCostHeatmap->SetPixelCost(j, i, mCostHeatmap->ReadCost() - costBefore);
         }
     }
 
     return image;
 }
 
-Color DefaultRenderer::RenderMultiSampled(const Camera *cam, int row, int column)
+/*
+ * Samples of the pixel are traced in packets
+ */
+Color DefaultRenderer::RenderMultiSampled(const Camera *cam, int row, int column, Random<double> &randomGenerator)
 {
+    LightContributionCalculator contributionCalculator{};
+    SetupContributionCalculator(contributionCalculator, randomGenerator);
+
     Pixel currentPixel = cam->GeneratePixelDataAt(row, column);
     MultiSampledRayGenerator rayGenerator{*cam, currentPixel};
 
+    float columnsNormalized01[RayPacket::size];
+    float rowsNormalized01[RayPacket::size];
+    std::fill(columnsNormalized01, columnsNormalized01 + RayPacket::size, (float)column / cam->imgPlane.nx);
+    std::fill(rowsNormalized01, rowsNormalized01 + RayPacket::size, (float)row / cam->imgPlane.ny);
+
     Vector3f sumOfPixelSampleColors{};
     while(!rayGenerator.FinishedSamples())
     {
-        Ray ray = rayGenerator.GetNextSampleRay();
-        Vector3f pixelSampleColor;
-        CalculateLight(ray, pixelSampleColor, 0, (float)column / cam->imgPlane.nx, (float)row / cam->imgPlane.ny);
-        sumOfPixelSampleColors += pixelSampleColor;
+        Ray sampleRays[RayPacket::size];
+        Ray *rays[RayPacket::size];
+
+        int rayCount = 0;
+        {
+            ACTRACER_STATS_STAGE(RAY_GENERATION);
+            for (; rayCount < RayPacket::size && !rayGenerator.FinishedSamples(); ++rayCount)
+            {
+                sampleRays[rayCount] = rayGenerator.GetNextSampleRay();
+                rays[rayCount] = &sampleRays[rayCount];
+            }
+        }
+        ACTRACER_STATS_INCREMENT(CAMERA_RAYS, rayCount);
+
+        RayPacket packet{rays, rayCount};
+        Vector3f pixelSampleColors[RayPacket::size];
+        contributionCalculator.CalculateLightForPacket(packet, pixelSampleColors, columnsNormalized01, rowsNormalized01);
+
+        for (int i = 0; i < rayCount; ++i)
+            sumOfPixelSampleColors += pixelSampleColors[i];
     }
 
     sumOfPixelSampleColors /= cam->GetSampleCount();
@@ -123,29 +202,44 @@ Color DefaultRenderer::RenderMultiSampled(const Camera *cam, int row, int column
 }
 
 /*
- * Shoots the ray directly to the center of the pixel located at [row, column] and returns the calculated color
+ * Shoots the rays directly to the centers of the pixels located at [row, startColumn-endColumn] and writes the calculated colors
  */ 
-Color DefaultRenderer::RenderWithOneSample(const Camera *camera, int row, int column)
+void DefaultRenderer::RenderRowSegmentWithOneSample(const Camera *camera, Image &image, int row, int startColumn, int endColumn, Random<double> &randomGenerator)
 {
-    Ray r = camera->GenerateRay(row, column);
-    r.currMat = Material::DefaultMaterial;
-    r.currShape = nullptr;
+    LightContributionCalculator contributionCalculator{};
+    SetupContributionCalculator(contributionCalculator, randomGenerator);
 
-    Vector3f pixelColor{};
-    CalculateLight(r, pixelColor, 0, (float) column / camera->imgPlane.nx, (float)row / camera->imgPlane.ny);
+    Ray cameraRays[RayPacket::size];
+    Ray *rays[RayPacket::size];
+    float columnsNormalized01[RayPacket::size];
+    float rowsNormalized01[RayPacket::size];
 
-    return ObtainColorFromUnclampedVector(pixelColor);
+    int rayCount = endColumn - startColumn;
+    {
+        ACTRACER_STATS_STAGE(RAY_GENERATION);
+        for (int i = 0; i < rayCount; ++i)
+        {
+            cameraRays[i] = camera->GenerateRay(row, startColumn + i);
+            cameraRays[i].currMat = Material::DefaultMaterial;
+            cameraRays[i].currShape = nullptr;
+            rays[i] = &cameraRays[i];
+
+            columnsNormalized01[i] = (float)(startColumn + i) / camera->imgPlane.nx;
+            rowsNormalized01[i] = (float)row / camera->imgPlane.ny;
+        }
+    }
+    ACTRACER_STATS_INCREMENT(CAMERA_RAYS, rayCount);
+
+    RayPacket packet{rays, rayCount};
+    Vector3f pixelColors[RayPacket::size];
+    contributionCalculator.CalculateLightForPacket(packet, pixelColors, columnsNormalized01, rowsNormalized01);
+
+    for (int i = 0; i < rayCount; ++i)
+        image.SetPixelColor(startColumn + i, row, ObtainColorFromUnclampedVector(pixelColors[i]));
 }
 
-/*
- * columnNormalized01 -> ColumnPosition Mapped to [0-1]: column / width
- * rowNormalized01 -> RowPosition Mapped to [0-1]: row / height
- * depth -> recursion depth
- * Light contribution result is written into outColor
- */
-void DefaultRenderer::CalculateLight(Ray &r, Vector3f &outColor, int depth, float columnNormalized01, float rowNormalized01)
+void DefaultRenderer::SetupContributionCalculator(LightContributionCalculator &contributionCalculator, Random<double> &randomGenerator)
 {
-    LightContributionCalculator contributionCalculator{};
     contributionCalculator.SetSceneLights(mCurrentRenderedScene->GetAllLights(), 
                                           mCurrentRenderedScene->GetAmbientColor(), 
                                           mCurrentRenderedScene->GetBackgroundColor(),
@@ -157,8 +251,9 @@ void DefaultRenderer::CalculateLight(Ray &r, Vector3f &outColor, int depth, floa
                                                mCurrentRenderedScene->GetShadowRayEpsilon(),
                                                2.2f,
                                                randomGenerator);
-
-    contributionCalculator.CalculateLight(r, outColor, 0, columnNormalized01, rowNormalized01);
+    contributionCalculator.SetPathTerminationParameters(mCurrentRenderedScene->GetMinimumThroughput());
+    contributionCalculator.SetFresnelBranchSelection(mSelectFresnelBranch);
+    contributionCalculator.SetLightSampling(mLightBVH, mCurrentRenderedScene->GetLightSampleCount());
 }
 
-}
\ No newline at end of file
+}
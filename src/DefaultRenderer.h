@@ -7,10 +7,13 @@ namespace actracer
 {
 
 class AccelerationStructure;
+class LightBVH;
 class Tonemapper;
+class LightContributionCalculator;
 class Image;
 class Camera;
 class Scene;
+class CostHeatmap;
 union Color;
 
 class DefaultRenderer : public RenderStrategy
@@ -28,19 +31,30 @@ protected:
     virtual void RetrieveRenderingParamsFromScene(Scene *scene) override;
 
 private:
+    /*
+     * Renders the camera view and saves the image,
+     * one fresnel branch is selected per hit if the camera has more samples than the scene threshold.
+     * If the camera asks for a cost heatmap, pixels are traced one by one so that their costs can be told apart
+     */
     void RenderCamera(const Camera* camera);
     /*
-     * Computes the values of pixels of rows [startRowIndex-endRowIndex] and writes into image
+     * Computes the values of pixels of rows [startRowIndex-endRowIndex] and writes into image,
+     * draws of the worker come from a generator of its own seeded with startRowIndex
      */ 
     Image &RenderCameraViewOntoImage(const Camera *camera, Image &image, int startRowIndex, int endRowIndex);
 
-    Color RenderWithOneSample(const Camera *camera, int row, int column);
-    Color RenderMultiSampled(const Camera *cam, int row, int col);
+    /*
+     * Renders pixels [startColumn-endColumn] of the row with one sample each, camera rays are traced in packets
+     */
+    void RenderRowSegmentWithOneSample(const Camera *camera, Image &image, int row, int startColumn, int endColumn, Random<double> &randomGenerator);
+    Color RenderMultiSampled(const Camera *cam, int row, int col, Random<double> &randomGenerator);
 
-    void CalculateLight(Ray &cameraRay, Vector3f &outColor, int depth, float columnNormalized01, float rowNormalized01);
+    void SetupContributionCalculator(LightContributionCalculator &contributionCalculator, Random<double> &randomGenerator);
 
 private:
     const Scene* mCurrentRenderedScene;
+    bool mSelectFresnelBranch; // Set per camera
+    CostHeatmap *mCostHeatmap = nullptr; // Set per camera, nullptr if the camera has no heatmap
 
     int maximumRecursionDepth;
     float intersectionTestEpsilon;
@@ -51,7 +65,8 @@ private:
 
     const Tonemapper* tonemapper;
 
-    AccelerationStructure* accelerator;
+    AccelerationStructure* accelerator = nullptr;
+    LightBVH* mLightBVH = nullptr; // Built if the scene samples lights
 };
 
 
@@ -59,6 +59,8 @@ namespace actracer
                 RecordPixelLuminance(i, j, luminanceSum);
             }
         }
+
+        return luminanceSum;
     }
 
     void DefaultTonemapStrategy::RecordPixelLuminance(int row, int column, float &luminanceSum)
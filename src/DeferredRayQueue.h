@@ -0,0 +1,32 @@
+#pragma once
+
+#include "acmath.h"
+
+namespace actracer
+{
+
+class Ray;
+
+/*
+ * Receives the rays that LightContributionCalculator would otherwise trace on the spot,
+ * used by renderers that trace rays in batches instead of depth first per pixel
+ */
+class DeferredRayQueue
+{
+public:
+    virtual ~DeferredRayQueue() {}
+
+    /*
+     * Reflection/refraction ray whose color is going to be scaled by branchWeight,
+     * addColorOnMiss -> background color is added if the ray does not hit anything
+     */
+    virtual void QueueBranchRay(const Ray &branchRay, const Vector3f &branchWeight, int depth, float throughput, bool addColorOnMiss) = 0;
+    /*
+     * Shadow ray that is fired from surfacePoint to a light,
+     * contribution is added if nothing blocks the way through the light,
+     * lightIndex -> index of the light in the scene light list
+     */
+    virtual void QueueShadowRay(const Ray &shadowRay, const Vector3f &surfacePoint, float distanceToLight, const Vector3f &contribution, int lightIndex) = 0;
+};
+
+}
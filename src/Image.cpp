@@ -1,6 +1,7 @@
 #include "Image.h"
 
 #include "Tonemapper.h"
+#include "Tracer.h"
 
 namespace actracer {
 
@@ -45,7 +46,13 @@ void Image::SaveImage() const
 
 void Image::SaveImageAsEXR() const
 {
-    float *tonemappedColorOutputValues = mTonemapper->Tonemap(*this);
+    float *tonemappedColorOutputValues;
+    {
+        TraceScope traceScope{"Tonemap"};
+        tonemappedColorOutputValues = mTonemapper->Tonemap(*this);
+    }
+
+    TraceScope traceScope{"Save image"};
     mTonemapper->SaveEXR(tonemappedColorOutputValues, GetImageWidth(), GetImageHeight(), mImageName);
 
     delete[] tonemappedColorOutputValues;
@@ -53,6 +60,8 @@ void Image::SaveImageAsEXR() const
 
 void Image::SaveImageAsPPM() const
 {
+    TraceScope traceScope{"Save image"};
+
     FILE *output;
 
     output = fopen(mImageName, "w");
@@ -9,7 +9,6 @@ namespace actracer
 {
 
 static float GetAverageValue(const Vector3f& color);
-static void AssignRowsFromMatrix(const glm::mat3x2& matrix, glm::vec2& row1, glm::vec2& row2, glm::vec2& row3);
 
 ImageTextureImpl::~ImageTextureImpl()
 {
@@ -19,13 +18,15 @@ ImageTextureImpl::~ImageTextureImpl()
 
 Vector3f ImageTextureImpl::GetBaseTextureColorForColorChange(const SurfaceIntersection &intersection) const
 {
-    return RetrieveRGBFromUV(intersection.uv.x, intersection.uv.y) / mNormalizer;
+    // Normal and bump maps keep reading the base image, filtering them would flatten the surface
+    return mTextureReader->ComputeRGBValueOn(intersection.uv.x, intersection.uv.y, intersection.GetUVFootprint()) / mNormalizer;
 }
 
-ImageTextureImpl::ImageTextureImpl(const std::string& imagePath, float bumpFactor,  int normalizer, ImageType imageType, InterpolationMethodCode interpolationMethodeCode)
+ImageTextureImpl::ImageTextureImpl(const std::string& imagePath, float bumpFactor,  int normalizer, ImageType imageType, InterpolationMethodCode interpolationMethodeCode,
+                                   TextureCache *textureCache)
     : TextureImpl(bumpFactor), mNormalizer(normalizer)
 {
-    mTextureReader = TextureReader::CreateTextureReader(imagePath, imageType, interpolationMethodeCode);
+    mTextureReader = TextureReader::CreateTextureReader(imagePath, imageType, interpolationMethodeCode, textureCache);
 }
 
 Vector3f ImageTextureImpl::RetrieveRGBFromUV(float u, float v, float w) const
@@ -37,53 +38,13 @@ Vector3f ImageTextureImpl::GetReplacedNormal(const SurfaceIntersection &intersec
 {
     if(!triangle) return {};
 
-    glm::mat3x2 edgeMatrix = ComputePositionEdgeMatrixInObjectSpace(*triangle);
-    glm::mat2x2 uvEdgeMatrix = glm::inverse(-ComputeUVEdgeMatrix(*triangle));
-
-    glm::mat3x2 combinedMatrix = uvEdgeMatrix * edgeMatrix;
-
-    glm::vec2 row1, row2, row3;
-    AssignRowsFromMatrix(combinedMatrix, row1, row2, row3);
-
-    glm::vec3 tangent = Normalize(Vector3f(row1.x, row2.x, row3.x));
-    glm::vec3 bitangent = Normalize(Vector3f(row1.y, row2.y, row3.y));
-
-    glm::mat3x3 TBNMatrix(tangent, bitangent, triangle->GetNormal());
+    TangentFrame frame = triangle->GetObjectTangentFrame(intersectedSurfaceInformation);
+    glm::mat3x3 TBNMatrix(frame.tangent, frame.bitangent, frame.normal);
 
     Vector3f textureNormal = ComputeNormalValueOn(intersectedSurfaceInformation.uv.x, intersectedSurfaceInformation.uv.y);
     return (TBNMatrix * textureNormal);
 }
 
-glm::mat3x2 ImageTextureImpl::ComputePositionEdgeMatrixInObjectSpace(const Triangle &triangle) const
-{
-    const Vector3f &p0p1 = triangle.GetEdgeVectorFromFirstToSecondVertex();
-    const Vector3f &p0p2 = triangle.GetEdgeVectorFromFirstToThirdVertex();
-
-    return glm::mat3x2(glm::vec2(p0p1.x, p0p2.x),
-                       glm::vec2(p0p1.y, p0p2.y),
-                       glm::vec2(p0p1.z, p0p2.z));
-}
-
-glm::mat2x2 ImageTextureImpl::ComputeUVEdgeMatrix(const Triangle &triangle) const
-{
-    const Vertex *v0 = triangle.GetFirstVertex();
-    const Vertex *v1 = triangle.GetSecondVertex();
-    const Vertex *v2 = triangle.GetThirdVertex();
-
-    glm::vec2 v0v1UVEdgeVector = -glm::vec2(v0->uv.u - v1->uv.u, v0->uv.v - v1->uv.v);
-    glm::vec2 v0v2UVEdgeVector = -glm::vec2(v0->uv.u - v2->uv.u, v0->uv.v - v2->uv.v);
-
-    glm::mat2x2 uvEdgeMatrix(glm::vec2(v0v1UVEdgeVector.x, v0v2UVEdgeVector.x), glm::vec2(v0v1UVEdgeVector.y, v0v2UVEdgeVector.y));
-    return uvEdgeMatrix;
-}
-
-static void AssignRowsFromMatrix(const glm::mat3x2 &matrix, glm::vec2 &row1, glm::vec2 &row2, glm::vec2 &row3)
-{
-    row1 = matrix[0];
-    row2 = matrix[1];
-    row3 = matrix[2];
-}
-
 Vector3f ImageTextureImpl::ComputeNormalValueOn(float u, float v) const
 {
     Vector3f normal = mTextureReader->ComputeRGBValueOn(u, v) / 255.0f;
@@ -97,8 +58,10 @@ Vector3f ImageTextureImpl::GetBumpedNormal(const SurfaceIntersection &intersecte
 {
     if(!triangle) return {};
 
-    glm::vec3 tangent, bitangent, normal;
-    ComputeTBNVectors(*triangle, tangent, bitangent, normal);
+    TangentFrame frame = triangle->GetWorldTangentFrame(intersectedSurfaceInformation);
+    glm::vec3 tangent = frame.tangent;
+    glm::vec3 bitangent = frame.bitangent;
+    glm::vec3 normal = frame.normal;
 
     float standardColor, horizontalOffsetColor, verticalOffsetColor;
     ComputeTextureColorValues(intersectedSurfaceInformation.uv, standardColor, horizontalOffsetColor, verticalOffsetColor);
@@ -112,48 +75,6 @@ Vector3f ImageTextureImpl::GetBumpedNormal(const SurfaceIntersection &intersecte
     return Vector3f{bumpedNormal};
 }
 
-void ImageTextureImpl::ComputeTBNVectors(const Triangle &triangle, glm::vec3 &tangent, glm::vec3 &bitangent, glm::vec3 &normal) const
-{
-    glm::vec2 combinedMatrixRow1;
-    glm::vec2 combinedMatrixRow2;
-    glm::vec2 combinedMatrixRow3;
-    AssignCombinedMatrixRows(triangle, combinedMatrixRow1, combinedMatrixRow2, combinedMatrixRow3);
-
-    tangent = Normalize(Vector3f(combinedMatrixRow1.x, combinedMatrixRow2.x, combinedMatrixRow3.x));
-    bitangent = Normalize(Vector3f(combinedMatrixRow1.y, combinedMatrixRow2.y, combinedMatrixRow3.y));
-
-    normal = glm::cross(tangent, bitangent);
-
-    tangent = tangent - normal * glm::dot(tangent, normal);
-    bitangent = bitangent - glm::dot(bitangent, normal) * normal - glm::dot(tangent, bitangent) * tangent;
-}
-
-void ImageTextureImpl::AssignCombinedMatrixRows(const Triangle &triangle, glm::vec2 &row1, glm::vec2 &row2, glm::vec2 &row3) const
-{
-    glm::mat3x2 edgeMatrix = ComputePositionEdgeMatrixInWorldSpace(triangle);
-    glm::mat2x2 uvEdgeMatrix = glm::inverse(ComputeUVEdgeMatrix(triangle));
-
-    glm::mat3x2 combinedMatrix = uvEdgeMatrix * edgeMatrix;
-
-    row1 = combinedMatrix[0];
-    row2 = combinedMatrix[1];
-    row3 = combinedMatrix[2];
-}
-
-glm::mat3x2 ImageTextureImpl::ComputePositionEdgeMatrixInWorldSpace(const Triangle &triangle) const
-{
-    // Transform into world space
-    Vector3f p0p1t = (*triangle.GetObjectTransform())(-triangle.GetEdgeVectorFromFirstToSecondVertex(), true);
-    Vector3f p0p2t = (*triangle.GetObjectTransform())(-triangle.GetEdgeVectorFromFirstToThirdVertex(), true);
-
-    glm::vec3 firstEdgeVectorWorldSpace = p0p1t;
-    glm::vec3 secondEdgeVectorWorldSpace = p0p2t;
-
-    return glm::mat3x2(glm::vec2(firstEdgeVectorWorldSpace.x, secondEdgeVectorWorldSpace.x),
-                       glm::vec2(firstEdgeVectorWorldSpace.y, secondEdgeVectorWorldSpace.y),
-                       glm::vec2(firstEdgeVectorWorldSpace.z, secondEdgeVectorWorldSpace.z));
-}
-
 void ImageTextureImpl::ComputeTextureColorValues(const Vector2f &intersectionPointUV, float &standardColor, float &horizontalColor, float &verticalColor, float uvOffsetEpsilon) const
 {
     float u = intersectionPointUV.x - std::floor(intersectionPointUV.x);
@@ -10,13 +10,15 @@ enum class InterpolationMethodCode;
 enum class ImageType;
 
 class TextureReader;
+class TextureCache;
 
 class ImageTextureImpl : public Texture::TextureImpl
 {
 public:
     virtual ~ImageTextureImpl();
 
-    ImageTextureImpl(const std::string& imagePath, float bumpFactor, int normalizer, ImageType imageType, InterpolationMethodCode interpolationMethod);
+    ImageTextureImpl(const std::string& imagePath, float bumpFactor, int normalizer, ImageType imageType, InterpolationMethodCode interpolationMethod,
+                     TextureCache *textureCache = nullptr);
 
     virtual Vector3f RetrieveRGBFromUV(float u, float v, float w = 0) const override;
 
@@ -31,16 +33,6 @@ public:
      * e.g kd replacement, kd blend
      */ 
     virtual Vector3f GetBaseTextureColorForColorChange(const SurfaceIntersection& intersection) const override;
-private:
-    /*
-     * Computes two tangents of the surface and derives normal vector from them
-     * Results are written into passed references
-     */
-    void ComputeTBNVectors(const Triangle &triangle, glm::vec3 &tangent, glm::vec3 &bitangent, glm::vec3 &normal) const;
-    void AssignCombinedMatrixRows(const Triangle &triangle, glm::vec2 &row1, glm::vec2 &row2, glm::vec2 &row3) const;
-    glm::mat3x2 ComputePositionEdgeMatrixInWorldSpace(const Triangle &triangle) const;
-    glm::mat3x2 ComputePositionEdgeMatrixInObjectSpace(const Triangle &triangle) const;
-    glm::mat2x2 ComputeUVEdgeMatrix(const Triangle& triangle) const;
 private:
     void ComputeTextureColorValues(const Vector2f& intersectionPointUV, float& standardColor, float& horizontalColor, float& verticalColor, float uvOffsetEpsilon = 0.001f) const;
 
@@ -3,6 +3,9 @@
 #include "Shape.h"
 #include "Material.h"
 
+#include <algorithm>
+#include <cmath>
+
 namespace actracer
 {
 
@@ -28,6 +31,50 @@ void SurfaceIntersection::TweakSurfaceNormal()
         n = shape->GetChangedNormal(*this);
 }
 
+void SurfaceIntersection::ComputeDifferentials(const Ray &ray, const Vector3f &dpdu, const Vector3f &dpdv)
+{
+    if (!ray.hasDifferentials)
+        return;
+
+    float planeDistance = Dot(n, ip);
+    float rxCorrelation = Dot(n, ray.rxd);
+    float ryCorrelation = Dot(n, ray.ryd);
+    if (rxCorrelation == 0 || ryCorrelation == 0) // Differentials are parallel to the tangent plane
+        return;
+
+    float tx = (planeDistance - Dot(n, ray.rxo)) / rxCorrelation;
+    float ty = (planeDistance - Dot(n, ray.ryo)) / ryCorrelation;
+
+    dpdx = ray.rxo + ray.rxd * tx - ip;
+    dpdy = ray.ryo + ray.ryd * ty - ip;
+    hasDifferentials = true;
+
+    // dpdx = dpdu * dudx + dpdv * dvdx is solved on the two axes that the normal is the least aligned with
+    int firstAxis = 0, secondAxis = 1;
+    if (std::abs(n.x) > std::abs(n.y) && std::abs(n.x) > std::abs(n.z))
+        firstAxis = 2;
+    else if (std::abs(n.y) > std::abs(n.z))
+        secondAxis = 2;
+
+    float determinant = dpdu[firstAxis] * dpdv[secondAxis] - dpdv[firstAxis] * dpdu[secondAxis];
+    if (determinant == 0)
+    {
+        duvdx = duvdy = Vector2f{};
+        return;
+    }
+
+    float inverseDeterminant = 1 / determinant;
+    duvdx = Vector2f((dpdv[secondAxis] * dpdx[firstAxis] - dpdv[firstAxis] * dpdx[secondAxis]) * inverseDeterminant,
+                     (dpdu[firstAxis] * dpdx[secondAxis] - dpdu[secondAxis] * dpdx[firstAxis]) * inverseDeterminant);
+    duvdy = Vector2f((dpdv[secondAxis] * dpdy[firstAxis] - dpdv[firstAxis] * dpdy[secondAxis]) * inverseDeterminant,
+                     (dpdu[firstAxis] * dpdy[secondAxis] - dpdu[secondAxis] * dpdy[firstAxis]) * inverseDeterminant);
+}
+
+float SurfaceIntersection::GetUVFootprint() const
+{
+    return std::sqrt(std::max(duvdx.u * duvdx.u + duvdx.v * duvdx.v, duvdy.u * duvdy.u + duvdy.v * duvdy.v));
+}
+
 Vector3f SurfaceIntersection::GetDiffuseReflectionCoefficient() const
 {
     if(mat)
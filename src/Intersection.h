@@ -41,6 +41,30 @@ inline bool Intersection::IsValid() const
     return mat != nullptr; 
 }
 
+// Hit found during traversal, only what is needed to pick the closest one is kept.
+// Surface attributes of the closest hit are computed later by Shape::Finalize
+class HitRecord {
+public:
+    float     t;      // Parameter t of the world space ray
+    float     localT; // Parameter t of the ray in object space of the shape
+    float     beta;   // Barycentric coordinates of the hit on triangles
+    float     gamma;  //
+    Vector3f  ip;     // Intersection point in world space
+    Shape*    shape;  // The shape that is hit, nullptr if there is no hit
+
+    HitRecord() : t(std::numeric_limits<float>::max()), localT(0), beta(0), gamma(0), shape(nullptr) {}
+
+    HitRecord(float _t, float _localT, float _beta, float _gamma, const Vector3f &_ip, Shape *_shape)
+        : t(_t), localT(_localT), beta(_beta), gamma(_gamma), ip(_ip), shape(_shape) { }
+
+    bool IsValid() const;
+};
+
+inline bool HitRecord::IsValid() const
+{
+    return shape != nullptr;
+}
+
 // Intersection type used for ray-shape intersections
 // Additionaly stores the information about the shape
 class SurfaceIntersection : public Intersection {
@@ -51,6 +75,13 @@ public:
     const ColorChangerTexture *mColorChangerTexture = nullptr;
     const NormalChangerTexture *mNormalChangerTexture = nullptr;
 
+    // Filled by ComputeDifferentials if the ray carries differentials
+    bool hasDifferentials = false;
+    Vector3f dpdx; // Offsets of the differential hits on the tangent plane from ip
+    Vector3f dpdy; //
+    Vector2f duvdx; // Change of uv towards the neighbouring pixels
+    Vector2f duvdy; //
+
     SurfaceIntersection() : Intersection() { }
 
     SurfaceIntersection(const Vector3f &_lip, const Vector3f &_ip, const Vector3f &_n, const Vector2f _uv, Vector3f _rd, float _t = std::numeric_limits<float>::max(), Material *_mat = nullptr, Shape *_s = nullptr, Shape* _cs = nullptr, const ColorChangerTexture *tex1 = nullptr, const NormalChangerTexture *tex2 = nullptr)
@@ -63,11 +94,18 @@ public:
     bool CanReflectLight() const;
 
     void TweakSurfaceNormal();
+    /*
+     * Intersects the differentials of the ray with the tangent plane and expresses the offsets in uv,
+     * dpdu and dpdv are the world space derivatives of the surface point, zero if the surface has no uv
+     */
+    void ComputeDifferentials(const Ray &ray, const Vector3f &dpdu, const Vector3f &dpdv);
 public:
     Vector3f GetDiffuseReflectionCoefficient() const;
     Vector3f GetSpecularReflectionCoefficient() const;
     Vector3f GetSurfaceNormal() const;
     float GetRefractionIndex() const;
+    // Length of the larger uv change towards the neighbouring pixels, zero without differentials
+    float GetUVFootprint() const;
 };
 
 inline bool SurfaceIntersection::DoesSurfaceTextureReplaceAllColor() const
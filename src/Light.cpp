@@ -6,11 +6,12 @@
 #include "Intersection.h"
 #include "brdf.h"
 
+#include <algorithm>
+
 
 namespace actracer {
 
 static float deg2radians = 3.1415926f / 180.0f;
-static float rad2deg = 180.0f / 3.1415926f;
 
 Light::Light(const Vector3f &position, const Vector3f &intensity)
     : lightPosition(position), lightIntenstiy(intensity) {}
@@ -22,25 +23,63 @@ AdjustableLight::AdjustableLight(const Vector3f &position, const Vector3f &inten
     : Light(position, intensity), lightDirection(direction) {}
 
 SpotLight::SpotLight(const Vector3f &position, const Vector3f &intensity, const Vector3f &direction, float ca, float fa, float exponent)
-    : AdjustableLight(position, intensity, direction), spotLightExponent(exponent), coverageAngle(ca), falloffAngle(fa) { }
+    : AdjustableLight(position, intensity, Normalize(direction)), spotLightExponent(exponent), coverageAngle(ca), falloffAngle(fa)
+{
+    mCosHalfCoverageAngle = std::cos(coverageAngle * deg2radians / 2);
+    mCosHalfFalloffAngle = std::cos(falloffAngle * deg2radians / 2);
+    mInverseFalloffRange = 1.0f / (mCosHalfFalloffAngle - mCosHalfCoverageAngle);
+}
 
-AreaLight::AreaLight(const Vector3f &p, const Vector3f &r, const Vector3f &d, float s)
-    : AdjustableLight(p, r, d), size(s) { }
+AreaLight::AreaLight(const Vector3f &p, const Vector3f &r, const Vector3f &d, float s, int sampleCount)
+    : AdjustableLight(p, r, d), size(s), mRadianceTimesArea(r * s * s)
+{
+    Vector3f normal = Normalize(d);
+    Vector3f helper = std::abs(normal.x) > 0.9f ? Vector3f{0.0f, 1.0f, 0.0f} : Vector3f{1.0f, 0.0f, 0.0f};
+    mTangent = Normalize(Cross(helper, normal));
+    mBitangent = Cross(normal, mTangent);
+
+    // Grid as close to square as possible
+    mStrataColumnCount = std::ceil(std::sqrt(std::max(sampleCount, 1)));
+    mStrataRowCount = (std::max(sampleCount, 1) + mStrataColumnCount - 1) / mStrataColumnCount;
+}
 
 DirectionalLight::DirectionalLight(const Vector3f &position, const Vector3f &intensity, const Vector3f &direction)
-    : AdjustableLight(position, intensity, direction) { }
+    : AdjustableLight(position, intensity, direction), mPointToLight(Normalize(-direction)) { }
 
 /*
  * Calculates light contribution using brdf and regulates the color using intensity
- * gammaMultiplier is used for applying degamma in case of Tonemapping
  */ 
-Vector3f Light::ComputeResultingColorContribution(const SurfaceIntersection &intersection, const Vector3f &pointToViewer, const Vector3f& pointToLight, const float distanceToLight, float gamma) const
+Vector3f Light::ComputeResultingColorContribution(const SurfaceIntersection &intersection, const Vector3f &pointToViewer, const Vector3f& pointToLight, const float distanceToLight) const
+{
+    return ComputeBRDFForLight(intersection, pointToViewer, pointToLight) * GetLightIntensityAtPoint(pointToLight, distanceToLight);
+}
+
+void Light::ComputeResultingColorContributions(const SurfaceIntersection &intersection, const Vector3f &pointToViewer, int count,
+                                              const Vector3f *pointsToLight, const float *distancesToLight, Vector3f *contributions) const
 {
-    float gammaMutliplier = 1;
-    if(intersection.mat->GetDegamma()) 
-        gammaMutliplier = static_cast<float>(std::pow(1, gamma));
+    constexpr int chunkSize = BRDFBase::batchChunkSize;
+    Vector3f wos[chunkSize];
+    Vector3f ns[chunkSize];
+
+    Vector3f kd = intersection.GetDiffuseReflectionCoefficient();
+    Vector3f ks = intersection.GetSpecularReflectionCoefficient();
+    Vector3f n = intersection.GetSurfaceNormal();
+    float refractionIndex = intersection.GetRefractionIndex();
+
+    for (int i = 0; i < chunkSize; ++i)
+    {
+        wos[i] = pointToViewer;
+        ns[i] = n;
+    }
+
+    for (int start = 0; start < count; start += chunkSize)
+    {
+        int chunkCount = std::min(chunkSize, count - start);
+        intersection.mat->GetBRDF()->EvaluateBatch(chunkCount, pointsToLight + start, wos, ns, kd, ks, refractionIndex, contributions + start);
 
-    return ComputeBRDFForLight(intersection, pointToViewer, pointToLight) * GetLightIntensityAtPoint(pointToLight, distanceToLight) * gammaMutliplier;
+        for (int i = start; i < start + chunkCount; ++i)
+            contributions[i] *= GetLightIntensityAtPoint(pointsToLight[i], distancesToLight[i]);
+    }
 }
 
 Vector3f Light::ComputeBRDFForLight(const SurfaceIntersection &intersection, const Vector3f &pointToViewer, const Vector3f& pointToLight) const
@@ -60,25 +99,26 @@ Vector3f DirectionalLight::GetLightIntensityAtPoint(const Vector3f &pointToLight
     return lightIntenstiy;
 }
 
+/*
+ * Angles are compared through their cosines, cosine decreases as the angle grows
+ */
 Vector3f SpotLight::GetLightIntensityAtPoint(const Vector3f &pointToLight, const float distanceToLight) const
 {
-    float cosAngle = std::cos(coverageAngle * deg2radians / 2);
-    float theta = std::acos(-Dot(pointToLight, lightDirection));
-    float falloff = (std::cos(theta) - cosAngle) / (std::cos(falloffAngle * deg2radians / 2) - cosAngle);
+    float cosTheta = -Dot(pointToLight, lightDirection);
 
-    if(theta * rad2deg > coverageAngle / 2)
+    if(!IsInsideCoverage(pointToLight))
         return {};
 
     Vector3f fadedLightIntenstiy = lightIntenstiy / (distanceToLight * distanceToLight);
-    if (theta * rad2deg > falloffAngle / 2)
-        fadedLightIntenstiy *= falloff;
+    if (cosTheta < mCosHalfFalloffAngle)
+        fadedLightIntenstiy *= (cosTheta - mCosHalfCoverageAngle) * mInverseFalloffRange;
 
     return fadedLightIntenstiy;
 }
 
 Vector3f AreaLight::GetLightIntensityAtPoint(const Vector3f &pointToLight, const float distanceToLight) const
 {
-    return lightIntenstiy * std::abs(Dot(-pointToLight, lightDirection)) * size * size / (distanceToLight * distanceToLight);
+    return mRadianceTimesArea * std::abs(Dot(-pointToLight, lightDirection)) / (distanceToLight * distanceToLight);
 }
 
 Vector3f PointLight::GetLightIntensityAtPoint(const Vector3f &pointToLight, const float distanceToLight) const
@@ -86,6 +126,68 @@ Vector3f PointLight::GetLightIntensityAtPoint(const Vector3f &pointToLight, cons
     return lightIntenstiy / (distanceToLight * distanceToLight);
 }
 
+bool SpotLight::IsInsideCoverage(const Vector3f &pointToLight) const
+{
+    return -Dot(pointToLight, lightDirection) >= mCosHalfCoverageAngle;
+}
+
+// --
+
+BoundingVolume3f Light::GetBounds() const
+{
+    return BoundingVolume3f{lightPosition, lightPosition};
+}
+
+float Light::GetPower() const
+{
+    return (lightIntenstiy.x + lightIntenstiy.y + lightIntenstiy.z) / 3.0f;
+}
+
+/*
+ * Point light falloff, distance is clamped so that points on the light do not get infinite values
+ */
+float Light::EstimateIntensityAtPoint(const Vector3f &point) const
+{
+    float squaredDistance = Length(lightPosition - point);
+
+    return GetPower() / std::max(squaredDistance, 1e-6f);
+}
+
+float SpotLight::EstimateIntensityAtPoint(const Vector3f &point) const
+{
+    if(!IsInsideCoverage(Normalize(lightPosition - point)))
+        return 0;
+
+    return Light::EstimateIntensityAtPoint(point);
+}
+
+BoundingVolume3f AreaLight::GetBounds() const
+{
+    Vector3f halfDiagonal = (mTangent + mBitangent) * size * 0.5f;
+    Vector3f halfOtherDiagonal = (mTangent - mBitangent) * size * 0.5f;
+
+    BoundingVolume3f bounds{lightPosition - halfDiagonal, lightPosition + halfDiagonal};
+    bounds = Merge(bounds, lightPosition - halfOtherDiagonal);
+    bounds = Merge(bounds, lightPosition + halfOtherDiagonal);
+
+    return bounds;
+}
+
+float AreaLight::GetPower() const
+{
+    return (mRadianceTimesArea.x + mRadianceTimesArea.y + mRadianceTimesArea.z) / 3.0f;
+}
+
+float AreaLight::EstimateIntensityAtPoint(const Vector3f &point) const
+{
+    BoundingVolume3f bounds = GetBounds();
+    Vector3f closestPoint = MinElements(MaxElements(point, bounds.min), bounds.max);
+
+    return GetPower() / std::max(Length(closestPoint - point), 1e-6f);
+}
+
+// --
+
 void Light::AssignLightFormulaVariables(const SurfaceIntersection &intersection, Vector3f &pointToLight, float &distanceToLight) const
 {
     pointToLight = GetLightPosition() - intersection.ip;
@@ -96,34 +198,35 @@ void Light::AssignLightFormulaVariables(const SurfaceIntersection &intersection,
 void DirectionalLight::AssignLightFormulaVariables(const SurfaceIntersection &intersection, Vector3f &pointToLight, float &distanceToLight) const
 {
     distanceToLight = 1e9;
-    pointToLight = -GetLightDirection();
-    pointToLight = Normalize(pointToLight);
+    pointToLight = mPointToLight;
 }
 
-void AreaLight::AssignLightFormulaVariables(const SurfaceIntersection &intersection, Vector3f &pointToLight, float &distanceToLight) const
+void Light::AssignSampledLightFormulaVariables(const SurfaceIntersection &intersection, int, Random<double> &, Vector3f &pointToLight, float &distanceToLight) const
 {
-    Vector3f tempPos = GetLightDirection();
-
-    pointToLight = tempPos - intersection.ip;
-    distanceToLight = SqLength(pointToLight);
-    pointToLight = Normalize(pointToLight);
+    AssignLightFormulaVariables(intersection, pointToLight, distanceToLight);
 }
 
-Vector3f AreaLight::GetLightDirection(Vector3f) const
+int AreaLight::GetSampleCount() const
 {
-    return GetRandomPointInSquare();
+    return mStrataColumnCount * mStrataRowCount;
 }
 
-Vector3f AreaLight::GetRandomPointInSquare() const
+void AreaLight::AssignSampledLightFormulaVariables(const SurfaceIntersection &intersection, int sampleIndex, Random<double> &randomGenerator, Vector3f &pointToLight, float &distanceToLight) const
 {
-    double param1 = randPoint(0.0f, 1.0f);
-    double param2 = randPoint(0.0f, 1.0f);
+    Vector3f samplePoint = GetSamplePointInSquare(sampleIndex, randomGenerator);
 
-    param1 -= 0.5;
-    param2 -= 0.5;
+    pointToLight = samplePoint - intersection.ip;
+    distanceToLight = SqLength(pointToLight);
+    pointToLight = Normalize(pointToLight);
+}
+
+Vector3f AreaLight::GetSamplePointInSquare(int sampleIndex, Random<double> &randomGenerator) const
+{
+    float column = (sampleIndex % mStrataColumnCount + (float)randomGenerator(0.0, 1.0)) / mStrataColumnCount;
+    float row = (sampleIndex / mStrataColumnCount + (float)randomGenerator(0.0, 1.0)) / mStrataRowCount;
 
-    Vector3f toRight = (float)param1 * size * Vector3f(1.0f, 0.0f, 0.0f);
-    Vector3f toUp = (float)param2 * size * Vector3f(0.0f, 0.0f, 1.0f);
+    Vector3f toRight = (column - 0.5f) * size * mTangent;
+    Vector3f toUp = (row - 0.5f) * size * mBitangent;
 
     return lightPosition + toUp + toRight;
 }
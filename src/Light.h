@@ -20,21 +20,49 @@ public:
 public:
     Vector3f GetLightPosition() const { return lightPosition; }
     Vector3f GetLightIntensity() const { return lightIntenstiy; }
-    virtual Vector3f GetLightDirection(Vector3f normal = Vector3f{}) const {}
+    virtual Vector3f GetLightDirection(Vector3f normal = Vector3f{}) const { return Vector3f{}; }
 public:
     /*
      * Calculates pointToLight direction vector and distance value,
      * it may be specialized by derived classes, (e.g point light distance is different than directional light(infinite) )
      */ 
     virtual void AssignLightFormulaVariables(const SurfaceIntersection &intersection, Vector3f &pointToLight, float &distanceToLight) const;
-    Vector3f ComputeResultingColorContribution(const SurfaceIntersection &intersection, const Vector3f &viewerDirection, const Vector3f &pointToLight, const float distanceToLight, float gamma = 2.2f) const;
+    /*
+     * Lights with an extent are evaluated with GetSampleCount() samples per shading point,
+     * sampleIndex picks the part of the light the sample is taken from
+     */
+    virtual int GetSampleCount() const { return 1; }
+    virtual void AssignSampledLightFormulaVariables(const SurfaceIntersection &intersection, int sampleIndex, Random<double> &randomGenerator, Vector3f &pointToLight, float &distanceToLight) const;
+    Vector3f ComputeResultingColorContribution(const SurfaceIntersection &intersection, const Vector3f &viewerDirection, const Vector3f &pointToLight, const float distanceToLight) const;
+    /*
+     * ComputeResultingColorContribution for count samples of the light seen from the same surface point,
+     * BRDF is evaluated for all of the samples in one batch
+     */
+    void ComputeResultingColorContributions(const SurfaceIntersection &intersection, const Vector3f &viewerDirection, int count,
+                                            const Vector3f *pointsToLight, const float *distancesToLight, Vector3f *contributions) const;
+    /*
+     * Intensity that arrives at the point, pointToLight and distanceToLight are the ones assigned by AssignLightFormulaVariables
+     */
+    virtual Vector3f GetLightIntensityAtPoint(const Vector3f &pointToLight, const float distanceToLight) const = 0;
+public:
+    /*
+     * Bounds and power are used by the light hierarchy,
+     * infinite lights have no bounds and are not put into the hierarchy
+     */
+    virtual bool IsInfinite() const { return false; }
+    virtual BoundingVolume3f GetBounds() const;
+    virtual float GetPower() const;
+    /*
+     * Rough estimate of the intensity that arrives at the point, used for picking lights.
+     * Must not be 0 if the light can illuminate the point
+     */
+    virtual float EstimateIntensityAtPoint(const Vector3f &point) const;
 private:
     /*
      * Calls material's BRDF function with respective parameters,
      * for more information check brdf.cpp source file
      */ 
     Vector3f ComputeBRDFForLight(const SurfaceIntersection &intersection, const Vector3f &pointToViewer, const Vector3f &pointToLight) const;
-    virtual Vector3f GetLightIntensityAtPoint(const Vector3f &pointToLight, const float distanceToLight) const = 0;
 protected:
     Vector3f lightIntenstiy;
     Vector3f lightPosition;
@@ -60,6 +88,10 @@ public:
 
     virtual void AssignLightFormulaVariables(const SurfaceIntersection &intersection, Vector3f &pointToLight, float &distanceToLight) const override;
     virtual Vector3f GetLightIntensityAtPoint(const Vector3f &pointToLight, const float distanceToLight) const override;
+
+    virtual bool IsInfinite() const override { return true; }
+private:
+    Vector3f mPointToLight; // Normalized opposite of the direction
 };
 
 class SpotLight : public AdjustableLight
@@ -68,26 +100,53 @@ public:
     SpotLight(const Vector3f &position, const Vector3f &intensity, const Vector3f &direction, float ca, float fa, float exponent = 1);
 
     virtual Vector3f GetLightIntensityAtPoint(const Vector3f &pointToLight, const float distanceToLight) const override;
+
+    // Zero outside of the coverage cone
+    virtual float EstimateIntensityAtPoint(const Vector3f &point) const override;
+private:
+    bool IsInsideCoverage(const Vector3f &pointToLight) const;
 protected:
     float spotLightExponent; // Used to control spotlight's effect radius
     float coverageAngle;
     float falloffAngle;
+
+    // Precomputed from the angles
+    float mCosHalfCoverageAngle;
+    float mCosHalfFalloffAngle;
+    float mInverseFalloffRange; // 1 / (mCosHalfFalloffAngle - mCosHalfCoverageAngle)
 };
 
+// Square light that lies on the plane with normal d,
+// sampled on a jittered grid of the square
 class AreaLight : public AdjustableLight
 {
 public:
-    AreaLight(const Vector3f& p, const Vector3f& r, const Vector3f& d, float s);
+    AreaLight(const Vector3f& p, const Vector3f& r, const Vector3f& d, float s, int sampleCount = 1);
 
-    virtual void AssignLightFormulaVariables(const SurfaceIntersection &intersection, Vector3f &pointToLight, float &distanceToLight) const override;
     virtual Vector3f GetLightIntensityAtPoint(const Vector3f &pointToLight, const float distanceToLight) const override;
 
-    Vector3f GetRandomPointInSquare() const;
-    virtual Vector3f GetLightDirection(Vector3f normal = Vector3f{}) const override;
+    // Sample count is rounded up to fill the grid
+    virtual int GetSampleCount() const override;
+    virtual void AssignSampledLightFormulaVariables(const SurfaceIntersection &intersection, int sampleIndex, Random<double> &randomGenerator, Vector3f &pointToLight, float &distanceToLight) const override;
+
+    /*
+     * Random point in the cell of the grid that sampleIndex corresponds to
+     */
+    Vector3f GetSamplePointInSquare(int sampleIndex, Random<double> &randomGenerator) const;
+
+    // Extent of the square
+    virtual BoundingVolume3f GetBounds() const override;
+    virtual float GetPower() const override;
+    // Uses the distance to the closest point of the square
+    virtual float EstimateIntensityAtPoint(const Vector3f &point) const override;
 
 protected:
     float size;
-    mutable Random<double> randPoint{};
+    Vector3f mRadianceTimesArea;
+    Vector3f mTangent;   // Edge directions of the square
+    Vector3f mBitangent;
+    int mStrataColumnCount;
+    int mStrataRowCount;
 };
 
 class PointLight : public Light
@@ -0,0 +1,140 @@
+#include "LightBVH.h"
+#include "Light.h"
+
+#include <algorithm>
+
+namespace actracer
+{
+
+LightBVH::LightBVH(const std::vector<Light *> &lights)
+    : mLights(lights)
+{
+    std::vector<int> boundedLightIndices;
+    int lightCount = lights.size();
+    for (int i = 0; i < lightCount; ++i)
+    {
+        if (lights[i]->IsInfinite())
+            mInfiniteLightIndices.push_back(i);
+        else
+            boundedLightIndices.push_back(i);
+    }
+
+    if (boundedLightIndices.empty())
+        return;
+
+    mNodes.reserve(2 * boundedLightIndices.size());
+    BuildTree(boundedLightIndices, 0, boundedLightIndices.size());
+
+    for (LightNode &node : mNodes)
+    {
+        node.alignedMin = node.bbox.min;
+        node.alignedMax = node.bbox.max;
+    }
+}
+
+int LightBVH::BuildTree(std::vector<int> &lightIndices, int start, int end)
+{
+    int nodeIndex = mNodes.size();
+    mNodes.push_back(LightNode{});
+
+    if (end - start == 1)
+    {
+        const Light *light = mLights[lightIndices[start]];
+        mNodes[nodeIndex] = LightNode{light->GetBounds(), {}, {}, light->GetPower(), -1, -1, lightIndices[start]};
+
+        return nodeIndex;
+    }
+
+    BoundingVolume3f combinedCenter{};
+    for (int i = start; i < end; ++i)
+    {
+        BoundingVolume3f bounds = mLights[lightIndices[i]]->GetBounds();
+        combinedCenter = Merge(combinedCenter, (bounds.max + bounds.min) * 0.5f);
+    }
+
+    int splitAxis = MaxElementIndex(combinedCenter.max - combinedCenter.min);
+    int mid = (start + end) / 2;
+    std::nth_element(lightIndices.begin() + start, lightIndices.begin() + mid, lightIndices.begin() + end,
+                     [this, splitAxis](int lhs, int rhs) {
+                         BoundingVolume3f lhsBounds = mLights[lhs]->GetBounds();
+                         BoundingVolume3f rhsBounds = mLights[rhs]->GetBounds();
+                         return lhsBounds.max[splitAxis] + lhsBounds.min[splitAxis] < rhsBounds.max[splitAxis] + rhsBounds.min[splitAxis];
+                     });
+
+    int left = BuildTree(lightIndices, start, mid);
+    int right = BuildTree(lightIndices, mid, end);
+
+    LightNode &node = mNodes[nodeIndex];
+    node.left = left;
+    node.right = right;
+    node.lightIndex = -1;
+    node.bbox = Merge(mNodes[left].bbox, mNodes[right].bbox);
+    node.power = mNodes[left].power + mNodes[right].power;
+
+    return nodeIndex;
+}
+
+bool LightBVH::SampleLight(const Vector3f &point, const Vector3f &normal, Random<double> &randomGenerator, int &lightIndex, float &pmf) const
+{
+    if (mNodes.empty())
+        return false;
+
+    Vector3fa alignedPoint = point;
+    Vector3fa alignedNormal = normal;
+
+    pmf = 1.0f;
+    const LightNode *node = &mNodes[0];
+    while (!node->IsLeaf())
+    {
+        const LightNode &left = mNodes[node->left];
+        const LightNode &right = mNodes[node->right];
+
+        float leftImportance = ComputeImportance(left, alignedPoint, alignedNormal);
+        float rightImportance = ComputeImportance(right, alignedPoint, alignedNormal);
+        if (leftImportance + rightImportance <= 0)
+            return false;
+
+        float leftProbability = leftImportance / (leftImportance + rightImportance);
+        if (randomGenerator(0.0, 1.0) < leftProbability)
+        {
+            node = &left;
+            pmf *= leftProbability;
+        }
+        else
+        {
+            node = &right;
+            pmf *= 1 - leftProbability;
+        }
+    }
+
+    // Root is not weighted on the way down when the tree has a single light
+    if (ComputeImportance(*node, alignedPoint, alignedNormal) <= 0)
+        return false;
+
+    lightIndex = node->lightIndex;
+    return pmf > 0;
+}
+
+/*
+ * Lights behind the tangent plane of the surface can not contribute,
+ * leaves use the estimate of the light itself so that spot cones and area extents are taken into account
+ */
+float LightBVH::ComputeImportance(const LightNode &node, const Vector3fa &point, const Vector3fa &normal) const
+{
+    // Largest distance of the box corners to the tangent plane, each axis takes the side that is further along the normal
+    Vector3fa minSideDistances = (node.alignedMin - point) * normal;
+    Vector3fa maxSideDistances = (node.alignedMax - point) * normal;
+    if (Dot(MaxElements(minSideDistances, maxSideDistances), Vector3fa{1, 1, 1}) <= 0)
+        return 0;
+
+    if (node.IsLeaf())
+        return mLights[node.lightIndex]->EstimateIntensityAtPoint(point);
+
+    // Distance is not allowed to go under the half diagonal so that close clusters are not overestimated
+    Vector3fa closestPoint = MinElements(MaxElements(point, node.alignedMin), node.alignedMax);
+    float squaredDistance = std::max(Length(closestPoint - point), Length(node.alignedMax - node.alignedMin) * 0.25f);
+
+    return node.power / std::max(squaredDistance, 1e-6f);
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+
+#include "acmath.h"
+#include "Random.h"
+
+namespace actracer
+{
+
+class Light;
+
+/*
+ * Hierarchy over the bounded lights of the scene (point, spot and area lights),
+ * each node keeps the bounds and the total power of the lights under it.
+ * A light is picked by descending the tree and choosing a child with probability
+ * proportional to its estimated contribution to the shading point
+ */
+class LightBVH
+{
+public:
+    LightBVH(const std::vector<Light *> &lights);
+
+    /*
+     * Picks one of the bounded lights for the shading point,
+     * lightIndex -> index of the picked light in the scene light list
+     * pmf -> probability of picking that light
+     * Returns false if the descent ends up on lights that can not illuminate the point
+     */
+    bool SampleLight(const Vector3f &point, const Vector3f &normal, Random<double> &randomGenerator, int &lightIndex, float &pmf) const;
+
+    int GetBoundedLightCount() const;
+    // Lights without bounds (directional lights) that should be processed on every shading point
+    const std::vector<int> &GetInfiniteLightIndices() const;
+private:
+    struct LightNode
+    {
+        BoundingVolume3f bbox;
+        Vector3fa alignedMin, alignedMax; // Copies of the bounds for the importance computation
+        float power;
+        int left, right; // Indices of the child nodes
+        int lightIndex;  // Index of the light in the scene list for leaves, -1 for internal nodes
+
+        bool IsLeaf() const
+        {
+            return lightIndex >= 0;
+        }
+    };
+private:
+    /*
+     * Splits the lights at the median of their centers along the longest axis, returns the index of the created node
+     */
+    int BuildTree(std::vector<int> &lightIndices, int start, int end);
+    /*
+     * Estimated contribution of the lights under the node, 0 if all of them are behind the surface
+     */
+    float ComputeImportance(const LightNode &node, const Vector3fa &point, const Vector3fa &normal) const;
+private:
+    const std::vector<Light *> &mLights;
+    std::vector<LightNode> mNodes; // Root is the first node
+    std::vector<int> mInfiniteLightIndices;
+};
+
+inline int LightBVH::GetBoundedLightCount() const
+{
+    return mLights.size() - mInfiniteLightIndices.size();
+}
+
+inline const std::vector<int> &LightBVH::GetInfiniteLightIndices() const
+{
+    return mInfiniteLightIndices;
+}
+
+}
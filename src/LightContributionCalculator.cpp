@@ -1,5 +1,7 @@
 #include "LightContributionCalculator.h"
 
+#include <algorithm>
+
 #include "Texture.h"
 #include "Intersection.h"
 #include "AccelerationStructure.h"
@@ -8,6 +10,10 @@
 #include "Shape.h"
 #include "Light.h"
 #include "brdf.h"
+#include "DeferredRayQueue.h"
+#include "RayPacket.h"
+#include "LightBVH.h"
+#include "RenderStatistics.h"
 
 #include "RecursiveComputation.h"
 
@@ -39,38 +45,90 @@ void LightContributionCalculator::SetRenderParameters(int maximumRecursionDepth,
     this->randomGenerator = &randomGenerator;
 }
 
+void LightContributionCalculator::SetPathTerminationParameters(float minimumThroughput)
+{
+    this->minimumThroughput = minimumThroughput;
+}
+
+void LightContributionCalculator::SetFresnelBranchSelection(bool isOn)
+{
+    this->selectFresnelBranch = isOn;
+}
+
+void LightContributionCalculator::SetDeferredRayQueue(DeferredRayQueue *queue)
+{
+    mDeferredRayQueue = queue;
+}
+
+void LightContributionCalculator::SetLightSampling(const LightBVH *lightBVH, int lightSampleCount)
+{
+    mLightBVH = lightBVH;
+    mLightSampleCount = lightSampleCount;
+}
+
 /*
  * Recursive light calculation,
  * returns true if ray intersects with any primitive
  */ 
-bool LightContributionCalculator::CalculateLight(Ray &cameraRay, Vector3f &outColor, int depth, float columnNormalized01, float rowNormalized01) const
+bool LightContributionCalculator::CalculateLight(Ray &cameraRay, Vector3f &outColor, int depth, float columnNormalized01, float rowNormalized01, float throughput) const
 {
     SurfaceIntersection intersection{};
-    accelerator->Intersect(cameraRay, intersection, this->intersectionTestEpsilon);
+    {
+        ACTRACER_STATS_STAGE(CLOSEST_HIT_TRAVERSAL);
+        accelerator->Intersect(cameraRay, intersection, this->intersectionTestEpsilon);
+    }
 
     if (intersection.IsValid())
     {
-        // Do not calculate costly light contribution if texture replaces all color directly
-        if (intersection.DoesSurfaceTextureReplaceAllColor())
-            outColor = intersection.mColorChangerTexture->RetrieveRGBFromUV(intersection.uv.x, intersection.uv.y);
-        else
-        {
-            intersection.TweakSurfaceNormal();
-            CalculateContribution(cameraRay, intersection, outColor, depth);
-        }
-
+        ShadeIntersection(cameraRay, intersection, outColor, depth, throughput);
         return true;
     }
     else
-        outColor = mBackgroundColor.GetBackgroundColorAt(columnNormalized01, rowNormalized01);
+        outColor = GetBackgroundColorAt(columnNormalized01, rowNormalized01);
 
     return false;
 }
 
+void LightContributionCalculator::CalculateLightForPacket(RayPacket &cameraRays, Vector3f *outColors, const float *columnsNormalized01, const float *rowsNormalized01) const
+{
+    SurfaceIntersection intersections[RayPacket::size]{};
+    {
+        ACTRACER_STATS_STAGE(CLOSEST_HIT_TRAVERSAL);
+        accelerator->IntersectPacket(cameraRays, intersections, this->intersectionTestEpsilon);
+    }
+
+    for (int i = 0; i < cameraRays.GetRayCount(); ++i)
+    {
+        if (intersections[i].IsValid())
+            ShadeIntersection(cameraRays.GetRay(i), intersections[i], outColors[i], 0);
+        else
+            outColors[i] = GetBackgroundColorAt(columnsNormalized01[i], rowsNormalized01[i]);
+    }
+}
+
+void LightContributionCalculator::ShadeIntersection(Ray &cameraRay, SurfaceIntersection &intersection, Vector3f &outColor, int depth, float throughput) const
+{
+    ACTRACER_STATS_STAGE(SHADING);
+
+    // Do not calculate costly light contribution if texture replaces all color directly
+    if (intersection.DoesSurfaceTextureReplaceAllColor())
+        outColor = intersection.mColorChangerTexture->RetrieveRGBFromUV(intersection.uv.x, intersection.uv.y);
+    else
+    {
+        intersection.TweakSurfaceNormal();
+        CalculateContribution(cameraRay, intersection, outColor, depth, throughput);
+    }
+}
+
+Vector3f LightContributionCalculator::GetBackgroundColorAt(float columnNormalized01, float rowNormalized01) const
+{
+    return mBackgroundColor.GetBackgroundColorAt(columnNormalized01, rowNormalized01);
+}
+
 /*
  * Calls the light contribution computation then calls recursive computation
  */ 
-void LightContributionCalculator::CalculateContribution(Ray &cameraRay, SurfaceIntersection &intersectedSurface, Vector3f &outColor, int depth) const
+void LightContributionCalculator::CalculateContribution(Ray &cameraRay, SurfaceIntersection &intersectedSurface, Vector3f &outColor, int depth, float throughput) const
 {
     Vector3f pointToViewer = Normalize(cameraRay.o - intersectedSurface.ip);
 
@@ -81,7 +139,7 @@ void LightContributionCalculator::CalculateContribution(Ray &cameraRay, SurfaceI
 
     if (depth < maximumRecursionDepth)
     {
-        RecursiveComputation* recursiveComputation = RecursiveComputation::CreateRecursiveComputation(intersectedSurface, *this, cameraRay, depth, *randomGenerator);
+        RecursiveComputation* recursiveComputation = RecursiveComputation::CreateRecursiveComputation(intersectedSurface, *this, cameraRay, depth, throughput, *randomGenerator);
         if(recursiveComputation)
         {
             recursiveComputation->AddRecursiveComputationToColor(outColor);
@@ -100,42 +158,185 @@ Vector3f LightContributionCalculator::ProcessLights(const SurfaceIntersection &i
     Vector3f allLightContribution{};
     allLightContribution += CalculateAmbientLightContribution(intersectedSurface);
 
-    for (Light *light : *lights)
-        allLightContribution += ProcessLight(light, intersectedSurface, pointToViewer, rayTime);
+    if (mLightBVH && mLightSampleCount > 0 && mLightSampleCount < mLightBVH->GetBoundedLightCount())
+        return allLightContribution + ProcessSampledLights(intersectedSurface, pointToViewer, rayTime);
+
+    int lightCount = lights->size();
+    for (int i = 0; i < lightCount; ++i)
+        allLightContribution += ProcessLight((*lights)[i], i, intersectedSurface, pointToViewer, rayTime);
 
     return allLightContribution;
 }
 
+/*
+ * Infinite lights are processed as usual, bounded lights are picked mLightSampleCount times with replacement,
+ * each pick is weighted with 1 / (mLightSampleCount * pmf) so that the sum stays unbiased
+ */
+Vector3f LightContributionCalculator::ProcessSampledLights(const SurfaceIntersection &intersectedSurface, const Vector3f &pointToViewer, float rayTime) const
+{
+    Vector3f sampledLightContribution{};
+
+    for (int i : mLightBVH->GetInfiniteLightIndices())
+        sampledLightContribution += ProcessLight((*lights)[i], i, intersectedSurface, pointToViewer, rayTime);
+
+    for (int sample = 0; sample < mLightSampleCount; ++sample)
+    {
+        int lightIndex;
+        float pmf;
+        // Descent may end on lights that can not reach the point, such picks contribute nothing
+        if (!mLightBVH->SampleLight(intersectedSurface.ip, intersectedSurface.n, *randomGenerator, lightIndex, pmf))
+            continue;
+
+        sampledLightContribution += ProcessLight((*lights)[lightIndex], lightIndex, intersectedSurface, pointToViewer, rayTime, 1.0f / (mLightSampleCount * pmf));
+    }
+
+    return sampledLightContribution;
+}
+
 Vector3f LightContributionCalculator::CalculateAmbientLightContribution(const SurfaceIntersection &intersectedSurface) const
 {
     return mAmbientLightColor * intersectedSurface.mat->GetAmbientReflectionCoefficient();
 }
 
-Vector3f LightContributionCalculator::ProcessLight(const Light *light, const SurfaceIntersection &intersectedSurface, const Vector3f &pointToViewer, float rayTime) const
+/*
+ * Lights with multiple samples are evaluated in batches,
+ * shadow rays of a batch start from the same point and are tested for occlusion together
+ */
+Vector3f LightContributionCalculator::ProcessLight(const Light *light, int lightIndex, const SurfaceIntersection &intersectedSurface, const Vector3f &pointToViewer, float rayTime, float selectionWeight) const
+{
+    int sampleCount = light->GetSampleCount();
+    if (sampleCount == 1)
+        return ProcessLightSample(light, lightIndex, intersectedSurface, pointToViewer, rayTime, selectionWeight);
+
+    Vector3f lightContribution{};
+    for (int sampleStart = 0; sampleStart < sampleCount; sampleStart += RayPacket::size)
+    {
+        int batchSampleCount = std::min(RayPacket::size, sampleCount - sampleStart);
+        lightContribution += ProcessLightSampleBatch(light, lightIndex, sampleStart, batchSampleCount, intersectedSurface, pointToViewer, rayTime, selectionWeight / sampleCount);
+    }
+
+    return lightContribution;
+}
+
+Vector3f LightContributionCalculator::ProcessLightSample(const Light *light, int lightIndex, const SurfaceIntersection &intersectedSurface, const Vector3f &pointToViewer, float rayTime, float sampleWeight) const
 {
     Vector3f pointToLight;
     float distanceToLight;
-    light->AssignLightFormulaVariables(intersectedSurface, pointToLight, distanceToLight);
+    light->AssignSampledLightFormulaVariables(intersectedSurface, 0, *randomGenerator, pointToLight, distanceToLight);
+
+    if(mDeferredRayQueue)
+    {
+        Vector3f contribution = light->ComputeResultingColorContribution(intersectedSurface, pointToViewer, pointToLight, distanceToLight) * sampleWeight;
+        mDeferredRayQueue->QueueShadowRay(CreateShadowRay(intersectedSurface, pointToLight, rayTime), intersectedSurface.ip, distanceToLight, contribution, lightIndex);
+        return {};
+    }
 
     if(!IsThereAnObjectBetweenLightAndIntersectionPoint(intersectedSurface, pointToLight, distanceToLight, rayTime))
-        return light->ComputeResultingColorContribution(intersectedSurface, pointToViewer, pointToLight, distanceToLight);
+        return light->ComputeResultingColorContribution(intersectedSurface, pointToViewer, pointToLight, distanceToLight) * sampleWeight;
 
     return {};
 }
 
+Vector3f LightContributionCalculator::ProcessLightSampleBatch(const Light *light, int lightIndex, int sampleStart, int sampleCount, const SurfaceIntersection &intersectedSurface,
+                                                              const Vector3f &pointToViewer, float rayTime, float sampleWeight) const
+{
+    Ray shadowRays[RayPacket::size];
+    Ray *rays[RayPacket::size];
+    Vector3f pointsToLight[RayPacket::size];
+    Vector3f surfacePoints[RayPacket::size];
+    float distancesToLight[RayPacket::size];
+
+    for (int i = 0; i < sampleCount; ++i)
+    {
+        light->AssignSampledLightFormulaVariables(intersectedSurface, sampleStart + i, *randomGenerator, pointsToLight[i], distancesToLight[i]);
+        shadowRays[i] = CreateShadowRay(intersectedSurface, pointsToLight[i], rayTime);
+        rays[i] = &shadowRays[i];
+        surfacePoints[i] = intersectedSurface.ip;
+    }
+
+    Vector3f contributions[RayPacket::size];
+    if(mDeferredRayQueue)
+    {
+        light->ComputeResultingColorContributions(intersectedSurface, pointToViewer, sampleCount, pointsToLight, distancesToLight, contributions);
+        for (int i = 0; i < sampleCount; ++i)
+            mDeferredRayQueue->QueueShadowRay(shadowRays[i], intersectedSurface.ip, distancesToLight[i], contributions[i] * sampleWeight, lightIndex);
+
+        return {};
+    }
+
+    RayPacket packet{rays, sampleCount};
+    unsigned blockedRays = FindBlockedShadowRays(packet, surfacePoints, distancesToLight);
+
+    // Samples that reach the light are packed together for the BRDF batch
+    int unblockedCount = 0;
+    for (int i = 0; i < sampleCount; ++i)
+    {
+        if (blockedRays & (1u << i))
+            continue;
+
+        pointsToLight[unblockedCount] = pointsToLight[i];
+        distancesToLight[unblockedCount] = distancesToLight[i];
+        ++unblockedCount;
+    }
+
+    light->ComputeResultingColorContributions(intersectedSurface, pointToViewer, unblockedCount, pointsToLight, distancesToLight, contributions);
+
+    Vector3f batchContribution{};
+    for (int i = 0; i < unblockedCount; ++i)
+        batchContribution += contributions[i] * sampleWeight;
+
+    return batchContribution;
+}
+
 /*
  * Fires a ray from intersection point through light with a small epsilon with surface normal(to prevent self intersection),
  * if this ray intersects with an object that is closer than light returns true
  */ 
 bool LightContributionCalculator::IsThereAnObjectBetweenLightAndIntersectionPoint(const SurfaceIntersection &intersection, const Vector3f &pointToLight, const float distanceToLight, float rayTime) const
 {
-    SurfaceIntersection closestObjectInPath{};
-    Ray tempRay = Ray(intersection.ip + intersection.n * shadowRayEpsilon, pointToLight, nullptr, nullptr, rayTime);
-    accelerator->Intersect(tempRay, closestObjectInPath, this->intersectionTestEpsilon);
+    Ray tempRay = CreateShadowRay(intersection, pointToLight, rayTime);
+    return IsShadowRayBlocked(tempRay, intersection.ip, distanceToLight);
+}
+
+Ray LightContributionCalculator::CreateShadowRay(const SurfaceIntersection &intersection, const Vector3f &pointToLight, float rayTime) const
+{
+    ACTRACER_STATS_INCREMENT(SHADOW_RAYS, 1);
+    return Ray(intersection.ip + intersection.n * shadowRayEpsilon, pointToLight, nullptr, nullptr, rayTime);
+}
+
+bool LightContributionCalculator::IsShadowRayBlocked(Ray &shadowRay, const Vector3f &surfacePoint, const float distanceToLight) const
+{
+    ACTRACER_STATS_STAGE(SHADOW_TRAVERSAL);
 
-    if (closestObjectInPath.IsValid())                                                                                                                       
+    // Only the distance to the blocker is needed, surface attributes are not computed
+    HitRecord closestHitInPath{};
+    accelerator->IntersectClosestHit(shadowRay, closestHitInPath, this->intersectionTestEpsilon);
+
+    return DoesIntersectionBlockLight(closestHitInPath, surfacePoint, distanceToLight);
+}
+
+unsigned LightContributionCalculator::FindBlockedShadowRays(RayPacket &shadowRays, const Vector3f *surfacePoints, const float *distancesToLight) const
+{
+    ACTRACER_STATS_STAGE(SHADOW_TRAVERSAL);
+
+    HitRecord closestHitsInPath[RayPacket::size]{};
+    accelerator->IntersectClosestHits(shadowRays, closestHitsInPath, this->intersectionTestEpsilon);
+
+    unsigned blockedRays = 0;
+    for (int i = 0; i < shadowRays.GetRayCount(); ++i)
+    {
+        if (DoesIntersectionBlockLight(closestHitsInPath[i], surfacePoints[i], distancesToLight[i]))
+            blockedRays |= 1u << i;
+    }
+
+    return blockedRays;
+}
+
+bool LightContributionCalculator::DoesIntersectionBlockLight(const HitRecord &closestHitInPath, const Vector3f &surfacePoint, const float distanceToLight) const
+{
+    if (closestHitInPath.IsValid())
     {
-        float distanceToClosestObject = SqLength(closestObjectInPath.ip - intersection.ip);
+        float distanceToClosestObject = SqLength(closestHitInPath.ip - surfacePoint);
 
         if (distanceToClosestObject > shadowRayEpsilon && distanceToClosestObject < distanceToLight - shadowRayEpsilon)
             return true;
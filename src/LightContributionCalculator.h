@@ -13,7 +13,11 @@ class Light;
 class Texture;
 class AccelerationStructure;
 class SurfaceIntersection;
+class HitRecord;
 class Material;
+class DeferredRayQueue;
+class RayPacket;
+class LightBVH;
 
 class BackgroundColor
 {
@@ -31,25 +35,80 @@ class LightContributionCalculator
 {
 public:
     float GetShadownRayEpsilon() const;
+    float GetMinimumThroughput() const;
+    bool IsFresnelBranchSelectionOn() const;
+    DeferredRayQueue* GetDeferredRayQueue() const;
 public:
     /*
      * columnNormalized01 -> ColumnPosition Mapped to 01: column / width
      * rowNormalized01 -> RowPosition Mapped to 01: row / height
      * depth -> reflection/refraction Depth
+     * throughput -> product of the reflection/refraction weights along the path
      */
-    bool CalculateLight(Ray &cameraRay, Vector3f &outColor, int depth, float columnNormalized01 = 0, float rowNormalized01 = 0) const;
+    bool CalculateLight(Ray &cameraRay, Vector3f &outColor, int depth, float columnNormalized01 = 0, float rowNormalized01 = 0, float throughput = 1.0f) const;
+    /*
+     * CalculateLight for the camera rays of a packet, rays are intersected together then shaded one by one,
+     * color and pixel position of the ith ray are at the ith index of the arrays
+     */
+    void CalculateLightForPacket(RayPacket &cameraRays, Vector3f *outColors, const float *columnsNormalized01, const float *rowsNormalized01) const;
+    /*
+     * Computes the color of an already found valid intersection
+     */
+    void ShadeIntersection(Ray &cameraRay, SurfaceIntersection &intersection, Vector3f &outColor, int depth, float throughput = 1.0f) const;
+    Vector3f GetBackgroundColorAt(float columnNormalized01, float rowNormalized01) const;
+
+    /*
+     * Returns true if shadowRay intersects with an object that is closer than the light
+     */
+    bool IsShadowRayBlocked(Ray &shadowRay, const Vector3f &surfacePoint, const float distanceToLight) const;
+    /*
+     * IsShadowRayBlocked for the rays of a packet, ith bit of the result is set if the ith ray is blocked
+     */
+    unsigned FindBlockedShadowRays(RayPacket &shadowRays, const Vector3f *surfacePoints, const float *distancesToLight) const;
 
     void SetSceneLights(const std::vector<Light*>& lights, const Vector3f& ambientLightColor, const Vector3f& backgroundColor, const Texture* backgroundTexture);
     void SetSceneAccelerator(const AccelerationStructure& accelerator);
     void SetRenderParameters(int maximumRecursionDepth, float intersectionTestEpsilon, float shadowRayEpsilon, float gamma, Random<double>& randomGenerator);
+    /*
+     * Recursive branches whose throughput falls under minimumThroughput are terminated by russian roulette,
+     * 0 disables the termination
+     */
+    void SetPathTerminationParameters(float minimumThroughput);
+    /*
+     * If on, dielectrics and conductors trace only one of the reflection and refraction branches
+     * chosen by fresnel probability instead of tracing both
+     */
+    void SetFresnelBranchSelection(bool isOn);
+    /*
+     * If set, reflection/refraction and shadow rays are passed to the queue instead of being traced
+     */
+    void SetDeferredRayQueue(DeferredRayQueue *queue);
+    /*
+     * If lightSampleCount is positive and less than the number of bounded lights,
+     * lightSampleCount lights are picked through the hierarchy per hit instead of processing all lights.
+     * Directional lights are processed on every hit
+     */
+    void SetLightSampling(const LightBVH *lightBVH, int lightSampleCount);
 private:
-    void CalculateContribution(Ray &cameraRay, SurfaceIntersection &intersectedSurface, Vector3f &outColor, int depth) const;
+    void CalculateContribution(Ray &cameraRay, SurfaceIntersection &intersectedSurface, Vector3f &outColor, int depth, float throughput) const;
 
     Vector3f ProcessLights(const SurfaceIntersection &intersectedSurface, const Vector3f &viewerDirection, float rayTime = 0.0f) const;
-    Vector3f ProcessLight(const Light *light, const SurfaceIntersection &intersectedSurface, const Vector3f &pointToViewer, float rayTime) const;
+    Vector3f ProcessSampledLights(const SurfaceIntersection &intersectedSurface, const Vector3f &pointToViewer, float rayTime) const;
+    /*
+     * selectionWeight -> contribution of the light is scaled by it, compensates for the probability of picking the light
+     */
+    Vector3f ProcessLight(const Light *light, int lightIndex, const SurfaceIntersection &intersectedSurface, const Vector3f &pointToViewer, float rayTime, float selectionWeight = 1.0f) const;
+    Vector3f ProcessLightSample(const Light *light, int lightIndex, const SurfaceIntersection &intersectedSurface, const Vector3f &pointToViewer, float rayTime, float sampleWeight) const;
+    /*
+     * Evaluates samples [sampleStart, sampleStart + sampleCount) of the light, sampleCount is at most the packet size
+     */
+    Vector3f ProcessLightSampleBatch(const Light *light, int lightIndex, int sampleStart, int sampleCount, const SurfaceIntersection &intersectedSurface,
+                                     const Vector3f &pointToViewer, float rayTime, float sampleWeight) const;
     Vector3f CalculateAmbientLightContribution(const SurfaceIntersection &intersectedSurface) const;
 
     bool IsThereAnObjectBetweenLightAndIntersectionPoint(const SurfaceIntersection &intersection, const Vector3f &pointToLight, const float distanceToClosestObject, float rayTime) const;
+    Ray CreateShadowRay(const SurfaceIntersection &intersection, const Vector3f &pointToLight, float rayTime) const;
+    bool DoesIntersectionBlockLight(const HitRecord &closestHitInPath, const Vector3f &surfacePoint, const float distanceToLight) const;
 private:
     const std::vector<Light*>* lights;
     Random<double>* randomGenerator;
@@ -59,10 +118,17 @@ private:
     int maximumRecursionDepth;
     float intersectionTestEpsilon;
     float shadowRayEpsilon;
+    float minimumThroughput;
+    bool selectFresnelBranch;
 
     Vector3f mAmbientLightColor;
     BackgroundColor mBackgroundColor;
     const AccelerationStructure* accelerator;
+
+    DeferredRayQueue* mDeferredRayQueue = nullptr;
+
+    const LightBVH* mLightBVH = nullptr;
+    int mLightSampleCount = 0;
 public:
     class RecursiveComputation;
 
@@ -73,4 +139,19 @@ inline float LightContributionCalculator::GetShadownRayEpsilon() const
     return shadowRayEpsilon;
 }
 
+inline float LightContributionCalculator::GetMinimumThroughput() const
+{
+    return minimumThroughput;
+}
+
+inline bool LightContributionCalculator::IsFresnelBranchSelectionOn() const
+{
+    return selectFresnelBranch;
+}
+
+inline DeferredRayQueue *LightContributionCalculator::GetDeferredRayQueue() const
+{
+    return mDeferredRayQueue;
+}
+
 }
\ No newline at end of file
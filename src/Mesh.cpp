@@ -1,15 +1,18 @@
 #include "Scene.h"
 #include "Mesh.h"
 #include "Primitive.h"
+#include "Tracer.h"
 
 #include <set>
 #include <unordered_map>
 
 namespace actracer {
 
-    Mesh::Mesh(int _id, Material *_mat, const std::vector<std::pair<int, Material *>> &faces, const std::vector<Vector3f *> *pIndices, const std::vector<Vector2f *> *pUVs, std::vector<Primitive *> &primitives, Transform *objToWorld, ShadingMode shMode)
+    Mesh::Mesh(int _id, Material *_mat, const std::vector<std::pair<int, Material *>> &faces, const std::vector<Vector3f *> *pIndices, const std::vector<Vector2f *> *pUVs, Transform *objToWorld, ShadingMode shMode)
         : Shape(_id, _mat, objToWorld, shMode)
     {
+        TraceScope traceScope{"Build mesh", _id};
+
         if (objTransform)
             objTransform->UpdateTransform();
 
@@ -55,7 +58,6 @@ namespace actracer {
         for (int i = 0; i < faces.size(); ++i) // Populate the vector with the triangles that makes up this mesh
         {
             triangles->push_back(new Triangle(_id, faces[i].second, vertexHash[((*pIndices)[i * 3 + 0])], vertexHash[((*pIndices)[i * 3 + 1])], vertexHash[((*pIndices)[i * 3 + 2])], objTransform, this, shMode));
-            primitives.push_back(new Primitive(triangles->back(), mat));
 
             Vector3f &p0 = *((*pIndices)[i * 3 + 0]); //
             Vector3f &p1 = *((*pIndices)[i * 3 + 1]); // Vertex points
@@ -95,32 +97,57 @@ namespace actracer {
         }
 }
 
-void Mesh::FindClosestObject(Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon)
+void Mesh::AddTrianglePrimitives(std::vector<Primitive *> &primitives) const
+{
+    for (Triangle *triangle : *triangles)
+        primitives.push_back(new Primitive(triangle, mat));
+}
+
+void Mesh::FindClosestObject(Ray &r, HitRecord &hit, float intersectionTestEpsilon)
 {
     float minT = std::numeric_limits<float>::max(); // Initialize min t with inf
 
     for (Shape *shape : *triangles)
     {
-        SurfaceIntersection io{};
-        shape->Intersect(r, io, intersectionTestEpsilon); // Find the surface of intersection
+        HitRecord candidate{};
+        shape->Intersect(r, candidate, intersectionTestEpsilon); // Find the surface of intersection
 
         // If there is no intersection
-        if (!io.IsValid())
+        if (!candidate.IsValid())
             continue;
 
-        // Update the closest surface information and the minimum distance variable
-        if (io.t < minT && io.t > -intersectionTestEpsilon)
+        // Update the closest hit and the minimum distance variable
+        if (candidate.t < minT && candidate.t > -intersectionTestEpsilon)
         {
-            minT = io.t; // New minimum distance
-            rt = io;     // New closest surface
+            minT = candidate.t; // New minimum distance
+            hit = candidate;    // New closest hit
         }
     }
 }
 
-void Mesh::Intersect(Ray &rr, SurfaceIntersection &rt, float intersectionTestEpsilon)
+void Mesh::Intersect(Ray &rr, HitRecord &hit, float intersectionTestEpsilon)
+{
+    FindClosestObject(rr, hit, intersectionTestEpsilon);
+}
+
+void Mesh::Finalize(Ray &r, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon)
+{
+    hit.shape->Finalize(r, hit, rt, intersectionTestEpsilon);
+}
+
+void Mesh::SmoothTangents()
 {
-    Ray r = rr;
-    FindClosestObject(rr, rt, intersectionTestEpsilon);
+    if (shadingMode != Shape::ShadingMode::SMOOTH)
+        return;
+
+    for (Triangle *triangle : *triangles)
+        triangle->AccumulateVertexTangents();
+
+    for (Vertex *vertex : *meshVertices)
+    {
+        if (vertex->t.x != 0 || vertex->t.y != 0 || vertex->t.z != 0)
+            vertex->t = Normalize(vertex->t);
+    }
 }
 
 Shape* Mesh::Clone(bool resetTransform) const
@@ -161,6 +188,15 @@ Shape* Mesh::Clone(bool resetTransform) const
     return cloned;
 }
 
+void Mesh::BakeIntoWorldSpace()
+{
+    if (activeMotion)
+        return;
+
+    for (Triangle *tr : (*triangles))
+        tr->BakeIntoWorldSpace();
+}
+
 void Mesh::SetMaterial(Material* newMat)
 {
     Shape::SetMaterial(newMat);
@@ -187,7 +223,6 @@ void Mesh::SetMotionBlur(const Vector3f& mb, std::vector<Primitive *> &primitive
     {
         tr->SetMotionBlur(mb, primitives);
         tr->SetHasActiveMotion(this->activeMotion);
-        primitives.push_back(new Primitive(tr, this->mat));
     }
 }
 
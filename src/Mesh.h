@@ -13,12 +13,25 @@ private:
     std::vector<Triangle*>* triangles;
     std::vector<Vertex*>* meshVertices;
 public:
-    Mesh(int _id, Material *_mat, const std::vector<std::pair<int, Material *>> &faces, const std::vector<Vector3f *> *pIndices, const std::vector<Vector2f *> *pUVs, std::vector<Primitive *> &primitives, Transform *objToWorld = nullptr, ShadingMode shMode = ShadingMode::DEFAULT);
+    Mesh(int _id, Material *_mat, const std::vector<std::pair<int, Material *>> &faces, const std::vector<Vector3f *> *pIndices, const std::vector<Vector2f *> *pUVs, Transform *objToWorld = nullptr, ShadingMode shMode = ShadingMode::DEFAULT);
     Mesh() { }
 
-    void FindClosestObject(Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon);
-    void Intersect(Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) override;
+    /*
+     * Adds a primitive for each triangle, kept apart from construction so that meshes can be built concurrently
+     */
+    void AddTrianglePrimitives(std::vector<Primitive *> &primitives) const;
+    /*
+     * Averages the tangents of the triangles on the shared vertices, so that normal changer textures
+     * do not show the edges of the triangles on smooth meshes. Only has effect on smooth meshes
+     */
+    void SmoothTangents();
+
+    void FindClosestObject(Ray &r, HitRecord &hit, float intersectionTestEpsilon);
+    void Intersect(Ray &r, HitRecord &hit, float intersectionTestEpsilon) override;
+    // Hits are recorded by the triangles of the mesh, finalization is forwarded to them
+    void Finalize(Ray &r, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon) override;
     Shape *Clone(bool resetTransform) const override;
+    void BakeIntoWorldSpace() override;
 public:
     virtual void SetMaterial(Material* newMat) override;
     virtual void SetTransformation(Transform* newTransform, bool owned = false) override;
@@ -0,0 +1,290 @@
+#include <algorithm>
+
+#include "MotionBVHTree.h"
+#include "BVHTree.h"
+#include "SBVHTree.h"
+#include "Primitive.h"
+#include "RayPacket.h"
+#include "Intersection.h"
+#include "RenderStatistics.h"
+
+namespace actracer
+{
+
+constexpr int MotionBVHTree::BIN_COUNT;
+constexpr float MotionBVHTree::REFIT_REBUILD_RATIO;
+
+MotionBVHTree::MotionBVHTree(int maxPrimitiveCountInLeaf, const std::vector<Primitive *> &prims,
+                             AccelerationStructureAlgorithmCode staticAlgorithmCode, float maxReferenceGrowth)
+    : mMaxPrimitiveCountInLeaf(maxPrimitiveCountInLeaf), mStaticTree(nullptr), mRoot(nullptr)
+{
+    std::vector<Primitive *> staticPrimitives;
+    for (Primitive *primitive : prims)
+    {
+        if (!primitive->IsMoving())
+        {
+            staticPrimitives.push_back(primitive);
+            continue;
+        }
+
+        mMovingPrimitives.push_back(CreateMovingPrimitive(primitive));
+    }
+
+    if (!staticPrimitives.empty())
+    {
+        if (staticAlgorithmCode == AccelerationStructureAlgorithmCode::SBVH)
+            mStaticTree = new SBVHTree(1, maxReferenceGrowth, staticPrimitives);
+        else
+            mStaticTree = new BVHTree(1, 10000, staticPrimitives);
+    }
+
+    if (!mMovingPrimitives.empty())
+        mRoot = BuildTree(0, mMovingPrimitives.size());
+}
+
+MotionBVHTree::~MotionBVHTree()
+{
+    delete mStaticTree;
+    Clear(mRoot);
+}
+
+MotionBVHTree::MovingPrimitive MotionBVHTree::CreateMovingPrimitive(Primitive *primitive)
+{
+    MovingPrimitive movingPrimitive;
+    movingPrimitive.primitive = primitive;
+    movingPrimitive.openBbox = primitive->GetBoundingBoxAt(0.0f);
+    movingPrimitive.closeBbox = primitive->GetBoundingBoxAt(1.0f);
+    movingPrimitive.middleBbox = primitive->GetBoundingBoxAt(0.5f);
+
+    return movingPrimitive;
+}
+
+void MotionBVHTree::Clear(MotionBVHNode *head)
+{
+    if (!head)
+        return;
+
+    Clear(head->left);
+    Clear(head->right);
+
+    delete head;
+}
+
+MotionBVHTree::MotionBVHNode *MotionBVHTree::BuildTree(int start, int end)
+{
+    MotionBVHNode *node = new MotionBVHNode{};
+    node->startIndex = start;
+    node->endIndex = end;
+    node->axis = 0;
+
+    BoundingVolume3f middleBbox{};
+    for (int i = start; i < end; ++i)
+    {
+        node->openBbox = Merge(node->openBbox, mMovingPrimitives[i].openBbox);
+        node->closeBbox = Merge(node->closeBbox, mMovingPrimitives[i].closeBbox);
+        middleBbox = Merge(middleBbox, mMovingPrimitives[i].middleBbox);
+    }
+
+    node->sahCost = node->builtSahCost = end - start;
+    if (end - start <= mMaxPrimitiveCountInLeaf)
+        return node;
+
+    int midIndex = PartitionWithSAH(start, end, middleBbox.SA(), node->axis);
+    if (midIndex == -1)
+        return node;
+
+    node->left = BuildTree(start, midIndex);
+    node->right = BuildTree(midIndex, end);
+
+    node->UpdateSahCost();
+    node->builtSahCost = node->sahCost;
+
+    return node;
+}
+
+int MotionBVHTree::Refit()
+{
+    int rebuiltBranchCount = mStaticTree ? mStaticTree->Refit() : 0;
+
+    if (mRoot)
+    {
+        for (MovingPrimitive &movingPrimitive : mMovingPrimitives)
+            movingPrimitive = CreateMovingPrimitive(movingPrimitive.primitive);
+
+        rebuiltBranchCount += RefitBranch(mRoot);
+    }
+
+    return rebuiltBranchCount;
+}
+
+int MotionBVHTree::RefitBranch(MotionBVHNode *head)
+{
+    if (head->IsLeaf())
+    {
+        head->openBbox = head->closeBbox = BoundingVolume3f{};
+        for (int i = head->startIndex; i < head->endIndex; ++i)
+        {
+            head->openBbox = Merge(head->openBbox, mMovingPrimitives[i].openBbox);
+            head->closeBbox = Merge(head->closeBbox, mMovingPrimitives[i].closeBbox);
+        }
+
+        return 0;
+    }
+
+    int rebuiltBranchCount = RefitBranch(head->left) + RefitBranch(head->right);
+
+    head->openBbox = Merge(head->left->openBbox, head->right->openBbox);
+    head->closeBbox = Merge(head->left->closeBbox, head->right->closeBbox);
+    head->UpdateSahCost();
+
+    if (head->sahCost > head->builtSahCost * REFIT_REBUILD_RATIO)
+    {
+        // Rebuilt in place so that the parent keeps pointing at the node
+        MotionBVHNode *rebuiltNode = BuildTree(head->startIndex, head->endIndex);
+
+        Clear(head->left);
+        Clear(head->right);
+        *head = *rebuiltNode;
+        delete rebuiltNode;
+
+        return 1; // Replaces the branches rebuilt under it
+    }
+
+    return rebuiltBranchCount;
+}
+
+/*
+ * Binned SAH over the bounds at the middle of the shutter, they are the average of the bounds over the shutter
+ */
+int MotionBVHTree::PartitionWithSAH(int start, int end, float middleArea, int &axis)
+{
+    int primCount = end - start;
+
+    BoundingVolume3f combinedCenter{}; // Largest extend of the centers
+    for (int i = start; i < end; ++i)
+        combinedCenter = Merge(combinedCenter, (mMovingPrimitives[i].middleBbox.max + mMovingPrimitives[i].middleBbox.min) * 0.5f);
+
+    axis = MaxElementIndex(combinedCenter.max - combinedCenter.min);
+    if (std::abs(combinedCenter.max[axis] - combinedCenter.min[axis]) < 0.00000001f)
+        return -1;
+
+    auto GetBinIndex = [&](const MovingPrimitive &movingPrimitive) {
+        Vector3f center = (movingPrimitive.middleBbox.max + movingPrimitive.middleBbox.min) * 0.5f;
+        int index = BIN_COUNT * ClippedPosition(combinedCenter, center, axis);
+
+        return std::min(index, BIN_COUNT - 1);
+    };
+
+    BoundingVolume3f binBounds[BIN_COUNT];
+    int binCounts[BIN_COUNT] = {};
+    for (int i = start; i < end; ++i)
+    {
+        int index = GetBinIndex(mMovingPrimitives[i]);
+
+        binCounts[index]++;
+        binBounds[index] = Merge(binBounds[index], mMovingPrimitives[i].middleBbox);
+    }
+
+    // Area and count of the bins on the right of each split, the left side is accumulated while going over the splits
+    float rightAreas[BIN_COUNT];
+    int rightCounts[BIN_COUNT];
+    BoundingVolume3f rightBounds{};
+    int rightCount = 0;
+    for (int i = BIN_COUNT - 1; i > 0; --i)
+    {
+        rightBounds = Merge(rightBounds, binBounds[i]);
+        rightCount += binCounts[i];
+
+        rightAreas[i] = rightBounds.SA();
+        rightCounts[i] = rightCount;
+    }
+
+    float minCost = 1e9;
+    int splitBin = -1;
+    BoundingVolume3f leftBounds{};
+    int leftCount = 0;
+    for (int i = 0; i < BIN_COUNT - 1; ++i)
+    {
+        leftBounds = Merge(leftBounds, binBounds[i]);
+        leftCount += binCounts[i];
+
+        if (leftCount == 0 || rightCounts[i + 1] == 0)
+            continue;
+
+        float cost = 0.125f + (leftCount * leftBounds.SA() + rightCounts[i + 1] * rightAreas[i + 1]) / middleArea;
+        if (cost < minCost)
+        {
+            minCost = cost;
+            splitBin = i;
+        }
+    }
+
+    if (splitBin == -1 || minCost >= primCount)
+        return -1;
+
+    MovingPrimitive *mid = std::partition(&mMovingPrimitives[start], &mMovingPrimitives[end - 1] + 1,
+                                          [&](const MovingPrimitive &movingPrimitive) { return GetBinIndex(movingPrimitive) <= splitBin; });
+
+    return mid - &mMovingPrimitives[0];
+}
+
+void MotionBVHTree::IntersectClosestHit(Ray &cameraRay, HitRecord &closestHit, float intersectionTestEpsilon) const
+{
+    if (mStaticTree)
+        mStaticTree->IntersectClosestHit(cameraRay, closestHit, intersectionTestEpsilon);
+
+    if (mRoot)
+        IntersectThroughHierarchy(mRoot, cameraRay, closestHit, intersectionTestEpsilon);
+}
+
+void MotionBVHTree::IntersectClosestHits(RayPacket &packet, HitRecord *closestHits, float intersectionTestEpsilon) const
+{
+    // Static part keeps the packet traversal, rays of the packet have different times for the moving part
+    if (mStaticTree)
+        mStaticTree->IntersectClosestHits(packet, closestHits, intersectionTestEpsilon);
+
+    if (mRoot)
+    {
+        for (int i = 0; i < packet.GetRayCount(); ++i)
+            IntersectThroughHierarchy(mRoot, packet.GetRay(i), closestHits[i], intersectionTestEpsilon);
+    }
+}
+
+void MotionBVHTree::IntersectThroughHierarchy(const MotionBVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const
+{
+    float tn, tf;
+    ACTRACER_STATS_INCREMENT(BOX_TESTS, 1);
+    if (!head->GetBoundingBoxAt(r.time).Intersect(r, tn, tf) || tn > hit.t)
+        return;
+
+    ACTRACER_STATS_INCREMENT(NODE_VISITS, 1);
+    if (head->IsLeaf())
+    {
+        for (int i = head->startIndex; i < head->endIndex; ++i)
+        {
+            HitRecord candidate{};
+            mMovingPrimitives[i].primitive->Intersect(r, candidate, intersectionTestEpsilon);
+
+            if (candidate.IsValid() &&
+                candidate.t > 0 && candidate.t < hit.t - 0.001f) // Closer
+            {
+                hit = candidate;
+            }
+        }
+
+        return;
+    }
+
+    if (r.d[head->axis] < 0)
+    {
+        IntersectThroughHierarchy(head->right, r, hit, intersectionTestEpsilon);
+        IntersectThroughHierarchy(head->left, r, hit, intersectionTestEpsilon);
+    }
+    else
+    {
+        IntersectThroughHierarchy(head->left, r, hit, intersectionTestEpsilon);
+        IntersectThroughHierarchy(head->right, r, hit, intersectionTestEpsilon);
+    }
+}
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+
+#include "AccelerationStructure.h"
+#include "acmath.h"
+
+namespace actracer
+{
+
+class Primitive;
+class HitRecord;
+class RayPacket;
+
+/*
+ * Hierarchy for the scenes with motion blur. Static primitives are put into a BVHTree or an SBVHTree of their own,
+ * moving ones into a tree whose nodes keep their bounds at the shutter open and close.
+ * Bounds of a node are interpolated with the time of the ray, so rays are not tested against the swept volume
+ * that the primitives pass through over the whole shutter
+ */
+class MotionBVHTree : public AccelerationStructure
+{
+public:
+    /*
+     * staticAlgorithmCode is the structure of the static primitives, BVH or SBVH.
+     * maxReferenceGrowth bounds the references of the SBVH
+     */
+    MotionBVHTree(int maxPrimitiveCountInLeaf, const std::vector<Primitive *> &prims,
+                  AccelerationStructureAlgorithmCode staticAlgorithmCode = AccelerationStructureAlgorithmCode::BVH, float maxReferenceGrowth = 1.5f);
+    ~MotionBVHTree();
+
+    virtual void IntersectClosestHit(Ray &cameraRay, HitRecord &closestHit, float intersectionTestEpsilon) const override;
+    virtual void IntersectClosestHits(RayPacket &packet, HitRecord *closestHits, float intersectionTestEpsilon) const override;
+    virtual int Refit() override;
+
+private:
+    static constexpr int BIN_COUNT = 12; // Number of bins the centers are put in to find the split
+    static constexpr float REFIT_REBUILD_RATIO = 1.3f; // Branches whose SAH cost grows past this ratio by a refit are rebuilt
+
+    struct MovingPrimitive
+    {
+        Primitive *primitive;
+        BoundingVolume3f openBbox;  // Bounds at the shutter open
+        BoundingVolume3f closeBbox; // Bounds at the shutter close
+        BoundingVolume3f middleBbox; // Bounds at the middle of the shutter, used for the splits
+    };
+
+    struct MotionBVHNode
+    {
+        MotionBVHNode *left = nullptr;  // Left child, nullptr for the leaves
+        MotionBVHNode *right = nullptr; // Right child
+        BoundingVolume3f openBbox;
+        BoundingVolume3f closeBbox;
+        int axis; // The axis the primitives are split upon, can be [0,1,2]
+        int startIndex, endIndex; // The interval of the moving primitives contained in this branch
+        float sahCost;      // SAH cost of the branch at the middle of the shutter, relative to the surface area of its bounds
+        float builtSahCost; // sahCost when the branch was built
+
+        bool IsLeaf() const;
+        // Bounds are linear in time as the motion is a translation
+        BoundingVolume3f GetBoundingBoxAt(float time) const;
+        // Computes sahCost of an internal node from the costs of its children
+        void UpdateSahCost();
+    };
+
+private:
+    MotionBVHNode *BuildTree(int start, int end);
+    /*
+     * Returns the index that the primitives are partitioned at, or -1 if splitting costs more than a leaf.
+     * middleArea is the surface area of the node at the middle of the shutter
+     */
+    int PartitionWithSAH(int start, int end, float middleArea, int &axis);
+    void Clear(MotionBVHNode *head);
+    /*
+     * Refits the bounds of the branch bottom-up and rebuilds the branch if its SAH cost degraded past REFIT_REBUILD_RATIO,
+     * returns the number of rebuilt branches in it
+     */
+    int RefitBranch(MotionBVHNode *head);
+    static MovingPrimitive CreateMovingPrimitive(Primitive *primitive);
+
+    /*
+     * Replaces the hit if a primitive under the node is closer, the child on the side the ray comes from is visited first
+     */
+    void IntersectThroughHierarchy(const MotionBVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const;
+
+private:
+    const int mMaxPrimitiveCountInLeaf;
+
+    AccelerationStructure *mStaticTree; // nullptr if every primitive moves
+    std::vector<MovingPrimitive> mMovingPrimitives;
+    MotionBVHNode *mRoot; // nullptr if no primitive moves
+};
+
+inline bool MotionBVHTree::MotionBVHNode::IsLeaf() const
+{
+    return left == nullptr;
+}
+
+inline BoundingVolume3f MotionBVHTree::MotionBVHNode::GetBoundingBoxAt(float time) const
+{
+    BoundingVolume3f bbox;
+    bbox.min = openBbox.min * (1 - time) + closeBbox.min * time;
+    bbox.max = openBbox.max * (1 - time) + closeBbox.max * time;
+
+    return bbox;
+}
+
+inline void MotionBVHTree::MotionBVHNode::UpdateSahCost()
+{
+    float area = GetBoundingBoxAt(0.5f).SA();
+    if (area > 0)
+        sahCost = 0.125f + (left->sahCost * left->GetBoundingBoxAt(0.5f).SA() + right->sahCost * right->GetBoundingBoxAt(0.5f).SA()) / area;
+    else // Flat children of a flat box
+        sahCost = 0.125f + left->sahCost + right->sahCost;
+}
+
+}
@@ -5,8 +5,24 @@
 
 namespace actracer
 {
-static Vector3i GetUnboundedFlooredCoordinates(const Vector3i& point);
-static Vector3f GetFlooredDirectionWeights(const Vector3f& flooredPoint);
+
+namespace
+{
+
+// Components of the gradient vectors, kept apart so that eight corners are gathered into lanes
+const float gradientX[16] = {1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, -1.0f, 0.0f, 0.0f};
+const float gradientY[16] = {1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f};
+const float gradientZ[16] = {0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f};
+
+// Derivative of Smoothstep
+inline float SmoothstepDerivative(float t)
+{
+    return 30 * t * t * (t - 1) * (t - 1);
+}
+
+}
+
+constexpr int PerlinTextureImpl::TABLE_SIZE;
 
 Vector3f PerlinTextureImpl::GetBaseTextureColorForColorChange(const SurfaceIntersection &intersection) const
 {
@@ -26,10 +42,11 @@ Vector3f PerlinTextureImpl::GetReplacedNormal(const SurfaceIntersection &interse
 PerlinTextureImpl::PerlinTextureImpl(float bumpFactor, float noiseScale, NoiseConversionType method, std::default_random_engine& generator)
     : TextureImpl(bumpFactor), mNoiseScale(noiseScale), mConversionMethod(method)
 {
-    for (int i = 0; i < mTableSize; i++)
-        mIndices.push_back(i);
+    for (int i = 0; i < TABLE_SIZE; i++)
+        mPermutation[i] = i;
 
-    std::shuffle(mIndices.begin(), mIndices.end(), generator);
+    std::shuffle(mPermutation, mPermutation + TABLE_SIZE, generator);
+    std::copy(mPermutation, mPermutation + TABLE_SIZE, mPermutation + TABLE_SIZE);
 }
 
 Vector3f PerlinTextureImpl::GetBumpedNormal(const SurfaceIntersection &intersectedSurfaceInformation, const Triangle *triangle) const
@@ -55,44 +72,44 @@ Vector3f PerlinTextureImpl::GetTweakedNormal(const SurfaceIntersection &intersec
 
 Vector3f PerlinTextureImpl::GetDifferenceVector(const Vector3f &intersectionPoint) const
 {
-    float standardColorValue = RetrieveRGBFromUV(intersectionPoint.x, intersectionPoint.y, intersectionPoint.z).x;
+    Vector3f noiseGradient;
+    float noise = EvaluateNoise(GetNoiseScaledUVParameters(intersectionPoint.x, intersectionPoint.y, intersectionPoint.z), &noiseGradient);
 
-    float xOffsetColorValue = RetrieveRGBFromUV(intersectionPoint.x + mOffsetEpsilon, intersectionPoint.y, intersectionPoint.z).x;
-    float yOffsetColorValue = RetrieveRGBFromUV(intersectionPoint.x, intersectionPoint.y + mOffsetEpsilon, intersectionPoint.z).x;
-    float zOffsetColorValue = RetrieveRGBFromUV(intersectionPoint.x, intersectionPoint.y, intersectionPoint.z + mOffsetEpsilon).x;
+    // Chain rule through the noise scale and the conversion
+    float conversionDerivative = 0.0f;
+    switch (mConversionMethod)
+    {
+    case NoiseConversionType::ABSVAL:
+        conversionDerivative = noise < 0 ? -1.0f : 1.0f;
+        break;
+    case NoiseConversionType::LINEAR:
+        conversionDerivative = 0.5f;
+        break;
+    }
 
-    return {(xOffsetColorValue - standardColorValue) / mOffsetEpsilon,
-            (yOffsetColorValue - standardColorValue) / mOffsetEpsilon,
-            (zOffsetColorValue - standardColorValue) / mOffsetEpsilon};
+    return noiseGradient * (conversionDerivative * mNoiseScale);
 }
 
-/*
- * TODO: Refactor this function
- * First Attempt: Results are wrong when decomposed into functions,
- * probably floating precision.
- */ 
 Vector3f PerlinTextureImpl::RetrieveRGBFromUV(float u, float v, float z) const
 {
-    
-    Vector3f p = GetNoiseScaledUVParameters(u, v, z);
+    float result = EvaluateNoise(GetNoiseScaledUVParameters(u, v, z), nullptr);
+    ApplyNoiseConversion(result);
 
-    int N = mTableSize;
-
-    int xFloor = ((int)std::floor(p.x)) % N; //
-    int yFloor = ((int)std::floor(p.y)) % N; // Floored coordinates
-    int zFloor = ((int)std::floor(p.z)) % N; //
-
-    int xCeil = (xFloor + 1) % N; //
-    int yCeil = (yFloor + 1) % N; // Ceiled coordinates
-    int zCeil = (zFloor + 1) % N; //
+    return {result, result, result};
+}
 
-    int xfc[2] = {xFloor, xCeil}; //
-    int yfc[2] = {yFloor, yCeil}; // Group for easier use
-    int zfc[2] = {zFloor, zCeil}; //
+/*
+ * Corners are numbered by their (x, y, z) bits, x being the highest, lanes of the first batch are the corners on the floored x
+ */
+float PerlinTextureImpl::EvaluateNoise(const Vector3f &p, Vector3f *gradient) const
+{
+    int xFloor = (int)std::floor(p.x); //
+    int yFloor = (int)std::floor(p.y); // Floored coordinates
+    int zFloor = (int)std::floor(p.z); //
 
-    float dxf = p.x - ((int)std::floor(p.x)); //
-    float dyf = p.y - ((int)std::floor(p.y)); // Directions to floored points
-    float dzf = p.z - ((int)std::floor(p.z)); //
+    float dxf = p.x - xFloor; //
+    float dyf = p.y - yFloor; // Directions to floored points
+    float dzf = p.z - zFloor; //
 
     float dxc = dxf - 1; //
     float dyc = dyf - 1; // Directions to ceiled points
@@ -102,145 +119,60 @@ Vector3f PerlinTextureImpl::RetrieveRGBFromUV(float u, float v, float z) const
     float w1 = Smoothstep(dyf); // Perlin weights of directions
     float w2 = Smoothstep(dzf); //
 
-    Vector3f g0 = GetGradientVector(xfc[0], yfc[0], zfc[0]); //
-    Vector3f g1 = GetGradientVector(xfc[0], yfc[0], zfc[1]); //
-    Vector3f g2 = GetGradientVector(xfc[0], yfc[1], zfc[0]); //
-    Vector3f g3 = GetGradientVector(xfc[0], yfc[1], zfc[1]); // Gradient vectors of the lattice points
-    Vector3f g4 = GetGradientVector(xfc[1], yfc[0], zfc[0]); //
-    Vector3f g5 = GetGradientVector(xfc[1], yfc[0], zfc[1]); //
-    Vector3f g6 = GetGradientVector(xfc[1], yfc[1], zfc[0]); //
-    Vector3f g7 = GetGradientVector(xfc[1], yfc[1], zfc[1]); //
-
-    Vector3f v0(dxf, dyf, dzf); //
-    Vector3f v1(dxf, dyf, dzc); //
-    Vector3f v2(dxf, dyc, dzf); //
-    Vector3f v3(dxf, dyc, dzc); // Direction vectors of the lattice points
-    Vector3f v4(dxc, dyf, dzf); // ( Direction towards the intersection point p )
-    Vector3f v5(dxc, dyf, dzc); //
-    Vector3f v6(dxc, dyc, dzf); //
-    Vector3f v7(dxc, dyc, dzc); //
-
-    // linear interpolation
-    float l0 = Lerp(Dot(g0, v0), Dot(g4, v4), w0); //
-    float l1 = Lerp(Dot(g2, v2), Dot(g6, v6), w0); // Lerp between corners
-    float l2 = Lerp(Dot(g1, v1), Dot(g5, v5), w0); //
-    float l3 = Lerp(Dot(g3, v3), Dot(g7, v7), w0); //
-
-    float ll0 = Lerp(l0, l1, w1); // Lerp lerped corners
-    float ll1 = Lerp(l2, l3, w1); //
+    int gradientIndices[8];
+    for (int corner = 0; corner < 8; ++corner)
+        gradientIndices[corner] = GetGradientIndex(xFloor + (corner >> 2), yFloor + ((corner >> 1) & 1), zFloor + (corner & 1));
 
-    float result = Lerp(ll0, ll1, w2); // Lerp last two values
+    const int *floorX = gradientIndices;
+    const int *ceilX = gradientIndices + 4;
 
-    // Noise conversion
-    if (this->mConversionMethod == NoiseConversionType::ABSVAL)
-        result = std::abs(result);
-    else if (this->mConversionMethod == NoiseConversionType::LINEAR)
-        result = (result + 1) / 2.0f;
+    Vector4fa floorXGradientX(gradientX[floorX[0]], gradientX[floorX[1]], gradientX[floorX[2]], gradientX[floorX[3]]);
+    Vector4fa floorXGradientY(gradientY[floorX[0]], gradientY[floorX[1]], gradientY[floorX[2]], gradientY[floorX[3]]);
+    Vector4fa floorXGradientZ(gradientZ[floorX[0]], gradientZ[floorX[1]], gradientZ[floorX[2]], gradientZ[floorX[3]]);
+    Vector4fa ceilXGradientX(gradientX[ceilX[0]], gradientX[ceilX[1]], gradientX[ceilX[2]], gradientX[ceilX[3]]);
+    Vector4fa ceilXGradientY(gradientY[ceilX[0]], gradientY[ceilX[1]], gradientY[ceilX[2]], gradientY[ceilX[3]]);
+    Vector4fa ceilXGradientZ(gradientZ[ceilX[0]], gradientZ[ceilX[1]], gradientZ[ceilX[2]], gradientZ[ceilX[3]]);
 
-    return {result, result, result};
-    // Vector3f point = GetNoiseScaledUVParameters(u, v, z);
-    // Vector3i unboundedFlooredLatticePoint = GetUnboundedFlooredCoordinates(Vector3i(point.x, point.y, point.z));
-
-    // Vector3i boundedFlooredLatticePoint = BoundFloorCoordinates(unboundedFlooredLatticePoint);
-    // Vector3i boundedCeiledLatticePoint = GetBoundedCeiledCoordinates(boundedFlooredLatticePoint);
+    // Direction vectors of the corners towards p, y and z are the same for both batches
+    Vector4fa directionY(dyf, dyf, dyc, dyc);
+    Vector4fa directionZ(dzf, dzc, dzf, dzc);
 
-    // Vector3f directionToFlooredLatticePoint = point - unboundedFlooredLatticePoint;
-    // Vector3f directionToCeiledLatticePoint = directionToFlooredLatticePoint - Vector3i(1, 1, 1);
+    Vector4fa floorXValues = floorXGradientX * dxf + floorXGradientY * directionY + floorXGradientZ * directionZ;
+    Vector4fa ceilXValues = ceilXGradientX * dxc + ceilXGradientY * directionY + ceilXGradientZ * directionZ;
 
-    // float result = ComputeResult(boundedFlooredLatticePoint, boundedCeiledLatticePoint, directionToFlooredLatticePoint, directionToCeiledLatticePoint);
+    // Lerp between corners along x, lanes are the edges (y, z) = (f, f), (f, c), (c, f), (c, c)
+    Vector4fa edgeValues = floorXValues * (1 - w0) + ceilXValues * w0;
 
-    // ApplyNoiseConversion(result);
-
-    // return {result, result, result};
-}
+    float ll0 = Lerp(edgeValues.x, edgeValues.z, w1); // Lerp lerped corners
+    float ll1 = Lerp(edgeValues.y, edgeValues.w, w1); //
 
-Vector3f PerlinTextureImpl::GetNoiseScaledUVParameters(float u, float v, float z) const
-{
-    return {u * mNoiseScale, v * mNoiseScale, z * mNoiseScale};    
-}
-
-static Vector3i GetUnboundedFlooredCoordinates(const Vector3i &point)
-{
-    return { (int)std::floor(point.x), (int)std::floor(point.y), (int)std::floor(point.z) };
-}
+    float result = Lerp(ll0, ll1, w2); // Lerp last two values
 
-Vector3i PerlinTextureImpl::BoundFloorCoordinates(const Vector3i &unboundedFlooredPoint) const
-{
-    return { unboundedFlooredPoint.x % mTableSize, unboundedFlooredPoint.y % mTableSize, unboundedFlooredPoint.z % mTableSize };
-}
+    if (gradient)
+    {
+        // Gradient of the dot product of a corner is its gradient vector, the rest comes from the derivatives of the weights
+        float dw0 = SmoothstepDerivative(dxf);
+        float dw1 = SmoothstepDerivative(dyf);
+        float dw2 = SmoothstepDerivative(dzf);
 
-Vector3i PerlinTextureImpl::GetBoundedCeiledCoordinates(const Vector3i &boundedFlooredPoint) const
-{
-    return { (boundedFlooredPoint.x + 1) % mTableSize,
-             (boundedFlooredPoint.y + 1) % mTableSize,
-             (boundedFlooredPoint.z + 1) % mTableSize};
-}
+        Vector4fa edgeGradientX = floorXGradientX * (1 - w0) + ceilXGradientX * w0 + (ceilXValues - floorXValues) * dw0;
+        Vector4fa edgeGradientY = floorXGradientY * (1 - w0) + ceilXGradientY * w0;
+        Vector4fa edgeGradientZ = floorXGradientZ * (1 - w0) + ceilXGradientZ * w0;
 
-float PerlinTextureImpl::ComputeResult(const Vector3i &boundedFlooredLatticePoint, const Vector3i &boundedCeiledLatticePoint,
-                                       const Vector3f& directionToFlooredPoint, const Vector3f& directionToCeiledPoint) const
-{
-    Vector3f flooredDirectionWeights = GetFlooredDirectionWeights(directionToFlooredPoint);
-
-    // Rename/Regroup for easier use
-    int xFlooredCeiled[2]{boundedFlooredLatticePoint.x, boundedCeiledLatticePoint.x};
-    int yFlooredCeiled[2]{boundedFlooredLatticePoint.y, boundedCeiledLatticePoint.y};
-    int zFlooredCeiled[2]{boundedFlooredLatticePoint.z, boundedCeiledLatticePoint.z};
-
-    const float& dxf = directionToFlooredPoint.x;
-    const float& dyf = directionToFlooredPoint.y;
-    const float& dzf = directionToFlooredPoint.z;
-
-    const float& dxc = directionToCeiledPoint.x;
-    const float& dyc = directionToCeiledPoint.y;
-    const float& dzc = directionToCeiledPoint.z;
-    // --
-
-    Vector3f g0 = GetGradientVector(xFlooredCeiled[0], yFlooredCeiled[0], zFlooredCeiled[0]); //
-    Vector3f g1 = GetGradientVector(xFlooredCeiled[0], yFlooredCeiled[0], zFlooredCeiled[1]); //
-    Vector3f g2 = GetGradientVector(xFlooredCeiled[0], yFlooredCeiled[1], zFlooredCeiled[0]); //
-    Vector3f g3 = GetGradientVector(xFlooredCeiled[0], yFlooredCeiled[1], zFlooredCeiled[1]); // Gradient vectors of the lattice points
-    Vector3f g4 = GetGradientVector(xFlooredCeiled[1], yFlooredCeiled[0], zFlooredCeiled[0]); //
-    Vector3f g5 = GetGradientVector(xFlooredCeiled[1], yFlooredCeiled[0], zFlooredCeiled[1]); //
-    Vector3f g6 = GetGradientVector(xFlooredCeiled[1], yFlooredCeiled[1], zFlooredCeiled[0]); //
-    Vector3f g7 = GetGradientVector(xFlooredCeiled[1], yFlooredCeiled[1], zFlooredCeiled[1]); //
-
-    Vector3f v0(dxf, dyf, dzf); //
-    Vector3f v1(dxf, dyf, dzc); //
-    Vector3f v2(dxf, dyc, dzf); //
-    Vector3f v3(dxf, dyc, dzc); // Direction vectors of the lattice points
-    Vector3f v4(dxc, dyf, dzf); // ( Direction towards the intersection point p )
-    Vector3f v5(dxc, dyf, dzc); //
-    Vector3f v6(dxc, dyc, dzf); //
-    Vector3f v7(dxc, dyc, dzc); //
-
-    // linear interpolation
-    float l0 = Lerp(Dot(g0, v0), Dot(g4, v4), flooredDirectionWeights.x); //
-    float l1 = Lerp(Dot(g2, v2), Dot(g6, v6), flooredDirectionWeights.x); // Lerp between corners
-    float l2 = Lerp(Dot(g1, v1), Dot(g5, v5), flooredDirectionWeights.x); //
-    float l3 = Lerp(Dot(g3, v3), Dot(g7, v7), flooredDirectionWeights.x); //
-
-    float ll0 = Lerp(l0, l1, flooredDirectionWeights.y); // Lerp lerped corners
-    float ll1 = Lerp(l2, l3, flooredDirectionWeights.y); //
-
-    return Lerp(ll0, ll1, flooredDirectionWeights.z);
-}
+        Vector3f ll0Gradient = Lerp(Vector3f(edgeGradientX.x, edgeGradientY.x, edgeGradientZ.x), Vector3f(edgeGradientX.z, edgeGradientY.z, edgeGradientZ.z), w1) +
+                               Vector3f(0.0f, (edgeValues.z - edgeValues.x) * dw1, 0.0f);
+        Vector3f ll1Gradient = Lerp(Vector3f(edgeGradientX.y, edgeGradientY.y, edgeGradientZ.y), Vector3f(edgeGradientX.w, edgeGradientY.w, edgeGradientZ.w), w1) +
+                               Vector3f(0.0f, (edgeValues.w - edgeValues.y) * dw1, 0.0f);
 
-static Vector3f GetFlooredDirectionWeights(const Vector3f &directionToFlooredPoint)
-{
-    return {Smoothstep(directionToFlooredPoint.x), Smoothstep(directionToFlooredPoint.y), Smoothstep(directionToFlooredPoint.z)};
-}
+        *gradient = Lerp(ll0Gradient, ll1Gradient, w2) + Vector3f(0.0f, 0.0f, (ll1 - ll0) * dw2);
+    }
 
-Vector3f PerlinTextureImpl::GetGradientVector(int i, int j, int k) const
-{
-    return gradientVectors[GetShuffledIndex(i + GetShuffledIndex(j + GetShuffledIndex(k)))];
+    return result;
 }
 
-int PerlinTextureImpl::GetShuffledIndex(int i) const
+Vector3f PerlinTextureImpl::GetNoiseScaledUVParameters(float u, float v, float z) const
 {
-    int res = i % mTableSize;
-    if (res < 0)
-        res += mTableSize;
-    return mIndices[res];
+    return {u * mNoiseScale, v * mNoiseScale, z * mNoiseScale};    
 }
 
 void PerlinTextureImpl::ApplyNoiseConversion(float &result) const
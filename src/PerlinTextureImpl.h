@@ -3,7 +3,7 @@
 #include "TextureImpl.h"
 #include "acmath.h"
 
-#include <vector>
+#include <cstdint>
 
 namespace actracer
 {
@@ -30,52 +30,42 @@ public:
     virtual Vector3f GetBaseTextureColorForColorChange(const SurfaceIntersection& intersection) const override;
 private:
     Vector3f GetTweakedNormal(const SurfaceIntersection& intersectedSurfaceInformation) const;
+    /*
+     * Gradient of the converted noise with respect to the intersection point
+     */
     Vector3f GetDifferenceVector(const Vector3f& intersectionPoint) const;
 private:
+    static constexpr int TABLE_SIZE = 16;
+
+    /*
+     * Noise on the noise scaled point p before the conversion,
+     * its gradient with respect to p is written into gradient if it is not null.
+     * The eight lattice corners are evaluated in two 4 wide batches
+     */
+    float EvaluateNoise(const Vector3f &p, Vector3f *gradient) const;
+
     /*
      * Use i, j, k to compute index
-     * The indices array is shuffled in constructor, results are random 
-     * but same (i, j, k) triple always returns the same GradientVector
+     * The permutation is shuffled in constructor, results are random 
+     * but same (i, j, k) triple always returns the same gradient
      */ 
-    Vector3f GetGradientVector(int i, int j, int k) const;
-    int GetShuffledIndex(int i) const;
+    int GetGradientIndex(int i, int j, int k) const;
 
     Vector3f GetNoiseScaledUVParameters(float u, float v, float z) const;
-    Vector3i BoundFloorCoordinates(const Vector3i &unboundedFlooredPoint) const;
-    Vector3i GetBoundedCeiledCoordinates(const Vector3i &boundedFlooredPoint) const;
-
-    float ComputeResult(const Vector3i &boundedFlooredLatticePoint, const Vector3i &boundedCeiledLatticePoint,
-                        const Vector3f &directionToFlooredPoint, const Vector3f &directionToCeiledPoint) const;
 
     void ApplyNoiseConversion(float& result) const;
 
 private:
-    float mOffsetEpsilon = 0.001f;
-
-    Vector3f gradientVectors[16] = {
-        Vector3f{1.0f, 1.0f, 0.0f},
-        Vector3f{-1.0f, 1.0f, 0.0f},
-        Vector3f{1.0f, -1.0f, 0.0f},
-        Vector3f{-1.0f, -1.0f, 0.0f},
-        Vector3f{1.0f, 0.0f, 1.0f},
-        Vector3f{-1.0f, 0.0f, 1.0f},
-        Vector3f{1.0f, 0.0f, -1.0f},
-        Vector3f{-1.0f, 0.0f, -1.0f},
-        Vector3f{0.0f, 1.0f, 1.0f},
-        Vector3f{0.0f, -1.0f, 1.0f},
-        Vector3f{0.0f, 1.0f, -1.0f},
-        Vector3f{0.0f, -1.0f, -1.0f},
-        Vector3f{1.0f, 1.0f, 0.0f},
-        Vector3f{-1.0f, 1.0f, 0.0f},
-        Vector3f{0.0f, -1.0f, 1.0f},
-        Vector3f{0.0f, -1.0f, -1.0f}};
-
-    std::vector<int> mIndices;
+    // Shuffled indices repeated twice so that nested lookups do not need to wrap
+    uint8_t mPermutation[2 * TABLE_SIZE];
 private:
     float mNoiseScale;
     NoiseConversionType mConversionMethod;
-
-    int mTableSize = 16;
 };
 
+inline int PerlinTextureImpl::GetGradientIndex(int i, int j, int k) const
+{
+    return mPermutation[(i & (TABLE_SIZE - 1)) + mPermutation[(j & (TABLE_SIZE - 1)) + mPermutation[k & (TABLE_SIZE - 1)]]];
+}
+
 }
\ No newline at end of file
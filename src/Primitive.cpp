@@ -2,9 +2,14 @@
 
 namespace actracer {
 
-SurfaceIntersection Primitive::Intersect(Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) 
+void Primitive::Intersect(Ray &r, HitRecord &hit, float intersectionTestEpsilon) 
 { 
-    containedShape->Intersect(r, rt, intersectionTestEpsilon); 
+    containedShape->Intersect(r, hit, intersectionTestEpsilon); 
+}
+
+unsigned Primitive::IntersectPacket(const RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon)
+{
+    return containedShape->IntersectPacket(packet, activeRays, hits, intersectionTestEpsilon);
 }
 
 }
\ No newline at end of file
@@ -7,7 +7,8 @@
 namespace actracer {
 
 class Material;
-class SurfaceIntersection;
+class HitRecord;
+class RayPacket;
 
 class Primitive {
 private:
@@ -25,11 +26,40 @@ public:
         mID = ++id;
     }
 
-    SurfaceIntersection Intersect(Ray& r, SurfaceIntersection& rt, float intersectionTestEpsilon);
+    void Intersect(Ray& r, HitRecord& hit, float intersectionTestEpsilon);
+    // Returns the rays of activeRays that hit, only their hits are written
+    unsigned IntersectPacket(const RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon);
+
+    bool IsMoving() const;
+    // Copies the box of the shape after its transformation changed
+    void UpdateBoundingBox();
+    // Read from the shape, as bbox is not updated if the motion is set after the primitive is created
+    BoundingVolume3f GetBoundingBoxAt(float time) const;
+    // Box of the part of the shape in the slab on the axis, for the spatial splits
+    BoundingVolume3f GetClippedBoundingBox(int axis, float slabMin, float slabMax) const;
 public:
     BoundingVolume3f bbox; 
 };
 
+inline bool Primitive::IsMoving() const
+{
+    return containedShape->IsMotionBlurActive();
+}
+
+inline void Primitive::UpdateBoundingBox()
+{
+    bbox = containedShape->GetBoundingBox();
+}
+
+inline BoundingVolume3f Primitive::GetBoundingBoxAt(float time) const
+{
+    return containedShape->GetBoundingBoxAt(time);
+}
+
+inline BoundingVolume3f Primitive::GetClippedBoundingBox(int axis, float slabMin, float slabMax) const
+{
+    return containedShape->GetClippedBoundingBox(axis, slabMin, slabMax);
+}
 
 }
 
@@ -4,19 +4,54 @@
 #include <random>
 #include <ctime>
 #include <chrono>
+#include <atomic>
 
 template<typename T>
 class Random {
 private:
     unsigned seed;
     std::default_random_engine generator;
+
+    static std::atomic<bool> sIsSeedFixed;
+    static std::atomic<unsigned> sFirstFixedSeed;
+    static std::atomic<unsigned> sNextFixedSeed;
 public:
     Random()
     {
-        seed = std::chrono::system_clock::now().time_since_epoch().count();
+        if(sIsSeedFixed)
+            seed = sNextFixedSeed++;
+        else
+            seed = std::chrono::system_clock::now().time_since_epoch().count();
         generator = std::default_random_engine(seed);
     }
 
+    /*
+     * Generator of one of the streams that are drawn from concurrently, e.g. one per render worker.
+     * With fixed seeds it is seeded from the first fixed seed and streamIndex,
+     * so the draws of a stream do not depend on the order the streams are created in
+     */
+    explicit Random(unsigned streamIndex)
+    {
+        if(sIsSeedFixed)
+            seed = sFirstFixedSeed;
+        else
+            seed = std::chrono::system_clock::now().time_since_epoch().count();
+
+        std::seed_seq sequence{seed, streamIndex};
+        generator.seed(sequence);
+    }
+
+    /*
+     * Generators that are created after this call are seeded with successive values
+     * starting from firstSeed instead of the clock, so that renders can be repeated
+     */
+    static void UseFixedSeeds(unsigned firstSeed)
+    {
+        sFirstFixedSeed = firstSeed;
+        sNextFixedSeed = firstSeed;
+        sIsSeedFixed = true;
+    }
+
     T operator()(T lowerBound, T upperBound)
     {
         std::uniform_real_distribution<T> distribution(lowerBound, upperBound);
@@ -24,4 +59,13 @@ public:
     }
 };
 
+template<typename T>
+std::atomic<bool> Random<T>::sIsSeedFixed{false};
+
+template<typename T>
+std::atomic<unsigned> Random<T>::sFirstFixedSeed{0};
+
+template<typename T>
+std::atomic<unsigned> Random<T>::sNextFixedSeed{0};
+
 #endif
\ No newline at end of file
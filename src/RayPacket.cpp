@@ -0,0 +1,128 @@
+#include "RayPacket.h"
+
+#include <limits>
+
+namespace actracer
+{
+
+constexpr int RayPacket::size;
+
+RayPacket::RayPacket(Ray *const *rays, int rayCount)
+    : mRayCount(rayCount)
+{
+    for (int i = 0; i < size; ++i)
+    {
+        // Unused slots repeat the last ray so that the lanes stay valid
+        const Ray &ray = *rays[i < rayCount ? i : rayCount - 1];
+
+        mRays[i] = rays[i < rayCount ? i : rayCount - 1];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            mOrigin[axis][i] = ray.o[axis];
+            mDirection[axis][i] = ray.d[axis];
+        }
+    }
+
+    ComputeFrustumBounds();
+}
+
+void RayPacket::ComputeFrustumBounds()
+{
+    mHasCommonDirectionSigns = true;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        mIsDirectionNegative[axis] = mDirection[axis][0] < 0;
+
+        mMinOrigin[axis] = mMaxOrigin[axis] = mOrigin[axis][0];
+        mMinAbsDirection[axis] = mMaxAbsDirection[axis] = std::abs(mDirection[axis][0]);
+
+        for (int i = 0; i < mRayCount; ++i)
+        {
+            float direction = mDirection[axis][i];
+            if (direction == 0 || (direction < 0) != mIsDirectionNegative[axis])
+                mHasCommonDirectionSigns = false;
+
+            SetMin(mMinOrigin[axis], mOrigin[axis][i]);
+            SetMax(mMaxOrigin[axis], mOrigin[axis][i]);
+            SetMin(mMinAbsDirection[axis], std::abs(direction));
+            SetMax(mMaxAbsDirection[axis], std::abs(direction));
+        }
+    }
+}
+
+/*
+ * Same slab test as BoundingVolume3f::Intersect for each ray,
+ * comparisons are kept in the same form so that the results are identical
+ */
+unsigned RayPacket::IntersectBox(const BoundingVolume3f &box, unsigned activeRays) const
+{
+    if (mHasCommonDirectionSigns && !CanFrustumIntersectBox(box))
+        return 0;
+
+    float tn[size];
+    float tf[size];
+    for (int i = 0; i < size; ++i)
+    {
+        tn[i] = 0;
+        tf[i] = std::numeric_limits<float>::max();
+    }
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float boxMin = box.min[axis];
+        float boxMax = box.max[axis];
+
+        for (int i = 0; i < size; ++i)
+        {
+            float tnn = (boxMin - mOrigin[axis][i]) / mDirection[axis][i];
+            float tff = (boxMax - mOrigin[axis][i]) / mDirection[axis][i];
+
+            float tNear = tnn > tff ? tff : tnn;
+            float tFar = tnn > tff ? tnn : tff;
+
+            tn[i] = tn[i] < tNear ? tNear : tn[i];
+            tf[i] = tf[i] > tFar ? tFar : tf[i];
+        }
+    }
+
+    unsigned hitRays = 0;
+    for (int i = 0; i < size; ++i)
+        hitRays |= (tf[i] < tn[i] ? 0u : 1u) << i;
+
+    return hitRays & activeRays;
+}
+
+bool RayPacket::CanFrustumIntersectBox(const BoundingVolume3f &box) const
+{
+    float maxOfNear = 0;
+    float minOfFar = std::numeric_limits<float>::max();
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        // Distances to the slab planes along the direction, for negative directions the planes swap
+        float nearLow, farHigh;
+        if (mIsDirectionNegative[axis])
+        {
+            nearLow = mMinOrigin[axis] - box.max[axis];
+            farHigh = mMaxOrigin[axis] - box.min[axis];
+        }
+        else
+        {
+            nearLow = box.min[axis] - mMaxOrigin[axis];
+            farHigh = box.max[axis] - mMinOrigin[axis];
+        }
+
+        // Smallest possible near and largest possible far parameter of all rays
+        float nearBound = nearLow >= 0 ? nearLow / mMaxAbsDirection[axis] : nearLow / mMinAbsDirection[axis];
+        float farBound = farHigh >= 0 ? farHigh / mMinAbsDirection[axis] : farHigh / mMaxAbsDirection[axis];
+
+        SetMax(maxOfNear, nearBound);
+        SetMin(minOfFar, farBound);
+    }
+
+    // Small tolerance keeps the test conservative against rounding
+    return maxOfNear <= minOfFar + 1e-4f * (std::abs(minOfFar) + 1.0f);
+}
+
+}
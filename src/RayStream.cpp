@@ -0,0 +1,79 @@
+#include "RayStream.h"
+
+#include <algorithm>
+
+namespace actracer
+{
+
+// Spreads the lower 10 bits of the value so that there are two zero bits between each bit
+static uint32_t ExpandBits(uint32_t value)
+{
+    value = (value | (value << 16)) & 0x030000FF;
+    value = (value | (value << 8)) & 0x0300F00F;
+    value = (value | (value << 4)) & 0x030C30C3;
+    value = (value | (value << 2)) & 0x09249249;
+
+    return value;
+}
+
+static uint32_t ComputeMortonCode(const Vector3f &point, const BoundingVolume3f &bounds)
+{
+    Vector3f extent = bounds.max - bounds.min;
+
+    uint32_t cell[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float normalized = extent[axis] > 0 ? (point[axis] - bounds.min[axis]) / extent[axis] : 0.0f;
+        cell[axis] = std::min(1023u, static_cast<uint32_t>(normalized * 1024.0f));
+    }
+
+    return (ExpandBits(cell[0]) << 2) | (ExpandBits(cell[1]) << 1) | ExpandBits(cell[2]);
+}
+
+static uint32_t ComputeDirectionOctant(const Vector3f &direction)
+{
+    return (direction.x < 0 ? 4 : 0) | (direction.y < 0 ? 2 : 0) | (direction.z < 0 ? 1 : 0);
+}
+
+uint64_t ComputeCoherentRayKey(const Vector3f &origin, const Vector3f &direction, const BoundingVolume3f &originBounds, int group)
+{
+    // Group takes the highest bits, then the octant so that rays with the same direction signs come together
+    return (static_cast<uint64_t>(group) << 33) | (static_cast<uint64_t>(ComputeDirectionOctant(direction)) << 30) | ComputeMortonCode(origin, originBounds);
+}
+
+void SortCoherentRayKeys(std::vector<std::pair<uint64_t, int>> &keys, std::vector<std::pair<uint64_t, int>> &buffer)
+{
+    constexpr int digitBitCount = 11;
+    constexpr int digitCount = 1 << digitBitCount;
+
+    // Keys of most streams fit into the lower 33 bits, passes over the zero digits are skipped
+    uint64_t maxKey = 0;
+    for (const std::pair<uint64_t, int> &key : keys)
+        maxKey = std::max(maxKey, key.first);
+
+    buffer.resize(keys.size());
+
+    int digitOffsets[digitCount];
+    for (int shift = 0; shift < 64 && (maxKey >> shift) != 0; shift += digitBitCount)
+    {
+        std::fill(digitOffsets, digitOffsets + digitCount, 0);
+        for (const std::pair<uint64_t, int> &key : keys)
+            ++digitOffsets[(key.first >> shift) & (digitCount - 1)];
+
+        int offset = 0;
+        for (int digit = 0; digit < digitCount; ++digit)
+        {
+            int count = digitOffsets[digit];
+            digitOffsets[digit] = offset;
+            offset += count;
+        }
+
+        // Keys with the same digit keep their order so that the lower digits stay sorted
+        for (const std::pair<uint64_t, int> &key : keys)
+            buffer[digitOffsets[(key.first >> shift) & (digitCount - 1)]++] = key;
+
+        keys.swap(buffer);
+    }
+}
+
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+#include "acmath.h"
+
+namespace actracer
+{
+
+/*
+ * Ray that waits in a stream of the wavefront renderer,
+ * carries the path state that the recursive renderer keeps on the call stack
+ */
+struct StreamRay
+{
+    Ray ray;
+    Vector3f weight;     // Color of the ray is scaled with weight before being added to the pixel
+    int pixelIndex;      // Index of the pixel in the tile
+    int depth;           // Reflection/refraction depth
+    float throughput;
+    bool addColorOnMiss; // Background color is added if the ray does not hit anything
+};
+
+/*
+ * Shadow ray that waits in a stream of the wavefront renderer,
+ * contribution is added to the pixel if nothing blocks the way through the light
+ */
+struct ShadowStreamRay
+{
+    Vector3f surfacePoint;
+    Vector3f contribution;
+    float distanceToLight;
+    float time;          // Shadow ray is created when the packet is traced, origin and direction are kept by the stream
+    int pixelIndex;
+    int lightIndex;      // Shadow rays of the same light are traced together
+};
+
+/*
+ * Returns the key that orders the rays group by group, octant by octant of their directions inside a group
+ * and in Morton order of their origins inside an octant, originBounds -> bounds of the origins of all sorted rays
+ */
+uint64_t ComputeCoherentRayKey(const Vector3f &origin, const Vector3f &direction, const BoundingVolume3f &originBounds, int group);
+
+/*
+ * Radix sort of the keys by their first member, index in the second member is carried along.
+ * buffer -> memory the sort works in, kept by the caller to be reused
+ */
+void SortCoherentRayKeys(std::vector<std::pair<uint64_t, int>> &keys, std::vector<std::pair<uint64_t, int>> &buffer);
+
+// Rays of different groups are not mixed by the sort, shadow rays are grouped by their light
+inline int GetSortGroup(const StreamRay &) { return 0; }
+inline int GetSortGroup(const ShadowStreamRay &shadowRay) { return shadowRay.lightIndex; }
+
+/*
+ * Rays stay where they are pushed, the stream is traced in the order of mOrder.
+ * Origins, directions and groups are also kept in arrays of their own so that sorting does not touch the rays
+ */
+template <typename T>
+class RayStream
+{
+public:
+    void Push(const Vector3f &origin, const Vector3f &direction, T &&streamRay);
+    void Reserve(int rayCount);
+    // Removes the rays, memory is kept for the next rays
+    void Clear();
+    void Swap(RayStream<T> &other);
+
+    int Size() const;
+    bool IsEmpty() const;
+
+    // index -> position of the ray in the tracing order
+    T &operator[](int index);
+    const T &operator[](int index) const;
+    const Vector3f &GetOrigin(int index) const;
+    const Vector3f &GetDirection(int index) const;
+
+    /*
+     * Reorders the rays so that successive rays are likely to traverse the same nodes of the hierarchy
+     */
+    void SortByDirectionAndOrigin();
+private:
+    std::vector<T> mRays;
+    std::vector<Vector3f> mOrigins;
+    std::vector<Vector3f> mDirections;
+    std::vector<int> mGroups;
+
+    std::vector<int> mOrder; // Indices of the rays in the tracing order
+    std::vector<std::pair<uint64_t, int>> mSortKeys; // Kept to reuse their memory
+    std::vector<std::pair<uint64_t, int>> mSortBuffer;
+};
+
+template <typename T>
+inline void RayStream<T>::Push(const Vector3f &origin, const Vector3f &direction, T &&streamRay)
+{
+    mOrder.push_back(mRays.size());
+    mOrigins.push_back(origin);
+    mDirections.push_back(direction);
+    mGroups.push_back(GetSortGroup(streamRay));
+    mRays.push_back(std::move(streamRay));
+}
+
+template <typename T>
+inline void RayStream<T>::Reserve(int rayCount)
+{
+    mRays.reserve(rayCount);
+    mOrigins.reserve(rayCount);
+    mDirections.reserve(rayCount);
+    mGroups.reserve(rayCount);
+    mOrder.reserve(rayCount);
+}
+
+template <typename T>
+inline void RayStream<T>::Clear()
+{
+    mRays.clear();
+    mOrigins.clear();
+    mDirections.clear();
+    mGroups.clear();
+    mOrder.clear();
+}
+
+template <typename T>
+inline void RayStream<T>::Swap(RayStream<T> &other)
+{
+    mRays.swap(other.mRays);
+    mOrigins.swap(other.mOrigins);
+    mDirections.swap(other.mDirections);
+    mGroups.swap(other.mGroups);
+    mOrder.swap(other.mOrder);
+}
+
+template <typename T>
+inline int RayStream<T>::Size() const
+{
+    return mRays.size();
+}
+
+template <typename T>
+inline bool RayStream<T>::IsEmpty() const
+{
+    return mRays.empty();
+}
+
+template <typename T>
+inline T &RayStream<T>::operator[](int index)
+{
+    return mRays[mOrder[index]];
+}
+
+template <typename T>
+inline const T &RayStream<T>::operator[](int index) const
+{
+    return mRays[mOrder[index]];
+}
+
+template <typename T>
+inline const Vector3f &RayStream<T>::GetOrigin(int index) const
+{
+    return mOrigins[mOrder[index]];
+}
+
+template <typename T>
+inline const Vector3f &RayStream<T>::GetDirection(int index) const
+{
+    return mDirections[mOrder[index]];
+}
+
+template <typename T>
+void RayStream<T>::SortByDirectionAndOrigin()
+{
+    int rayCount = mRays.size();
+    if (rayCount < 2)
+        return;
+
+    BoundingVolume3f originBounds{};
+    for (const Vector3f &origin : mOrigins)
+    {
+        originBounds.min = MinElements(originBounds.min, origin);
+        originBounds.max = MaxElements(originBounds.max, origin);
+    }
+
+    mSortKeys.resize(rayCount);
+    for (int i = 0; i < rayCount; ++i)
+        mSortKeys[i] = std::make_pair(ComputeCoherentRayKey(mOrigins[i], mDirections[i], originBounds, mGroups[i]), i);
+
+    SortCoherentRayKeys(mSortKeys, mSortBuffer);
+
+    for (int i = 0; i < rayCount; ++i)
+        mOrder[i] = mSortKeys[i].second;
+}
+
+}
@@ -1,20 +1,22 @@
 #include "RecursiveComputation.h"
 #include "Intersection.h"
 #include "Material.h"
+#include "DeferredRayQueue.h"
+#include "RenderStatistics.h"
 
 namespace actracer
 {
 
-LightContributionCalculator::RecursiveComputation *LightContributionCalculator::RecursiveComputation::CreateRecursiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator)
+LightContributionCalculator::RecursiveComputation *LightContributionCalculator::RecursiveComputation::CreateRecursiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator)
 {
     switch (intersection.mat->GetMaterialType())
     {
         case Material::MatType::DIELECTRIC:
-            return new RecursiveDielectricComputation(intersection, baseContributor, baseRay, depth, randomGenerator);
+            return new RecursiveDielectricComputation(intersection, baseContributor, baseRay, depth, throughput, randomGenerator);
         case Material::MatType::CONDUCTOR:
-            return new RecursiveConductorComputation(intersection, baseContributor, baseRay, depth, randomGenerator);
+            return new RecursiveConductorComputation(intersection, baseContributor, baseRay, depth, throughput, randomGenerator);
         case Material::MatType::MIRROR:
-            return new RecursiveMirrorComputation(intersection, baseContributor, baseRay, depth, randomGenerator);
+            return new RecursiveMirrorComputation(intersection, baseContributor, baseRay, depth, throughput, randomGenerator);
         default:
             break;
     }
@@ -22,30 +24,32 @@ LightContributionCalculator::RecursiveComputation *LightContributionCalculator::
     return nullptr;
 }
 
-LightContributionCalculator::RecursiveComputation::RecursiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double>& randomGenerator)
-    : mIntersection(intersection), mBaseContributor(baseContributor), mBaseRay(baseRay), depth(depth), randomGenerator(randomGenerator)
+LightContributionCalculator::RecursiveComputation::RecursiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double>& randomGenerator)
+    : mIntersection(intersection), mBaseContributor(baseContributor), mBaseRay(baseRay), depth(depth), mThroughput(throughput), randomGenerator(randomGenerator)
 {
     mPointToViewer = Normalize(baseRay.o - intersection.ip);
     mIntersectionSurfaceNormal = Normalize(intersection.n);
 }
 
-RecursiveRefractiveComputation::RecursiveRefractiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator)
-    : RecursiveComputation(intersection, baseContributor, baseRay, depth, randomGenerator)
+RecursiveRefractiveComputation::RecursiveRefractiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator)
+    : RecursiveComputation(intersection, baseContributor, baseRay, depth, throughput, randomGenerator)
 {
     mIsRayInsideObject = intersection.IsInternalReflection(baseRay);
     mFraction = 0;
 }
 
-RecursiveDielectricComputation::RecursiveDielectricComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator)
-    : RecursiveRefractiveComputation(intersection, baseContributor, baseRay, depth, randomGenerator)
-{ }
+RecursiveDielectricComputation::RecursiveDielectricComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator)
+    : RecursiveRefractiveComputation(intersection, baseContributor, baseRay, depth, throughput, randomGenerator)
+{
+    mAbsorption = mIsRayInsideObject ? GetDielectricPowerAbsorptionParameter() : Vector3f{1.0f, 1.0f, 1.0f};
+}
 
-RecursiveConductorComputation::RecursiveConductorComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator)
-    : RecursiveRefractiveComputation(intersection, baseContributor, baseRay, depth, randomGenerator)
+RecursiveConductorComputation::RecursiveConductorComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator)
+    : RecursiveRefractiveComputation(intersection, baseContributor, baseRay, depth, throughput, randomGenerator)
 { }
 
-RecursiveMirrorComputation::RecursiveMirrorComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator)
-    : RecursiveComputation(intersection, baseContributor, baseRay, depth, randomGenerator)
+RecursiveMirrorComputation::RecursiveMirrorComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator)
+    : RecursiveComputation(intersection, baseContributor, baseRay, depth, throughput, randomGenerator)
 { }
 
 void RecursiveConductorComputation::AddRecursiveComputationToColor(Vector3f &outColor)
@@ -61,11 +65,63 @@ void RecursiveMirrorComputation::AddRecursiveComputationToColor(Vector3f &outCol
 
 void LightContributionCalculator::RecursiveComputation::PerformReflection(Vector3f &outColor)
 {
-    Vector3f mirrorColor{};
-    bool hasIntersection = ComputeMirrorColor(mirrorColor);
+    Vector3f viewerReflectionDirection = GetViewerReflectionDirection();
+    ComputeTiltedGlossyReflectionDirection(viewerReflectionDirection);
+
+    Ray tempRay = Ray(mIntersection.ip + mIntersectionSurfaceNormal * mBaseContributor.GetShadownRayEpsilon(), viewerReflectionDirection, mBaseRay.currMat, mBaseRay.currShape, mBaseRay.time);
+    SetReflectionDifferentials(tempRay);
+    TraceBranch(tempRay, mIntersection.mat->GetMirrorReflectionCoefficient() * GetMirrorCoefficient(), outColor); // Calculate color of the object for the viewer reflection direction ray
+}
+
+void LightContributionCalculator::RecursiveComputation::SetReflectionDifferentials(Ray &branchRay) const
+{
+    if (!mBaseRay.hasDifferentials || !mIntersection.hasDifferentials)
+        return;
+
+    const Vector3f &normal = mIntersectionSurfaceNormal;
+
+    branchRay.rxo = branchRay.o + mIntersection.dpdx;
+    branchRay.ryo = branchRay.o + mIntersection.dpdy;
+    branchRay.rxd = mBaseRay.rxd - normal * (2.0f * Dot(mBaseRay.rxd, normal));
+    branchRay.ryd = mBaseRay.ryd - normal * (2.0f * Dot(mBaseRay.ryd, normal));
+    branchRay.hasDifferentials = true;
+}
+
+bool LightContributionCalculator::RecursiveComputation::TraceBranch(Ray &branchRay, Vector3f branchWeight, Vector3f &outColor, bool addColorOnMiss)
+{
+    float branchThroughput = mThroughput * MaxElement(branchWeight * GetBranchAttenuation());
+    if (branchThroughput <= 0.0f) // Nothing to add
+        return false;
+
+    // Russian roulette, survived branches are scaled to keep the estimate unbiased
+    float minimumThroughput = mBaseContributor.GetMinimumThroughput();
+    if (branchThroughput < minimumThroughput)
+    {
+        float survivalProbability = branchThroughput / minimumThroughput;
+        if (randomGenerator(0, 1) >= survivalProbability)
+            return false;
+
+        branchWeight /= survivalProbability;
+        branchThroughput = minimumThroughput;
+    }
+    // --
+
+    ACTRACER_STATS_INCREMENT(SECONDARY_RAYS, 1);
 
-    if(hasIntersection)
-        outColor = outColor + mirrorColor * mIntersection.mat->GetMirrorReflectionCoefficient() * GetMirrorCoefficient();
+    // Batched renderers trace the branch later, attenuation is folded into the weight
+    if (DeferredRayQueue *deferredRayQueue = mBaseContributor.GetDeferredRayQueue())
+    {
+        deferredRayQueue->QueueBranchRay(branchRay, branchWeight * GetBranchAttenuation(), depth + 1, branchThroughput, addColorOnMiss);
+        return false;
+    }
+
+    Vector3f branchColor{};
+    bool hasIntersection = mBaseContributor.CalculateLight(branchRay, branchColor, depth + 1, 0, 0, branchThroughput);
+
+    if (hasIntersection || addColorOnMiss)
+        outColor = outColor + branchColor * branchWeight;
+
+    return hasIntersection;
 }
 
 float RecursiveMirrorComputation::GetMirrorCoefficient() const
@@ -78,15 +134,9 @@ float RecursiveConductorComputation::GetMirrorCoefficient() const
     return mFraction;
 }
 
-bool LightContributionCalculator::RecursiveComputation::ComputeMirrorColor(Vector3f &mirrorColor)
+Vector3f RecursiveDielectricComputation::GetBranchAttenuation() const
 {
-    Vector3f viewerReflectionDirection = GetViewerReflectionDirection();
-    ComputeTiltedGlossyReflectionDirection(viewerReflectionDirection);
-
-    Ray tempRay = Ray(mIntersection.ip + mIntersectionSurfaceNormal * mBaseContributor.GetShadownRayEpsilon(), viewerReflectionDirection, mBaseRay.currMat, mBaseRay.currShape, mBaseRay.time);
-    bool hasIntersection = mBaseContributor.CalculateLight(tempRay, mirrorColor, depth + 1); // Calculate color of the object for the viewer reflection direction ray
-
-    return hasIntersection;
+    return mAbsorption;
 }
 
 void LightContributionCalculator::RecursiveComputation::ComputeTiltedGlossyReflectionDirection(Vector3f &vrd) const
@@ -130,14 +180,12 @@ void RecursiveDielectricComputation::AddRecursiveComputationToColor(Vector3f &ou
 void RecursiveDielectricComputation::AddDielectricConsumption(Vector3f &outColor)
 {
     Vector3f viewerReflectionDirection = GetViewerReflectionDirection();
-    Vector3f mirrorColor = Vector3f(0.0f, 0.0f, 0.0f);
     Ray tempRay = Ray(mIntersection.ip + mIntersectionSurfaceNormal * mBaseContributor.GetShadownRayEpsilon(), viewerReflectionDirection, mBaseRay.currMat, mBaseRay.currShape, mBaseRay.time);
-    mBaseContributor.CalculateLight(tempRay, mirrorColor, depth + 1); // Calculate color of the object for the viewer reflection direction ray
-
-    outColor = outColor + mirrorColor * mFraction;
+    SetReflectionDifferentials(tempRay);
+    TraceBranch(tempRay, Vector3f{mFraction, mFraction, mFraction}, outColor, true); // Calculate color of the object for the viewer reflection direction ray
 
     if (mIsRayInsideObject)
-        outColor *= GetDielectricPowerAbsorptionParameter();
+        outColor *= mAbsorption;
 }
 
 Vector3f RecursiveDielectricComputation::GetDielectricPowerAbsorptionParameter()
@@ -154,30 +202,41 @@ Vector3f RecursiveDielectricComputation::GetDielectricPowerAbsorptionParameter()
 void RecursiveRefractiveComputation::PerformRefraction(Vector3f& outColor)
 {
     Vector3f tiltedRay{};
-    if (ComputeRefractionParameters(tiltedRay))
+    bool canRefract = ComputeRefractionParameters(tiltedRay);
+    if (!canRefract && mIsRayInsideObject)
+        mFraction = 1;
+
+    if (mBaseContributor.IsFresnelBranchSelectionOn())
+        SelectFresnelBranch();
+
+    if (canRefract)
     {
-        bool intersectsAnObject = false;
-        Vector3f fractionColor{};
+        float refractionWeight = 1 - mFraction;
         if (!mIsRayInsideObject)
         {
             Ray refractionRay = Ray(mIntersection.ip + -mIntersectionSurfaceNormal * mBaseContributor.GetShadownRayEpsilon(), tiltedRay, mIntersection.mat, mIntersection.containerShape, mBaseRay.time);
-            intersectsAnObject = mBaseContributor.CalculateLight(refractionRay, fractionColor, depth + 1);
+            SetRefractionDifferentials(refractionRay);
+            TraceBranch(refractionRay, Vector3f{refractionWeight, refractionWeight, refractionWeight}, outColor);
         }
         else
         {
             Ray refractionRay = Ray(mIntersection.ip + -mIntersectionSurfaceNormal * mBaseContributor.GetShadownRayEpsilon(), tiltedRay, Material::DefaultMaterial, nullptr, mBaseRay.time);
-            intersectsAnObject = mBaseContributor.CalculateLight(refractionRay, fractionColor, depth + 1);
+            SetRefractionDifferentials(refractionRay);
+            TraceBranch(refractionRay, Vector3f{refractionWeight, refractionWeight, refractionWeight}, outColor);
         }
-
-        if (intersectsAnObject)
-            outColor = outColor + fractionColor * (1 - mFraction);
-    }
-    else if (mIsRayInsideObject)
-    {
-        mFraction = 1;
     }
 }
 
+/*
+ * Picks reflection with probability of fresnel fraction and refraction otherwise,
+ * the picked branch gets the full weight and the other one gets zero weight,
+ * so only one branch is traced while the expected color stays the same
+ */
+void RecursiveRefractiveComputation::SelectFresnelBranch()
+{
+    mFraction = randomGenerator(0, 1) < mFraction ? 1.0f : 0.0f;
+}
+
 bool RecursiveRefractiveComputation::ComputeRefractionParameters(Vector3f &tiltedRay)
 {
     float corr;
@@ -187,6 +246,7 @@ bool RecursiveRefractiveComputation::ComputeRefractionParameters(Vector3f &tilte
     float n2 = materialRefractionIndices.second;
 
     float param = n1 / n2;
+    mRefractionIndexRatio = param;
     float cost = 1 - corr * corr;
     float det = 1 - param * param * cost;
 
@@ -200,6 +260,36 @@ bool RecursiveRefractiveComputation::ComputeRefractionParameters(Vector3f &tilte
     return false;
 }
 
+/*
+ * Surface normal is already turned towards the base ray by ComputeFresnel
+ */
+void RecursiveRefractiveComputation::SetRefractionDifferentials(Ray &branchRay) const
+{
+    if (!mBaseRay.hasDifferentials || !mIntersection.hasDifferentials)
+        return;
+
+    const Vector3f &normal = mIntersectionSurfaceNormal;
+    const Vector3f *baseDirections[2] = {&mBaseRay.rxd, &mBaseRay.ryd};
+    Vector3f refractedDirections[2];
+
+    for (int i = 0; i < 2; ++i)
+    {
+        float corr = -Dot(*baseDirections[i], normal);
+        corr = Clamp<float>(corr, -1, 1);
+        float det = 1 - mRefractionIndexRatio * mRefractionIndexRatio * (1 - corr * corr);
+        if (det < 0)
+            return;
+
+        refractedDirections[i] = Normalize((*baseDirections[i] + normal * corr) * mRefractionIndexRatio - normal * std::sqrt(det));
+    }
+
+    branchRay.rxo = branchRay.o + mIntersection.dpdx;
+    branchRay.ryo = branchRay.o + mIntersection.dpdy;
+    branchRay.rxd = refractedDirections[0];
+    branchRay.ryd = refractedDirections[1];
+    branchRay.hasDifferentials = true;
+}
+
 std::pair<float, float> RecursiveRefractiveComputation::ComputeFresnel(float &corr)
 {
     float outsideMatIndex = mBaseRay.currMat->GetRefractionIndex();
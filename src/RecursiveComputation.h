@@ -13,10 +13,10 @@ class Ray;
 class LightContributionCalculator::RecursiveComputation
 {
 public:
-    static RecursiveComputation* CreateRecursiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double>& randomGenerator);
+    static RecursiveComputation* CreateRecursiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double>& randomGenerator);
     virtual void AddRecursiveComputationToColor(Vector3f &outColor) = 0;
 protected:
-    RecursiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double>& randomGenerator);
+    RecursiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double>& randomGenerator);
 protected:
     Vector3f GetViewerReflectionDirection() const;
 protected:
@@ -24,12 +24,28 @@ protected:
      * Fires ray and adds the reflection color into out color
      */ 
     void PerformReflection(Vector3f& outColor);
-    bool ComputeMirrorColor(Vector3f &mirrorColor);
+    /*
+     * Fires the branch ray and adds its color scaled by branchWeight into out color,
+     * branches that carry no energy are pruned and branches whose throughput falls
+     * under the scene's minimum throughput are terminated by russian roulette
+     * Returns true if the branch ray intersects with any primitive,
+     * always false if the branch is deferred to the calculator's ray queue
+     */
+    bool TraceBranch(Ray &branchRay, Vector3f branchWeight, Vector3f &outColor, bool addColorOnMiss = false);
 
     void ComputeTiltedGlossyReflectionDirection(Vector3f &vrd) const;
+    /*
+     * Starts the differentials of the branch ray from the differential hits of the intersection,
+     * their directions are mirrored around the surface normal. Changes of the normal
+     * between the differential hits and glossy tilting are not accounted for
+     */
+    void SetReflectionDifferentials(Ray &branchRay) const;
     virtual float GetMirrorCoefficient() const { return 0; }
+    // Attenuation that is applied to all branches after they are traced
+    virtual Vector3f GetBranchAttenuation() const { return Vector3f{1.0f, 1.0f, 1.0f}; }
 protected:
     float depth;
+    float mThroughput; // Product of the branch weights from the camera up to this point
     Vector3f mIntersectionSurfaceNormal;
 
     Vector3f mPointToViewer;
@@ -43,10 +59,15 @@ protected:
 class RecursiveRefractiveComputation : public LightContributionCalculator::RecursiveComputation
 {
 public:
-    RecursiveRefractiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator);
+    RecursiveRefractiveComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator);
 
 protected:
+    /*
+     * Fires the refraction ray and adds the refraction color into out color,
+     * sets up the fresnel fraction that is used for reflection
+     */
     void PerformRefraction(Vector3f &outColor);
+    void SelectFresnelBranch();
     // Calculates the refraction color and returns if the ray is intersecting from inside to outside
     bool ComputeRefractionParameters(Vector3f &tiltedRay);
     /* 
@@ -57,8 +78,14 @@ protected:
      * Returns the outside and inside materials' refraction index values
      */
     std::pair<float, float> ComputeFresnel(float &corr);
+    /*
+     * Refracts the differentials of the base ray like SetReflectionDifferentials mirrors them,
+     * the branch ray has no differentials if either of them is totally reflected
+     */
+    void SetRefractionDifferentials(Ray &branchRay) const;
 
 protected:
+    float mRefractionIndexRatio = 1; // Outside over inside refraction index, set when the refraction is computed
     float mFraction;
     bool mIsRayInsideObject;
 };
@@ -66,18 +93,22 @@ protected:
 class RecursiveDielectricComputation : public RecursiveRefractiveComputation
 {
 public:
-    RecursiveDielectricComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator);
+    RecursiveDielectricComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator);
 
     virtual void AddRecursiveComputationToColor(Vector3f &outColor) override;
+protected:
+    virtual Vector3f GetBranchAttenuation() const override;
 private:
     void AddDielectricConsumption(Vector3f &outColor);
     Vector3f GetDielectricPowerAbsorptionParameter();
+private:
+    Vector3f mAbsorption;
 };
 
 class RecursiveConductorComputation : public RecursiveRefractiveComputation
 {
 public:
-    RecursiveConductorComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator);
+    RecursiveConductorComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator);
 
     virtual void AddRecursiveComputationToColor(Vector3f &outColor) override;
 
@@ -88,7 +119,7 @@ protected:
 class RecursiveMirrorComputation : public LightContributionCalculator::RecursiveComputation
 {
 public:
-    RecursiveMirrorComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, Random<double> &randomGenerator);
+    RecursiveMirrorComputation(const SurfaceIntersection &intersection, const LightContributionCalculator &baseContributor, Ray &baseRay, float depth, float throughput, Random<double> &randomGenerator);
 
     virtual void AddRecursiveComputationToColor(Vector3f &outColor) override;
 protected:
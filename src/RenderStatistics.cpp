@@ -0,0 +1,131 @@
+#include "RenderStatistics.h"
+
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+
+namespace actracer
+{
+
+namespace
+{
+
+std::mutex totalsMutex;
+uint64_t totalCounters[(int)RenderStatistics::Counter::COUNT] = {};
+std::chrono::steady_clock::duration totalStageTimes[(int)RenderStatistics::Stage::COUNT] = {};
+uint64_t reportedRayCount = 0;
+
+const char *const stageNames[] = {"Ray generation", "Closest hit traversal", "Shadow traversal", "Shading"};
+
+double PerRay(uint64_t count, uint64_t rayCount)
+{
+    return rayCount > 0 ? (double)count / rayCount : 0.0;
+}
+
+}
+
+thread_local RenderStatistics::ThreadCounters RenderStatistics::sThreadCounters;
+
+RenderStatistics::ScopedStage::ScopedStage(Stage stage)
+{
+    ThreadCounters &threadCounters = sThreadCounters;
+    Clock::time_point now = Clock::now();
+
+    threadCounters.AddElapsedTimeToCurrentStage(now);
+    mPreviousStage = threadCounters.currentStage;
+    threadCounters.currentStage = stage;
+    threadCounters.stageStart = now;
+}
+
+RenderStatistics::ScopedStage::~ScopedStage()
+{
+    ThreadCounters &threadCounters = sThreadCounters;
+    Clock::time_point now = Clock::now();
+
+    threadCounters.AddElapsedTimeToCurrentStage(now);
+    threadCounters.currentStage = mPreviousStage;
+    threadCounters.stageStart = now;
+}
+
+RenderStatistics::ThreadCounters::~ThreadCounters()
+{
+    MergeIntoTotals();
+}
+
+void RenderStatistics::ThreadCounters::AddElapsedTimeToCurrentStage(const Clock::time_point &now)
+{
+    if (currentStage != Stage::NONE)
+        stageTimes[(int)currentStage] += now - stageStart;
+}
+
+void RenderStatistics::ThreadCounters::MergeIntoTotals()
+{
+    std::lock_guard<std::mutex> lock(totalsMutex);
+
+    for (int i = 0; i < (int)Counter::COUNT; ++i)
+    {
+        totalCounters[i] += counters[i];
+        counters[i] = 0;
+    }
+
+    for (int i = 0; i < (int)Stage::COUNT; ++i)
+    {
+        totalStageTimes[i] += stageTimes[i];
+        stageTimes[i] = Clock::duration::zero();
+    }
+}
+
+void RenderStatistics::Report(const char *title)
+{
+    // Render threads are merged on exit, the calling thread may have counted too
+    sThreadCounters.MergeIntoTotals();
+
+    std::lock_guard<std::mutex> lock(totalsMutex);
+
+    uint64_t cameraRayCount = totalCounters[(int)Counter::CAMERA_RAYS];
+    uint64_t secondaryRayCount = totalCounters[(int)Counter::SECONDARY_RAYS];
+    uint64_t shadowRayCount = totalCounters[(int)Counter::SHADOW_RAYS];
+    uint64_t rayCount = cameraRayCount + secondaryRayCount + shadowRayCount;
+    uint64_t triangleTestCount = totalCounters[(int)Counter::TRIANGLE_TESTS];
+    uint64_t sphereTestCount = totalCounters[(int)Counter::SPHERE_TESTS];
+
+    std::ostream &out = std::cout;
+    out << "Statistics: " << title << "\n"
+        << std::left << std::fixed << std::setprecision(2)
+        << "  " << std::setw(26) << "Camera rays" << cameraRayCount << "\n"
+        << "  " << std::setw(26) << "Secondary rays" << secondaryRayCount << "\n"
+        << "  " << std::setw(26) << "Shadow rays" << shadowRayCount << "\n"
+        << "  " << std::setw(26) << "Node visits per ray" << PerRay(totalCounters[(int)Counter::NODE_VISITS], rayCount) << "\n"
+        << "  " << std::setw(26) << "Box tests per ray" << PerRay(totalCounters[(int)Counter::BOX_TESTS], rayCount) << "\n"
+        << "  " << std::setw(26) << "Primitive tests per ray" << PerRay(triangleTestCount + sphereTestCount, rayCount)
+        << " (triangles " << PerRay(triangleTestCount, rayCount) << ", spheres " << PerRay(sphereTestCount, rayCount) << ")\n";
+
+    out << "  Time per stage, summed over threads\n";
+    for (int i = 0; i < (int)Stage::COUNT; ++i)
+    {
+        double milliseconds = std::chrono::duration<double, std::milli>(totalStageTimes[i]).count();
+        out << "    " << std::setw(24) << stageNames[i] << milliseconds << " ms\n";
+    }
+
+    out.unsetf(std::ios_base::floatfield);
+    out << std::right << std::setprecision(6);
+
+    reportedRayCount += rayCount;
+
+    for (int i = 0; i < (int)Counter::COUNT; ++i)
+        totalCounters[i] = 0;
+    for (int i = 0; i < (int)Stage::COUNT; ++i)
+        totalStageTimes[i] = Clock::duration::zero();
+}
+
+uint64_t RenderStatistics::TakeReportedRayCount()
+{
+    std::lock_guard<std::mutex> lock(totalsMutex);
+
+    uint64_t rayCount = reportedRayCount;
+    reportedRayCount = 0;
+
+    return rayCount;
+}
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace actracer
+{
+
+/*
+ * Counters and stage timers of the hot paths, only compiled in if ACTRACER_STATS is defined.
+ * Each thread counts into its own storage which is merged into the totals when the thread exits,
+ * so counting does not need synchronization. Use the ACTRACER_STATS_ macros at the bottom
+ * instead of the class so that the calls disappear from regular builds
+ */
+class RenderStatistics
+{
+public:
+    enum class Counter
+    {
+        CAMERA_RAYS,
+        SECONDARY_RAYS, // Reflection/refraction rays
+        SHADOW_RAYS,
+        NODE_VISITS,    // Nodes whose box is hit by a ray, a packet counts once per ray
+        BOX_TESTS,      // Ray-box tests of hierarchy nodes, a packet counts once per ray
+        TRIANGLE_TESTS,
+        SPHERE_TESTS,
+        COUNT
+    };
+
+    enum class Stage
+    {
+        RAY_GENERATION,
+        CLOSEST_HIT_TRAVERSAL, // Camera and secondary rays, surface attributes of the hits included
+        SHADOW_TRAVERSAL,
+        SHADING,
+        COUNT,
+        NONE
+    };
+
+    /*
+     * Adds the time until it is destroyed to the stage,
+     * stages that are entered in its lifetime pause it so that stage times do not overlap
+     */
+    class ScopedStage
+    {
+    public:
+        explicit ScopedStage(Stage stage);
+        ~ScopedStage();
+
+    private:
+        Stage mPreviousStage;
+    };
+
+public:
+    static void Increment(Counter counter, uint64_t amount = 1);
+    /*
+     * Value of the counter of the calling thread, it is reset when the thread reports or exits
+     */
+    static uint64_t GetThreadCounter(Counter counter);
+
+    /*
+     * Prints the counters that are collected since the last report as a table and resets them,
+     * must be called after the threads that render are joined
+     */
+    static void Report(const char *title);
+
+    /*
+     * Sum of the rays of all reports since the last call
+     */
+    static uint64_t TakeReportedRayCount();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct ThreadCounters
+    {
+        uint64_t counters[(int)Counter::COUNT] = {};
+        Clock::duration stageTimes[(int)Stage::COUNT] = {};
+
+        Stage currentStage = Stage::NONE;
+        Clock::time_point stageStart;
+
+        ~ThreadCounters();
+
+        void AddElapsedTimeToCurrentStage(const Clock::time_point &now);
+        void MergeIntoTotals();
+    };
+
+    static thread_local ThreadCounters sThreadCounters;
+};
+
+inline void RenderStatistics::Increment(Counter counter, uint64_t amount)
+{
+    sThreadCounters.counters[(int)counter] += amount;
+}
+
+inline uint64_t RenderStatistics::GetThreadCounter(Counter counter)
+{
+    return sThreadCounters.counters[(int)counter];
+}
+
+}
+
+#if defined(ACTRACER_STATS)
+#define ACTRACER_STATS_INCREMENT(counter, amount) ::actracer::RenderStatistics::Increment(::actracer::RenderStatistics::Counter::counter, amount)
+#define ACTRACER_STATS_STAGE(stage) ::actracer::RenderStatistics::ScopedStage statsScopedStage{::actracer::RenderStatistics::Stage::stage}
+#define ACTRACER_STATS_REPORT(title) ::actracer::RenderStatistics::Report(title)
+#else
+#define ACTRACER_STATS_INCREMENT(counter, amount) ((void)0)
+#define ACTRACER_STATS_STAGE(stage) ((void)0)
+#define ACTRACER_STATS_REPORT(title) ((void)0)
+#endif
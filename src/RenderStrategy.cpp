@@ -1,10 +1,65 @@
 #include "RenderStrategy.h"
+#include "Image.h"
+#include "Scene.h"
+#include "AccelerationStructureFactory.h"
+#include "Primitive.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
 
 namespace actracer
 {
 void RenderStrategy::RetrieveRenderingParamsFromScene(Scene *scene)
 {
-    randomGenerator = Random<double>{};
+}
+
+AccelerationStructure *RenderStrategy::BuildAccelerationStructure(const Scene *scene)
+{
+    TraceScope traceScope{"Build BVH"};
+    std::chrono::high_resolution_clock::time_point startingTime = std::chrono::high_resolution_clock::now();
+
+    const std::vector<Primitive *> &primitives = scene->GetAllPrimitives();
+
+    // Moving primitives are kept apart from the static ones so that rays are not tested against their swept bounds,
+    // the structure the scene asks for is built over the static ones
+    bool hasMovingPrimitives = std::any_of(primitives.begin(), primitives.end(), [](const Primitive *primitive) { return primitive->IsMoving(); });
+    AccelerationStructure::AccelerationStructureAlgorithmCode algorithmCode = hasMovingPrimitives ? AccelerationStructure::AccelerationStructureAlgorithmCode::MOTION_BVH
+                                                                                                  : scene->GetAccelerationStructureCode();
+
+    AccelerationStructure *accelerationStructure = AccelerationStructureFactory::CreateAccelerationStructure(algorithmCode, primitives, scene->GetMaximumReferenceGrowth(),
+                                                                                                             scene->GetAccelerationStructureCode());
+
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    mAccelerationStructureBuildTime = std::chrono::duration_cast<std::chrono::microseconds>(end - startingTime).count() / 1000.0f;
+
+    return accelerationStructure;
+}
+
+void RenderStrategy::RefitAccelerationStructure(AccelerationStructure *accelerationStructure)
+{
+    TraceScope traceScope{"Refit BVH"};
+    std::chrono::high_resolution_clock::time_point startingTime = std::chrono::high_resolution_clock::now();
+
+    int rebuiltBranchCount = accelerationStructure->Refit();
+
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    float refitTime = std::chrono::duration_cast<std::chrono::microseconds>(end - startingTime).count() / 1000.0f;
+    mAccelerationStructureBuildTime += refitTime;
+
+    std::cout << "BVH refit in " << refitTime << " ms, " << rebuiltBranchCount << " branches rebuilt\n";
+}
+
+Color RenderStrategy::ObtainColorFromUnclampedVector(const Vector3f &unclampedColor)
+{
+    // Clamp the raw values between 0 - 255
+    unsigned char colorRed = unclampedColor.x > 255.0f ? 255 : unclampedColor.x;
+    unsigned char colorGreen = unclampedColor.y > 255.0f ? 255 : unclampedColor.y;
+    unsigned char colorBlue = unclampedColor.z > 255.0f ? 255 : unclampedColor.z;
+    // --
+
+    return {colorRed, colorGreen, colorBlue};
 }
 
 }
\ No newline at end of file
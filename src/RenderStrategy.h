@@ -8,21 +8,43 @@ namespace actracer
 
 class Scene;
 class AccelerationStructure;
+union Color;
 
 class RenderStrategy
 {
+public:
+    enum class RenderStrategyCode { DEFAULT, WAVEFRONT };
 public:
     virtual ~RenderStrategy() {}
     virtual void RenderSceneIntoPPM(Scene* scene) = 0;
     RenderStrategy(const AccelerationStructure* accelerator);
+
+    /*
+     * Time spent building the acceleration structure of the last rendered scene
+     * and refitting it to the following frames in milliseconds
+     */
+    float GetAccelerationStructureBuildTime() const;
 protected:
     virtual void RetrieveRenderingParamsFromScene(Scene *scene);
 
+    AccelerationStructure *BuildAccelerationStructure(const Scene *scene);
+    /*
+     * Called after the scene is moved to its next frame, the structure is refit to the moved primitives
+     * instead of being built again
+     */
+    void RefitAccelerationStructure(AccelerationStructure *accelerationStructure);
+
+    static Color ObtainColorFromUnclampedVector(const Vector3f &unclampedColor);
 
     RenderStrategy() {}
-protected:
-    Random<double> randomGenerator;
-    
+
+private:
+    float mAccelerationStructureBuildTime = 0.0f;
 };
 
+inline float RenderStrategy::GetAccelerationStructureBuildTime() const
+{
+    return mAccelerationStructureBuildTime;
+}
+
 } 
@@ -0,0 +1,23 @@
+#include "RenderStrategyFactory.h"
+#include "DefaultRenderer.h"
+#include "WavefrontRenderer.h"
+
+namespace actracer
+{
+
+RenderStrategy *RenderStrategyFactory::CreateRenderStrategy(RenderStrategy::RenderStrategyCode strategyCode)
+{
+    switch (strategyCode)
+    {
+    case RenderStrategy::RenderStrategyCode::DEFAULT:
+        return new DefaultRenderer();
+    case RenderStrategy::RenderStrategyCode::WAVEFRONT:
+        return new WavefrontRenderer();
+    default:
+        break;
+    }
+
+    return nullptr;
+}
+
+}
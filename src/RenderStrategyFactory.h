@@ -0,0 +1,14 @@
+#pragma once
+
+#include "RenderStrategy.h"
+
+namespace actracer
+{
+
+class RenderStrategyFactory
+{
+public:
+    static RenderStrategy *CreateRenderStrategy(RenderStrategy::RenderStrategyCode strategyCode);
+};
+
+}
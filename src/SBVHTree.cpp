@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <iostream>
+
+#include "SBVHTree.h"
+#include "Primitive.h"
+#include "Intersection.h"
+#include "RenderStatistics.h"
+
+namespace actracer
+{
+
+constexpr int SBVHTree::BIN_COUNT;
+constexpr int SBVHTree::MAX_DEPTH;
+constexpr float SBVHTree::SPATIAL_SPLIT_OVERLAP_RATIO;
+
+static BoundingVolume3f Overlap(const BoundingVolume3f &b0, const BoundingVolume3f &b1)
+{
+    BoundingVolume3f overlap;
+    overlap.min = MaxElements(b0.min, b1.min);
+    overlap.max = MinElements(b0.max, b1.max);
+
+    return overlap;
+}
+
+static bool IsEmpty(const BoundingVolume3f &bbox)
+{
+    return bbox.min.x > bbox.max.x || bbox.min.y > bbox.max.y || bbox.min.z > bbox.max.z;
+}
+
+SBVHTree::SBVHTree(int maxPrimitiveCountInLeaf, float maxReferenceGrowth, const std::vector<Primitive *> &prims)
+    : mMaxPrimitiveCountInLeaf(maxPrimitiveCountInLeaf), mMaxReferenceGrowth(maxReferenceGrowth), mRoot(nullptr)
+{
+    primitives = prims;
+
+    Build();
+
+    std::cout << "SBVH built with " << mNodeCount << " nodes, " << mReferenceCount << " references to "
+              << primitives.size() << " primitives, " << mSpatialSplitCount << " spatial splits\n";
+}
+
+SBVHTree::~SBVHTree()
+{
+    Clear(mRoot);
+}
+
+void SBVHTree::Clear(SBVHNode *head)
+{
+    if (!head)
+        return;
+
+    Clear(head->left);
+    Clear(head->right);
+
+    delete head;
+}
+
+void SBVHTree::Build()
+{
+    std::vector<Reference> references;
+    references.reserve(primitives.size());
+
+    BoundingVolume3f rootBbox{};
+    for (Primitive *primitive : primitives)
+    {
+        references.push_back(Reference{primitive, primitive->bbox});
+        rootBbox = Merge(rootBbox, primitive->bbox);
+    }
+
+    mReferencedPrimitives.clear();
+    mRootArea = rootBbox.SA();
+    mReferenceCount = primitives.size();
+    mReferenceBudget = std::max<int>(primitives.size() * mMaxReferenceGrowth, primitives.size());
+    mNodeCount = 0;
+    mSpatialSplitCount = 0;
+
+    mRoot = references.empty() ? nullptr : BuildTree(references, 0);
+}
+
+int SBVHTree::Refit()
+{
+    for (Primitive *primitive : primitives)
+        primitive->UpdateBoundingBox();
+
+    Clear(mRoot);
+    Build();
+
+    return 1;
+}
+
+SBVHTree::SBVHNode *SBVHTree::BuildLeaf(const std::vector<Reference> &references, const BoundingVolume3f &nodeBbox)
+{
+    SBVHNode *node = new SBVHNode{};
+    node->bbox = nodeBbox;
+    node->axis = 0;
+    node->startIndex = mReferencedPrimitives.size();
+
+    for (const Reference &reference : references)
+        mReferencedPrimitives.push_back(reference.primitive);
+
+    node->endIndex = mReferencedPrimitives.size();
+    ++mNodeCount;
+
+    return node;
+}
+
+SBVHTree::SBVHNode *SBVHTree::BuildTree(std::vector<Reference> &references, int depth)
+{
+    int referenceCount = references.size();
+
+    BoundingVolume3f nodeBbox{};
+    for (const Reference &reference : references)
+        nodeBbox = Merge(nodeBbox, reference.bbox);
+
+    float nodeArea = nodeBbox.SA();
+    if (referenceCount <= mMaxPrimitiveCountInLeaf || depth >= MAX_DEPTH || nodeArea <= 0)
+        return BuildLeaf(references, nodeBbox);
+
+    Split split = FindObjectSplit(references, nodeArea);
+
+    // Spatial splits only pay off where the children of the object split overlap, and while the references are in the budget
+    if (mReferenceCount < mReferenceBudget)
+    {
+        BoundingVolume3f overlap = Overlap(split.leftBbox, split.rightBbox);
+        if (split.axis == -1 || (!IsEmpty(overlap) && overlap.SA() > SPATIAL_SPLIT_OVERLAP_RATIO * mRootArea))
+        {
+            Split spatialSplit = FindSpatialSplit(references, nodeBbox, nodeArea);
+            int duplicatedCount = spatialSplit.leftCount + spatialSplit.rightCount - referenceCount;
+
+            if (spatialSplit.cost < split.cost && mReferenceCount + duplicatedCount <= mReferenceBudget)
+                split = spatialSplit;
+        }
+    }
+
+    if (split.axis == -1 || split.cost >= referenceCount)
+        return BuildLeaf(references, nodeBbox);
+
+    std::vector<Reference> leftReferences, rightReferences;
+    if (split.isSpatial)
+        PartitionSpatially(split, references, leftReferences, rightReferences);
+    else
+        PartitionObjects(split, references, leftReferences, rightReferences);
+
+    if (leftReferences.empty() || rightReferences.empty()) // Clipping left one of the sides empty
+        return BuildLeaf(references, nodeBbox);
+
+    mReferenceCount += leftReferences.size() + rightReferences.size() - referenceCount;
+    if (split.isSpatial)
+        ++mSpatialSplitCount;
+
+    std::vector<Reference>().swap(references); // Not needed by the children
+
+    SBVHNode *node = new SBVHNode{};
+    node->bbox = nodeBbox;
+    node->axis = split.axis;
+    ++mNodeCount;
+
+    node->left = BuildTree(leftReferences, depth + 1);
+    node->right = BuildTree(rightReferences, depth + 1);
+
+    return node;
+}
+
+int SBVHTree::GetBinIndex(float position, float binMin, float binExtent)
+{
+    int index = BIN_COUNT * (position - binMin) / binExtent;
+
+    return std::min(std::max(index, 0), BIN_COUNT - 1);
+}
+
+SBVHTree::Split SBVHTree::FindObjectSplit(const std::vector<Reference> &references, float nodeArea) const
+{
+    BoundingVolume3f combinedCenter{}; // Largest extend of the centers
+    for (const Reference &reference : references)
+        combinedCenter = Merge(combinedCenter, (reference.bbox.max + reference.bbox.min) * 0.5f);
+
+    Split split;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float binMin = combinedCenter.min[axis];
+        float binExtent = combinedCenter.max[axis] - binMin;
+        if (binExtent < 0.00000001f)
+            continue;
+
+        BoundingVolume3f binBounds[BIN_COUNT];
+        int binCounts[BIN_COUNT] = {};
+        for (const Reference &reference : references)
+        {
+            int index = GetBinIndex((reference.bbox.max[axis] + reference.bbox.min[axis]) * 0.5f, binMin, binExtent);
+
+            binCounts[index]++;
+            binBounds[index] = Merge(binBounds[index], reference.bbox);
+        }
+
+        float previousCost = split.cost;
+        SweepBins(binBounds, binCounts, binCounts, nodeArea, axis, split);
+
+        if (split.cost < previousCost)
+        {
+            split.binMin = binMin;
+            split.binExtent = binExtent;
+        }
+    }
+
+    return split;
+}
+
+SBVHTree::Split SBVHTree::FindSpatialSplit(const std::vector<Reference> &references, const BoundingVolume3f &nodeBbox, float nodeArea) const
+{
+    Split split;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float binMin = nodeBbox.min[axis];
+        float binExtent = nodeBbox.max[axis] - binMin;
+        if (binExtent < 0.00000001f)
+            continue;
+
+        float binWidth = binExtent / BIN_COUNT;
+
+        BoundingVolume3f binBounds[BIN_COUNT];
+        int entryCounts[BIN_COUNT] = {};
+        int exitCounts[BIN_COUNT] = {};
+        for (const Reference &reference : references)
+        {
+            int firstBin = GetBinIndex(reference.bbox.min[axis], binMin, binExtent);
+            int lastBin = GetBinIndex(reference.bbox.max[axis], binMin, binExtent);
+
+            entryCounts[firstBin]++;
+            exitCounts[lastBin]++;
+
+            if (firstBin == lastBin)
+            {
+                binBounds[firstBin] = Merge(binBounds[firstBin], reference.bbox);
+                continue;
+            }
+
+            for (int i = firstBin; i <= lastBin; ++i)
+            {
+                float slabMin = binMin + i * binWidth;
+                BoundingVolume3f clippedBbox = Overlap(reference.primitive->GetClippedBoundingBox(axis, slabMin, slabMin + binWidth), reference.bbox);
+
+                if (!IsEmpty(clippedBbox))
+                    binBounds[i] = Merge(binBounds[i], clippedBbox);
+            }
+        }
+
+        float previousCost = split.cost;
+        SweepBins(binBounds, entryCounts, exitCounts, nodeArea, axis, split);
+
+        if (split.cost < previousCost)
+        {
+            split.binMin = binMin;
+            split.binExtent = binExtent;
+            split.isSpatial = true;
+        }
+    }
+
+    return split;
+}
+
+void SBVHTree::SweepBins(const BoundingVolume3f *binBounds, const int *entryCounts, const int *exitCounts, float nodeArea, int axis, Split &split)
+{
+    // Bounds and count of the bins on the right of each split, the left side is accumulated while going over the splits
+    BoundingVolume3f rightBounds[BIN_COUNT];
+    int rightCounts[BIN_COUNT];
+    BoundingVolume3f accumulatedBounds{};
+    int rightCount = 0;
+    for (int i = BIN_COUNT - 1; i > 0; --i)
+    {
+        accumulatedBounds = Merge(accumulatedBounds, binBounds[i]);
+        rightCount += exitCounts[i];
+
+        rightBounds[i] = accumulatedBounds;
+        rightCounts[i] = rightCount;
+    }
+
+    BoundingVolume3f leftBounds{};
+    int leftCount = 0;
+    for (int i = 0; i < BIN_COUNT - 1; ++i)
+    {
+        leftBounds = Merge(leftBounds, binBounds[i]);
+        leftCount += entryCounts[i];
+
+        if (leftCount == 0 || rightCounts[i + 1] == 0)
+            continue;
+
+        float cost = 0.125f + (leftCount * leftBounds.SA() + rightCounts[i + 1] * rightBounds[i + 1].SA()) / nodeArea;
+        if (cost < split.cost)
+        {
+            split.cost = cost;
+            split.axis = axis;
+            split.bin = i;
+            split.leftBbox = leftBounds;
+            split.rightBbox = rightBounds[i + 1];
+            split.leftCount = leftCount;
+            split.rightCount = rightCounts[i + 1];
+        }
+    }
+}
+
+void SBVHTree::PartitionObjects(const Split &split, const std::vector<Reference> &references, std::vector<Reference> &left, std::vector<Reference> &right) const
+{
+    for (const Reference &reference : references)
+    {
+        float center = (reference.bbox.max[split.axis] + reference.bbox.min[split.axis]) * 0.5f;
+
+        if (GetBinIndex(center, split.binMin, split.binExtent) <= split.bin)
+            left.push_back(reference);
+        else
+            right.push_back(reference);
+    }
+}
+
+void SBVHTree::PartitionSpatially(const Split &split, const std::vector<Reference> &references, std::vector<Reference> &left, std::vector<Reference> &right) const
+{
+    float plane = split.binMin + (split.bin + 1) * split.binExtent / BIN_COUNT;
+
+    for (const Reference &reference : references)
+    {
+        // Same bins as the reference is counted in while finding the split
+        int firstBin = GetBinIndex(reference.bbox.min[split.axis], split.binMin, split.binExtent);
+        int lastBin = GetBinIndex(reference.bbox.max[split.axis], split.binMin, split.binExtent);
+
+        if (lastBin <= split.bin)
+        {
+            left.push_back(reference);
+            continue;
+        }
+
+        if (firstBin > split.bin)
+        {
+            right.push_back(reference);
+            continue;
+        }
+
+        Reference leftPart{reference.primitive, Overlap(reference.primitive->GetClippedBoundingBox(split.axis, reference.bbox.min[split.axis], plane), reference.bbox)};
+        Reference rightPart{reference.primitive, Overlap(reference.primitive->GetClippedBoundingBox(split.axis, plane, reference.bbox.max[split.axis]), reference.bbox)};
+
+        if (!IsEmpty(leftPart.bbox))
+            left.push_back(leftPart);
+        if (!IsEmpty(rightPart.bbox))
+            right.push_back(rightPart);
+    }
+}
+
+void SBVHTree::IntersectClosestHit(Ray &cameraRay, HitRecord &closestHit, float intersectionTestEpsilon) const
+{
+    if (mRoot)
+        IntersectThroughHierarchy(mRoot, cameraRay, closestHit, intersectionTestEpsilon);
+}
+
+void SBVHTree::IntersectThroughHierarchy(SBVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const
+{
+    float tn, tf;
+    ACTRACER_STATS_INCREMENT(BOX_TESTS, 1);
+    if (!head->bbox.Intersect(r, tn, tf) || tn > hit.t)
+        return;
+
+    ACTRACER_STATS_INCREMENT(NODE_VISITS, 1);
+    if (head->IsLeaf())
+    {
+        for (int i = head->startIndex; i < head->endIndex; ++i)
+        {
+            HitRecord candidate{};
+            mReferencedPrimitives[i]->Intersect(r, candidate, intersectionTestEpsilon);
+
+            // Strictly closer, so the hit does not depend on which of the leaves referencing a primitive is visited first
+            if (candidate.IsValid() && candidate.t > 0 && candidate.t < hit.t)
+            {
+                hit = candidate;
+            }
+        }
+
+        return;
+    }
+
+    if (r.d[head->axis] < 0)
+    {
+        IntersectThroughHierarchy(head->right, r, hit, intersectionTestEpsilon);
+        IntersectThroughHierarchy(head->left, r, hit, intersectionTestEpsilon);
+    }
+    else
+    {
+        IntersectThroughHierarchy(head->left, r, hit, intersectionTestEpsilon);
+        IntersectThroughHierarchy(head->right, r, hit, intersectionTestEpsilon);
+    }
+}
+
+}
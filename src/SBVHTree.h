@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+
+#include "AccelerationStructure.h"
+#include "acmath.h"
+
+namespace actracer
+{
+
+class Primitive;
+class HitRecord;
+
+/*
+ * Hierarchy with spatial splits for the scenes with long and thin triangles whose boxes overlap heavily.
+ * Besides partitioning the primitives, a node may be split with a plane, the primitives crossing the plane
+ * are then referenced from both children with their boxes clipped to the sides of the plane.
+ * Number of the references is bounded by maxReferenceGrowth times the number of the primitives
+ */
+class SBVHTree : public AccelerationStructure
+{
+public:
+    SBVHTree(int maxPrimitiveCountInLeaf, float maxReferenceGrowth, const std::vector<Primitive *> &prims);
+    ~SBVHTree();
+
+    virtual void IntersectClosestHit(Ray &cameraRay, HitRecord &closestHit, float intersectionTestEpsilon) const override;
+    /*
+     * Clipped boxes of the references can not be refit from the primitives, so the whole tree is rebuilt
+     */
+    virtual int Refit() override;
+
+    int GetNodeCount() const;
+    int GetReferenceCount() const;
+    int GetSpatialSplitCount() const;
+
+private:
+    static constexpr int BIN_COUNT = 16; // Number of bins for both the object and the spatial splits
+    static constexpr int MAX_DEPTH = 64;
+    static constexpr float SPATIAL_SPLIT_OVERLAP_RATIO = 1e-5f; // Spatial splits are tried if the children of the object split overlap more than this ratio of the root area
+
+    // A primitive, or the part of it in a box if it is split spatially
+    struct Reference
+    {
+        Primitive *primitive;
+        BoundingVolume3f bbox;
+    };
+
+    struct SBVHNode
+    {
+        SBVHNode *left = nullptr;  // Left child, nullptr for the leaves
+        SBVHNode *right = nullptr; // Right child
+        BoundingVolume3f bbox;
+        int axis; // The axis the node is split upon, can be [0,1,2]
+        int startIndex, endIndex; // The interval of the leaf in the referenced primitives
+
+        bool IsLeaf() const;
+    };
+
+    struct Split
+    {
+        float cost = 1e9;
+        int axis = -1;
+        int bin = -1; // Bins up to and including it are on the left
+        float binMin = 0;    // Start of the binned interval on the axis
+        float binExtent = 0; // Length of the binned interval
+        bool isSpatial = false;
+        BoundingVolume3f leftBbox;
+        BoundingVolume3f rightBbox;
+        int leftCount = 0;
+        int rightCount = 0;
+    };
+
+private:
+    void Build();
+    SBVHNode *BuildTree(std::vector<Reference> &references, int depth);
+    SBVHNode *BuildLeaf(const std::vector<Reference> &references, const BoundingVolume3f &nodeBbox);
+    void Clear(SBVHNode *head);
+
+    /*
+     * Binned SAH over the centers of the reference boxes on each axis
+     */
+    Split FindObjectSplit(const std::vector<Reference> &references, float nodeArea) const;
+    /*
+     * Binned SAH over the planes that cut the node box into equal bins, references are clipped into every bin they cross
+     */
+    Split FindSpatialSplit(const std::vector<Reference> &references, const BoundingVolume3f &nodeBbox, float nodeArea) const;
+    static int GetBinIndex(float position, float binMin, float binExtent);
+    /*
+     * Sweeps the bins for the cheapest plane, a reference is counted on the left from the bin it enters
+     * and on the right up to the bin it exits
+     */
+    static void SweepBins(const BoundingVolume3f *binBounds, const int *entryCounts, const int *exitCounts, float nodeArea, int axis, Split &split);
+
+    void PartitionObjects(const Split &split, const std::vector<Reference> &references, std::vector<Reference> &left, std::vector<Reference> &right) const;
+    /*
+     * References crossing the plane are clipped into both sides
+     */
+    void PartitionSpatially(const Split &split, const std::vector<Reference> &references, std::vector<Reference> &left, std::vector<Reference> &right) const;
+
+    /*
+     * Replaces the hit if a primitive under the node is closer, the child on the side the ray comes from is visited first
+     */
+    void IntersectThroughHierarchy(SBVHNode *head, Ray &r, HitRecord &hit, float intersectionTestEpsilon) const;
+
+private:
+    const int mMaxPrimitiveCountInLeaf;
+    const float mMaxReferenceGrowth;
+
+    SBVHNode *mRoot;
+    std::vector<Primitive *> mReferencedPrimitives; // Primitives of the leaves, a primitive is in as many leaves as it is referenced from
+    float mRootArea;
+    int mReferenceBudget; // Spatial splits are not made once the references would exceed it
+    int mReferenceCount;
+    int mNodeCount;
+    int mSpatialSplitCount;
+};
+
+inline bool SBVHTree::SBVHNode::IsLeaf() const
+{
+    return left == nullptr;
+}
+
+inline int SBVHTree::GetNodeCount() const
+{
+    return mNodeCount;
+}
+
+inline int SBVHTree::GetReferenceCount() const
+{
+    return mReferenceCount;
+}
+
+inline int SBVHTree::GetSpatialSplitCount() const
+{
+    return mSpatialSplitCount;
+}
+
+}
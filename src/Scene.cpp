@@ -31,12 +31,45 @@ int Primitive::id = 0;
 Scene::Scene()
 {
     tmo = nullptr;
+    bgTexture = nullptr;
+    textureCache = nullptr;
+
+    mRenderStrategyCode = RenderStrategy::RenderStrategyCode::DEFAULT;
+    mAccelerationStructureCode = AccelerationStructure::AccelerationStructureAlgorithmCode::BVH;
+    mMaxReferenceGrowth = 1.5f; // Spatial splits may add half as many references as the primitives
 
     sceneRandom = Random<double>{};
 
     maxRecursionDepth = 0; // Default recursion depth
     shadowRayEps = 0.005;  // Default shadow ray epsilon
+    minThroughput = 0;     // Russian roulette is disabled by default
+    fresnelBranchSampleThreshold = 0; // Both fresnel branches are traced by default
+    lightSampleCount = 0;  // All lights are processed on every hit by default
     intTestEps = 0.0001;
+    frameCount = 1;        // Only the scene as it is parsed is rendered by default
+    currentFrameIndex = 0;
+}
+
+void Scene::AdvanceFrame()
+{
+    ++currentFrameIndex;
+
+    for (const FrameAnimation &frameAnimation : frameAnimations)
+        frameAnimation.shape->SetTransformation(frameAnimation.frameTransform);
+
+    for (Camera *camera : cameras)
+        camera->SetFrameIndex(currentFrameIndex);
+}
+
+bool Scene::IsAnimated(const Shape *shape) const
+{
+    for (const FrameAnimation &frameAnimation : frameAnimations)
+    {
+        if (frameAnimation.shape == shape)
+            return true;
+    }
+
+    return false;
 }
 
 Shape* Scene::GetMeshWithID(int id)
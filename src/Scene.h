@@ -11,6 +11,8 @@
 #include "acmath.h"
 #include "Shape.h"
 #include "Random.h"
+#include "RenderStrategy.h"
+#include "AccelerationStructure.h"
 
 #include <unordered_map>
 
@@ -26,6 +28,7 @@ class Primitive;
 class BVHTree;
 class Tonemapper;
 class BRDFBase;
+class TextureCache;
 union Color;
 
 class Scene {
@@ -33,6 +36,9 @@ friend class SceneParser;
 
 private:
     RenderStrategy* mRenderStrategy;
+    RenderStrategy::RenderStrategyCode mRenderStrategyCode;
+    AccelerationStructure::AccelerationStructureAlgorithmCode mAccelerationStructureCode; // Scenes with moving primitives use it for the static primitives of the motion BVH
+    float mMaxReferenceGrowth; // Bound of the references to the primitives of the SBVH
 
 private:
     Tonemapper *tmo;
@@ -56,6 +62,9 @@ private:
     int maxRecursionDepth; // Maximum recursion depth
     float intTestEps;          // IntersectionTestEpsilon
     float shadowRayEps;        // ShadowRayEpsilon
+    float minThroughput;       // MinimumThroughput
+    int fresnelBranchSampleThreshold; // FresnelBranchSelectionThreshold
+    int lightSampleCount;      // LightSampleCount
     Vector3f backgroundColor;  // Background color
     Vector3f ambientLight;     // Ambient light radiance
 
@@ -74,8 +83,22 @@ private:
     std::vector<Translation *> translations;
     std::vector<Transformation*> transformations; // All transformations in the scene
 
+    /*
+     * Transformation of an animated shape that is applied once more on every frame
+     */
+    struct FrameAnimation
+    {
+        Shape *shape;
+        Transform *frameTransform;
+    };
+
+    int frameCount;        // Number of frames rendered in sequence, FrameCount
+    int currentFrameIndex;
+    std::vector<FrameAnimation> frameAnimations;
+
     std::vector<std::string> imagePaths;
     std::vector<Texture *> textures;
+    TextureCache *textureCache; // Image textures are decoded on first access if it is set
 public:
     Scene();
 public:
@@ -83,24 +106,59 @@ public:
     const std::vector<Primitive*>& GetAllPrimitives() const;
     const std::vector<Light*>& GetAllLights() const;
     
+    RenderStrategy::RenderStrategyCode GetRenderStrategyCode() const;
+    AccelerationStructure::AccelerationStructureAlgorithmCode GetAccelerationStructureCode() const;
+    float GetMaximumReferenceGrowth() const;
     const Tonemapper* GetTonemapper() const;
+    TextureCache *GetTextureCache() const;
     const Texture* GetBackgroundTexture() const;
 
     int GetMaximumRecursionDepth() const;
     float GetIntersectionTestEpsilon() const;
     float GetShadowRayEpsilon() const;
+    float GetMinimumThroughput() const;
+    int GetFresnelBranchSelectionThreshold() const;
+    int GetLightSampleCount() const;
     Vector3f GetBackgroundColor() const;
     Vector3f GetAmbientColor() const;
+    int GetFrameCount() const;
+
+    /*
+     * Moves the animated shapes to the next frame and names the images of the cameras after it,
+     * primitives are left to the acceleration structure to be refit
+     */
+    void AdvanceFrame();
 
 private:
     Shape *GetMeshWithID(int id);
+    bool IsAnimated(const Shape *shape) const;
 };
 
+inline RenderStrategy::RenderStrategyCode Scene::GetRenderStrategyCode() const
+{
+    return mRenderStrategyCode;
+}
+
+inline AccelerationStructure::AccelerationStructureAlgorithmCode Scene::GetAccelerationStructureCode() const
+{
+    return mAccelerationStructureCode;
+}
+
+inline float Scene::GetMaximumReferenceGrowth() const
+{
+    return mMaxReferenceGrowth;
+}
+
 inline const Tonemapper *Scene::GetTonemapper() const
 {
     return tmo;
 }
 
+inline TextureCache *Scene::GetTextureCache() const
+{
+    return textureCache;
+}
+
 inline const Texture *Scene::GetBackgroundTexture() const
 {
     return bgTexture;
@@ -136,6 +194,21 @@ inline float Scene::GetShadowRayEpsilon() const
     return shadowRayEps;
 }
 
+inline float Scene::GetMinimumThroughput() const
+{
+    return minThroughput;
+}
+
+inline int Scene::GetFresnelBranchSelectionThreshold() const
+{
+    return fresnelBranchSampleThreshold;
+}
+
+inline int Scene::GetLightSampleCount() const
+{
+    return lightSampleCount;
+}
+
 inline Vector3f Scene::GetBackgroundColor() const
 {
     return backgroundColor;
@@ -146,6 +219,11 @@ inline Vector3f Scene::GetAmbientColor() const
     return ambientLight;
 }
 
+inline int Scene::GetFrameCount() const
+{
+    return frameCount;
+}
+
 }
 
 
@@ -12,6 +12,7 @@
 #include "ImageTextureImpl.h"
 
 #include "TextureReader.h"
+#include "TextureCache.h"
 
 #include "NormalChangerTexture.h"
 #include "ColorChangerTexture.h"
@@ -24,6 +25,11 @@
 #include "Primitive.h"
 
 #include "Light.h"
+#include "Tracer.h"
+
+#include <atomic>
+#include <functional>
+#include <thread>
 
 
 using namespace tinyxml2; 
@@ -31,6 +37,174 @@ using namespace tinyxml2;
 namespace actracer
 {
 
+namespace
+{
+
+struct ImageTextureLoadTask
+{
+	Texture *texture;
+	std::string imagePath;
+	float bumpFactor;
+	int normalizer;
+	ImageType imageType;
+	InterpolationMethodCode interpolationMethod;
+	TextureCache *textureCache; // Only the size of the image is read if it is set
+};
+
+/*
+ * What is read from the element of a mesh, the mesh is built from it by BuildMesh
+ */
+struct MeshLoadTask
+{
+	int id;
+	Material *material;
+	Shape::ShadingMode shadingMode = Shape::ShadingMode::DEFAULT;
+	bool smoothsTangents = false; // Vertex tangents are averaged for the normal changer textures, smooth meshes only
+	Vector3f motionBlur;
+	Transform *objTransform;
+	Transform *frameTransform = nullptr; // Applied once more on every frame if the mesh is animated
+	const char *faceText = nullptr; // Faces in the XML, used if there is no plyPath
+	std::string plyPath;
+	int vertexOffset = 0;
+	int textureOffset = 0;
+	ColorChangerTexture *colorChanger = nullptr;
+	NormalChangerTexture *normalChanger = nullptr;
+
+	Mesh *mesh = nullptr; // Built mesh, its triangles are not added to the primitives yet
+};
+
+/*
+ * Runs task(0) ... task(taskCount - 1) on the hardware threads, the calling thread takes tasks too
+ */
+void RunInParallel(int taskCount, const std::function<void(int)> &task)
+{
+	std::atomic<int> nextTaskIndex{0};
+	auto runTasks = [&]() {
+		for (int taskIndex = nextTaskIndex++; taskIndex < taskCount; taskIndex = nextTaskIndex++)
+			task(taskIndex);
+	};
+
+	int threadCount = std::min<int>(std::max(1u, std::thread::hardware_concurrency()), taskCount);
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < threadCount; ++i)
+		threads.emplace_back(runTasks);
+
+	runTasks();
+
+	for (std::thread &th : threads)
+		th.join();
+}
+
+void LoadImageTexture(const ImageTextureLoadTask &task)
+{
+	TraceScope traceScope{"Decode texture"};
+	task.texture->SetupImageTexture(task.imagePath, task.bumpFactor, task.normalizer, task.imageType, task.interpolationMethod, task.textureCache);
+}
+
+/*
+ * Reads the faces from the XML text or the PLY file and builds the mesh,
+ * vertices and vertexCoords of the scene are only read
+ */
+void BuildMesh(MeshLoadTask &task, std::vector<Vector3f> &vertices, std::vector<Vector2f> &vertexCoords)
+{
+	std::vector<std::pair<int, Material *>> faces;
+	std::vector<Vector3f *> meshIndices;
+	std::vector<Vector2f *> meshUVs;
+	std::vector<Vector3f> vertexPos; // Positions read from the PLY file, the mesh copies them
+
+	if (task.faceText == nullptr)
+	{
+		TraceScope traceScope{"Load PLY", task.id};
+
+		happly::PLYData plyIn(task.plyPath);
+		std::vector<std::array<double, 3>> vPos = plyIn.getVertexPositions();
+		std::vector<std::vector<size_t>> fInd = plyIn.getFaceIndices<size_t>();
+
+		for (const std::array<double, 3> &a : vPos)
+		{
+			vertexPos.push_back(Vector3f(a[0], a[1], a[2]));
+		}
+
+		for (const std::vector<size_t> &v : fInd)
+		{
+			if (v.size() == 4)
+			{
+				faces.push_back(std::make_pair(-1, task.material));
+				faces.push_back(std::make_pair(-1, task.material));
+				meshIndices.push_back(&(vertexPos[v[0]]));
+				meshIndices.push_back(&(vertexPos[v[1]]));
+				meshIndices.push_back(&(vertexPos[v[2]]));
+				meshIndices.push_back(&(vertexPos[v[2]]));
+				meshIndices.push_back(&(vertexPos[v[3]]));
+				meshIndices.push_back(&(vertexPos[v[0]]));
+
+				for (int i = 0; i < 6; ++i)
+					meshUVs.push_back(&(vertexCoords[0]));
+			}
+			else if (v.size() == 3)
+			{
+				for (int i = 0; i < 3; ++i)
+				{
+					meshIndices.push_back(&(vertexPos[v[i]]));
+					meshUVs.push_back(&(vertexCoords[0]));
+				}
+				faces.push_back(std::make_pair(-1, task.material));
+			}
+		}
+	}
+	else
+	{
+		const char *str = task.faceText;
+		int cursor = 0;
+		int p1Index, p2Index, p3Index;
+
+		while (str[cursor] == ' ' || str[cursor] == '\t' || str[cursor] == '\n')
+			cursor++;
+		while (str[cursor] != '\0')
+		{
+			for (int cnt = 0; cnt < 3; cnt++)
+			{
+				if (cnt == 0)
+					p1Index = atoi(str + cursor);
+				else if (cnt == 1)
+					p2Index = atoi(str + cursor);
+				else
+					p3Index = atoi(str + cursor);
+				while (str[cursor] != ' ' && str[cursor] != '\t' && str[cursor] != '\n')
+					cursor++;
+				while (str[cursor] == ' ' || str[cursor] == '\t' || str[cursor] == '\n')
+					cursor++;
+			}
+			faces.push_back(std::make_pair(-1, task.material));
+
+			meshIndices.push_back(&(vertices[p1Index - 1 + task.vertexOffset]));
+			meshIndices.push_back(&(vertices[p2Index - 1 + task.vertexOffset]));
+			meshIndices.push_back(&(vertices[p3Index - 1 + task.vertexOffset]));
+
+			if (vertexCoords.size() == 1)
+			{
+				meshUVs.push_back(&(vertexCoords[0]));
+				meshUVs.push_back(&(vertexCoords[0]));
+				meshUVs.push_back(&(vertexCoords[0]));
+			}
+			else
+			{
+				meshUVs.push_back(&(vertexCoords[p1Index - 1 + task.textureOffset]));
+				meshUVs.push_back(&(vertexCoords[p2Index - 1 + task.textureOffset]));
+				meshUVs.push_back(&(vertexCoords[p3Index - 1 + task.textureOffset]));
+			}
+		}
+	}
+
+	task.mesh = new Mesh(task.id, task.material, faces, &meshIndices, &meshUVs, task.objTransform, task.shadingMode);
+
+	if (task.smoothsTangents)
+		task.mesh->SmoothTangents();
+}
+
+}
+
 /*
  * TODO: Refactor method
  * Decompose into multiple functions that are responsible for
@@ -39,6 +213,8 @@ namespace actracer
  */ 
 Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 {
+	TraceScope traceScope{"Parse scene"};
+
 	Scene* scene = new Scene();
 
 	const char *str;
@@ -56,6 +232,26 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 
 	XMLNode *pRoot = xmlDoc.FirstChild();
 
+	// Renderer
+	pElement = pRoot->FirstChildElement("Renderer");
+	if (pElement != nullptr)
+	{
+		str = pElement->GetText();
+		if (strcmp(str, "wavefront") == 0)
+			scene->mRenderStrategyCode = RenderStrategy::RenderStrategyCode::WAVEFRONT;
+	}
+
+	// Acceleration structure, spatial splits duplicate the references up to maxReferenceGrowth times the primitives
+	pElement = pRoot->FirstChildElement("AccelerationStructure");
+	if (pElement != nullptr)
+	{
+		str = pElement->GetText();
+		if (strcmp(str, "sbvh") == 0)
+			scene->mAccelerationStructureCode = AccelerationStructure::AccelerationStructureAlgorithmCode::SBVH;
+
+		pElement->QueryFloatAttribute("maxReferenceGrowth", &scene->mMaxReferenceGrowth);
+	}
+
 	// Recursion depth
 	pElement = pRoot->FirstChildElement("MaxRecursionDepth");
 	if (pElement != nullptr)
@@ -73,11 +269,47 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 	if (pElement != nullptr)
 		pElement->QueryFloatText(&scene->shadowRayEps);
 
+	// Minimum throughput for recursive branches
+	pElement = pRoot->FirstChildElement("MinimumThroughput");
+	if (pElement != nullptr)
+		pElement->QueryFloatText(&scene->minThroughput);
+
+	// Cameras with more samples than the threshold trace one fresnel branch per hit
+	pElement = pRoot->FirstChildElement("FresnelBranchSelectionThreshold");
+	if (pElement != nullptr)
+		pElement->QueryIntText(&scene->fresnelBranchSampleThreshold);
+
+	// Number of lights that are selected through the light hierarchy per hit
+	pElement = pRoot->FirstChildElement("LightSampleCount");
+	if (pElement != nullptr)
+		pElement->QueryIntText(&scene->lightSampleCount);
+
 	// Intersection epsilon
 	pElement = pRoot->FirstChildElement("intersectionTestEpsilon");
 	if (pElement != nullptr)
 		eResult = pElement->QueryFloatText(&scene->intTestEps);
 
+	// Image textures are loaded lazily into a cache of the given size in megabytes
+	pElement = pRoot->FirstChildElement("TextureCacheBudget");
+	if (pElement != nullptr)
+	{
+		float textureCacheBudget = 0;
+		pElement->QueryFloatText(&textureCacheBudget);
+		if (textureCacheBudget > 0)
+			scene->textureCache = new TextureCache(textureCacheBudget * 1024 * 1024);
+	}
+
+	// Static meshes and triangles are baked into world space after they are parsed
+	bool bakeStaticGeometry = false;
+	pElement = pRoot->FirstChildElement("BakeStaticGeometry");
+	if (pElement != nullptr)
+		pElement->QueryBoolText(&bakeStaticGeometry);
+
+	// Frames rendered in sequence, shapes with frame transformations are moved between them
+	pElement = pRoot->FirstChildElement("FrameCount");
+	if (pElement != nullptr)
+		pElement->QueryIntText(&scene->frameCount);
+
 	// Parse cameras
 	pElement = pRoot->FirstChildElement("Cameras");
 	XMLElement *pCamera = pElement->FirstChildElement("Camera");
@@ -180,7 +412,25 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 			scene->tmo = new Tonemapper(key, burn, saturation, gamma);
 		}
 
-		scene->cameras.push_back(new Camera(id, imageName, pos, gaze, up, imgPlane, numSamples, PixelSampleMethod::JITTERED, focalDistance, apertureSize));
+		Camera *camera = new Camera(id, imageName, pos, gaze, up, imgPlane, numSamples, PixelSampleMethod::JITTERED, focalDistance, apertureSize);
+
+		// Per pixel cost image, one of nodevisits, primitivetests, time
+		camElement = pCamera->FirstChildElement("CostHeatmap");
+		if (camElement != nullptr)
+		{
+			str = camElement->GetText();
+			if (strcmp(str, "nodevisits") == 0)
+				camera->SetCostHeatmapMetric(CostHeatmapMetric::NODE_VISITS);
+			else if (strcmp(str, "primitivetests") == 0)
+				camera->SetCostHeatmapMetric(CostHeatmapMetric::PRIMITIVE_TESTS);
+			else if (strcmp(str, "time") == 0)
+				camera->SetCostHeatmapMetric(CostHeatmapMetric::TIME);
+		}
+
+		if (scene->frameCount > 1)
+			camera->SetFrameIndex(0);
+
+		scene->cameras.push_back(camera);
 
 		pCamera = pCamera->NextSiblingElement("Camera");
 	}
@@ -439,6 +689,8 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 
 	pElement = pRoot->FirstChildElement("Textures");
 
+	std::vector<ImageTextureLoadTask> imageTextureLoadTasks;
+	bool usesRayDifferentials = false; // Mip levels are selected by the footprint of the rays
 	if (pElement != nullptr)
 	{
 		XMLElement *textureElement = pElement->FirstChildElement("Images");
@@ -573,6 +825,11 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 								itype == InterpolationMethodCode::BILINEAR;
 							else if (strcmp(attrType, "nearest") == 0)
 								itype == InterpolationMethodCode::NEAREST;
+							else if (strcmp(attrType, "trilinear") == 0)
+							{
+								itype = InterpolationMethodCode::TRILINEAR;
+								usesRayDifferentials = true;
+							}
 						}
 					}
 
@@ -581,7 +838,8 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 					else
 						imType = ImageType::PNG;
 
-					createdTexture->SetupImageTexture(scene->imagePaths[imageID - 1], bumpFactor, normalizer, imType, itype);
+					// Decoded later together with the meshes
+					imageTextureLoadTasks.push_back(ImageTextureLoadTask{createdTexture, scene->imagePaths[imageID - 1], bumpFactor, normalizer, imType, itype, scene->textureCache});
 				}
 
 				scene->textures.push_back(createdTexture);
@@ -594,8 +852,14 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 		}
 	}
 
+	if (usesRayDifferentials)
+	{
+		for (Camera *camera : scene->cameras)
+			camera->SetGeneratesRayDifferentials(true);
+	}
+
 	pElement = pRoot->FirstChildElement("Transformations");
-	XMLElement *pTransformation;
+	XMLElement *pTransformation = nullptr;
 	if (pElement != nullptr)
 		pTransformation = pElement->FirstChildElement("Scaling");
 	while (pTransformation != nullptr)
@@ -789,6 +1053,10 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 
 		scene->objects.back()->SetTextures(colorChanger, normalChanger);
 
+		objElement = pObject->FirstChildElement("FrameTransformations");
+		if (objElement != nullptr)
+			scene->frameAnimations.push_back({scene->objects.back(), CreateFrameTransform(scene, objElement->GetText())});
+
 		pObject = pObject->NextSiblingElement("Sphere");
 	}
 
@@ -857,58 +1125,43 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 		}
 
 		scene->objects.push_back(new Triangle(id, scene->materials[matIndex - 1], scene->vertices[p1Index - 1], scene->vertices[p2Index - 1], scene->vertices[p3Index - 1],
-											  scene->vertexCoords[p1Index - 1], scene->vertexCoords[p2Index - 1], scene->vertexCoords[p3Index - 1], nullptr));
+											  scene->vertexCoords[p1Index - 1], scene->vertexCoords[p2Index - 1], scene->vertexCoords[p3Index - 1], objTransform));
 		scene->primitives.push_back(new Primitive(scene->objects.back(), scene->objects.back()->GetMaterial()));
 
 		scene->objects.back()->SetTextures(colorChanger, normalChanger);
 
+		objElement = pObject->FirstChildElement("FrameTransformations");
+		if (objElement != nullptr)
+			scene->frameAnimations.push_back({scene->objects.back(), CreateFrameTransform(scene, objElement->GetText())});
+
 		pObject = pObject->NextSiblingElement("Triangle");
 	}
 
-	// Parse meshes
+	// Parse meshes, faces are read and meshes are built later by the loading tasks
+	std::vector<MeshLoadTask> meshLoadTasks;
 	pObject = pElement->FirstChildElement("Mesh");
-	// pObject = nullptr;
 	while (pObject != nullptr)
 	{
-		enum FileType
-		{
-			DEFAULT,
-			PLY
-		};
-
-		Vector3f motBlur{};
-		FileType fType = FileType::DEFAULT;
-		Shape::ShadingMode sMode = Shape::ShadingMode::DEFAULT;
-		int id;
+		MeshLoadTask task{};
 		int matIndex;
-		int p1Index;
-		int p2Index;
-		int p3Index;
-		int cursor = 0;
-		int vertexOffset = 0;
-		int textureOffset = 0;
-		std::vector<std::pair<int, Material *>> faces;
-		std::vector<Vector3f *> *meshIndices = new std::vector<Vector3f *>;
-		std::vector<Vector2f *> *meshUVs = new std::vector<Vector2f *>;
-		std::vector<Texture *> texs;
-		ColorChangerTexture *colorChanger = nullptr;
-		NormalChangerTexture *normalChanger = nullptr;
 		glm::mat4 dummy = glm::mat4(1);
-		Transform *objTransform = new Transform(dummy);
+		task.objTransform = new Transform(dummy);
 
 		const char *attr = pObject->Attribute("shadingMode");
 		if (attr != nullptr && strcmp(attr, "smooth") == 0)
-			sMode = Shape::ShadingMode::SMOOTH;
+			task.shadingMode = Shape::ShadingMode::SMOOTH;
+		pObject->QueryBoolAttribute("smoothTangents", &task.smoothsTangents);
 
-		eResult = pObject->QueryIntAttribute("id", &id);
+		eResult = pObject->QueryIntAttribute("id", &task.id);
 		objElement = pObject->FirstChildElement("Material");
 		eResult = objElement->QueryIntText(&matIndex);
+		task.material = scene->materials[matIndex - 1];
 
 		objElement = pObject->FirstChildElement("MotionBlur");
 		if (objElement != nullptr)
 		{
 			str = objElement->GetText();
-			sscanf(str, "%f %f %f", &motBlur.x, &motBlur.y, &motBlur.z);
+			sscanf(str, "%f %f %f", &task.motionBlur.x, &task.motionBlur.y, &task.motionBlur.z);
 		}
 
 		objElement = pObject->FirstChildElement("Transformations");
@@ -916,119 +1169,25 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 		{
 			str = objElement->GetText();
 			const char *ch = str;
-			ComputeTransformMatrix(scene, ch, *objTransform);
+			ComputeTransformMatrix(scene, ch, *task.objTransform);
 		}
 
+		objElement = pObject->FirstChildElement("FrameTransformations");
+		if (objElement != nullptr)
+			task.frameTransform = CreateFrameTransform(scene, objElement->GetText());
+
 		objElement = pObject->FirstChildElement("Faces");
-		objElement->QueryIntAttribute("vertexOffset", &vertexOffset);
-		objElement->QueryIntAttribute("textureOffset", &textureOffset);
+		objElement->QueryIntAttribute("vertexOffset", &task.vertexOffset);
+		objElement->QueryIntAttribute("textureOffset", &task.textureOffset);
 
 		attr = objElement->Attribute("plyFile");
 		if (attr != nullptr)
-			fType = FileType::PLY;
-
-		switch (fType)
-		{
-		case FileType::DEFAULT:
 		{
-			str = objElement->GetText();
-			while (str[cursor] == ' ' || str[cursor] == '\t' || str[cursor] == '\n')
-				cursor++;
-			while (str[cursor] != '\0')
-			{
-				for (int cnt = 0; cnt < 3; cnt++)
-				{
-					if (cnt == 0)
-						p1Index = atoi(str + cursor);
-					else if (cnt == 1)
-						p2Index = atoi(str + cursor);
-					else
-						p3Index = atoi(str + cursor);
-					while (str[cursor] != ' ' && str[cursor] != '\t' && str[cursor] != '\n')
-						cursor++;
-					while (str[cursor] == ' ' || str[cursor] == '\t' || str[cursor] == '\n')
-						cursor++;
-				}
-				faces.push_back(std::make_pair(-1, scene->materials[matIndex - 1]));
-
-				meshIndices->push_back(&(scene->vertices[p1Index - 1 + vertexOffset]));
-				meshIndices->push_back(&(scene->vertices[p2Index - 1 + vertexOffset]));
-				meshIndices->push_back(&(scene->vertices[p3Index - 1 + vertexOffset]));
-
-				if (scene->vertexCoords.size() == 1)
-				{
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-				}
-				else
-				{
-					meshUVs->push_back(&(scene->vertexCoords[p1Index - 1 + textureOffset]));
-					meshUVs->push_back(&(scene->vertexCoords[p2Index - 1 + textureOffset]));
-					meshUVs->push_back(&(scene->vertexCoords[p3Index - 1 + textureOffset]));
-				}
-			}
-
-			scene->objects.push_back(new Mesh(id, scene->materials[matIndex - 1], faces, meshIndices, meshUVs, scene->primitives, objTransform, sMode));
-		}
-		break;
-		case FileType::PLY:
-		{
-			std::string resLoc("scenes/");
-
-			resLoc += std::string(attr);
-
-			std::cout << "Reading from path: " << resLoc << "\n";
-			//system("pause");
-			happly::PLYData plyIn(resLoc);
-			std::vector<std::array<double, 3>> vPos = plyIn.getVertexPositions();
-			std::vector<std::vector<size_t>> fInd = plyIn.getFaceIndices<size_t>();
-
-			std::vector<Vector3f> vertexPos;
-			for (const std::array<double, 3> &a : vPos)
-			{
-				vertexPos.push_back(Vector3f(a[0], a[1], a[2]));
-			}
-
-			for (const std::vector<size_t> &v : fInd)
-			{
-				if (v.size() == 4)
-				{
-					faces.push_back(std::make_pair(-1, scene->materials[matIndex - 1]));
-					faces.push_back(std::make_pair(-1, scene->materials[matIndex - 1]));
-					meshIndices->push_back(&(vertexPos[v[0]]));
-					meshIndices->push_back(&(vertexPos[v[1]]));
-					meshIndices->push_back(&(vertexPos[v[2]]));
-					meshIndices->push_back(&(vertexPos[v[2]]));
-					meshIndices->push_back(&(vertexPos[v[3]]));
-					meshIndices->push_back(&(vertexPos[v[0]]));
-
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-					meshUVs->push_back(&(scene->vertexCoords[0]));
-				}
-				else if (v.size() == 3)
-				{
-					for (int i = 0; i < 3; ++i)
-					{
-
-						meshIndices->push_back(&(vertexPos[v[i]]));
-						meshUVs->push_back(&(scene->vertexCoords[0]));
-					}
-					faces.push_back(std::make_pair(-1, scene->materials[matIndex - 1]));
-				}
-			}
-
-			scene->objects.push_back(new Mesh(id, scene->materials[matIndex - 1], faces, meshIndices, meshUVs, scene->primitives, objTransform, sMode));
-		}
-		break;
-
-		default:
-			std::cout << "Invalid file type\n";
+			task.plyPath = std::string("scenes/") + attr;
+			std::cout << "Reading from path: " << task.plyPath << "\n";
 		}
+		else
+			task.faceText = objElement->GetText();
 
 		objElement = pObject->FirstChildElement("Textures");
 		if (objElement != nullptr)
@@ -1056,20 +1215,39 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 				ColorChangerTexture *colorPart = dynamic_cast<ColorChangerTexture *>(tex);
 
 				if (normalPart)
-					normalChanger = normalPart;
+					task.normalChanger = normalPart;
 				else if (colorPart)
-					colorChanger = colorPart;
+					task.colorChanger = colorPart;
 			}
 		}
 
-		scene->objects.back()->SetMotionBlur(motBlur, scene->primitives);
-		scene->objects.back()->SetTextures(colorChanger, normalChanger);
-		meshIndices->erase(meshIndices->begin(), meshIndices->end());
-		meshIndices->clear();
+		meshLoadTasks.push_back(task);
 
 		pObject = pObject->NextSiblingElement("Mesh");
 	}
 
+	// Images and meshes do not depend on each other, they are loaded together
+	int imageTextureLoadTaskCount = imageTextureLoadTasks.size();
+	int loadTaskCount = imageTextureLoadTaskCount + meshLoadTasks.size();
+	RunInParallel(loadTaskCount, [&](int taskIndex) {
+		if (taskIndex < imageTextureLoadTaskCount)
+			LoadImageTexture(imageTextureLoadTasks[taskIndex]);
+		else
+			BuildMesh(meshLoadTasks[taskIndex - imageTextureLoadTaskCount], scene->vertices, scene->vertexCoords);
+	});
+
+	// Merged in file order so that objects and primitives are ordered and numbered as in a sequential load
+	for (MeshLoadTask &task : meshLoadTasks)
+	{
+		scene->objects.push_back(task.mesh);
+		task.mesh->AddTrianglePrimitives(scene->primitives);
+		task.mesh->SetMotionBlur(task.motionBlur, scene->primitives);
+		task.mesh->SetTextures(task.colorChanger, task.normalChanger);
+
+		if (task.frameTransform)
+			scene->frameAnimations.push_back({task.mesh, task.frameTransform});
+	}
+
 	std::cout << "Read all meshes\n";
 	// Parse mesh instances
 	pObject = pElement->FirstChildElement("MeshInstance");
@@ -1095,7 +1273,7 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 
 		Shape *soughtMesh = scene->GetMeshWithID(baseMeshID);
 
-		Shape *newMesh = soughtMesh->Clone(resetTransform);
+		Mesh *newMesh = static_cast<Mesh *>(soughtMesh->Clone(resetTransform));
 
 		int matIndex;
 
@@ -1122,12 +1300,28 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 
 		newMesh->SetTransformation(objTransform);
 		newMesh->SetMotionBlur(motBlur, scene->primitives);
+		newMesh->AddTrianglePrimitives(scene->primitives);
 
 		scene->objects.push_back(newMesh);
 
+		objElement = pObject->FirstChildElement("FrameTransformations");
+		if (objElement != nullptr)
+			scene->frameAnimations.push_back({newMesh, CreateFrameTransform(scene, objElement->GetText())});
+
 		pObject = pObject->NextSiblingElement("MeshInstance");
 	}
 
+	// Instances are cloned from the base meshes, so nothing is baked before all of them are transformed
+	if (bakeStaticGeometry)
+	{
+		for (Shape *object : scene->objects)
+		{
+			// Animated shapes keep intersecting in object space as their transforms change per frame
+			if (!scene->IsAnimated(object))
+				object->BakeIntoWorldSpace();
+		}
+	}
+
 	// Parse lights
 	int id;
 
@@ -1224,6 +1418,7 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 		Vector3f normal;
 		Vector3f radiance;
 		float size;
+		int sampleCount = 1;
 
 		eResult = pLight->QueryIntAttribute("id", &id);
 		lightElement = pLight->FirstChildElement("Position");
@@ -1237,8 +1432,11 @@ Scene* SceneParser::CreateSceneFromXML(const char* filePath)
 		sscanf(str, "%f %f %f", &radiance.r, &radiance.g, &radiance.b);
 		lightElement = pLight->FirstChildElement("Size");
 		lightElement->QueryFloatText(&size);
+		lightElement = pLight->FirstChildElement("NumSamples");
+		if (lightElement != nullptr)
+			lightElement->QueryIntText(&sampleCount);
 
-		scene->lights.push_back(new AreaLight(position, radiance, normal, size));
+		scene->lights.push_back(new AreaLight(position, radiance, normal, size, sampleCount));
 
 		pLight = pLight->NextSiblingElement("AreaLight");
 	}
@@ -1301,5 +1499,17 @@ Transform& SceneParser::ComputeTransformMatrix(Scene* scene, const char *ch, Tra
 
 		++ch;
 	}
+
+	return objTransform;
+}
+
+Transform *SceneParser::CreateFrameTransform(Scene *scene, const char *ch)
+{
+	glm::mat4 dummy = glm::mat4(1);
+	Transform *frameTransform = new Transform(dummy);
+
+	ComputeTransformMatrix(scene, ch, *frameTransform);
+
+	return frameTransform;
 }
 }
\ No newline at end of file
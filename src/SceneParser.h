@@ -12,6 +12,10 @@ public:
 	static Scene* CreateSceneFromXML(const char* filePath);
 private:
 	static Transform& ComputeTransformMatrix(Scene* scene, const char *ch, Transform &objTransform);
+	/*
+	 * Transform of the FrameTransformations of a shape, it is applied to the shape once per frame
+	 */
+	static Transform *CreateFrameTransform(Scene *scene, const char *ch);
 private:
 	SceneParser() = default;
 };
@@ -1,6 +1,7 @@
 #include "Scene.h"
 #include "Shape.h"
 #include "Texture.h"
+#include "RayPacket.h"
 
 namespace actracer {
 
@@ -10,11 +11,56 @@ Shape::Shape(int _id, Material *_mat, Transform *objToWorld, ShadingMode shMode)
     motionBlur = Vector3f{}; 
 }
 
+unsigned Shape::IntersectPacket(const RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon)
+{
+    unsigned hitRays = 0;
+    for (int i = 0; i < RayPacket::size; ++i)
+    {
+        if (!(activeRays & (1u << i)))
+            continue;
+
+        HitRecord hit{};
+        Intersect(packet.GetRay(i), hit, intersectionTestEpsilon);
+        if (!hit.IsValid())
+            continue;
+
+        hits[i] = hit;
+        hitRays |= 1u << i;
+    }
+
+    return hitRays;
+}
+
 BoundingVolume3f Shape::GetBoundingBox() const
 {
     return bbox;
 }
 
+BoundingVolume3f Shape::GetBoundingBoxAt(float time) const
+{
+    if (!IsMotionBlurActive())
+        return bbox;
+
+    Transformation motionBlurTranslation = Translation(-1, (glm::vec3)(motionBlur * time));
+
+    Transform motionBlurInWorldSpace = (*objTransform)(motionBlurTranslation);
+    motionBlurInWorldSpace.UpdateTransform();
+
+    return motionBlurInWorldSpace(orgBbox);
+}
+
+BoundingVolume3f Shape::GetClippedBoundingBox(int axis, float slabMin, float slabMax) const
+{
+    if (bbox.max[axis] < slabMin || bbox.min[axis] > slabMax)
+        return BoundingVolume3f{};
+
+    BoundingVolume3f clippedBbox = bbox;
+    SetMax(clippedBbox.min[axis], slabMin);
+    SetMin(clippedBbox.max[axis], slabMax);
+
+    return clippedBbox;
+}
+
 void Shape::SetTextures(const ColorChangerTexture* colorChangerTexture, const NormalChangerTexture* normalChangerTexture)
 {
     mColorChangerTexture = colorChangerTexture;
@@ -36,6 +82,8 @@ void Shape::SetTransformation(Transform *newTransform, bool owned)
     }
     
     bbox = (*(objTransform))(orgBbox);
+    if(IsMotionBlurActive()) // Transformed again after the motion is set when the scene is animated
+        AdaptWorldBoundingBoxForMotionBlur(motionBlur);
 }
 
 void Shape::SetMotionBlur(const Vector3f &motBlur, std::vector<Primitive *> &primitives)
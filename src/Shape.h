@@ -16,6 +16,7 @@ class NormalChangerTexture;
 class Material;
 class Texture;
 class Primitive;
+class RayPacket;
 
 class Shape {
 public:
@@ -26,9 +27,27 @@ public:
     virtual void SetTransformation(Transform *newTransform, bool owned = false);
     virtual void SetMotionBlur(const Vector3f &motBlur, std::vector<Primitive *> &primitives);
 public:
-    virtual Vector3f GetChangedNormal(const SurfaceIntersection &intersection) const {}
-    virtual void Intersect(Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) = 0;
+    virtual Vector3f GetChangedNormal(const SurfaceIntersection &intersection) const { return Vector3f{}; }
+    /*
+     * Records the hit of the ray with the shape into hit if there is one,
+     * surface attributes are not computed
+     */
+    virtual void Intersect(Ray &r, HitRecord &hit, float intersectionTestEpsilon) = 0;
+    /*
+     * Intersect for the rays of the packet that are in activeRays, hits[i] is written only if ray i hits.
+     * Returns the rays that hit, shapes without a packet test intersect the rays one by one
+     */
+    virtual unsigned IntersectPacket(const RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon);
+    /*
+     * Computes normal, uv, world space values and textures of a hit recorded by Intersect
+     */
+    virtual void Finalize(Ray &r, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon) = 0;
     virtual Shape *Clone(bool resetTransform) const = 0;
+    /*
+     * Moves the geometry that rays are tested against into world space so that rays are not transformed per test,
+     * shapes that move keep intersecting in object space
+     */
+    virtual void BakeIntoWorldSpace() { }
 
     virtual void TransformRayIntoObjectSpace(Ray& r) const;
 protected:
@@ -36,7 +55,6 @@ protected:
     Shape() { }
 
     void AdaptWorldBoundingBoxForMotionBlur(const Vector3f& motBlur);
-    bool IsMotionBlurActive() const;
     bool IsOwnedByComposite() const;
 
     Transform GetMotionBlurExtendedTransform(float time) const;
@@ -44,6 +62,17 @@ public:
     int GetID() const;
     Material* GetMaterial() const;
     BoundingVolume3f GetBoundingBox() const;
+    /*
+     * World space bounding box at the time of the shutter in [0, 1], the bounding box of the whole shutter
+     * is the union of the ones at the open and the close as the motion is a translation
+     */
+    BoundingVolume3f GetBoundingBoxAt(float time) const;
+    /*
+     * World space bounding box of the part of the shape in the slab between slabMin and slabMax on the axis,
+     * empty if the shape does not cross the slab. The box is clipped to the slab unless the shape clips itself tighter
+     */
+    virtual BoundingVolume3f GetClippedBoundingBox(int axis, float slabMin, float slabMax) const;
+    bool IsMotionBlurActive() const;
 
     const Transform *GetObjectTransform() const;
 public:
@@ -1,9 +1,13 @@
 #include "Scene.h"
 #include "Sphere.h"
 #include "Texture.h"
+#include "RenderStatistics.h"
+#include "RayPacket.h"
 
 #include "NormalChangerTexture.h"
 
+#include <bitset>
+
 namespace actracer {
 
 Sphere::Sphere(int _id, Material *_mat, float _radius, const Vector3f &centerPoint, Transform *objToWorld, ShadingMode shMode)
@@ -28,8 +32,10 @@ Vector3f Sphere::GetChangedNormal(const SurfaceIntersection &intersection) const
     return intersection.n;
 }
 
-void Sphere::Intersect(Ray &rr, SurfaceIntersection &rt, float intersectionTestEpsilon)
+void Sphere::Intersect(Ray &rr, HitRecord &hit, float intersectionTestEpsilon)
 {
+    ACTRACER_STATS_INCREMENT(SPHERE_TESTS, 1);
+
     Ray r = rr;
     TransformRayIntoObjectSpace(r);
 
@@ -39,17 +45,110 @@ void Sphere::Intersect(Ray &rr, SurfaceIntersection &rt, float intersectionTestE
 
     if (hasIntersected) // If there is an intersection
     {
-        Vector3f intersectionPoint = r(ot); // intersection point
-        Vector3f surfaceNormal = (intersectionPoint - center) / radius; // surface normal
+        Transform motionTransform{};
+        Vector3f intersectionPoint = (*GetWorldTransform(r.time, motionTransform))(Vector4f(r(ot), 1.0f), true);
+        hit = HitRecord(rr(intersectionPoint), ot, 0.0f, 0.0f, intersectionPoint, this); // t value for intersection point in world space
+    }
+}
+
+unsigned Sphere::IntersectPacket(const RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon)
+{
+    if (IsMotionBlurActive())
+        return Shape::IntersectPacket(packet, activeRays, hits, intersectionTestEpsilon);
+
+    ACTRACER_STATS_INCREMENT(SPHERE_TESTS, std::bitset<RayPacket::size>(activeRays).count());
+
+    // Object space rays in SoA layout, transformed as TransformRayIntoObjectSpace does without copying the rays
+    float origin[3][RayPacket::size];
+    float direction[3][RayPacket::size];
+    for (int i = 0; i < RayPacket::size; ++i)
+    {
+        Vector3f rayOrigin{packet.GetOrigins(0)[i], packet.GetOrigins(1)[i], packet.GetOrigins(2)[i]};
+        Vector3f rayDirection{packet.GetDirections(0)[i], packet.GetDirections(1)[i], packet.GetDirections(2)[i]};
+        if (objTransform)
+        {
+            Vector4f objectOrigin = (*objTransform)(Vector4f(rayOrigin, 1.0f), false, false);
+            Vector4f objectDirection = (*objTransform)(Vector4f(rayDirection, 0.0f), false, false);
+
+            rayOrigin = Vector3f(objectOrigin.x, objectOrigin.y, objectOrigin.z);
+            rayDirection = Normalize(Vector3f(objectDirection.x, objectDirection.y, objectDirection.z));
+        }
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            origin[axis][i] = rayOrigin[axis];
+            direction[axis][i] = rayDirection[axis];
+        }
+    }
+
+    // Same steps as CalculateTValueForIntersection, rays that miss end up with a t that is not positive or NaN
+    float t[RayPacket::size];
+    bool hasIntersected[RayPacket::size];
+    for (int i = 0; i < RayPacket::size; ++i)
+    {
+        float originToCenterX = origin[0][i] - center.x;
+        float originToCenterY = origin[1][i] - center.y;
+        float originToCenterZ = origin[2][i] - center.z;
+
+        float dirOtC = originToCenterX * direction[0][i] + originToCenterY * direction[1][i] + originToCenterZ * direction[2][i];
+        float dd = direction[0][i] * direction[0][i] + direction[1][i] * direction[1][i] + direction[2][i] * direction[2][i];
+        float otCSquared = originToCenterX * originToCenterX + originToCenterY * originToCenterY + originToCenterZ * originToCenterZ;
 
-        Vector2f uv{};
-        float phi, theta;
-        CalculateThetaPhiValuesForPoint(intersectionPoint, uv, theta, phi);
+        float discriminant = dirOtC * dirOtC - dd * (otCSquared - radius * radius);
+        bool hasRoot = !(discriminant < 0);
 
-        TransformSurfaceVariablesIntoWorldSpace(r.time, intersectionPoint, surfaceNormal);
-        ot = rr(intersectionPoint); // t value for intersection point in world space
+        discriminant = std::sqrt(discriminant);
+        float closerT = -1 * dirOtC - discriminant;
+        float fartherT = -dirOtC + discriminant;
 
-        rt = SurfaceIntersection(Vector3f{theta, phi, 0.0f}, intersectionPoint, surfaceNormal, uv, Vector3f{}, ot, mat, this, this, mColorChangerTexture, mNormalChangerTexture);
+        if (closerT < 0 || (fartherT < closerT && fartherT > 0))
+            closerT = fartherT;
+
+        t[i] = closerT / dd;
+        hasIntersected[i] = hasRoot && t[i] > 0;
+    }
+
+    unsigned hitRays = 0;
+    for (int i = 0; i < RayPacket::size; ++i)
+    {
+        if (!(activeRays & (1u << i)) || !hasIntersected[i])
+            continue;
+
+        Vector3f objectPoint = Vector3f(origin[0][i], origin[1][i], origin[2][i]) + Vector3f(direction[0][i], direction[1][i], direction[2][i]) * t[i];
+
+        Transform motionTransform{};
+        Vector3f intersectionPoint = (*GetWorldTransform(packet.GetRay(i).time, motionTransform))(Vector4f(objectPoint, 1.0f), true);
+        hits[i] = HitRecord(packet.GetRay(i)(intersectionPoint), t[i], 0.0f, 0.0f, intersectionPoint, this);
+        hitRays |= 1u << i;
+    }
+
+    return hitRays;
+}
+
+void Sphere::Finalize(Ray &rr, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon)
+{
+    Ray r = rr;
+    TransformRayIntoObjectSpace(r);
+
+    Vector3f localIntersectionPoint = r(hit.localT);
+    Vector3f surfaceNormal = (localIntersectionPoint - center) / radius; // surface normal
+
+    Vector2f uv{};
+    float phi, theta;
+    CalculateThetaPhiValuesForPoint(localIntersectionPoint, uv, theta, phi);
+
+    Transform motionTransform{};
+    const Transform *worldTransform = GetWorldTransform(r.time, motionTransform);
+    surfaceNormal = (*worldTransform)(Vector4f(surfaceNormal, 0.0f), true, true);
+    surfaceNormal = Normalize(surfaceNormal);
+
+    rt = SurfaceIntersection(Vector3f{theta, phi, 0.0f}, hit.ip, surfaceNormal, uv, Vector3f{}, hit.t, mat, this, this, mColorChangerTexture, mNormalChangerTexture);
+
+    if (rr.hasDifferentials)
+    {
+        Vector3f dpdu, dpdv;
+        CalculateSurfaceDerivatives(localIntersectionPoint, theta, phi, dpdu, dpdv);
+        rt.ComputeDifferentials(rr, (*worldTransform)(Vector4f(dpdu, 0.0f), true), (*worldTransform)(Vector4f(dpdv, 0.0f), true));
     }
 }
 
@@ -113,21 +212,27 @@ void Sphere::CalculateThetaPhiValuesForPoint(const Vector3f& point, Vector2f& uv
     phi = PI - (2 * PI) * uv.x;
 }
 
-void Sphere::TransformSurfaceVariablesIntoWorldSpace(float rayTime, Vector3f &intersectionPoint, Vector3f &surfaceNormal) const
+/*
+ * u turns phi backwards a full circle and v turns theta half a circle, see CalculateThetaPhiValuesForPoint
+ */
+void Sphere::CalculateSurfaceDerivatives(const Vector3f &point, float theta, float phi, Vector3f &dpdu, Vector3f &dpdv) const
 {
-    Transform transformObject = *this->objTransform;
+    Vector3f centered = point - center;
 
-    if (IsMotionBlurActive())
-    {
-        Vector3f timeExtendedMotionBlur = this->motionBlur * rayTime;
-        Transformation motionBlurTranslation = Translation(-1, (glm::vec3)timeExtendedMotionBlur);
-        transformObject = (*objTransform)(motionBlurTranslation);
-        transformObject.UpdateTransform();
-    }
+    dpdu = Vector3f(centered.z, 0.0f, -centered.x) * (2.0f * (float)PI);
+    dpdv = Vector3f(centered.y * std::cos(phi), -radius * std::sin(theta), centered.y * std::sin(phi)) * (float)PI;
+}
 
-    intersectionPoint = (transformObject)(Vector4f(intersectionPoint, 1.0f), true);
-    surfaceNormal = (transformObject)(Vector4f(surfaceNormal, 0.0f), true, true);
-    surfaceNormal = Normalize(surfaceNormal);
+const Transform *Sphere::GetWorldTransform(float rayTime, Transform &motionTransform) const
+{
+    if (!IsMotionBlurActive())
+        return this->objTransform;
+
+    Vector3f timeExtendedMotionBlur = this->motionBlur * rayTime;
+    Transformation motionBlurTranslation = Translation(-1, (glm::vec3)timeExtendedMotionBlur);
+    motionTransform = (*objTransform)(motionBlurTranslation);
+
+    return &motionTransform;
 }
 
 Shape *Sphere::Clone(bool resetTransform) const
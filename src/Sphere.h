@@ -17,12 +17,24 @@ public:
 public:
     float GetRadius() const;
 public:
-    void Intersect(Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) override;
+    void Intersect(Ray &r, HitRecord &hit, float intersectionTestEpsilon) override;
+    /*
+     * Rays are taken into object space one by one as in Intersect, the quadratic is solved for all of them at once.
+     * Moving spheres are tested ray by ray
+     */
+    unsigned IntersectPacket(const RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon) override;
+    void Finalize(Ray &r, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon) override;
     Shape* Clone(bool resetTransform) const override;
 private:
     void CalculateTValueForIntersection(const Ray &r, bool &hasIntersected, float &t) const;
     void CalculateThetaPhiValuesForPoint(const Vector3f &point, Vector2f &uv, float &theta, float &phi) const;
-    void TransformSurfaceVariablesIntoWorldSpace(float rayTime, Vector3f &intersectionPoint, Vector3f &surfaceNormal) const;
+    // Derivatives of the object space point by u and v
+    void CalculateSurfaceDerivatives(const Vector3f &point, float theta, float phi, Vector3f &dpdu, Vector3f &dpdv) const;
+    /*
+     * Object to world transform of the sphere at the given time of motion blur,
+     * motionTransform holds the transform extended with motion blur if the sphere moves
+     */
+    const Transform *GetWorldTransform(float rayTime, Transform &motionTransform) const;
 };
 
 inline float Sphere::GetRadius() const
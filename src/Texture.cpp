@@ -10,9 +10,10 @@ Texture::Texture()
     : mTextureImpl(nullptr)
     { }
 
-void Texture::SetupImageTexture(const std::string &imagePath, float bumpFactor, int normalizer, ImageType imageType, InterpolationMethodCode interpolationMethod)
+void Texture::SetupImageTexture(const std::string &imagePath, float bumpFactor, int normalizer, ImageType imageType, InterpolationMethodCode interpolationMethod,
+                                TextureCache *textureCache)
 {
-    mTextureImpl = new ImageTextureImpl(imagePath, bumpFactor, normalizer, imageType, interpolationMethod);
+    mTextureImpl = new ImageTextureImpl(imagePath, bumpFactor, normalizer, imageType, interpolationMethod, textureCache);
 }
 
 void Texture::SetupPerlinTexture(float bumpFactor, float noiseScale, NoiseConversionType method, std::default_random_engine& generator)
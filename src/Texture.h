@@ -18,6 +18,8 @@ enum class ImageType;
 enum class InterpolationMethodCode;
 enum class NoiseConversionType;
 
+class TextureCache;
+
 enum class DecalMode
 {
     REPLACE_NORMAL,
@@ -40,7 +42,8 @@ friend class PerlinTextureImpl;
 friend class ImageTextureImpl;
 
 public:
-    void SetupImageTexture(const std::string &imagePath, float bumpFactor, int normalizer, ImageType imageType, InterpolationMethodCode interpolationMethod);
+    void SetupImageTexture(const std::string &imagePath, float bumpFactor, int normalizer, ImageType imageType, InterpolationMethodCode interpolationMethod,
+                           TextureCache *textureCache = nullptr);
     void SetupPerlinTexture(float bumpFactor, float noiseScale, NoiseConversionType method, std::default_random_engine& generator);
 
     bool IsValid() const;
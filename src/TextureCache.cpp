@@ -0,0 +1,165 @@
+#include "TextureCache.h"
+
+#include <iomanip>
+#include <iostream>
+
+namespace actracer
+{
+
+constexpr int TextureCache::SHARD_COUNT;
+
+TextureCache::TextureCache(size_t byteBudget)
+    : mByteBudget(byteBudget), mResidentByteCount(0), mPeakResidentByteCount(0), mNextEvictedShard(0)
+{ }
+
+uint32_t TextureCache::CreateTextureId()
+{
+    static std::atomic<uint32_t> nextTextureId{1};
+    return nextTextureId++;
+}
+
+size_t TextureCache::KeyHash::operator()(const Key &key) const
+{
+    size_t hash = key.textureId * 0x9E3779B1u;
+    hash ^= (size_t)(key.level + 1) * 0x85EBCA77u + (hash << 6) + (hash >> 2);
+    hash ^= (size_t)key.tileIndex * 0xC2B2AE3Du + (hash << 6) + (hash >> 2);
+
+    return hash;
+}
+
+TextureCache::Shard &TextureCache::GetShard(const Key &key)
+{
+    // Upper bits so that the shard does not follow the buckets of the shard map
+    return mShards[(KeyHash{}(key) >> 16) % SHARD_COUNT];
+}
+
+std::list<TextureCache::Entry> &TextureCache::GetEntries(Shard &shard, const Key &key)
+{
+    return key.level < 0 ? shard.imageEntries : shard.tileEntries;
+}
+
+std::shared_ptr<const void> TextureCache::Find(const Key &key)
+{
+    Shard &shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto location = shard.entryLocations.find(key);
+    if (location == shard.entryLocations.end())
+    {
+        ++shard.missCount;
+        return nullptr;
+    }
+
+    ++shard.hitCount;
+    std::list<Entry> &entries = GetEntries(shard, key);
+    entries.splice(entries.begin(), entries, location->second);
+
+    return location->second->value;
+}
+
+std::shared_ptr<const void> TextureCache::Insert(const Key &key, const std::shared_ptr<const void> &value, size_t byteCount)
+{
+    Shard &shard = GetShard(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto location = shard.entryLocations.find(key);
+        if (location != shard.entryLocations.end())
+            return location->second->value;
+
+        std::list<Entry> &entries = GetEntries(shard, key);
+        entries.push_front(Entry{key, value, byteCount});
+        shard.entryLocations[key] = entries.begin();
+    }
+
+    size_t residentByteCount = mResidentByteCount += byteCount;
+
+    size_t peakResidentByteCount = mPeakResidentByteCount;
+    while (residentByteCount > peakResidentByteCount && !mPeakResidentByteCount.compare_exchange_weak(peakResidentByteCount, residentByteCount))
+        ;
+
+    if (residentByteCount > mByteBudget)
+        EvictOverBudget();
+
+    return value;
+}
+
+void TextureCache::EvictOverBudget()
+{
+    // Shards are locked one at a time, so a full round of shards without tiles is needed before images are evicted
+    bool evictsImages = false;
+    int emptyShardCount = 0;
+    while (mResidentByteCount > mByteBudget)
+    {
+        Shard &shard = mShards[mNextEvictedShard++ % SHARD_COUNT];
+
+        if (EvictLeastRecentlyUsed(shard, evictsImages ? shard.imageEntries : shard.tileEntries))
+        {
+            emptyShardCount = 0;
+        }
+        else if (++emptyShardCount == SHARD_COUNT)
+        {
+            if (evictsImages)
+                break;
+
+            evictsImages = true;
+            emptyShardCount = 0;
+        }
+    }
+}
+
+bool TextureCache::EvictLeastRecentlyUsed(Shard &shard, std::list<Entry> &entries)
+{
+    std::shared_ptr<const void> evictedValue; // Released after the lock
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (entries.empty())
+        return false;
+
+    Entry &leastRecentlyUsed = entries.back();
+    evictedValue = std::move(leastRecentlyUsed.value);
+    mResidentByteCount -= leastRecentlyUsed.byteCount;
+
+    shard.entryLocations.erase(leastRecentlyUsed.key);
+    entries.pop_back();
+    ++shard.evictionCount;
+
+    return true;
+}
+
+void TextureCache::Report(const char *title)
+{
+    uint64_t hitCount = 0;
+    uint64_t missCount = 0;
+    uint64_t evictionCount = 0;
+
+    for (Shard &shard : mShards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        hitCount += shard.hitCount;
+        missCount += shard.missCount;
+        evictionCount += shard.evictionCount;
+        shard.hitCount = shard.missCount = shard.evictionCount = 0;
+    }
+
+    uint64_t lookupCount = hitCount + missCount;
+    double megabyte = 1024.0 * 1024.0;
+
+    std::ostream &out = std::cout;
+    out << "Texture cache: " << title << "\n"
+        << std::left << std::fixed << std::setprecision(2)
+        << "  " << std::setw(26) << "Lookups" << lookupCount << "\n"
+        << "  " << std::setw(26) << "Hit rate" << (lookupCount ? 100.0 * hitCount / lookupCount : 0.0) << " %\n"
+        << "  " << std::setw(26) << "Misses" << missCount << "\n"
+        << "  " << std::setw(26) << "Evictions" << evictionCount << "\n"
+        << "  " << std::setw(26) << "Resident" << mResidentByteCount / megabyte << " MB (peak "
+        << mPeakResidentByteCount / megabyte << " MB, budget " << mByteBudget / megabyte << " MB)\n";
+
+    out.unsetf(std::ios_base::floatfield);
+    out << std::right << std::setprecision(6);
+
+    mPeakResidentByteCount = mResidentByteCount.load();
+}
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace actracer
+{
+
+/*
+ * Keeps decoded images and texel tiles of image textures in a memory budget,
+ * entries are created by the textures on first access and the least recently used ones are evicted when the budget is exceeded.
+ * Entries are spread over shards that have their own locks so that threads rarely wait for each other,
+ * recency is tracked per shard and evictions go over the shards in turns.
+ * Decoded images are evicted only when there are no tiles left, as they are far more expensive to create
+ */
+class TextureCache
+{
+public:
+    struct Key
+    {
+        uint32_t textureId;
+        int level; // Mip level of the tile, -1 for the decoded image
+        int tileIndex;
+
+        bool operator==(const Key &key) const;
+    };
+
+public:
+    explicit TextureCache(size_t byteBudget);
+
+    /*
+     * Counts a hit or a miss, returns nullptr on a miss
+     */
+    std::shared_ptr<const void> Find(const Key &key);
+
+    /*
+     * Returns the entry of the key after the insertion,
+     * which is the one of another thread if it was inserted after the find of the caller
+     */
+    std::shared_ptr<const void> Insert(const Key &key, const std::shared_ptr<const void> &value, size_t byteCount);
+
+    /*
+     * Prints the lookups and evictions since the last report and resets them
+     */
+    void Report(const char *title);
+
+    size_t GetByteBudget() const;
+
+    /*
+     * Ids are unique over all caches, 0 is not used
+     */
+    static uint32_t CreateTextureId();
+
+private:
+    static constexpr int SHARD_COUNT = 64;
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+
+    struct Entry
+    {
+        Key key;
+        std::shared_ptr<const void> value;
+        size_t byteCount;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<Entry> tileEntries;  // Most recently used first
+        std::list<Entry> imageEntries; // Most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entryLocations;
+
+        uint64_t hitCount = 0;
+        uint64_t missCount = 0;
+        uint64_t evictionCount = 0;
+    };
+
+    Shard &GetShard(const Key &key);
+    static std::list<Entry> &GetEntries(Shard &shard, const Key &key);
+
+    /*
+     * Evicts from the shards in turns until the resident bytes are in the budget or the shards are empty
+     */
+    void EvictOverBudget();
+    /*
+     * Returns false if the entries are empty
+     */
+    bool EvictLeastRecentlyUsed(Shard &shard, std::list<Entry> &entries);
+
+private:
+    size_t mByteBudget;
+    std::atomic<size_t> mResidentByteCount;
+    std::atomic<size_t> mPeakResidentByteCount;
+    std::atomic<unsigned> mNextEvictedShard;
+
+    Shard mShards[SHARD_COUNT];
+};
+
+inline bool TextureCache::Key::operator==(const Key &key) const
+{
+    return textureId == key.textureId && level == key.level && tileIndex == key.tileIndex;
+}
+
+inline size_t TextureCache::GetByteBudget() const
+{
+    return mByteBudget;
+}
+
+}
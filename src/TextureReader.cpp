@@ -1,107 +1,308 @@
 #include "stb_image.h"
 
 #include "TextureReader.h"
+#include "TextureCache.h"
 #include "Tonemapper.h"
 
 #include "TextureValueRetrieveMethod.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 #define COLOUR_CHANNEL_COUNT 3
 
 namespace actracer
 {
 
-int GetRepeatCoordinate(int coordinate, int minimumCoordinateValue, int maximumCoordinateValue);
+namespace
+{
 
-TextureReader *TextureReader::CreateTextureReader(const std::string& imagePath, ImageType imageType, InterpolationMethodCode interplationMethodCode)
+/*
+ * Tile of the last cached texel that is read by the thread, bilinear lookups mostly stay in one tile
+ * so the cache is not locked for every texel
+ */
+struct LastCachedTile
 {
+    uint32_t textureId = 0;
+    int level = 0;
+    int tileIndex = 0;
+    std::shared_ptr<const void> tile;
+};
+
+thread_local LastCachedTile lastCachedTile;
+
+}
+
+constexpr int TextureReader::TILE_SIZE;
+constexpr int TextureReader::CACHE_TILE_SIZE;
+
+TextureReader *TextureReader::CreateTextureReader(const std::string& imagePath, ImageType imageType, InterpolationMethodCode interplationMethodCode,
+                                                  TextureCache *textureCache)
+{
+    TextureReader *reader = nullptr;
+
     switch(imageType)
     {
         case ImageType::EXR:
-            return new EXRTextureReader(imagePath, interplationMethodCode);
+            reader = new EXRTextureReader(imagePath, interplationMethodCode);
+            break;
         case ImageType::PNG:
-            return new PNGTextureReader(imagePath, interplationMethodCode);
+            reader = new PNGTextureReader(imagePath, interplationMethodCode);
+            break;
     }
 
-    return nullptr;
+    if (!reader)
+        return nullptr;
+
+    bool buildsMipLevels = interplationMethodCode == InterpolationMethodCode::TRILINEAR;
+
+    // Images are read through the virtual functions of the derived readers, so not in the constructor of the base
+    if (textureCache)
+    {
+        reader->mTextureCache = textureCache;
+        reader->ReadImageSize(reader->mWidth, reader->mHeight);
+        reader->mLevels.push_back(TexelLevel(reader->mWidth, reader->mHeight, false));
+    }
+    else
+    {
+        size_t byteCount;
+        std::shared_ptr<const void> imageData = reader->DecodeImage(reader->mWidth, reader->mHeight, byteCount);
+        reader->StoreTexels(imageData.get());
+    }
+
+    if (buildsMipLevels)
+        reader->BuildMipLevels(textureCache == nullptr);
+
+    return reader;
 }
 
 EXRTextureReader::EXRTextureReader(const std::string &exrImagePath, InterpolationMethodCode interpolationMethodCode)
-    : TextureReader(interpolationMethodCode)
+    : TextureReader(exrImagePath, interpolationMethodCode)
+{ }
+
+PNGTextureReader::PNGTextureReader(const std::string &pngImagePath, InterpolationMethodCode interpolationMethodCode)
+    : TextureReader(pngImagePath, interpolationMethodCode)
+{ }
+
+TextureReader::TextureReader(const std::string &imagePath, InterpolationMethodCode interpolationMethodCode)
+    : mTextureCache(nullptr), mTextureId(TextureCache::CreateTextureId()), mImagePath(imagePath), mWidth(0), mHeight(0)
 {
-    TMOData out = Tonemapper::ReadExr(exrImagePath);
+    mTextureValueRetriever = TextureValueRetrieveMethod::CreateTextureValueRetrieveMethod(interpolationMethodCode);
+}
 
-    mExrImageData = out.data;
-    mWidth = out.width;
-    mHeight = out.height;
+std::shared_ptr<const void> EXRTextureReader::DecodeImage(int &width, int &height, size_t &byteCount) const
+{
+    TMOData out = Tonemapper::ReadExr(mImagePath);
+
+    width = out.width;
+    height = out.height;
+    byteCount = sizeof(float) * 4 * width * height;
+
+    return std::shared_ptr<const void>(out.data, [](const void *data) { free((void *)data); });
 }
 
-PNGTextureReader::PNGTextureReader(const std::string &pngImagePath, InterpolationMethodCode interpolationMethodCode)
-    : TextureReader(interpolationMethodCode)
+std::shared_ptr<const void> PNGTextureReader::DecodeImage(int &width, int &height, size_t &byteCount) const
 {
-    mPngImageData = stbi_load(pngImagePath.c_str(), &mWidth, &mHeight, &mBytesPerPixel, 3);
+    int bytesPerPixel;
+    unsigned char *pngImageData = stbi_load(mImagePath.c_str(), &width, &height, &bytesPerPixel, 3);
+
+    byteCount = COLOUR_CHANNEL_COUNT * width * height;
+
+    return std::shared_ptr<const void>(pngImageData, [](const void *data) { stbi_image_free((void *)data); });
 }
 
-TextureReader::TextureReader(InterpolationMethodCode interpolationMethodCode)
+bool EXRTextureReader::ReadImageSize(int &width, int &height) const
 {
-    mTextureValueRetriever = TextureValueRetrieveMethod::CreateTextureValueRetrieveMethod(interpolationMethodCode);
+    return Tonemapper::ReadExrSize(mImagePath, width, height);
+}
+
+bool PNGTextureReader::ReadImageSize(int &width, int &height) const
+{
+    int bytesPerPixel;
+    return stbi_info(mImagePath.c_str(), &width, &height, &bytesPerPixel) != 0;
 }
 
-EXRTextureReader::~EXRTextureReader() 
+Vector3f TextureReader::ComputeRGBValueOn(float u, float v, float uvFootprint)
 {
-    delete[] mExrImageData;
+    return mTextureValueRetriever->RetrieveValueFromUVCoordinate(this, u, v, uvFootprint);
 }
 
-PNGTextureReader::~PNGTextureReader()
+Vector3f TextureReader::FetchPixelValueFromTexture(int row, int column, int level) const
 {
-    delete[] mPngImageData;
+    return GetTexel(level, row, column);
 }
 
-Vector3f TextureReader::ComputeRGBValueOn(float u, float v)
+Vector3f TextureReader::InterpolateBilinear(int row, int column, float rowWeight, float columnWeight, int level) const
 {
-    return mTextureValueRetriever->RetrieveValueFromUVCoordinate(this, u, v);
+    // Products are taken in the same order as blending separately fetched texels
+    return GetTexel(level, row, column) * (1 - rowWeight) * (1 - columnWeight) +
+           GetTexel(level, row + 1, column) * rowWeight * (1 - columnWeight) +
+           GetTexel(level, row, column + 1) * (1 - rowWeight) * columnWeight +
+           GetTexel(level, row + 1, column + 1) * rowWeight * columnWeight;
 }
 
-Vector3f TextureReader::FetchPixelValueFromTexture(int row, int column) const
+TextureReader::TexelLevel::TexelLevel(int levelWidth, int levelHeight, bool storesTexels)
+    : width(levelWidth), height(levelHeight),
+      tileColumnCount((levelWidth + TILE_SIZE - 1) / TILE_SIZE),
+      rowMask((levelHeight & (levelHeight - 1)) == 0 ? levelHeight - 1 : -1),
+      columnMask((levelWidth & (levelWidth - 1)) == 0 ? levelWidth - 1 : -1)
 {
-    int index = CalculateIndexFor(row, column);
-    
-    return GetColorData(index);
+    if (storesTexels)
+        texels.resize(tileColumnCount * ((levelHeight + TILE_SIZE - 1) / TILE_SIZE) * TILE_SIZE * TILE_SIZE);
 }
 
-int TextureReader::CalculateIndexFor(int row, int column) const
+void TextureReader::StoreTexels(const void *imageData)
 {
-    row = GetRepeatRow(row);
-    column = GetRepeatColumn(column);
+    TexelLevel image(mWidth, mHeight, true);
+
+    for (int row = 0; row < mHeight; ++row)
+        for (int column = 0; column < mWidth; ++column)
+            image.texels[CalculateIndexFor(image, row, column)] = GetColorData(imageData, COLOUR_CHANNEL_COUNT * (row * mWidth + column));
 
-    return COLOUR_CHANNEL_COUNT * (row * mWidth + column);
+    mLevels.push_back(std::move(image));
 }
 
-int TextureReader::GetRepeatRow(int row) const
+void TextureReader::BuildMipLevels(bool storesTexels)
 {
-    return GetRepeatCoordinate(row, 0, mHeight - 1);
+    for (int level = 0; GetWidth(level) > 1 || GetHeight(level) > 1; ++level)
+    {
+        TexelLevel nextLevel(std::max(1, GetWidth(level) / 2), std::max(1, GetHeight(level) / 2), storesTexels);
+
+        if (storesTexels)
+        {
+            for (int row = 0; row < nextLevel.height; ++row)
+                for (int column = 0; column < nextLevel.width; ++column)
+                    nextLevel.texels[CalculateIndexFor(nextLevel, row, column)] = ComputeMipTexel(level + 1, row, column);
+        }
+
+        mLevels.push_back(std::move(nextLevel));
+    }
+}
+
+/*
+ * Texels of odd sized levels are averaged with the edge texel repeated
+ */
+Vector3f TextureReader::ComputeMipTexel(int level, int row, int column) const
+{
+    int width = GetWidth(level - 1);
+    int height = GetHeight(level - 1);
+
+    int firstRow = std::min(2 * row, height - 1);
+    int secondRow = std::min(2 * row + 1, height - 1);
+    int firstColumn = std::min(2 * column, width - 1);
+    int secondColumn = std::min(2 * column + 1, width - 1);
+
+    return (FetchPixelValueFromTexture(firstRow, firstColumn, level - 1) +
+            FetchPixelValueFromTexture(firstRow, secondColumn, level - 1) +
+            FetchPixelValueFromTexture(secondRow, firstColumn, level - 1) +
+            FetchPixelValueFromTexture(secondRow, secondColumn, level - 1)) * 0.25f;
+}
+
+Vector3fa TextureReader::GetCachedTexel(int level, int row, int column) const
+{
+    const TexelLevel &texelLevel = mLevels[level];
+    row = GetRepeatCoordinate(row, texelLevel.height, texelLevel.rowMask);
+    column = GetRepeatCoordinate(column, texelLevel.width, texelLevel.columnMask);
+
+    int tileColumnCount = (texelLevel.width + CACHE_TILE_SIZE - 1) / CACHE_TILE_SIZE;
+    int tileIndex = (row / CACHE_TILE_SIZE) * tileColumnCount + column / CACHE_TILE_SIZE;
+
+    if (lastCachedTile.textureId != mTextureId || lastCachedTile.level != level || lastCachedTile.tileIndex != tileIndex)
+    {
+        // Tiles of mip levels read the level above, which replaces the last tile before this one is stored
+        std::shared_ptr<const CachedTile> tile = GetCachedTile(level, tileIndex);
+
+        lastCachedTile.textureId = mTextureId;
+        lastCachedTile.level = level;
+        lastCachedTile.tileIndex = tileIndex;
+        lastCachedTile.tile = std::move(tile);
+    }
+
+    const CachedTile *tile = static_cast<const CachedTile *>(lastCachedTile.tile.get());
+    return tile->texels[(row % CACHE_TILE_SIZE) * CACHE_TILE_SIZE + column % CACHE_TILE_SIZE];
+}
+
+std::shared_ptr<const TextureReader::CachedTile> TextureReader::GetCachedTile(int level, int tileIndex) const
+{
+    TextureCache::Key key{mTextureId, level, tileIndex};
+
+    std::shared_ptr<const void> tile = mTextureCache->Find(key);
+    if (!tile)
+        tile = mTextureCache->Insert(key, CreateCachedTile(level, tileIndex), sizeof(CachedTile));
+
+    return std::static_pointer_cast<const CachedTile>(tile);
 }
 
-int TextureReader::GetRepeatColumn(int column) const
+std::shared_ptr<const TextureReader::CachedTile> TextureReader::CreateCachedTile(int level, int tileIndex) const
 {
-    return GetRepeatCoordinate(column, 0, mWidth - 1);
+    std::shared_ptr<CachedTile> tile = std::make_shared<CachedTile>();
+
+    int width = GetWidth(level);
+    int height = GetHeight(level);
+    int tileColumnCount = (width + CACHE_TILE_SIZE - 1) / CACHE_TILE_SIZE;
+    int firstRow = tileIndex / tileColumnCount * CACHE_TILE_SIZE;
+    int firstColumn = tileIndex % tileColumnCount * CACHE_TILE_SIZE;
+    int rowCount = std::min(CACHE_TILE_SIZE, height - firstRow);
+    int columnCount = std::min(CACHE_TILE_SIZE, width - firstColumn);
+
+    if (level > 0)
+    {
+        for (int row = 0; row < rowCount; ++row)
+            for (int column = 0; column < columnCount; ++column)
+                tile->texels[row * CACHE_TILE_SIZE + column] = ComputeMipTexel(level, firstRow + row, firstColumn + column);
+
+        return tile;
+    }
+
+    std::shared_ptr<const void> imageData = GetCachedImage();
+    if (!imageData) // Texels stay black as the image can not be read
+        return tile;
+
+    for (int row = 0; row < rowCount; ++row)
+        for (int column = 0; column < columnCount; ++column)
+            tile->texels[row * CACHE_TILE_SIZE + column] = GetColorData(imageData.get(), COLOUR_CHANNEL_COUNT * ((firstRow + row) * mWidth + firstColumn + column));
+
+    return tile;
 }
 
-int GetRepeatCoordinate(int coordinate, int minimumCoordinateValue, int maximumCoordinateValue)
+/*
+ * The decoded image is an entry of the cache too, it is decoded again if it is evicted before all of its tiles are created
+ */
+std::shared_ptr<const void> TextureReader::GetCachedImage() const
 {
-    if(coordinate > maximumCoordinateValue) return minimumCoordinateValue;
-    else if(coordinate < minimumCoordinateValue) return maximumCoordinateValue;
+    TextureCache::Key key{mTextureId, -1, 0};
+
+    std::shared_ptr<const void> imageData = mTextureCache->Find(key);
+    if (imageData)
+        return imageData;
 
-    return coordinate;
+    std::lock_guard<std::mutex> lock(mDecodeMutex);
+
+    // Another thread may have decoded it while this one was waiting
+    imageData = mTextureCache->Find(key);
+    if (imageData)
+        return imageData;
+
+    int width;
+    int height;
+    size_t byteCount;
+    imageData = DecodeImage(width, height, byteCount);
+    if (!imageData || width != mWidth || height != mHeight)
+        return nullptr;
+
+    return mTextureCache->Insert(key, imageData, byteCount);
 }
 
-Vector3f EXRTextureReader::GetColorData(int index) const
+Vector3f EXRTextureReader::GetColorData(const void *imageData, int index) const
 {
-    return {mExrImageData[index], mExrImageData[index + 1], mExrImageData[index + 2]};
+    const float *exrImageData = static_cast<const float *>(imageData);
+    return {exrImageData[index], exrImageData[index + 1], exrImageData[index + 2]};
 }
 
-Vector3f PNGTextureReader::GetColorData(int index) const
+Vector3f PNGTextureReader::GetColorData(const void *imageData, int index) const
 {
-    return Vector3f(mPngImageData[index], mPngImageData[index + 1], mPngImageData[index + 2]);
+    const unsigned char *pngImageData = static_cast<const unsigned char *>(imageData);
+    return Vector3f(pngImageData[index], pngImageData[index + 1], pngImageData[index + 2]);
 }
 
-}
\ No newline at end of file
+}
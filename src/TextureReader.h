@@ -2,6 +2,10 @@
 
 #include "acmath.h"
 
+#include <memory>
+#include <mutex>
+#include <vector>
+
 namespace actracer
 {
 
@@ -15,68 +19,157 @@ enum class InterpolationMethodCode;
 
 class TextureReader;
 class TextureValueRetrieveMethod;
+class TextureCache;
 
 class TextureReader
 {
 public:
-    static TextureReader *CreateTextureReader(const std::string &imagePath, ImageType imageType, InterpolationMethodCode interplationMethodCode);
-
-    Vector3f ComputeRGBValueOn(float u, float v);
-
-    Vector3f FetchPixelValueFromTexture(int row, int colum) const;
+    /*
+     * If a cache is given only the size of the image is read, the image is decoded and converted tile by tile on first access
+     * and kept in the cache, otherwise the whole texture is converted now
+     */
+    static TextureReader *CreateTextureReader(const std::string &imagePath, ImageType imageType, InterpolationMethodCode interplationMethodCode,
+                                              TextureCache *textureCache = nullptr);
+
+    /*
+     * uvFootprint is the size of the area around uv that is covered, used by the methods that read mip levels
+     */
+    Vector3f ComputeRGBValueOn(float u, float v, float uvFootprint = 0.0f);
+
+    /*
+     * level 0 is the image itself, each further level halves the previous one
+     */
+    Vector3f FetchPixelValueFromTexture(int row, int colum, int level = 0) const;
+
+    /*
+     * Blends the 2x2 texels that start at (row, column), weights are the offsets of the sample towards row + 1 and column + 1
+     */
+    Vector3f InterpolateBilinear(int row, int column, float rowWeight, float columnWeight, int level) const;
 
     virtual ~TextureReader() { }
 public:
-    int GetWidth() const;
-    int GetHeight() const;
+    int GetWidth(int level = 0) const;
+    int GetHeight(int level = 0) const;
+    int GetLevelCount() const;
 protected:
-    TextureReader(InterpolationMethodCode interpolationMethodCode);
-    virtual Vector3f GetColorData(int index) const = 0;
+    TextureReader(const std::string &imagePath, InterpolationMethodCode interpolationMethodCode);
+
+    /*
+     * Returns the data that GetColorData reads, nullptr if the image can not be read
+     */
+    virtual std::shared_ptr<const void> DecodeImage(int &width, int &height, size_t &byteCount) const = 0;
+    virtual bool ReadImageSize(int &width, int &height) const = 0;
+    virtual Vector3f GetColorData(const void *imageData, int index) const = 0;
 private:
+    // Texels are kept in TILE_SIZE x TILE_SIZE tiles so that the neighbours of a texel share its cache lines,
+    // a tile row of 4 aligned texels is 64 bytes
+    static constexpr int TILE_SIZE = 4;
+    // Unit of the texture cache
+    static constexpr int CACHE_TILE_SIZE = 32;
+
+    struct TexelLevel
+    {
+        int width;
+        int height;
+        int tileColumnCount;
+        int rowMask;    // height - 1 if the height is a power of two, -1 otherwise
+        int columnMask; // width - 1 if the width is a power of two, -1 otherwise
+        std::vector<Vector3fa> texels; // Tiles in row major order, texels in a tile in row major order, empty if the texture is cached
+
+        TexelLevel(int levelWidth, int levelHeight, bool storesTexels);
+    };
+
+    struct CachedTile
+    {
+        Vector3fa texels[CACHE_TILE_SIZE * CACHE_TILE_SIZE]; // Row major
+    };
+
+    void StoreTexels(const void *imageData);
+    // Image halved level by level with a box filter down to a single texel
+    void BuildMipLevels(bool storesTexels);
+    Vector3f ComputeMipTexel(int level, int row, int column) const;
+
+    Vector3fa GetTexel(int level, int row, int column) const;
+    Vector3fa GetCachedTexel(int level, int row, int column) const;
+    std::shared_ptr<const CachedTile> GetCachedTile(int level, int tileIndex) const;
+    std::shared_ptr<const CachedTile> CreateCachedTile(int level, int tileIndex) const;
+    std::shared_ptr<const void> GetCachedImage() const;
+
     TextureValueRetrieveMethod* mTextureValueRetriever;
+    std::vector<TexelLevel> mLevels; // Image followed by the mip levels if the interpolation reads them
 
-    int GetRepeatRow(int row) const;
-    int GetRepeatColumn(int column) const;
+    TextureCache *mTextureCache;
+    uint32_t mTextureId; // Key of the texture in the cache
+    mutable std::mutex mDecodeMutex; // Only one thread decodes the image when it is not in the cache
 
-    int CalculateIndexFor(int row, int column) const;
+    static int GetRepeatCoordinate(int coordinate, int size, int mask);
+    static int CalculateIndexFor(const TexelLevel &level, int row, int column);
 protected:
+    std::string mImagePath;
     int mWidth;
     int mHeight;
 };
 
-inline int TextureReader::GetWidth() const
+inline int TextureReader::GetWidth(int level) const
+{
+    return mLevels[level].width;
+}
+
+inline int TextureReader::GetHeight(int level) const
+{
+    return mLevels[level].height;
+}
+
+inline int TextureReader::GetLevelCount() const
 {
-    return mWidth;
+    return mLevels.size();
 }
 
-inline int TextureReader::GetHeight() const
+inline int TextureReader::GetRepeatCoordinate(int coordinate, int size, int mask)
 {
-    return mHeight;
+    if (mask >= 0)
+        return coordinate & mask;
+
+    coordinate %= size;
+    return coordinate < 0 ? coordinate + size : coordinate;
+}
+
+inline Vector3fa TextureReader::GetTexel(int level, int row, int column) const
+{
+    if (mTextureCache)
+        return GetCachedTexel(level, row, column);
+
+    const TexelLevel &texelLevel = mLevels[level];
+    return texelLevel.texels[CalculateIndexFor(texelLevel, row, column)];
+}
+
+inline int TextureReader::CalculateIndexFor(const TexelLevel &level, int row, int column)
+{
+    row = GetRepeatCoordinate(row, level.height, level.rowMask);
+    column = GetRepeatCoordinate(column, level.width, level.columnMask);
+
+    int tileIndex = (row / TILE_SIZE) * level.tileColumnCount + column / TILE_SIZE;
+    return tileIndex * TILE_SIZE * TILE_SIZE + (row % TILE_SIZE) * TILE_SIZE + column % TILE_SIZE;
 }
 
 class EXRTextureReader : public TextureReader
 {
 public:
     EXRTextureReader(const std::string &exrImagePath, InterpolationMethodCode interpolationMethodCode);
-
-    virtual ~EXRTextureReader() override;
 protected:
-    virtual Vector3f GetColorData(int index) const override;
-private:
-    float *mExrImageData;
+    virtual std::shared_ptr<const void> DecodeImage(int &width, int &height, size_t &byteCount) const override;
+    virtual bool ReadImageSize(int &width, int &height) const override;
+    virtual Vector3f GetColorData(const void *imageData, int index) const override;
 };
 
 class PNGTextureReader : public TextureReader
 {
 public:
     PNGTextureReader(const std::string &pngImagePath, InterpolationMethodCode interpolationMethodCode);
-
-    virtual ~PNGTextureReader() override;
 protected:
-    virtual Vector3f GetColorData(int index) const override;
-private:
-    int mBytesPerPixel;
-    unsigned char* mPngImageData;
+    virtual std::shared_ptr<const void> DecodeImage(int &width, int &height, size_t &byteCount) const override;
+    virtual bool ReadImageSize(int &width, int &height) const override;
+    virtual Vector3f GetColorData(const void *imageData, int index) const override;
 };
 
 }
\ No newline at end of file
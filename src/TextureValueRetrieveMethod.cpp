@@ -1,6 +1,9 @@
 #include "TextureValueRetrieveMethod.h"
 #include "TextureReader.h"
 
+#include <algorithm>
+#include <cmath>
+
 namespace actracer
 {
 
@@ -12,16 +15,23 @@ TextureValueRetrieveMethod* TextureValueRetrieveMethod::CreateTextureValueRetrie
             return new NearestTextureValueRetrieveMethod();
         case InterpolationMethodCode::BILINEAR:
             return new BilinearTextureValueRetrieveMethod();
+        case InterpolationMethodCode::TRILINEAR:
+            return new TrilinearTextureValueRetrieveMethod();
     }
 
     return nullptr;
 }
 
-Vector3f TextureValueRetrieveMethod::RetrieveValueFromUVCoordinate(const TextureReader *reader, float u, float v) const
+Vector3f TextureValueRetrieveMethod::RetrieveValueFromUVCoordinate(const TextureReader *reader, float u, float v, float) const
 {       
-    std::pair<float, float> rawPixelCoordinates = GetRawRowColumnPositions(u, v, reader->GetWidth(), reader->GetHeight());
+    return RetrieveValueFromLevel(reader, u, v, 0);
+}
 
-    return RetrieveValueFromPixelCoordinate(reader, rawPixelCoordinates.second, rawPixelCoordinates.first);
+Vector3f TextureValueRetrieveMethod::RetrieveValueFromLevel(const TextureReader *reader, float u, float v, int level) const
+{
+    std::pair<float, float> rawPixelCoordinates = GetRawRowColumnPositions(u, v, reader->GetWidth(level), reader->GetHeight(level));
+
+    return RetrieveValueFromPixelCoordinate(reader, rawPixelCoordinates.second, rawPixelCoordinates.first, level);
 }
 
 std::pair<float, float> TextureValueRetrieveMethod::GetRawRowColumnPositions(float u, float v, int width, int height) const
@@ -34,24 +44,39 @@ std::pair<float, float> TextureValueRetrieveMethod::GetRawRowColumnPositions(flo
     return std::make_pair<float, float>(u * (width - 1), v * (height - 1));
 }
 
-Vector3f NearestTextureValueRetrieveMethod::RetrieveValueFromPixelCoordinate(const TextureReader *reader, float rawRowPosition, float rawColumnPosition) const
+Vector3f NearestTextureValueRetrieveMethod::RetrieveValueFromPixelCoordinate(const TextureReader *reader, float rawRowPosition, float rawColumnPosition, int level) const
 {
     int row = round(rawRowPosition);
     int column = round(rawColumnPosition);
-    return reader->FetchPixelValueFromTexture(row, column);
+    return reader->FetchPixelValueFromTexture(row, column, level);
 }
 
-Vector3f BilinearTextureValueRetrieveMethod::RetrieveValueFromPixelCoordinate(const TextureReader *reader, float rawRowPosition, float rawColumnPosition) const
+Vector3f BilinearTextureValueRetrieveMethod::RetrieveValueFromPixelCoordinate(const TextureReader *reader, float rawRowPosition, float rawColumnPosition, int level) const
 {
     int row = floor(rawRowPosition);
     int column = floor(rawColumnPosition);
     float rowOffsetFromCenter = rawRowPosition - row;
     float columnOffsetFromCenter = rawColumnPosition - column;
 
-    return reader->FetchPixelValueFromTexture(row, column) * (1 - rowOffsetFromCenter) * (1 - columnOffsetFromCenter) +
-           reader->FetchPixelValueFromTexture(row + 1, column) * (rowOffsetFromCenter) * (1 - columnOffsetFromCenter) +
-           reader->FetchPixelValueFromTexture(row, column + 1) * (1 - rowOffsetFromCenter) * (columnOffsetFromCenter) +
-           reader->FetchPixelValueFromTexture(row + 1, column + 1) * (rowOffsetFromCenter) * (columnOffsetFromCenter);
+    return reader->InterpolateBilinear(row, column, rowOffsetFromCenter, columnOffsetFromCenter, level);
+}
+
+Vector3f TrilinearTextureValueRetrieveMethod::RetrieveValueFromUVCoordinate(const TextureReader *reader, float u, float v, float uvFootprint) const
+{
+    float footprintInTexels = uvFootprint * std::max(reader->GetWidth(), reader->GetHeight());
+    if (footprintInTexels <= 1.0f) // Magnified, base image is the sharpest level
+        return RetrieveValueFromLevel(reader, u, v, 0);
+
+    int lastLevel = reader->GetLevelCount() - 1;
+    float level = std::log2(footprintInTexels);
+    if (level >= lastLevel)
+        return RetrieveValueFromLevel(reader, u, v, lastLevel);
+
+    int finerLevel = (int)level;
+    float coarserWeight = level - finerLevel;
+
+    return RetrieveValueFromLevel(reader, u, v, finerLevel) * (1 - coarserWeight) +
+           RetrieveValueFromLevel(reader, u, v, finerLevel + 1) * coarserWeight;
 }
 
 }
\ No newline at end of file
@@ -8,7 +8,8 @@ namespace actracer
 enum class InterpolationMethodCode
 {
     NEAREST,
-    BILINEAR
+    BILINEAR,
+    TRILINEAR
 };
 
 class TextureReader;
@@ -18,11 +19,18 @@ class TextureValueRetrieveMethod
 public:
     static TextureValueRetrieveMethod *CreateTextureValueRetrieveMethod(InterpolationMethodCode interpolationMethodCode);
 
-    Vector3f RetrieveValueFromUVCoordinate(const TextureReader *reader, float u, float v) const;
+    /*
+     * uvFootprint is the size of the area around uv that is covered, it is ignored by the methods that read the base image
+     */
+    virtual Vector3f RetrieveValueFromUVCoordinate(const TextureReader *reader, float u, float v, float uvFootprint) const;
+
+    virtual ~TextureValueRetrieveMethod() { }
 protected:
     TextureValueRetrieveMethod() { }
 
-    virtual Vector3f RetrieveValueFromPixelCoordinate(const TextureReader* reader, float rawRowPosition, float rawColumnPosition) const = 0;
+    Vector3f RetrieveValueFromLevel(const TextureReader *reader, float u, float v, int level) const;
+
+    virtual Vector3f RetrieveValueFromPixelCoordinate(const TextureReader* reader, float rawRowPosition, float rawColumnPosition, int level) const = 0;
     std::pair<float, float> GetRawRowColumnPositions(float u, float v, int width, int heigh) const;
 };
 
@@ -31,7 +39,7 @@ class NearestTextureValueRetrieveMethod : public TextureValueRetrieveMethod
 public:
     NearestTextureValueRetrieveMethod() { }
 
-    virtual Vector3f RetrieveValueFromPixelCoordinate(const TextureReader *reader, float rawRowPosition, float rawColumnPosition) const override;
+    virtual Vector3f RetrieveValueFromPixelCoordinate(const TextureReader *reader, float rawRowPosition, float rawColumnPosition, int level) const override;
 };
 
 class BilinearTextureValueRetrieveMethod : public TextureValueRetrieveMethod
@@ -39,7 +47,18 @@ class BilinearTextureValueRetrieveMethod : public TextureValueRetrieveMethod
 public:
     BilinearTextureValueRetrieveMethod() { }
 
-    virtual Vector3f RetrieveValueFromPixelCoordinate(const TextureReader *reader, float rawRowPosition, float rawColumnPosition) const override;
+    virtual Vector3f RetrieveValueFromPixelCoordinate(const TextureReader *reader, float rawRowPosition, float rawColumnPosition, int level) const override;
+};
+
+/*
+ * Blends bilinear values of the two mip levels whose texel size is the closest to the footprint
+ */
+class TrilinearTextureValueRetrieveMethod : public BilinearTextureValueRetrieveMethod
+{
+public:
+    TrilinearTextureValueRetrieveMethod() { }
+
+    virtual Vector3f RetrieveValueFromUVCoordinate(const TextureReader *reader, float u, float v, float uvFootprint) const override;
 };
 
 }
\ No newline at end of file
@@ -87,7 +87,7 @@ bool Tonemapper::SaveEXR(const float *rgb, int width, int height, const char *ou
     {
         fprintf(stderr, "Save EXR err: %s\n", err);
         FreeEXRErrorMessage(err); // free's buffer for an error message
-        return ret;
+        return false;
     }
     printf("Saved exr file. [ %s ] \n", outfilename);
 
@@ -96,6 +96,8 @@ bool Tonemapper::SaveEXR(const float *rgb, int width, int height, const char *ou
     free(header.channels);
     free(header.pixel_types);
     free(header.requested_pixel_types);
+
+    return true;
 }
 
 TMOData Tonemapper::ReadExr(std::string file)
@@ -125,4 +127,31 @@ TMOData Tonemapper::ReadExr(std::string file)
     return result;
 }
 
+bool Tonemapper::ReadExrSize(const std::string &file, int &width, int &height)
+{
+    EXRVersion version;
+    if (ParseEXRVersionFromFile(&version, file.c_str()) != TINYEXR_SUCCESS)
+        return false;
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+
+    const char *err = nullptr;
+    if (ParseEXRHeaderFromFile(&header, &version, file.c_str(), &err) != TINYEXR_SUCCESS)
+    {
+        if (err)
+        {
+            fprintf(stderr, "ERR : %s\n", err);
+            FreeEXRErrorMessage(err);
+        }
+        return false;
+    }
+
+    width = header.data_window[2] - header.data_window[0] + 1;
+    height = header.data_window[3] - header.data_window[1] + 1;
+    FreeEXRHeader(&header);
+
+    return true;
+}
+
 }
\ No newline at end of file
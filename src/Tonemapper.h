@@ -33,6 +33,10 @@ public:
     static bool SaveEXR(const float *rgb, int width, int height, const char *outfilename);
 
     static TMOData ReadExr(std::string file);
+    /*
+     * Reads only the header, returns false if it can not be read
+     */
+    static bool ReadExrSize(const std::string &file, int &width, int &height);
 
 public:
     void SetTonemapStrategy(TonemapType tonemapType);
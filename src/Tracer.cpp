@@ -0,0 +1,121 @@
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace actracer
+{
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+struct TraceEvent
+{
+    const char *name;
+    int index;
+    Clock::time_point start;
+    Clock::time_point end;
+};
+
+/*
+ * Buffers stay alive after their threads exit so that the events can be written at the end
+ */
+struct ThreadTraceBuffer
+{
+    static constexpr int capacity = 16384;
+
+    int threadId;
+    std::vector<TraceEvent> events;
+    uint64_t recordedEventCount = 0; // Keeps counting after the buffer wraps around
+
+    explicit ThreadTraceBuffer(int id) : threadId(id), events(capacity) {}
+};
+
+constexpr int ThreadTraceBuffer::capacity;
+
+std::mutex buffersMutex;
+std::vector<ThreadTraceBuffer *> threadBuffers;
+Clock::time_point traceStart;
+
+thread_local ThreadTraceBuffer *currentThreadBuffer = nullptr;
+
+ThreadTraceBuffer &GetCurrentThreadBuffer()
+{
+    if (currentThreadBuffer == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        currentThreadBuffer = new ThreadTraceBuffer(threadBuffers.size());
+        threadBuffers.push_back(currentThreadBuffer);
+    }
+
+    return *currentThreadBuffer;
+}
+
+double MicrosecondsSinceTraceStart(const Clock::time_point &timePoint)
+{
+    return std::chrono::duration<double, std::micro>(timePoint - traceStart).count();
+}
+
+}
+
+std::atomic<bool> Tracer::sIsEnabled{false};
+
+void Tracer::Enable()
+{
+    traceStart = Clock::now();
+    sIsEnabled = true;
+}
+
+void Tracer::Record(const char *name, int index, const Clock::time_point &start, const Clock::time_point &end)
+{
+    ThreadTraceBuffer &buffer = GetCurrentThreadBuffer();
+    buffer.events[buffer.recordedEventCount % ThreadTraceBuffer::capacity] = TraceEvent{name, index, start, end};
+    ++buffer.recordedEventCount;
+}
+
+bool Tracer::WriteChromeTrace(const char *filePath)
+{
+    FILE *output = fopen(filePath, "w");
+    if (output == nullptr)
+        return false;
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+
+    fprintf(output, "{\"traceEvents\":[\n");
+
+    bool isFirstEvent = true;
+    for (const ThreadTraceBuffer *buffer : threadBuffers)
+    {
+        uint64_t eventCount = std::min<uint64_t>(buffer->recordedEventCount, ThreadTraceBuffer::capacity);
+        uint64_t firstEvent = buffer->recordedEventCount - eventCount;
+
+        fprintf(output, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+                isFirstEvent ? "" : ",\n", buffer->threadId, buffer->threadId);
+        isFirstEvent = false;
+
+        for (uint64_t i = firstEvent; i < buffer->recordedEventCount; ++i)
+        {
+            const TraceEvent &event = buffer->events[i % ThreadTraceBuffer::capacity];
+
+            fprintf(output, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    event.name, buffer->threadId, MicrosecondsSinceTraceStart(event.start),
+                    std::chrono::duration<double, std::micro>(event.end - event.start).count());
+
+            if (event.index >= 0)
+                fprintf(output, ",\"args\":{\"index\":%d}", event.index);
+
+            fprintf(output, "}");
+        }
+    }
+
+    fprintf(output, "\n]}\n");
+    fclose(output);
+
+    return true;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace actracer
+{
+
+/*
+ * Records the timeline of scoped events and writes it as Chrome trace JSON,
+ * the file can be opened in chrome://tracing or Perfetto.
+ * Each thread records into its own ring buffer so recording does not synchronize,
+ * when the buffer is full the oldest events are overwritten.
+ * Nothing is recorded until Enable is called, disabled scopes only check a flag
+ */
+class Tracer
+{
+public:
+    static void Enable();
+    static bool IsEnabled();
+
+    /*
+     * Writes the events of all threads that are recorded so far, returns false if the file can not be written
+     */
+    static bool WriteChromeTrace(const char *filePath);
+
+private:
+    friend class TraceScope;
+
+    typedef std::chrono::steady_clock Clock;
+
+    /*
+     * name must outlive the tracer, string literals are expected
+     */
+    static void Record(const char *name, int index, const Clock::time_point &start, const Clock::time_point &end);
+
+    static std::atomic<bool> sIsEnabled;
+};
+
+/*
+ * Records an event that lasts from its construction to its destruction,
+ * index is shown among the arguments of the event if it is not negative
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name, int index = -1);
+    ~TraceScope();
+
+private:
+    const char *mName;
+    int mIndex;
+    Tracer::Clock::time_point mStart;
+};
+
+inline bool Tracer::IsEnabled()
+{
+    return sIsEnabled.load(std::memory_order_relaxed);
+}
+
+inline TraceScope::TraceScope(const char *name, int index)
+    : mName(nullptr), mIndex(index)
+{
+    if (!Tracer::IsEnabled())
+        return;
+
+    mName = name;
+    mStart = Tracer::Clock::now();
+}
+
+inline TraceScope::~TraceScope()
+{
+    if (mName)
+        Tracer::Record(mName, mIndex, mStart, Tracer::Clock::now());
+}
+
+}
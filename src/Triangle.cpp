@@ -1,9 +1,14 @@
 #include "Scene.h"
 #include "Triangle.h"
 #include "Texture.h"
+#include "RenderStatistics.h"
+#include "RayPacket.h"
 
 #include "NormalChangerTexture.h"
 
+#include <cmath>
+#include <bitset>
+
 namespace actracer {
 
 Triangle::Triangle(int _id, Material *_mat, const Vector3f &p0, const Vector3f &p1, const Vector3f &p2,
@@ -104,6 +109,134 @@ void Triangle::RegulateVertices()
     }
 }
 
+void Triangle::AccumulateVertexTangents()
+{
+    ComputeObjectTangentFrame();
+    mSmoothsTangents = true;
+
+    const Vector3f &tangent = mObjectTangentFrame.tangent;
+    if (!std::isfinite(Dot(tangent, tangent))) // Triangles with degenerate uvs do not bend the tangents of their vertices
+        return;
+
+    v0->t += tangent;
+    v1->t += tangent;
+    v2->t += tangent;
+}
+
+void Triangle::SetTextures(const ColorChangerTexture *colorChangerTexture, const NormalChangerTexture *normalChangerTexture)
+{
+    Shape::SetTextures(colorChangerTexture, normalChangerTexture);
+
+    if (mNormalChangerTexture)
+        ComputeTangentFrames();
+}
+
+void Triangle::SetTransformation(Transform *newTransform, bool owned)
+{
+    Shape::SetTransformation(newTransform, owned);
+
+    if (mNormalChangerTexture)
+        ComputeTangentFrames();
+}
+
+void Triangle::ComputeTangentFrames()
+{
+    ComputeObjectTangentFrame();
+
+    Vector3f firstEdge = -p0p1;
+    Vector3f secondEdge = -p0p2;
+    if (objTransform)
+    {
+        firstEdge = (*objTransform)(Vector4f(firstEdge, 0.0f), true);
+        secondEdge = (*objTransform)(Vector4f(secondEdge, 0.0f), true);
+    }
+
+    Vector3f uvTangent, uvBitangent;
+    ComputeUVTangents(firstEdge, secondEdge, uvTangent, uvBitangent);
+
+    glm::vec3 tangent = uvTangent;
+    glm::vec3 bitangent = uvBitangent;
+
+    // Gram-Schmidt against the normal of the tangents
+    glm::vec3 tangentNormal = glm::cross(tangent, bitangent);
+
+    tangent = tangent - tangentNormal * glm::dot(tangent, tangentNormal);
+    bitangent = bitangent - glm::dot(bitangent, tangentNormal) * tangentNormal - glm::dot(tangent, bitangent) * tangent;
+
+    mWorldTangentFrame = TangentFrame{tangent, bitangent, tangentNormal};
+}
+
+void Triangle::ComputeObjectTangentFrame()
+{
+    ComputeUVTangents(-p0p1, -p0p2, mObjectTangentFrame.tangent, mObjectTangentFrame.bitangent);
+    mObjectTangentFrame.normal = normal;
+
+    mTangentHandedness = Dot(Cross(normal, mObjectTangentFrame.tangent), mObjectTangentFrame.bitangent) < 0 ? -1.0f : 1.0f;
+}
+
+void Triangle::ComputeUVTangents(const Vector3f &firstEdge, const Vector3f &secondEdge, Vector3f &tangent, Vector3f &bitangent) const
+{
+    glm::vec2 firstUVEdge = -glm::vec2(v0->uv.u - v1->uv.u, v0->uv.v - v1->uv.v);
+    glm::vec2 secondUVEdge = -glm::vec2(v0->uv.u - v2->uv.u, v0->uv.v - v2->uv.v);
+
+    glm::mat2x2 inverseUVEdgeMatrix = glm::inverse(glm::mat2x2(glm::vec2(firstUVEdge.x, secondUVEdge.x), glm::vec2(firstUVEdge.y, secondUVEdge.y)));
+    glm::mat3x2 edgeMatrix(glm::vec2(firstEdge.x, secondEdge.x),
+                           glm::vec2(firstEdge.y, secondEdge.y),
+                           glm::vec2(firstEdge.z, secondEdge.z));
+
+    glm::mat3x2 combinedMatrix = inverseUVEdgeMatrix * edgeMatrix;
+
+    tangent = Normalize(Vector3f(combinedMatrix[0].x, combinedMatrix[1].x, combinedMatrix[2].x));
+    bitangent = Normalize(Vector3f(combinedMatrix[0].y, combinedMatrix[1].y, combinedMatrix[2].y));
+}
+
+TangentFrame Triangle::ComputeSmoothObjectTangentFrame(const Vector3f &localPoint) const
+{
+    // Barycentric coordinates of the point, the hit record is not kept in the intersection
+    Vector3f firstEdge = -p0p1;
+    Vector3f secondEdge = -p0p2;
+    Vector3f pointEdge = localPoint - v0->p;
+
+    float firstEdgeDot = Dot(firstEdge, firstEdge);
+    float crossEdgeDot = Dot(firstEdge, secondEdge);
+    float secondEdgeDot = Dot(secondEdge, secondEdge);
+    float firstPointDot = Dot(pointEdge, firstEdge);
+    float secondPointDot = Dot(pointEdge, secondEdge);
+
+    float inverseDenominator = 1 / (firstEdgeDot * secondEdgeDot - crossEdgeDot * crossEdgeDot);
+    float beta = (secondEdgeDot * firstPointDot - crossEdgeDot * secondPointDot) * inverseDenominator;
+    float gamma = (firstEdgeDot * secondPointDot - crossEdgeDot * firstPointDot) * inverseDenominator;
+    float alpha = 1 - beta - gamma;
+
+    TangentFrame frame;
+    frame.normal = Normalize(v0->n * alpha + v1->n * beta + v2->n * gamma);
+
+    Vector3f tangent = v0->t * alpha + v1->t * beta + v2->t * gamma;
+    frame.tangent = Normalize(tangent - frame.normal * Dot(frame.normal, tangent));
+    frame.bitangent = Cross(frame.normal, frame.tangent) * mTangentHandedness;
+
+    return frame;
+}
+
+TangentFrame Triangle::GetWorldTangentFrame(const SurfaceIntersection &intersection) const
+{
+    if (!mSmoothsTangents)
+        return mWorldTangentFrame;
+
+    TangentFrame frame = ComputeSmoothObjectTangentFrame(intersection.lip);
+
+    // The normal of the intersection is the smooth normal already taken into world space
+    Vector3f tangent = frame.tangent;
+    if (objTransform)
+        tangent = (*objTransform)(Vector4f(tangent, 0.0f), true);
+
+    frame.normal = intersection.n;
+    frame.tangent = Normalize(tangent - frame.normal * Dot(frame.normal, tangent));
+    frame.bitangent = Cross(frame.normal, frame.tangent) * mTangentHandedness;
+
+    return frame;
+}
+
 Vector3f Triangle::GetChangedNormal(const SurfaceIntersection &intersection) const
 {
     if(mNormalChangerTexture != nullptr)
@@ -112,30 +245,182 @@ Vector3f Triangle::GetChangedNormal(const SurfaceIntersection &intersection) con
     return intersection.n;
 }
 
-void Triangle::Intersect(Ray &rr, SurfaceIntersection &rt, float intersectionTestEpsilon)
+void Triangle::Intersect(Ray &rr, HitRecord &hit, float intersectionTestEpsilon)
 {
+    ACTRACER_STATS_INCREMENT(TRIANGLE_TESTS, 1);
+
+    if (mIsBakedIntoWorldSpace)
+    {
+        IntersectInWorldSpace(rr, hit, intersectionTestEpsilon);
+        return;
+    }
+
     Ray transformedRay = rr; // Ray to use in intersection test
     TransformRayIntoObjectSpace(rr, transformedRay);
 
     float t, beta, gamma;
     bool hasIntersected;
-    CalculateTValueForIntersection(transformedRay, hasIntersected, t, beta, gamma, intersectionTestEpsilon);
+    CalculateTValueForIntersection(transformedRay, v0->p, p0p1, p0p2, hasIntersected, t, beta, gamma, intersectionTestEpsilon);
 
     // Check if t value is in the front
     if (hasIntersected && t >= -intersectionTestEpsilon)
     {
         Vector3f intersectionPoint = (transformedRay)(t);
-        Vector3f surfaceNormal = this->normal;
-        Vector3f localIntersectionPoint = intersectionPoint;
 
-        Vector2f uv;
-        CalculateSurfaceValues(1 + intersectionTestEpsilon, beta, gamma, uv, surfaceNormal);
-        TransformSurfaceValues(rr, transformedRay, intersectionPoint, surfaceNormal);
+        Transform motionTransform{};
+        const Transform *surfaceTransform = GetSurfaceTransform(rr, motionTransform);
+        if (surfaceTransform)
+            intersectionPoint = (*surfaceTransform)(Vector4f(intersectionPoint, 1.0f), true);
+
+        hit = HitRecord(rr(intersectionPoint), t, beta, gamma, intersectionPoint, this);
+    }
+}
+
+unsigned Triangle::IntersectPacket(const RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon)
+{
+    if (!mIsBakedIntoWorldSpace)
+        return Shape::IntersectPacket(packet, activeRays, hits, intersectionTestEpsilon);
+
+    ACTRACER_STATS_INCREMENT(TRIANGLE_TESTS, std::bitset<RayPacket::size>(activeRays).count());
+
+    float t[RayPacket::size];
+    float beta[RayPacket::size];
+    float gamma[RayPacket::size];
+    unsigned hitRays = CalculateTValuesForPacket(packet, t, beta, gamma, intersectionTestEpsilon) & activeRays;
+
+    for (int i = 0; i < RayPacket::size; ++i)
+    {
+        if (hitRays & (1u << i))
+            hits[i] = HitRecord(t[i], t[i], beta[i], gamma[i], packet.GetRay(i)(t[i]), this);
+    }
+
+    return hitRays;
+}
+
+void Triangle::Finalize(Ray &rr, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon)
+{
+    if (mIsBakedIntoWorldSpace)
+    {
+        FinalizeInWorldSpace(rr, hit, rt, intersectionTestEpsilon);
+        return;
+    }
+
+    Ray transformedRay = rr;
+    TransformRayIntoObjectSpace(rr, transformedRay);
+
+    Vector3f localIntersectionPoint = (transformedRay)(hit.localT);
+    Vector3f surfaceNormal = this->normal;
+
+    Vector2f uv;
+    CalculateSurfaceValues(1 + intersectionTestEpsilon, hit.beta, hit.gamma, uv, surfaceNormal);
+
+    Transform motionTransform{};
+    const Transform *surfaceTransform = GetSurfaceTransform(rr, motionTransform);
+    if (surfaceTransform)
+    {
+        surfaceNormal = (*surfaceTransform)(Vector4f(surfaceNormal, 0.0f), true, true);
+        surfaceNormal = Normalize(surfaceNormal);
+    }
+
+    rt = SurfaceIntersection(localIntersectionPoint, hit.ip, surfaceNormal, uv, Normalize(rr.o - hit.ip), hit.t, mat, this, ownerMesh, mColorChangerTexture, mNormalChangerTexture);
+
+    if (rr.hasDifferentials)
+    {
+        if (surfaceTransform)
+            ComputeDifferentials(rr, (*surfaceTransform)(Vector4f(p0p1, 0.0f), true), (*surfaceTransform)(Vector4f(p0p2, 0.0f), true), rt);
+        else
+            ComputeDifferentials(rr, p0p1, p0p2, rt);
+    }
+}
+
+void Triangle::IntersectInWorldSpace(const Ray &r, HitRecord &hit, float intersectionTestEpsilon)
+{
+    float t, beta, gamma;
+    bool hasIntersected;
+    CalculateTValueForIntersection(r, mWorldFirstVertex, mWorldP0P1, mWorldP0P2, hasIntersected, t, beta, gamma, intersectionTestEpsilon);
+
+    // t is already the parameter of the world space ray
+    if (hasIntersected && t >= -intersectionTestEpsilon)
+        hit = HitRecord(t, t, beta, gamma, r(t), this);
+}
+
+void Triangle::FinalizeInWorldSpace(const Ray &r, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon)
+{
+    const float epsilon = 1 + intersectionTestEpsilon;
+
+    // Object space point is kept for the textures
+    Vector3f localIntersectionPoint = v0->p * (epsilon - hit.beta - hit.gamma) +
+                                      v1->p * hit.beta +
+                                      v2->p * hit.gamma;
+    Vector3f surfaceNormal = mWorldNormal;
+
+    Vector2f uv;
+    CalculateSurfaceValues(epsilon, hit.beta, hit.gamma, uv, surfaceNormal);
+
+    // Vertex normals are in object space
+    if (shadingMode == Shape::ShadingMode::SMOOTH && mSmoothNormalTransform)
+    {
+        surfaceNormal = (*mSmoothNormalTransform)(Vector4f(surfaceNormal, 0.0f), true, true);
+        surfaceNormal = Normalize(surfaceNormal);
+    }
+
+    rt = SurfaceIntersection(localIntersectionPoint, hit.ip, surfaceNormal, uv, Normalize(r.o - hit.ip), hit.t, mat, this, ownerMesh, mColorChangerTexture, mNormalChangerTexture);
+
+    if (r.hasDifferentials)
+        ComputeDifferentials(r, mWorldP0P1, mWorldP0P2, rt);
+}
+
+void Triangle::ComputeDifferentials(const Ray &r, const Vector3f &worldP0P1, const Vector3f &worldP0P2, SurfaceIntersection &rt) const
+{
+    Vector2f duv02 = v0->uv - v2->uv;
+    Vector2f duv12 = v1->uv - v2->uv;
 
-        t = rr(intersectionPoint);
+    Vector3f dpdu{}, dpdv{};
 
-        rt = SurfaceIntersection(localIntersectionPoint, intersectionPoint, surfaceNormal, uv, Normalize(rr.o - intersectionPoint), t, mat, this, ownerMesh, mColorChangerTexture, mNormalChangerTexture);
+    float determinant = duv02.u * duv12.v - duv02.v * duv12.u;
+    if (determinant != 0) // Triangles without uv only carry the differentials for the branch rays
+    {
+        Vector3f dp02 = worldP0P2;
+        Vector3f dp12 = worldP0P2 - worldP0P1;
+
+        float inverseDeterminant = 1 / determinant;
+        dpdu = (dp02 * duv12.v - dp12 * duv02.v) * inverseDeterminant;
+        dpdv = (dp12 * duv02.u - dp02 * duv12.u) * inverseDeterminant;
     }
+
+    rt.ComputeDifferentials(r, dpdu, dpdv);
+}
+
+/*
+ * Vertices and normals of the object space stay untouched, they are shared with the instances
+ * of the mesh and the normal changer textures compute tangent frames from them
+ */
+void Triangle::BakeIntoWorldSpace()
+{
+    if (activeMotion || IsMotionBlurActive())
+        return;
+
+    Vector3f secondVertex = v1->p;
+    Vector3f thirdVertex = v2->p;
+
+    mWorldFirstVertex = v0->p;
+    mWorldNormal = normal;
+    mSmoothNormalTransform = nullptr;
+
+    if (objTransform && !objTransform->IsIdentity())
+    {
+        mWorldFirstVertex = (*objTransform)(Vector4f(v0->p, 1.0f), true);
+        secondVertex = (*objTransform)(Vector4f(v1->p, 1.0f), true);
+        thirdVertex = (*objTransform)(Vector4f(v2->p, 1.0f), true);
+
+        mWorldNormal = Normalize((*objTransform)(Vector4f(normal, 0.0f), true, true));
+        mSmoothNormalTransform = objTransform;
+    }
+
+    mWorldP0P1 = mWorldFirstVertex - secondVertex;
+    mWorldP0P2 = mWorldFirstVertex - thirdVertex;
+
+    mIsBakedIntoWorldSpace = true;
 }
 
 void Triangle::TransformRayIntoObjectSpace(Ray &baseRay, Ray &r) const
@@ -183,7 +468,7 @@ void Triangle::TransformAndRecordRay(Ray& baseRay, Ray &r) const
     r = *(baseRay.transformedModes.at(ownerMesh));
 }
 
-void Triangle::CalculateTValueForIntersection(const Ray &r, bool &hasIntersected, float &t, float &beta, float &gamma, float intersectionTestEpsilon) const
+void Triangle::CalculateTValueForIntersection(const Ray &r, const Vector3f &p0, const Vector3f &p0p1, const Vector3f &p0p2, bool &hasIntersected, float &t, float &beta, float &gamma, float intersectionTestEpsilon) const
 {
     hasIntersected = false;
     t = 0;
@@ -192,7 +477,7 @@ void Triangle::CalculateTValueForIntersection(const Ray &r, bool &hasIntersected
     Vector3f r2 = {p0p1.y, p0p2.y, r.d.y};
     Vector3f r3 = {p0p1.z, p0p2.z, r.d.z};
 
-    Vector3f p0ro = {v0->p.x - r.o.x, v0->p.y - r.o.y, v0->p.z - r.o.z}; // Precalculate commonly used vector
+    Vector3f p0ro = {p0.x - r.o.x, p0.y - r.o.y, p0.z - r.o.z}; // Precalculate commonly used vector
 
     float detM = r1.x * (r2.y * r3.z - r2.z * r3.y) + r2.x * (r1.z * r3.y - r1.y * r3.z) + r3.x * (r1.y * r2.z - r1.z * r2.y); // Main determinant
 
@@ -249,6 +534,65 @@ void Triangle::CalculateTValueForIntersection(const Ray &r, bool &hasIntersected
     gamma = v2;
 }
 
+/*
+ * Same determinants as CalculateTValueForIntersection with the rows written out, operations are kept in the same order
+ * so that the lanes give the same results as the single ray test. Lanes are computed without branches and are rejected
+ * by the same comparisons at the end
+ */
+unsigned Triangle::CalculateTValuesForPacket(const RayPacket &packet, float *t, float *beta, float *gamma, float intersectionTestEpsilon) const
+{
+    const float *originX = packet.GetOrigins(0);
+    const float *originY = packet.GetOrigins(1);
+    const float *originZ = packet.GetOrigins(2);
+    const float *directionX = packet.GetDirections(0);
+    const float *directionY = packet.GetDirections(1);
+    const float *directionZ = packet.GetDirections(2);
+
+    const Vector3f &p0 = mWorldFirstVertex;
+    const Vector3f &p0p1 = mWorldP0P1;
+    const Vector3f &p0p2 = mWorldP0P2;
+
+    float err = 1 + intersectionTestEpsilon;
+
+    bool hasIntersected[RayPacket::size];
+    for (int i = 0; i < RayPacket::size; ++i)
+    {
+        float dx = directionX[i];
+        float dy = directionY[i];
+        float dz = directionZ[i];
+
+        float px = p0.x - originX[i];
+        float py = p0.y - originY[i];
+        float pz = p0.z - originZ[i];
+
+        float detM = p0p1.x * (p0p2.y * dz - dy * p0p2.z) + p0p1.y * (dx * p0p2.z - p0p2.x * dz) + p0p1.z * (p0p2.x * dy - dx * p0p2.y);
+        float invDetM = 1 / detM;
+
+        float det1 = px * (p0p2.y * dz - dy * p0p2.z) + py * (dx * p0p2.z - p0p2.x * dz) + pz * (p0p2.x * dy - dx * p0p2.y);
+        float v1 = det1 * invDetM;
+
+        float det2 = p0p1.x * (py * dz - dy * pz) + p0p1.y * (dx * pz - px * dz) + p0p1.z * (px * dy - dx * py);
+        float v2 = det2 * invDetM;
+
+        float det3 = p0p1.x * (p0p2.y * pz - py * p0p2.z) + p0p1.y * (px * p0p2.z - p0p2.x * pz) + p0p1.z * (p0p2.x * py - px * p0p2.y);
+
+        t[i] = det3 * invDetM;
+        beta[i] = v1;
+        gamma[i] = v2;
+
+        hasIntersected[i] = !(detM == 0.0f) &&
+                            !(v1 < -intersectionTestEpsilon || v1 > err) &&
+                            !(v2 < -intersectionTestEpsilon || v2 > err || v1 + v2 > err) &&
+                            t[i] >= -intersectionTestEpsilon;
+    }
+
+    unsigned hitRays = 0;
+    for (int i = 0; i < RayPacket::size; ++i)
+        hitRays |= (hasIntersected[i] ? 1u : 0u) << i;
+
+    return hitRays;
+}
+
 void Triangle::CalculateSurfaceValues(const float epsilon, const float beta, const float gamma, Vector2f &uv, Vector3f &surfaceNormal) const
 {
     uv = v0->uv * (epsilon - beta - gamma) +
@@ -265,10 +609,9 @@ void Triangle::CalculateSurfaceValues(const float epsilon, const float beta, con
     }
 }
 
-void Triangle::TransformSurfaceValues(const Ray &baseRay, const Ray &transformedRay, Vector3f &intersectionPoint, Vector3f &surfaceNormal) const
+const Transform *Triangle::GetSurfaceTransform(const Ray &baseRay, Transform &motionTransform) const
 {
-    Transform tempTransform{};
-    Transform* extendedTransform;
+    const Transform* extendedTransform;
 
     if (IsOwnedByComposite())
     {
@@ -284,8 +627,8 @@ void Triangle::TransformSurfaceValues(const Ray &baseRay, const Ray &transformed
             Vector3f timeExtendedMotionBlur = motionBlur * baseRay.time; // [0, 0, 0] - [motionBlur.x, motionBlur.y, motionBlur.z]
             Transformation motionBlurTranslation = Translation(-1, (glm::vec3)timeExtendedMotionBlur);
 
-            tempTransform = (*objTransform)(motionBlurTranslation); // Update transform omitted
-            extendedTransform = &tempTransform;
+            motionTransform = (*objTransform)(motionBlurTranslation); // Update transform omitted
+            extendedTransform = &motionTransform;
         }
         else
         {
@@ -293,12 +636,52 @@ void Triangle::TransformSurfaceValues(const Ray &baseRay, const Ray &transformed
         }
     }
 
-    if (extendedTransform->transformationMatrix != glm::mat4(1))
+    if (extendedTransform->IsIdentity())
+        return nullptr;
+
+    return extendedTransform;
+}
+
+BoundingVolume3f Triangle::GetClippedBoundingBox(int axis, float slabMin, float slabMax) const
+{
+    if (IsMotionBlurActive())
+        return Shape::GetClippedBoundingBox(axis, slabMin, slabMax);
+
+    Vector3f vertices[3] = { v0->p, v1->p, v2->p };
+    if (mIsBakedIntoWorldSpace) // Same vertices that the rays are tested against
     {
-        intersectionPoint = (*extendedTransform)(Vector4f(intersectionPoint, 1.0f), true);
-        surfaceNormal = (*extendedTransform)(Vector4f(surfaceNormal, 0.0f), true, true); // !!!!!!!! was this->normal
-        surfaceNormal = Normalize(surfaceNormal);
+        vertices[0] = mWorldFirstVertex;
+        vertices[1] = mWorldFirstVertex - mWorldP0P1;
+        vertices[2] = mWorldFirstVertex - mWorldP0P2;
+    }
+    else if (objTransform && !objTransform->IsIdentity())
+    {
+        for (Vector3f &vertex : vertices)
+            vertex = (*objTransform)(Vector4f(vertex, 1.0f), true);
+    }
+
+    // Vertices in the slab and the points that the edges cross its planes
+    BoundingVolume3f clippedBbox{};
+    for (int i = 0; i < 3; ++i)
+    {
+        const Vector3f &start = vertices[i];
+        const Vector3f &end = vertices[(i + 1) % 3];
+
+        if (start[axis] >= slabMin && start[axis] <= slabMax)
+            clippedBbox = Merge(clippedBbox, start);
+
+        for (float plane : { slabMin, slabMax })
+        {
+            if ((start[axis] < plane) == (end[axis] < plane) || start[axis] == plane || end[axis] == plane)
+                continue;
+
+            Vector3f crossing = start + (end - start) * ((plane - start[axis]) / (end[axis] - start[axis]));
+            crossing[axis] = plane;
+            clippedBbox = Merge(clippedBbox, crossing);
+        }
     }
+
+    return clippedBbox;
 }
 
 Triangle *Triangle::Clone(bool resetTransform) const
@@ -336,6 +719,10 @@ Triangle *Triangle::Clone(bool resetTransform) const
 
     cloned->normal = this->normal;
 
+    cloned->mSmoothsTangents = mSmoothsTangents;
+    if (mNormalChangerTexture)
+        cloned->ComputeTangentFrames();
+
     return cloned;
 }
 
@@ -5,6 +5,16 @@
 
 namespace actracer {
 
+/*
+ * Tangent, bitangent and normal of a surface that normal changer textures express their normals in
+ */
+struct TangentFrame
+{
+    Vector3f tangent;
+    Vector3f bitangent;
+    Vector3f normal;
+};
+
 class Triangle : public Shape {
 private:
     Vertex* v0; //
@@ -16,6 +26,20 @@ private:
     // Precalculated edge vectors
     Vector3f p0p1;  
     Vector3f p0p2; 
+
+    // World space copies of the tested geometry, filled in when the triangle is baked
+    bool mIsBakedIntoWorldSpace = false;
+    Vector3f mWorldFirstVertex;
+    Vector3f mWorldP0P1;
+    Vector3f mWorldP0P2;
+    Vector3f mWorldNormal;
+    const Transform *mSmoothNormalTransform = nullptr; // nullptr if the transform is identity
+
+    // Tangent frames of the normal changer texture, filled in when the texture or the transform is set
+    TangentFrame mObjectTangentFrame; // Normalized tangents of the uv edges with the normal of the triangle
+    TangentFrame mWorldTangentFrame;  // Orthogonalized tangents of the world space uv edges
+    bool mSmoothsTangents = false; // Tangents are interpolated from the vertices, only for smooth meshes
+    float mTangentHandedness = 1.0f; // Sign of the bitangent against the cross of normal and tangent
 public:
     Triangle(int _id, Material *_mat, const Vector3f &p0, const Vector3f &p1, const Vector3f &p2, 
              const Vector2f &uv0, const Vector2f &uv1, const Vector2f &uv2, Transform *objToWorld = nullptr, Shape *_m = nullptr, 
@@ -34,24 +58,80 @@ public:
     const Vertex* GetThirdVertex() const;
 
     const Vector3f& GetNormal() const;
+
+    /*
+     * Frames of the point of the intersection, interpolated from the vertex tangents if the tangents are smoothed
+     */
+    TangentFrame GetObjectTangentFrame(const SurfaceIntersection &intersection) const;
+    TangentFrame GetWorldTangentFrame(const SurfaceIntersection &intersection) const;
 public:
     void ModifyVertices();
 
     void PerformVertexModification();
     void RegulateVertices();
-
-    void Intersect(Ray &r, SurfaceIntersection &rt, float intersectionTestEpsilon) override;
+    /*
+     * Adds the object space tangent of the triangle to its vertices, vertex tangents are normalized by the mesh afterwards
+     */
+    void AccumulateVertexTangents();
+
+    void SetTextures(const ColorChangerTexture *colorChangerTexture, const NormalChangerTexture *normalChangerTexture) override;
+    void SetTransformation(Transform *newTransform, bool owned = false) override;
+
+    void Intersect(Ray &r, HitRecord &hit, float intersectionTestEpsilon) override;
+    /*
+     * Triangles that are baked into world space test all rays of the packet at once,
+     * the others are tested ray by ray in object space
+     */
+    unsigned IntersectPacket(const RayPacket &packet, unsigned activeRays, HitRecord *hits, float intersectionTestEpsilon) override;
+    void Finalize(Ray &r, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon) override;
+    void BakeIntoWorldSpace() override;
+    /*
+     * Clips the world space triangle itself rather than its box, so that long and thin triangles
+     * crossing the slab diagonally get a tight box
+     */
+    BoundingVolume3f GetClippedBoundingBox(int axis, float slabMin, float slabMax) const override;
     Triangle *Clone(bool resetTransform) const override;
 private:
+    void IntersectInWorldSpace(const Ray &r, HitRecord &hit, float intersectionTestEpsilon);
+    void FinalizeInWorldSpace(const Ray &r, const HitRecord &hit, SurfaceIntersection &rt, float intersectionTestEpsilon);
+
     void TransformRayIntoObjectSpace(Ray &baseRay, Ray &r) const;
     bool HasRayTransformedBefore(Ray& r) const;
 
     void TransformAndRecordRay(Ray &baseRay, Ray &r) const;
 
-    void CalculateTValueForIntersection(const Ray &r, bool &hasIntersected, float &t, float &beta, float &gamma, float intersectionTestEpsilon) const;
-    void TransformSurfaceValues(const Ray &baseRay, const Ray &transformedRay, Vector3f &intersectionPoint, Vector3f &surfaceNormal) const;
+    void CalculateTValueForIntersection(const Ray &r, const Vector3f &p0, const Vector3f &p0p1, const Vector3f &p0p2, bool &hasIntersected, float &t, float &beta, float &gamma, float intersectionTestEpsilon) const;
+    /*
+     * CalculateTValueForIntersection for each lane of the packet against the world space triangle,
+     * returns the lanes that hit in front of the origins
+     */
+    unsigned CalculateTValuesForPacket(const RayPacket &packet, float *t, float *beta, float *gamma, float intersectionTestEpsilon) const;
+    /*
+     * Transform that takes the surface values into world space for the ray, nullptr if it is identity.
+     * motionTransform is used to hold the transform extended with motion blur
+     */
+    const Transform *GetSurfaceTransform(const Ray &baseRay, Transform &motionTransform) const;
+
+    /*
+     * Derives dpdu and dpdv from the world space edges and fills the differentials of the intersection
+     */
+    void ComputeDifferentials(const Ray &r, const Vector3f &worldP0P1, const Vector3f &worldP0P2, SurfaceIntersection &rt) const;
 
     void CalculateSurfaceValues(const float epsilon, const float beta, const float gamma, Vector2f &uv, Vector3f &surfaceNormal) const;
+
+    /*
+     * Frames only depend on the triangle and its transform, so they are not computed again on every hit of a normal changer texture
+     */
+    void ComputeTangentFrames();
+    void ComputeObjectTangentFrame();
+    /*
+     * Normalized directions of the position edges that u and v change along, edges are from the first vertex
+     */
+    void ComputeUVTangents(const Vector3f &firstEdge, const Vector3f &secondEdge, Vector3f &tangent, Vector3f &bitangent) const;
+    /*
+     * Interpolated object space frame of the smoothed tangents at the local point
+     */
+    TangentFrame ComputeSmoothObjectTangentFrame(const Vector3f &localPoint) const;
 };
 
 inline const Vector3f& Triangle::GetNormal() const
@@ -59,6 +139,14 @@ inline const Vector3f& Triangle::GetNormal() const
     return normal;
 }
 
+inline TangentFrame Triangle::GetObjectTangentFrame(const SurfaceIntersection &intersection) const
+{
+    if (mSmoothsTangents)
+        return ComputeSmoothObjectTangentFrame(intersection.lip);
+
+    return mObjectTangentFrame;
+}
+
 inline const Vector3f& Triangle::GetEdgeVectorFromFirstToSecondVertex() const
 {
     return p0p1;
@@ -0,0 +1,420 @@
+#include "WavefrontRenderer.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "Image.h"
+#include "Tonemapper.h"
+#include "Timer.h"
+#include "Material.h"
+#include "Intersection.h"
+#include "Shape.h"
+#include "MultiSampledRayGenerator.h"
+#include "AccelerationStructure.h"
+#include "LightContributionCalculator.h"
+#include "LightBVH.h"
+#include "DeferredRayQueue.h"
+#include "RayPacket.h"
+#include "RenderStatistics.h"
+#include "TextureCache.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace actracer
+{
+
+constexpr int WavefrontRenderer::maxTileSize;
+constexpr int WavefrontRenderer::maxStreamRayCount;
+constexpr int WavefrontRenderer::threadCount;
+
+/*
+ * Collects the rays that are created while shading the hits of a stream,
+ * rays are tagged with the pixel and the weight of the path that is being shaded
+ */
+class WavefrontRenderer::TileRayQueue : public DeferredRayQueue
+{
+public:
+    void SetCurrentPath(int pixelIndex, const Vector3f &pathWeight);
+
+    virtual void QueueBranchRay(const Ray &branchRay, const Vector3f &branchWeight, int depth, float throughput, bool addColorOnMiss) override;
+    virtual void QueueShadowRay(const Ray &shadowRay, const Vector3f &surfacePoint, float distanceToLight, const Vector3f &contribution, int lightIndex) override;
+public:
+    RayStream<StreamRay> &GetBranchRayStream();
+    RayStream<ShadowStreamRay> &GetShadowRayStream();
+private:
+    int mPixelIndex = 0;
+    Vector3f mPathWeight;
+
+    RayStream<StreamRay> mBranchRayStream;
+    RayStream<ShadowStreamRay> mShadowRayStream;
+};
+
+void WavefrontRenderer::TileRayQueue::SetCurrentPath(int pixelIndex, const Vector3f &pathWeight)
+{
+    mPixelIndex = pixelIndex;
+    mPathWeight = pathWeight;
+}
+
+void WavefrontRenderer::TileRayQueue::QueueBranchRay(const Ray &branchRay, const Vector3f &branchWeight, int depth, float throughput, bool addColorOnMiss)
+{
+    mBranchRayStream.Push(branchRay.o, branchRay.d, StreamRay{branchRay, mPathWeight * branchWeight, mPixelIndex, depth, throughput, addColorOnMiss});
+}
+
+void WavefrontRenderer::TileRayQueue::QueueShadowRay(const Ray &shadowRay, const Vector3f &surfacePoint, float distanceToLight, const Vector3f &contribution, int lightIndex)
+{
+    mShadowRayStream.Push(shadowRay.o, shadowRay.d, ShadowStreamRay{surfacePoint, mPathWeight * contribution, distanceToLight, shadowRay.time, mPixelIndex, lightIndex});
+}
+
+RayStream<StreamRay> &WavefrontRenderer::TileRayQueue::GetBranchRayStream()
+{
+    return mBranchRayStream;
+}
+
+RayStream<ShadowStreamRay> &WavefrontRenderer::TileRayQueue::GetShadowRayStream()
+{
+    return mShadowRayStream;
+}
+
+/*
+ * Buffers of a thread that hold the intermediate results of a stream,
+ * reused by all streams of the thread so that they are not allocated again for every stream
+ */
+class WavefrontRenderer::StreamBuffers
+{
+public:
+    std::vector<HitRecord> closestHits;
+    std::vector<std::pair<const Material *, int>> shadingOrder; // Material of the hit and the position of its ray in the stream
+};
+
+// --
+
+WavefrontRenderer::~WavefrontRenderer()
+{
+    if(accelerator)
+        delete accelerator;
+    if(mLightBVH)
+        delete mLightBVH;
+}
+
+void WavefrontRenderer::RenderSceneIntoPPM(Scene *scene)
+{
+    mCurrentRenderedScene = scene;
+
+    RetrieveRenderingParamsFromScene(scene);
+
+    for (int frameIndex = 0; frameIndex < scene->GetFrameCount(); ++frameIndex)
+    {
+        // Only a few transforms change between the frames, the structure is refit instead of built again
+        if (frameIndex > 0)
+        {
+            scene->AdvanceFrame();
+            RefitAccelerationStructure(accelerator);
+        }
+
+        for (Camera *camera : scene->GetAllCameras())
+        {
+            RenderCamera(camera);
+        }
+    }
+}
+
+void WavefrontRenderer::RetrieveRenderingParamsFromScene(Scene *scene)
+{
+    if(accelerator)
+        delete accelerator;
+
+    accelerator = BuildAccelerationStructure(scene);
+    tonemapper = scene->GetTonemapper();
+
+    delete mLightBVH;
+    mLightBVH = nullptr;
+    if(scene->GetLightSampleCount() > 0)
+        mLightBVH = new LightBVH(scene->GetAllLights());
+}
+
+void WavefrontRenderer::RenderCamera(const Camera *camera)
+{
+    Timer cameraRenderTimer{camera->GetImageName()};
+    TraceScope traceScope{"Render camera", camera->GetID()};
+
+    int fresnelBranchSelectionThreshold = mCurrentRenderedScene->GetFresnelBranchSelectionThreshold();
+    mSelectFresnelBranch = fresnelBranchSelectionThreshold > 0 && camera->GetSampleCount() > fresnelBranchSelectionThreshold;
+    mTileSize = ComputeTileSize(camera);
+
+    Image sceneImage(camera->imgPlane.nx, camera->imgPlane.ny, camera->GetImageName(), tonemapper);
+
+    std::atomic<int> nextTileIndex{0};
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; ++i)
+        threads.emplace_back(&WavefrontRenderer::RenderTiles, this, camera, std::ref(sceneImage), std::ref(nextTileIndex));
+
+    for (std::thread &th : threads)
+        th.join();
+
+    ACTRACER_STATS_REPORT(camera->GetImageName());
+    if (TextureCache *textureCache = mCurrentRenderedScene->GetTextureCache())
+        textureCache->Report(camera->GetImageName());
+    sceneImage.SaveImage();
+}
+
+void WavefrontRenderer::RenderTiles(const Camera *camera, Image &image, std::atomic<int> &nextTileIndex)
+{
+    LightContributionCalculator contributionCalculator{};
+    TileRayQueue rayQueue{};
+    StreamBuffers streamBuffers{};
+    Random<double> randomGenerator{0u}; // Reseeded for each tile
+    SetupContributionCalculator(contributionCalculator, rayQueue, randomGenerator);
+
+    // Streams are reused by all tiles of the thread
+    RayStream<StreamRay> rayStream;
+    rayStream.Reserve(mTileSize * mTileSize * camera->GetSampleCount());
+
+    int tileCount = GetTileCount(camera);
+    for (int tileIndex = nextTileIndex++; tileIndex < tileCount; tileIndex = nextTileIndex++)
+    {
+        TraceScope traceScope{"Render tile", tileIndex};
+        randomGenerator = Random<double>{static_cast<unsigned>(tileIndex)};
+        RenderTile(camera, image, GetTile(camera, tileIndex), rayStream, streamBuffers, contributionCalculator, rayQueue);
+    }
+}
+
+/*
+ * Traces the tile stream by stream, each stream holds the rays of the same depth,
+ * colors are accumulated per pixel and written into image after all streams are traced
+ */
+void WavefrontRenderer::RenderTile(const Camera *camera, Image &image, const Tile &tile, RayStream<StreamRay> &rayStream, StreamBuffers &streamBuffers,
+                                   const LightContributionCalculator &contributionCalculator, TileRayQueue &rayQueue)
+{
+    int tileWidth = tile.endColumn - tile.startColumn;
+    std::vector<Vector3f> pixelColors(tileWidth * (tile.endRow - tile.startRow));
+
+    GenerateCameraRays(camera, tile, rayStream);
+
+    while (!rayStream.IsEmpty())
+    {
+        TraceRayStream(camera, tile, rayStream, streamBuffers, pixelColors, contributionCalculator, rayQueue);
+        TraceShadowRayStream(rayQueue.GetShadowRayStream(), pixelColors, contributionCalculator);
+
+        rayStream.Swap(rayQueue.GetBranchRayStream());
+        rayQueue.GetBranchRayStream().Clear();
+        rayStream.SortByDirectionAndOrigin();
+    }
+
+    int pixelCount = pixelColors.size();
+    for (int pixelIndex = 0; pixelIndex < pixelCount; ++pixelIndex)
+    {
+        Vector3f pixelColor = pixelColors[pixelIndex];
+        if (camera->IsMultiSamplingOn())
+            pixelColor /= camera->GetSampleCount();
+
+        image.SetPixelColor(tile.startColumn + pixelIndex % tileWidth, tile.startRow + pixelIndex / tileWidth, ObtainColorFromUnclampedVector(pixelColor));
+    }
+}
+
+void WavefrontRenderer::GenerateCameraRays(const Camera *camera, const Tile &tile, RayStream<StreamRay> &rayStream) const
+{
+    ACTRACER_STATS_STAGE(RAY_GENERATION);
+
+    int tileWidth = tile.endColumn - tile.startColumn;
+
+    for (int i = tile.startRow; i < tile.endRow; ++i)
+    {
+        for (int j = tile.startColumn; j < tile.endColumn; ++j)
+        {
+            int pixelIndex = (i - tile.startRow) * tileWidth + (j - tile.startColumn);
+
+            if (camera->IsMultiSamplingOn())
+            {
+                Pixel currentPixel = camera->GeneratePixelDataAt(i, j);
+                MultiSampledRayGenerator rayGenerator{*camera, currentPixel};
+
+                while (!rayGenerator.FinishedSamples())
+                {
+                    Ray r = rayGenerator.GetNextSampleRay();
+                    rayStream.Push(r.o, r.d, StreamRay{std::move(r), Vector3f{1.0f, 1.0f, 1.0f}, pixelIndex, 0, 1.0f, true});
+                }
+            }
+            else
+            {
+                Ray r = camera->GenerateRay(i, j);
+                r.currMat = Material::DefaultMaterial;
+                r.currShape = nullptr;
+
+                rayStream.Push(r.o, r.d, StreamRay{std::move(r), Vector3f{1.0f, 1.0f, 1.0f}, pixelIndex, 0, 1.0f, true});
+            }
+        }
+    }
+
+    ACTRACER_STATS_INCREMENT(CAMERA_RAYS, rayStream.Size());
+}
+
+void WavefrontRenderer::TraceRayStream(const Camera *camera, const Tile &tile, RayStream<StreamRay> &rayStream, StreamBuffers &streamBuffers,
+                                       std::vector<Vector3f> &pixelColors, const LightContributionCalculator &contributionCalculator, TileRayQueue &rayQueue) const
+{
+    float intersectionTestEpsilon = mCurrentRenderedScene->GetIntersectionTestEpsilon();
+    int tileWidth = tile.endColumn - tile.startColumn;
+
+    // Surface attributes are computed only for the hits that are shaded
+    std::vector<HitRecord> &closestHits = streamBuffers.closestHits;
+    closestHits.assign(rayStream.Size(), HitRecord{});
+    std::vector<std::pair<const Material *, int>> &shadingOrder = streamBuffers.shadingOrder;
+    shadingOrder.clear();
+
+    // Sorted stream keeps successive rays coherent, they are intersected in packets
+    {
+        ACTRACER_STATS_STAGE(CLOSEST_HIT_TRAVERSAL);
+        for (int packetStart = 0; packetStart < rayStream.Size(); packetStart += RayPacket::size)
+        {
+            Ray *rays[RayPacket::size];
+            int rayCount = std::min(RayPacket::size, rayStream.Size() - packetStart);
+            for (int i = 0; i < rayCount; ++i)
+                rays[i] = &rayStream[packetStart + i].ray;
+
+            RayPacket packet{rays, rayCount};
+            accelerator->IntersectClosestHits(packet, &closestHits[packetStart], intersectionTestEpsilon);
+        }
+    }
+
+    for (int i = 0; i < rayStream.Size(); ++i)
+    {
+        StreamRay &streamRay = rayStream[i];
+
+        if (closestHits[i].IsValid())
+            shadingOrder.push_back(std::make_pair(closestHits[i].shape->GetMaterial(), i));
+        else if (streamRay.addColorOnMiss)
+        {
+            // Camera rays use the background at their pixel, reflections use the one at the origin of the image
+            float columnNormalized01 = 0;
+            float rowNormalized01 = 0;
+            if (streamRay.depth == 0)
+            {
+                columnNormalized01 = (float)(tile.startColumn + streamRay.pixelIndex % tileWidth) / camera->imgPlane.nx;
+                rowNormalized01 = (float)(tile.startRow + streamRay.pixelIndex / tileWidth) / camera->imgPlane.ny;
+            }
+
+            pixelColors[streamRay.pixelIndex] += streamRay.weight * contributionCalculator.GetBackgroundColorAt(columnNormalized01, rowNormalized01);
+        }
+    }
+
+    // Hits of the same material are shaded as one batch, in stream order inside the batch
+    std::sort(shadingOrder.begin(), shadingOrder.end(), [](const std::pair<const Material *, int> &lhs, const std::pair<const Material *, int> &rhs) {
+        return std::less<const Material *>()(lhs.first, rhs.first) || (lhs.first == rhs.first && lhs.second < rhs.second);
+    });
+
+    for (const std::pair<const Material *, int> &shadedHit : shadingOrder)
+    {
+        int i = shadedHit.second;
+        StreamRay &streamRay = rayStream[i];
+        rayQueue.SetCurrentPath(streamRay.pixelIndex, streamRay.weight);
+
+        SurfaceIntersection intersection{};
+        closestHits[i].shape->Finalize(streamRay.ray, closestHits[i], intersection, intersectionTestEpsilon);
+
+        Vector3f surfaceColor{};
+        contributionCalculator.ShadeIntersection(streamRay.ray, intersection, surfaceColor, streamRay.depth, streamRay.throughput);
+
+        pixelColors[streamRay.pixelIndex] += streamRay.weight * surfaceColor;
+    }
+}
+
+void WavefrontRenderer::TraceShadowRayStream(RayStream<ShadowStreamRay> &shadowRayStream, std::vector<Vector3f> &pixelColors, const LightContributionCalculator &contributionCalculator) const
+{
+    // Sorting keeps the rays towards the same light together so that packets of point lights share a common target
+    shadowRayStream.SortByDirectionAndOrigin();
+
+    int shadowRayCount = shadowRayStream.Size();
+    int packetStart = 0;
+    while (packetStart < shadowRayCount)
+    {
+        int lightIndex = shadowRayStream[packetStart].lightIndex;
+
+        Ray shadowRays[RayPacket::size];
+        Ray *rays[RayPacket::size];
+        Vector3f surfacePoints[RayPacket::size];
+        float distancesToLight[RayPacket::size];
+
+        int rayCount = 0;
+        while (rayCount < RayPacket::size && packetStart + rayCount < shadowRayCount)
+        {
+            ShadowStreamRay &shadowRay = shadowRayStream[packetStart + rayCount];
+            if (shadowRay.lightIndex != lightIndex)
+                break;
+
+            Ray &ray = shadowRays[rayCount];
+            ray.o = shadowRayStream.GetOrigin(packetStart + rayCount);
+            ray.d = shadowRayStream.GetDirection(packetStart + rayCount);
+            ray.currMat = nullptr;
+            ray.currShape = nullptr;
+            ray.time = shadowRay.time;
+            rays[rayCount] = &ray;
+            surfacePoints[rayCount] = shadowRay.surfacePoint;
+            distancesToLight[rayCount] = shadowRay.distanceToLight;
+            ++rayCount;
+        }
+
+        RayPacket packet{rays, rayCount};
+        unsigned blockedRays = contributionCalculator.FindBlockedShadowRays(packet, surfacePoints, distancesToLight);
+
+        for (int i = 0; i < rayCount; ++i)
+        {
+            ShadowStreamRay &shadowRay = shadowRayStream[packetStart + i];
+            if (!(blockedRays & (1u << i)))
+                pixelColors[shadowRay.pixelIndex] += shadowRay.contribution;
+        }
+
+        packetStart += rayCount;
+    }
+
+    shadowRayStream.Clear();
+}
+
+void WavefrontRenderer::SetupContributionCalculator(LightContributionCalculator &contributionCalculator, TileRayQueue &rayQueue, Random<double> &randomGenerator)
+{
+    contributionCalculator.SetSceneLights(mCurrentRenderedScene->GetAllLights(),
+                                          mCurrentRenderedScene->GetAmbientColor(),
+                                          mCurrentRenderedScene->GetBackgroundColor(),
+                                          mCurrentRenderedScene->GetBackgroundTexture());
+
+    contributionCalculator.SetSceneAccelerator(*accelerator);
+    contributionCalculator.SetRenderParameters(mCurrentRenderedScene->GetMaximumRecursionDepth(),
+                                               mCurrentRenderedScene->GetIntersectionTestEpsilon(),
+                                               mCurrentRenderedScene->GetShadowRayEpsilon(),
+                                               2.2f,
+                                               randomGenerator);
+    contributionCalculator.SetPathTerminationParameters(mCurrentRenderedScene->GetMinimumThroughput());
+    contributionCalculator.SetFresnelBranchSelection(mSelectFresnelBranch);
+    contributionCalculator.SetLightSampling(mLightBVH, mCurrentRenderedScene->GetLightSampleCount());
+    contributionCalculator.SetDeferredRayQueue(&rayQueue);
+}
+
+int WavefrontRenderer::ComputeTileSize(const Camera *camera) const
+{
+    int tileSize = std::sqrt(maxStreamRayCount / camera->GetSampleCount());
+
+    return Clamp<int>(tileSize, 1, maxTileSize);
+}
+
+int WavefrontRenderer::GetTileCount(const Camera *camera) const
+{
+    int horizontalTileCount = (camera->imgPlane.nx + mTileSize - 1) / mTileSize;
+    int verticalTileCount = (camera->imgPlane.ny + mTileSize - 1) / mTileSize;
+
+    return horizontalTileCount * verticalTileCount;
+}
+
+WavefrontRenderer::Tile WavefrontRenderer::GetTile(const Camera *camera, int tileIndex) const
+{
+    int horizontalTileCount = (camera->imgPlane.nx + mTileSize - 1) / mTileSize;
+
+    Tile tile;
+    tile.startRow = (tileIndex / horizontalTileCount) * mTileSize;
+    tile.startColumn = (tileIndex % horizontalTileCount) * mTileSize;
+    tile.endRow = std::min(tile.startRow + mTileSize, camera->imgPlane.ny);
+    tile.endColumn = std::min(tile.startColumn + mTileSize, camera->imgPlane.nx);
+
+    return tile;
+}
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "RenderStrategy.h"
+#include "RayStream.h"
+#include "acmath.h"
+
+#include <atomic>
+#include <vector>
+
+namespace actracer
+{
+
+class AccelerationStructure;
+class LightBVH;
+class LightContributionCalculator;
+class SurfaceIntersection;
+class Tonemapper;
+class Image;
+class Camera;
+class Scene;
+
+/*
+ * Renders the image tile by tile and traces each tile breadth first instead of depth first per pixel.
+ * All camera rays of a tile are intersected as a stream, hits are shaded in material order,
+ * reflection/refraction and shadow rays are collected into new streams that are sorted
+ * by direction octant and origin before they are traced
+ */
+class WavefrontRenderer : public RenderStrategy
+{
+public:
+    virtual void RenderSceneIntoPPM(Scene *scene) override;
+    WavefrontRenderer() : RenderStrategy(), accelerator(nullptr) {}
+    virtual ~WavefrontRenderer();
+protected:
+    virtual void RetrieveRenderingParamsFromScene(Scene *scene) override;
+
+private:
+    class TileRayQueue;
+    class StreamBuffers;
+
+    typedef struct Tile
+    {
+        int startRow;
+        int endRow;
+        int startColumn;
+        int endColumn;
+    } Tile;
+
+private:
+    void RenderCamera(const Camera *camera);
+    /*
+     * Takes the next tile until all tiles of the image are rendered,
+     * draws of a tile come from a generator seeded with the tile index whichever thread takes it
+     */
+    void RenderTiles(const Camera *camera, Image &image, std::atomic<int> &nextTileIndex);
+    void RenderTile(const Camera *camera, Image &image, const Tile &tile, RayStream<StreamRay> &rayStream, StreamBuffers &streamBuffers,
+                    const LightContributionCalculator &contributionCalculator, TileRayQueue &rayQueue);
+
+    void GenerateCameraRays(const Camera *camera, const Tile &tile, RayStream<StreamRay> &rayStream) const;
+    /*
+     * Intersects all rays of the stream, adds the color of the rays that miss
+     * then shades the hits material by material,
+     * secondary rays that are created by shading are put into rayQueue
+     */
+    void TraceRayStream(const Camera *camera, const Tile &tile, RayStream<StreamRay> &rayStream, StreamBuffers &streamBuffers,
+                        std::vector<Vector3f> &pixelColors, const LightContributionCalculator &contributionCalculator, TileRayQueue &rayQueue) const;
+    void TraceShadowRayStream(RayStream<ShadowStreamRay> &shadowRayStream, std::vector<Vector3f> &pixelColors, const LightContributionCalculator &contributionCalculator) const;
+
+    void SetupContributionCalculator(LightContributionCalculator &contributionCalculator, TileRayQueue &rayQueue, Random<double> &randomGenerator);
+
+    /*
+     * Tiles are shrunk for multisampled cameras so that camera ray streams do not grow beyond maxStreamRayCount
+     */
+    int ComputeTileSize(const Camera *camera) const;
+    int GetTileCount(const Camera *camera) const;
+    Tile GetTile(const Camera *camera, int tileIndex) const;
+
+private:
+    static constexpr int maxTileSize = 32;
+    static constexpr int maxStreamRayCount = 16384;
+    static constexpr int threadCount = 8;
+
+    const Scene *mCurrentRenderedScene;
+    bool mSelectFresnelBranch; // Set per camera
+    int mTileSize;             // Width and height of a tile in pixels, set per camera
+
+    const Tonemapper *tonemapper;
+
+    AccelerationStructure *accelerator;
+    LightBVH *mLightBVH = nullptr; // Built if the scene samples lights
+};
+
+}
@@ -11,6 +11,14 @@
 
 #include <unordered_map>
 
+// Aligned vectors use SSE unless ACTRACER_NO_SIMD is defined
+#if !defined(ACTRACER_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define ACTRACER_SIMD 1
+#include <emmintrin.h>
+#else
+#define ACTRACER_SIMD 0
+#endif
+
 namespace actracer {
 
 class Material;
@@ -41,37 +49,14 @@ public:
     Vector2<T>(T _x = 0, T _y = 0)
         : x(_x), y(_y) {}
 
-    Vector2<T>(const Vector2<T> &rh)
-        : x(rh.x), y(rh.y) {}
-
     Vector2<T>(const glm::vec2 &v)
         : x(v.x), y(v.y) {}
 
-    Vector2<T> &operator=(const Vector2<T> &rh)
-    {
-        x = rh.x;
-        y = rh.y;
-
-        return *this;
-    }
-
-    Vector2<T>(Vector2<T> &&rh)
-        : x(rh.x), y(rh.y)
-    {
-        rh.x = 0;
-        rh.y = 0;
-    }
-
-    Vector2<T> &operator=(Vector2<T> &&rh)
-    {
-        x = rh.x;
-        y = rh.y;
-
-        rh.x = 0;
-        rh.y = 0;
-
-        return *this;
-    }
+    // Copy and move are member-wise so that vectors stay trivially copyable
+    Vector2<T>(const Vector2<T> &rh) = default;
+    Vector2<T> &operator=(const Vector2<T> &rh) = default;
+    Vector2<T>(Vector2<T> &&rh) = default;
+    Vector2<T> &operator=(Vector2<T> &&rh) = default;
     #pragma endregion
 
     template <typename U>
@@ -211,42 +196,11 @@ public:
     Vector3<T>(const glm::vec3 &v)
         : x(v.x), y(v.y), z(v.z) {}
 
-    // Copy constructor and assignment
-    Vector3<T>(const Vector3<T> &rh)
-        : x(rh.x), y(rh.y), z(rh.z) {}
-
-    Vector3<T> &operator=(const Vector3<T> &rh)
-    {
-        x = rh.x;
-        y = rh.y;
-        z = rh.z;
-
-        return *this;
-    }
-    // --
-
-    // Move constructor and assignment
-    Vector3<T>(Vector3<T> &&rh)
-        : x(rh.x), y(rh.y), z(rh.z)
-    {
-        rh.x = 0;
-        rh.y = 0;
-        rh.z = 0;
-    }
-
-    Vector3<T> &operator=(Vector3<T> &&rh)
-    {
-        x = rh.x;
-        y = rh.y;
-        z = rh.z;
-
-        rh.x = 0;
-        rh.y = 0;
-        rh.z = 0;
-
-        return *this;
-    }
-    // --
+    // Copy and move are member-wise so that vectors stay trivially copyable
+    Vector3<T>(const Vector3<T> &rh) = default;
+    Vector3<T> &operator=(const Vector3<T> &rh) = default;
+    Vector3<T>(Vector3<T> &&rh) = default;
+    Vector3<T> &operator=(Vector3<T> &&rh) = default;
     #pragma endregion
 
     template <typename U>
@@ -414,46 +368,11 @@ public:
     Vector4<T>(const glm::vec4& v) 
         : x(v.x), y(v.y), z(v.z), w(v.w) { }
 
-    // Copy constructor and assignment
-    Vector4<T>(const Vector4<T> &rh) 
-        : x(rh.x), y(rh.y), z(rh.z), w(rh.w) { }
-
-    Vector4<T> &operator=(const Vector4<T> &rh)
-    {
-        x = rh.x;
-        y = rh.y;
-        z = rh.z;
-        w = rh.w;
-
-        return *this;
-    }
-    // --
-
-    // Move constructor and assignment
-    Vector4<T>(Vector4<T> &&rh)
-        : x(rh.x), y(rh.y), z(rh.z), w(rh.w)
-    {
-        rh.x = 0;
-        rh.y = 0;
-        rh.z = 0;
-        rh.w = 0;
-    }
-
-    Vector4<T> &operator=(Vector4<T> &&rh)
-    {
-        x = rh.x;
-        y = rh.y;
-        z = rh.z;
-        w = rh.w;
-
-        rh.x = 0;
-        rh.y = 0;
-        rh.z = 0;
-        rh.w = 0;
-
-        return *this;
-    }
-    // --
+    // Copy and move are member-wise so that vectors stay trivially copyable
+    Vector4<T>(const Vector4<T> &rh) = default;
+    Vector4<T> &operator=(const Vector4<T> &rh) = default;
+    Vector4<T>(Vector4<T> &&rh) = default;
+    Vector4<T> &operator=(Vector4<T> &&rh) = default;
 
     #pragma endregion
 
@@ -683,6 +602,206 @@ inline Vector2<T> operator+(T scalar, const Vector2<T> &v) { return v + scalar;
 template <typename T>
 inline Vector2<T> operator-(T scalar, const Vector2<T> &v) { return v - scalar; }
 
+#pragma region aligned vectors
+
+/*
+ * Vector3fa and Vector4fa are 16 byte aligned float vectors for hot loops,
+ * their operations use SSE registers when ACTRACER_SIMD is 1 and plain floats otherwise.
+ * Defining ACTRACER_NO_SIMD at compile time forces the plain float path
+ */
+#if ACTRACER_SIMD
+namespace simd {
+
+inline __m128 Load(const float *values) { return _mm_load_ps(values); }
+inline void Store(float *values, __m128 m) { _mm_store_ps(values, m); }
+
+// Sum of the first three lanes, added in the same order as the scalar Dot
+inline float HorizontalSum3(__m128 m)
+{
+    __m128 y = _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(m, y), z));
+}
+
+inline float HorizontalSum4(__m128 m)
+{
+    __m128 y = _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 w = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(_mm_add_ss(m, y), z), w));
+}
+
+// Approximate 1 / sqrt(value) refined by one Newton-Raphson step, relative error is around 1e-7
+inline __m128 ReciprocalSqrt(__m128 value)
+{
+    __m128 estimate = _mm_rsqrt_ps(value);
+    __m128 halfValue = _mm_mul_ps(value, _mm_set1_ps(0.5f));
+    __m128 correction = _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfValue, _mm_mul_ps(estimate, estimate)));
+    return _mm_mul_ps(estimate, correction);
+}
+
+}
+#endif
+
+class alignas(16) Vector3fa
+{
+public:
+    float x;
+    float y;
+    float z;
+    float w; // Padding of the register, kept zero
+
+    Vector3fa(float _x = 0, float _y = 0, float _z = 0)
+        : x(_x), y(_y), z(_z), w(0) {}
+
+    Vector3fa(const Vector3f &v)
+        : x(v.x), y(v.y), z(v.z), w(0) {}
+
+#if ACTRACER_SIMD
+    Vector3fa(__m128 m) { simd::Store(&x, m); }
+    __m128 Get() const { return simd::Load(&x); }
+#endif
+
+    operator Vector3f() const { return {x, y, z}; }
+
+#if ACTRACER_SIMD
+    Vector3fa operator+(const Vector3fa &v) const { return _mm_add_ps(Get(), v.Get()); }
+    Vector3fa operator-(const Vector3fa &v) const { return _mm_sub_ps(Get(), v.Get()); }
+    Vector3fa operator*(const Vector3fa &v) const { return _mm_mul_ps(Get(), v.Get()); }
+    Vector3fa operator*(float scalar) const { return _mm_mul_ps(Get(), _mm_set1_ps(scalar)); }
+    Vector3fa operator-() const { return _mm_sub_ps(_mm_setzero_ps(), Get()); }
+#else
+    Vector3fa operator+(const Vector3fa &v) const { return {x + v.x, y + v.y, z + v.z}; }
+    Vector3fa operator-(const Vector3fa &v) const { return {x - v.x, y - v.y, z - v.z}; }
+    Vector3fa operator*(const Vector3fa &v) const { return {x * v.x, y * v.y, z * v.z}; }
+    Vector3fa operator*(float scalar) const { return {x * scalar, y * scalar, z * scalar}; }
+    Vector3fa operator-() const { return {-x, -y, -z}; }
+#endif
+
+    Vector3fa &operator+=(const Vector3fa &v) { return *this = *this + v; }
+    Vector3fa &operator-=(const Vector3fa &v) { return *this = *this - v; }
+    Vector3fa &operator*=(float scalar) { return *this = *this * scalar; }
+
+    float operator[](int i) const { assert(i >= 0 && i <= 2); return (&x)[i]; }
+    float &operator[](int i) { assert(i >= 0 && i <= 2); return (&x)[i]; }
+};
+
+class alignas(16) Vector4fa
+{
+public:
+    float x;
+    float y;
+    float z;
+    float w;
+
+    Vector4fa(float _x = 0, float _y = 0, float _z = 0, float _w = 0)
+        : x(_x), y(_y), z(_z), w(_w) {}
+
+    Vector4fa(const Vector4f &v)
+        : x(v.x), y(v.y), z(v.z), w(v.w) {}
+
+#if ACTRACER_SIMD
+    Vector4fa(__m128 m) { simd::Store(&x, m); }
+    __m128 Get() const { return simd::Load(&x); }
+#endif
+
+    operator Vector4f() const { return {x, y, z, w}; }
+
+#if ACTRACER_SIMD
+    Vector4fa operator+(const Vector4fa &v) const { return _mm_add_ps(Get(), v.Get()); }
+    Vector4fa operator-(const Vector4fa &v) const { return _mm_sub_ps(Get(), v.Get()); }
+    Vector4fa operator*(const Vector4fa &v) const { return _mm_mul_ps(Get(), v.Get()); }
+    Vector4fa operator*(float scalar) const { return _mm_mul_ps(Get(), _mm_set1_ps(scalar)); }
+    Vector4fa operator-() const { return _mm_sub_ps(_mm_setzero_ps(), Get()); }
+#else
+    Vector4fa operator+(const Vector4fa &v) const { return {x + v.x, y + v.y, z + v.z, w + v.w}; }
+    Vector4fa operator-(const Vector4fa &v) const { return {x - v.x, y - v.y, z - v.z, w - v.w}; }
+    Vector4fa operator*(const Vector4fa &v) const { return {x * v.x, y * v.y, z * v.z, w * v.w}; }
+    Vector4fa operator*(float scalar) const { return {x * scalar, y * scalar, z * scalar, w * scalar}; }
+    Vector4fa operator-() const { return {-x, -y, -z, -w}; }
+#endif
+
+    Vector4fa &operator+=(const Vector4fa &v) { return *this = *this + v; }
+    Vector4fa &operator-=(const Vector4fa &v) { return *this = *this - v; }
+    Vector4fa &operator*=(float scalar) { return *this = *this * scalar; }
+
+    float operator[](int i) const { assert(i >= 0 && i <= 3); return (&x)[i]; }
+    float &operator[](int i) { assert(i >= 0 && i <= 3); return (&x)[i]; }
+};
+
+#if ACTRACER_SIMD
+inline float Dot(const Vector3fa &v0, const Vector3fa &v1) { return simd::HorizontalSum3(_mm_mul_ps(v0.Get(), v1.Get())); }
+inline float Dot(const Vector4fa &v0, const Vector4fa &v1) { return simd::HorizontalSum4(_mm_mul_ps(v0.Get(), v1.Get())); }
+
+inline Vector3fa Cross(const Vector3fa &v0, const Vector3fa &v1)
+{
+    // (y0 z1 - z0 y1, z0 x1 - x0 z1, x0 y1 - y0 x1) with yzx and zxy rotations
+    __m128 a = v0.Get();
+    __m128 b = v1.Get();
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 aZXY = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 bZXY = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+
+    return _mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX));
+}
+
+inline Vector3fa MinElements(const Vector3fa &v0, const Vector3fa &v1) { return _mm_min_ps(v0.Get(), v1.Get()); }
+inline Vector3fa MaxElements(const Vector3fa &v0, const Vector3fa &v1) { return _mm_max_ps(v0.Get(), v1.Get()); }
+
+inline Vector3fa Normalize(const Vector3fa &v)
+{
+    __m128 m = v.Get();
+    __m128 squaredLength = _mm_set1_ps(Dot(v, v));
+    return _mm_mul_ps(m, simd::ReciprocalSqrt(squaredLength));
+}
+
+inline Vector4fa Normalize(const Vector4fa &v)
+{
+    __m128 m = v.Get();
+    __m128 squaredLength = _mm_set1_ps(Dot(v, v));
+    return _mm_mul_ps(m, simd::ReciprocalSqrt(squaredLength));
+}
+#else
+inline float Dot(const Vector3fa &v0, const Vector3fa &v1) { return v0.x * v1.x + v0.y * v1.y + v0.z * v1.z; }
+inline float Dot(const Vector4fa &v0, const Vector4fa &v1) { return v0.x * v1.x + v0.y * v1.y + v0.z * v1.z + v0.w * v1.w; }
+
+inline Vector3fa Cross(const Vector3fa &v0, const Vector3fa &v1)
+{
+    return {v0.y * v1.z - v0.z * v1.y,
+            v0.z * v1.x - v0.x * v1.z,
+            v0.x * v1.y - v0.y * v1.x};
+}
+
+inline Vector3fa MinElements(const Vector3fa &v0, const Vector3fa &v1)
+{
+    return {v0.x < v1.x ? v0.x : v1.x,
+            v0.y < v1.y ? v0.y : v1.y,
+            v0.z < v1.z ? v0.z : v1.z};
+}
+
+inline Vector3fa MaxElements(const Vector3fa &v0, const Vector3fa &v1)
+{
+    return {v0.x > v1.x ? v0.x : v1.x,
+            v0.y > v1.y ? v0.y : v1.y,
+            v0.z > v1.z ? v0.z : v1.z};
+}
+
+inline Vector3fa Normalize(const Vector3fa &v) { return v * (1.0f / std::sqrt(Dot(v, v))); }
+inline Vector4fa Normalize(const Vector4fa &v) { return v * (1.0f / std::sqrt(Dot(v, v))); }
+#endif
+
+inline float Length(const Vector3fa &v) { return Dot(v, v); }
+inline float Length(const Vector4fa &v) { return Dot(v, v); }
+
+inline float SqLength(const Vector3fa &v) { return std::sqrt(Length(v)); }
+inline float SqLength(const Vector4fa &v) { return std::sqrt(Length(v)); }
+
+inline Vector3fa operator*(float scalar, const Vector3fa &v) { return v * scalar; }
+inline Vector4fa operator*(float scalar, const Vector4fa &v) { return v * scalar; }
+
+#pragma endregion
+
 template <typename T>
 void SetMax(T& val0, const T& val1) { val0 = val0 < val1 ? val1 : val0; }
 
@@ -713,12 +832,15 @@ public:
     Vector3f o; // Origin of the ray
     Vector3f d; // Direction of the ray
 
+    // Differentials, rays through the neighbouring pixels to estimate the footprint of the ray on surfaces
     Vector3f ryo;
     Vector3f ryd;
 
     Vector3f rxo;
     Vector3f rxd;
 
+    bool hasDifferentials = false;
+
     Material* currMat;
     Shape*    currShape;
 
@@ -982,25 +1104,35 @@ struct Translation : Transformation
 
 class Transform {
 public:
+    // Classified when the matrices are computed so that transforms can skip the matrix products
+    enum class TransformType { IDENTITY, TRANSLATION, GENERAL };
+
     glm::mat4 transformationMatrix;
     glm::mat4 invTransformationMatrix;
     glm::mat4 transposeMatrix;
+    glm::mat4 inverseMatrix; // Transpose of invTransformationMatrix, takes points into object space
+
+    TransformType type = TransformType::GENERAL;
 
     Transform() {}
 
     Transform(glm::mat4& pMatrix)
         : transposeMatrix(pMatrix)
     {
-        transformationMatrix = glm::transpose(transposeMatrix);
-        invTransformationMatrix = glm::inverse(transformationMatrix);
+        UpdateTransform();
     }
 
     void UpdateTransform()
     {
         transformationMatrix = glm::transpose(transposeMatrix);
         invTransformationMatrix = glm::inverse(transformationMatrix);
+        inverseMatrix = glm::transpose(invTransformationMatrix);
+
+        type = Classify(transposeMatrix);
     }
 
+    bool IsIdentity() const { return type == TransformType::IDENTITY; }
+
     Transform operator()(const Transformation& other)
     {
         glm::mat4 newTransformationMatrix = other.transformation * this->transposeMatrix;
@@ -1015,20 +1147,26 @@ public:
 
     Vector4f operator()(Vector4f vec, bool obj2world = true, bool isDirection = false) const 
     {
-        glm::vec4 glvec = glm::vec4(vec.x, vec.y, vec.z, vec.w);
+        if(type == TransformType::IDENTITY)
+            return vec;
 
-        if(isDirection)
+        // Directions and normals are not affected by the translation
+        if(type == TransformType::TRANSLATION)
         {
-            if (obj2world)
-                return this->invTransformationMatrix * static_cast<glm::vec4>(vec);
-            else
-                return glm::transpose(this->invTransformationMatrix) * static_cast<glm::vec4>(vec);
+            if(isDirection)
+                return vec;
+
+            const glm::vec4 &translation = obj2world ? this->transposeMatrix[3] : this->inverseMatrix[3];
+            return Vector4f(vec.x + translation.x * vec.w, vec.y + translation.y * vec.w, vec.z + translation.z * vec.w, vec.w);
         }
 
+        if(isDirection && obj2world)
+            return this->invTransformationMatrix * static_cast<glm::vec4>(vec);
+
         if(obj2world) 
             return this->transposeMatrix * static_cast<glm::vec4>(vec);
         else
-            return glm::transpose(this->invTransformationMatrix) * static_cast<glm::vec4>(vec);
+            return this->inverseMatrix * static_cast<glm::vec4>(vec);
     }
 
     BoundingVolume3f operator()(const BoundingVolume3f &bbox, bool obj2world = true)
@@ -1067,6 +1205,20 @@ public:
 
         return resRay;
     }
+
+private:
+    static TransformType Classify(const glm::mat4 &matrix)
+    {
+        // Columns hold the axes, the last one the translation
+        if(matrix[0] != glm::vec4(1, 0, 0, 0) || matrix[1] != glm::vec4(0, 1, 0, 0) ||
+           matrix[2] != glm::vec4(0, 0, 1, 0) || matrix[3].w != 1)
+            return TransformType::GENERAL;
+
+        if(matrix[3].x == 0 && matrix[3].y == 0 && matrix[3].z == 0)
+            return TransformType::IDENTITY;
+
+        return TransformType::TRANSLATION;
+    }
 };
 
 static float CalculateGaussian(float x, float y, float spreadness)
@@ -1078,6 +1230,7 @@ struct Vertex
 {
     Vector3f p{};
     Vector3f n{};
+    Vector3f t{}; // Tangent along u, only filled in for the meshes that smooth their tangents
     Vector2f uv{};
 
     int refCount = 0;
@@ -0,0 +1,337 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "Scene.h"
+#include "Camera.h"
+#include "SceneParser.h"
+#include "RenderStrategyFactory.h"
+#include "Random.h"
+#include "RenderStatistics.h"
+
+using namespace actracer;
+
+/*
+ * Renders a fixed list of scenes with fixed seeds and reports the timings as JSON,
+ * if a baseline file is given rays per second of each scene is compared against it
+ * and the run fails when a scene is slower than the threshold allows.
+ * Must be run from the src directory so that the scene and texture paths resolve
+ */
+namespace
+{
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct BenchOptions
+{
+    float resolutionScale = 1.0f;
+    float sampleScale = 1.0f;
+    int repeatCount = 3;
+    unsigned seed = 1;
+    float threshold = 0.05f; // Allowed relative slowdown before a scene counts as a regression
+    const char *outputPath = nullptr;
+    const char *baselinePath = nullptr;
+    std::vector<std::string> scenePaths;
+};
+
+struct SceneResult
+{
+    std::string scenePath;
+    float parseTime;          // Median of the repeats in ms
+    float bvhBuildTime;       // Median of the repeats in ms
+    float medianRenderTime;   // ms
+    float minRenderTime;      // ms
+    long long cameraRayCount; // Camera rays of a single render
+    double raysPerSecond;     // Camera rays per second over the median render time
+    long peakRSS;             // Peak resident set size of the process in KB
+#if defined(ACTRACER_STATS)
+    long long tracedRayCount; // Camera, secondary and shadow rays of a single render
+#endif
+};
+
+const char *const defaultScenePaths[] = {
+    "scenes/simple.xml",
+    "scenes/spheres.xml",
+    "scenes/cornellbox.xml",
+    "scenes/scienceTree.xml",
+    "scenes/metal_glass_plates.xml"
+};
+
+float ElapsedMilliseconds(const Clock::time_point &start, const Clock::time_point &end)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0f;
+}
+
+float Median(std::vector<float> values)
+{
+    std::sort(values.begin(), values.end());
+    int middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) * 0.5f;
+}
+
+long GetPeakRSS()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024; // Reported in bytes
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+void PrintUsage()
+{
+    std::cout << "Usage: raytracer_bench [--resolution-scale s] [--sample-scale s] [--repeats n] [--seed n]\n"
+              << "                       [--out results.json] [--baseline baseline.json] [--threshold t] [scenes...]\n";
+}
+
+bool ParseOptions(int argc, char *argv[], BenchOptions &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(arg, "--resolution-scale") == 0 && hasValue)
+            options.resolutionScale = atof(argv[++i]);
+        else if (strcmp(arg, "--sample-scale") == 0 && hasValue)
+            options.sampleScale = atof(argv[++i]);
+        else if (strcmp(arg, "--repeats") == 0 && hasValue)
+            options.repeatCount = std::max(1, atoi(argv[++i]));
+        else if (strcmp(arg, "--seed") == 0 && hasValue)
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(arg, "--threshold") == 0 && hasValue)
+            options.threshold = atof(argv[++i]);
+        else if (strcmp(arg, "--out") == 0 && hasValue)
+            options.outputPath = argv[++i];
+        else if (strcmp(arg, "--baseline") == 0 && hasValue)
+            options.baselinePath = argv[++i];
+        else if (strncmp(arg, "--", 2) == 0)
+            return false;
+        else
+            options.scenePaths.push_back(arg);
+    }
+
+    if (options.scenePaths.empty())
+        options.scenePaths.assign(std::begin(defaultScenePaths), std::end(defaultScenePaths));
+
+    return options.resolutionScale > 0 && options.sampleScale > 0;
+}
+
+bool RunScene(const std::string &scenePath, const BenchOptions &options, SceneResult &result)
+{
+    std::vector<float> parseTimes;
+    std::vector<float> bvhBuildTimes;
+    std::vector<float> renderTimes;
+
+    result.scenePath = scenePath;
+    result.cameraRayCount = 0;
+
+    for (int repeat = 0; repeat < options.repeatCount; ++repeat)
+    {
+        // Every repeat draws the same random sequences
+        Random<double>::UseFixedSeeds(options.seed);
+
+        Clock::time_point parseStart = Clock::now();
+        Scene *scene = SceneParser::CreateSceneFromXML(scenePath.c_str());
+        parseTimes.push_back(ElapsedMilliseconds(parseStart, Clock::now()));
+
+        if (scene == nullptr)
+            return false;
+
+        long long cameraRayCount = 0;
+        for (Camera *camera : scene->GetAllCameras())
+        {
+            camera->ScaleWorkload(options.resolutionScale, options.sampleScale);
+            cameraRayCount += (long long)camera->imgPlane.nx * camera->imgPlane.ny * camera->GetSampleCount();
+        }
+        result.cameraRayCount = cameraRayCount;
+
+        RenderStrategy *renderer = RenderStrategyFactory::CreateRenderStrategy(scene->GetRenderStrategyCode());
+#if defined(ACTRACER_STATS)
+        RenderStatistics::TakeReportedRayCount();
+#endif
+
+        Clock::time_point renderStart = Clock::now();
+        renderer->RenderSceneIntoPPM(scene);
+        float renderTime = ElapsedMilliseconds(renderStart, Clock::now());
+
+#if defined(ACTRACER_STATS)
+        result.tracedRayCount = RenderStatistics::TakeReportedRayCount();
+#endif
+
+        // Build happens inside the render call, it is not counted as rendering
+        bvhBuildTimes.push_back(renderer->GetAccelerationStructureBuildTime());
+        renderTimes.push_back(renderTime - renderer->GetAccelerationStructureBuildTime());
+
+        delete renderer;
+        delete scene;
+    }
+
+    result.parseTime = Median(parseTimes);
+    result.bvhBuildTime = Median(bvhBuildTimes);
+    result.medianRenderTime = Median(renderTimes);
+    result.minRenderTime = *std::min_element(renderTimes.begin(), renderTimes.end());
+    result.raysPerSecond = result.medianRenderTime > 0 ? result.cameraRayCount / (result.medianRenderTime / 1000.0) : 0;
+    result.peakRSS = GetPeakRSS();
+
+    return true;
+}
+
+std::string ToJSON(const std::vector<SceneResult> &results, const BenchOptions &options)
+{
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"resolution_scale\": " << options.resolutionScale << ",\n"
+         << "  \"sample_scale\": " << options.sampleScale << ",\n"
+         << "  \"repeats\": " << options.repeatCount << ",\n"
+         << "  \"seed\": " << options.seed << ",\n"
+         << "  \"scenes\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const SceneResult &result = results[i];
+        json << "    {\n"
+             << "      \"scene\": \"" << result.scenePath << "\",\n"
+             << "      \"parse_ms\": " << result.parseTime << ",\n"
+             << "      \"bvh_build_ms\": " << result.bvhBuildTime << ",\n"
+             << "      \"render_ms_median\": " << result.medianRenderTime << ",\n"
+             << "      \"render_ms_min\": " << result.minRenderTime << ",\n"
+             << "      \"camera_rays\": " << result.cameraRayCount << ",\n"
+             << "      \"rays_per_second\": " << (long long)result.raysPerSecond << ",\n"
+#if defined(ACTRACER_STATS)
+             << "      \"traced_rays\": " << result.tracedRayCount << ",\n"
+#endif
+             << "      \"peak_rss_kb\": " << result.peakRSS << "\n"
+             << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    json << "  ]\n"
+         << "}\n";
+
+    return json.str();
+}
+
+/*
+ * Only reads back what ToJSON writes, pairs each "scene" with the "rays_per_second" that follows it
+ */
+bool ReadBaseline(const char *baselinePath, std::map<std::string, double> &baselineRaysPerSecond)
+{
+    std::ifstream file(baselinePath);
+    if (!file)
+        return false;
+
+    std::string currentScene;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t keyEnd = line.find("\":");
+        if (keyEnd == std::string::npos)
+            continue;
+
+        size_t keyStart = line.find('"');
+        std::string key = line.substr(keyStart + 1, keyEnd - keyStart - 1);
+        std::string value = line.substr(keyEnd + 2);
+
+        if (key == "scene")
+        {
+            size_t valueStart = value.find('"');
+            size_t valueEnd = value.rfind('"');
+            currentScene = value.substr(valueStart + 1, valueEnd - valueStart - 1);
+        }
+        else if (key == "rays_per_second" && !currentScene.empty())
+            baselineRaysPerSecond[currentScene] = atof(value.c_str());
+    }
+
+    return true;
+}
+
+/*
+ * Returns the number of scenes that got slower than the threshold allows
+ */
+int CompareAgainstBaseline(const std::vector<SceneResult> &results, const std::map<std::string, double> &baselineRaysPerSecond, float threshold)
+{
+    int regressionCount = 0;
+
+    std::cout << "\nComparison against baseline (threshold " << threshold * 100 << "%)\n";
+    for (const SceneResult &result : results)
+    {
+        std::map<std::string, double>::const_iterator baseline = baselineRaysPerSecond.find(result.scenePath);
+        if (baseline == baselineRaysPerSecond.end() || baseline->second <= 0)
+        {
+            std::cout << "  " << result.scenePath << ": no baseline\n";
+            continue;
+        }
+
+        double change = result.raysPerSecond / baseline->second - 1.0;
+        bool isRegression = change < -threshold;
+        if (isRegression)
+            ++regressionCount;
+
+        std::cout << "  " << result.scenePath << ": " << (change >= 0 ? "+" : "") << change * 100 << "%"
+                  << (isRegression ? "  REGRESSION" : "") << "\n";
+    }
+
+    return regressionCount;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    std::vector<SceneResult> results;
+    for (const std::string &scenePath : options.scenePaths)
+    {
+        SceneResult result;
+        if (!RunScene(scenePath, options, result))
+        {
+            std::cerr << "Could not load scene " << scenePath << "\n";
+            return 2;
+        }
+        results.push_back(result);
+    }
+
+    std::string json = ToJSON(results, options);
+    if (options.outputPath)
+        std::ofstream(options.outputPath) << json;
+    else
+        std::cout << "\n" << json;
+
+    if (options.baselinePath)
+    {
+        std::map<std::string, double> baselineRaysPerSecond;
+        if (!ReadBaseline(options.baselinePath, baselineRaysPerSecond))
+        {
+            std::cerr << "Could not read baseline " << options.baselinePath << "\n";
+            return 2;
+        }
+
+        if (CompareAgainstBaseline(results, baselineRaysPerSecond, options.threshold) > 0)
+            return 1;
+    }
+
+    return 0;
+}
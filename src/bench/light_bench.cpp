@@ -0,0 +1,97 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include "Light.h"
+#include "Intersection.h"
+
+using namespace actracer;
+
+/*
+ * Times the per-shading-point work of each light type: the direction and the distance to a surface point
+ * and the intensity that arrives there. Lights are called through Light references as the shading code does,
+ * so the virtual calls are part of the measured cost.
+ * Usage: light_bench [calls per light] [repeats]
+ */
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+struct NamedLight
+{
+    const char *name;
+    Light *light;
+};
+
+// Nanoseconds per shading point
+float TimeLightCalls(const Light &light, const std::vector<SurfaceIntersection> &points, int callCount, float &checksum)
+{
+    Vector3f sum{};
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < callCount; ++i)
+    {
+        Vector3f pointToLight;
+        float distanceToLight;
+        light.AssignLightFormulaVariables(points[i % points.size()], pointToLight, distanceToLight);
+
+        sum += light.GetLightIntensityAtPoint(pointToLight, distanceToLight);
+    }
+    float callTime = std::chrono::duration<float, std::nano>(Clock::now() - start).count() / callCount;
+
+    checksum += sum.x + sum.y + sum.z;
+    return callTime;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    int callCount = argc > 1 ? atoi(argv[1]) : 20000000;
+    int repeatCount = argc > 2 ? atoi(argv[2]) : 5;
+    if (callCount <= 0 || repeatCount <= 0)
+    {
+        std::cout << "Usage: light_bench [calls per light] [repeats]\n";
+        return 2;
+    }
+
+    // Points lie below the lights, the spot light points fall inside its coverage and falloff cones and outside of them
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> horizontal(-4.0f, 4.0f);
+    std::uniform_real_distribution<float> vertical(-8.0f, -1.0f);
+
+    std::vector<SurfaceIntersection> points(4096);
+    for (SurfaceIntersection &point : points)
+        point.ip = Vector3f{horizontal(generator), vertical(generator), horizontal(generator)};
+
+    Vector3f position{0.0f, 0.0f, 0.0f};
+    Vector3f intensity{1000.0f, 800.0f, 600.0f};
+    Vector3f down{0.0f, -1.0f, 0.0f};
+
+    std::vector<NamedLight> lights = {
+        {"point", new PointLight(position, intensity)},
+        {"directional", new DirectionalLight(position, intensity, down)},
+        {"spot", new SpotLight(position, intensity, down, 60.0f, 30.0f)},
+        {"area", new AreaLight(position, intensity, down, 2.0f)}
+    };
+
+    float checksum = 0.0f; // Printed so that the evaluations are not optimized away
+    for (NamedLight &namedLight : lights)
+    {
+        std::vector<float> callTimes;
+        for (int repeat = 0; repeat < repeatCount; ++repeat)
+            callTimes.push_back(TimeLightCalls(*namedLight.light, points, callCount, checksum));
+
+        std::sort(callTimes.begin(), callTimes.end());
+        std::cout << namedLight.name << ": " << callTimes[callTimes.size() / 2] << " ns per call\n";
+
+        delete namedLight.light;
+    }
+
+    std::cout << "checksum " << checksum << "\n";
+
+    return 0;
+}
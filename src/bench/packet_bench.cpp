@@ -0,0 +1,160 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "Scene.h"
+#include "Camera.h"
+#include "SceneParser.h"
+#include "Intersection.h"
+#include "RayPacket.h"
+#include "AccelerationStructure.h"
+#include "AccelerationStructureFactory.h"
+
+using namespace actracer;
+
+/*
+ * Times the closest hit search of the camera rays of each scene ray by ray and in packets of RayPacket::size
+ * neighbouring pixels of a row, the way DefaultRenderer traces one-sample cameras. Only the traversal is timed,
+ * rays are generated beforehand. Both searches must find the same hits, their checksums are printed.
+ * Must be run from the src directory so that the scene and texture paths resolve.
+ * Usage: packet_bench [--repeats n] scenes...
+ */
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+struct HitChecksum
+{
+    long long hitCount = 0;
+    double tSum = 0;
+};
+
+void AddHit(const HitRecord &hit, HitChecksum &checksum)
+{
+    if (!hit.IsValid())
+        return;
+
+    ++checksum.hitCount;
+    checksum.tSum += hit.t;
+}
+
+// Nanoseconds per ray
+float TimeSingleRays(const AccelerationStructure &accelerator, std::vector<Ray> &rays, float intersectionTestEpsilon, HitChecksum &checksum)
+{
+    checksum = HitChecksum{};
+
+    Clock::time_point start = Clock::now();
+    for (Ray &ray : rays)
+    {
+        HitRecord hit{};
+        accelerator.IntersectClosestHit(ray, hit, intersectionTestEpsilon);
+        AddHit(hit, checksum);
+    }
+
+    return std::chrono::duration<float, std::nano>(Clock::now() - start).count() / rays.size();
+}
+
+// Nanoseconds per ray, rowWidth keeps the packets from wrapping around the rows of the image
+float TimePackets(const AccelerationStructure &accelerator, std::vector<Ray> &rays, int rowWidth, float intersectionTestEpsilon, HitChecksum &checksum)
+{
+    checksum = HitChecksum{};
+    int rayCount = rays.size();
+
+    Clock::time_point start = Clock::now();
+    for (int rowStart = 0; rowStart < rayCount; rowStart += rowWidth)
+    {
+        for (int packetStart = rowStart; packetStart < rowStart + rowWidth; packetStart += RayPacket::size)
+        {
+            int packetRayCount = std::min(RayPacket::size, rowStart + rowWidth - packetStart);
+
+            Ray *packetRays[RayPacket::size];
+            for (int i = 0; i < packetRayCount; ++i)
+                packetRays[i] = &rays[packetStart + i];
+
+            RayPacket packet{packetRays, packetRayCount};
+            HitRecord hits[RayPacket::size]{};
+            accelerator.IntersectClosestHits(packet, hits, intersectionTestEpsilon);
+
+            for (int i = 0; i < packetRayCount; ++i)
+                AddHit(hits[i], checksum);
+        }
+    }
+
+    return std::chrono::duration<float, std::nano>(Clock::now() - start).count() / rays.size();
+}
+
+float Median(std::vector<float> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    int repeatCount = 5;
+    std::vector<const char *> scenePaths;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc)
+            repeatCount = atoi(argv[++i]);
+        else
+            scenePaths.push_back(argv[i]);
+    }
+
+    if (scenePaths.empty() || repeatCount <= 0)
+    {
+        std::cout << "Usage: packet_bench [--repeats n] scenes...\n";
+        return 2;
+    }
+
+    std::cout << "Packets of " << RayPacket::size << " rays\n";
+    for (const char *scenePath : scenePaths)
+    {
+        Scene *scene = SceneParser::CreateSceneFromXML(scenePath);
+        if (scene == nullptr)
+        {
+            std::cerr << "Could not load scene " << scenePath << "\n";
+            return 2;
+        }
+
+        AccelerationStructure *accelerator = AccelerationStructureFactory::CreateAccelerationStructure(scene->GetAccelerationStructureCode(), scene->GetAllPrimitives(),
+                                                                                                         scene->GetMaximumReferenceGrowth());
+        float intersectionTestEpsilon = scene->GetIntersectionTestEpsilon();
+
+        for (const Camera *camera : scene->GetAllCameras())
+        {
+            std::vector<Ray> rays;
+            rays.reserve(camera->imgPlane.nx * camera->imgPlane.ny);
+            for (int row = 0; row < camera->imgPlane.ny; ++row)
+                for (int column = 0; column < camera->imgPlane.nx; ++column)
+                    rays.push_back(camera->GenerateRay(row, column));
+
+            std::vector<float> singleRayTimes;
+            std::vector<float> packetTimes;
+            HitChecksum singleRayChecksum;
+            HitChecksum packetChecksum;
+            for (int repeat = 0; repeat < repeatCount; ++repeat)
+            {
+                singleRayTimes.push_back(TimeSingleRays(*accelerator, rays, intersectionTestEpsilon, singleRayChecksum));
+                packetTimes.push_back(TimePackets(*accelerator, rays, camera->imgPlane.nx, intersectionTestEpsilon, packetChecksum));
+            }
+
+            std::cout << scenePath << " " << camera->GetImageName() << ": "
+                      << Median(singleRayTimes) << " ns per ray one by one, "
+                      << Median(packetTimes) << " ns per ray in packets, "
+                      << "hits " << singleRayChecksum.hitCount << " / " << packetChecksum.hitCount << ", "
+                      << "t sum " << singleRayChecksum.tSum << " / " << packetChecksum.tSum << "\n";
+        }
+
+        delete accelerator;
+        delete scene;
+    }
+
+    return 0;
+}
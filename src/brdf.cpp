@@ -1,7 +1,7 @@
 /*
  * Various BRDF functions are implemented,
  * detailed explanation about BRDFs can be found on internet
- */ 
+ */
 
 #include "brdf.h"
 #include <algorithm>
@@ -10,9 +10,105 @@ const float pi = 3.14159265f;
 
 namespace actracer {
 
+    constexpr int BRDFBase::batchChunkSize;
+
+    BRDFBase::BRDFBase(float phong)
+        : specularPhong(phong)
+    {
+        isSpecularPhongInteger = phong >= 0 && phong <= 4096 && std::floor(phong) == phong;
+        integerSpecularPhong = isSpecularPhongInteger ? static_cast<int>(phong) : 0;
+    }
+
+    /*
+     * Exponent is the same for all values, looping over the bits outside lets the inner loops vectorize
+     */
+    void BRDFBase::PowSpecularBatch(float *values, int count) const
+    {
+        if (!isSpecularPhongInteger)
+        {
+            for (int i = 0; i < count; ++i)
+                values[i] = std::pow(values[i], specularPhong);
+            return;
+        }
+
+        float results[batchChunkSize];
+        for (int i = 0; i < count; ++i)
+            results[i] = 1.0f;
+
+        for (int exponent = integerSpecularPhong; exponent > 0; exponent >>= 1)
+        {
+            if (exponent & 1)
+            {
+                for (int i = 0; i < count; ++i)
+                    results[i] *= values[i];
+            }
+
+            // Squaring past the highest bit would only produce denormals
+            if (exponent == 1)
+                break;
+
+            for (int i = 0; i < count; ++i)
+                values[i] *= values[i];
+        }
+
+        for (int i = 0; i < count; ++i)
+            values[i] = results[i];
+    }
+
+    void BRDFBase::EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float ri, Vector3f *results)
+    {
+        for (int i = 0; i < count; ++i)
+            results[i] = f(wi[i], wo[i], n[i], kd, ks, ri);
+    }
+
+    /*
+     * Batch evaluations below load the directions of a chunk into separate component arrays
+     * and compute a diffuse and a specular factor per tuple, result is kd * diffuse + ks * specular.
+     * Tuples whose light is below the surface get zero factors
+     */
+    struct DirectionChunk
+    {
+        float x[BRDFBase::batchChunkSize];
+        float y[BRDFBase::batchChunkSize];
+        float z[BRDFBase::batchChunkSize];
+
+        void Load(const Vector3f *directions, int count)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                x[i] = directions[i].x;
+                y[i] = directions[i].y;
+                z[i] = directions[i].z;
+            }
+        }
+    };
+
+    static inline float Dot(const DirectionChunk &a, const DirectionChunk &b, int i)
+    {
+        return a.x[i] * b.x[i] + a.y[i] * b.y[i] + a.z[i] * b.z[i];
+    }
+
+    // Cosine between n and the normalized half vector of wi and wo
+    static inline float CosHalfVector(const DirectionChunk &wi, const DirectionChunk &wo, const DirectionChunk &n, int i)
+    {
+        float hx = wi.x[i] + wo.x[i];
+        float hy = wi.y[i] + wo.y[i];
+        float hz = wi.z[i] + wo.z[i];
+
+        return (n.x[i] * hx + n.y[i] * hy + n.z[i] * hz) / std::sqrt(hx * hx + hy * hy + hz * hz);
+    }
+
+    static void CombineBatchFactors(int count, const float *diffuseFactors, const float *specularFactors, const Vector3f &kd, const Vector3f &ks, Vector3f *results)
+    {
+        for (int i = 0; i < count; ++i)
+            results[i] = kd * diffuseFactors[i] + ks * specularFactors[i];
+    }
+
+    // --
+
     float BRDFTorranceSparrow::d(float cosa)
     {
-        return std::pow(cosa, specularPhong) * (specularPhong + 2) / (2.0f * pi); 
+        return PowSpecular(cosa) * (specularPhong + 2) / (2.0f * pi);
     }
 
     float BRDFTorranceSparrow::fr(float cosb, float ri)
@@ -20,7 +116,7 @@ namespace actracer {
         float n1 = 1.0f;        // Index of outside mat
         float n2 = ri; // Index of inside mat
 
-        
+
         cosb = Clamp<float>(cosb, -1, 1);
 
         if (cosb > 0) // Invert the normal for internal refraction
@@ -59,44 +155,94 @@ namespace actracer {
     {
         float cost = Dot(n, wi);
 
-        if(cost < 0)
+        if(cost <= 0)
             return Vector3f{};
 
-        if(std::acos(cost) < pi / 2.0)
+        Vector3f wh = Normalize(wi + wo);
+        float cosa = std::max(0.0f, Dot(n, wh));
+        float cosb = std::max(0.0f, Dot(wo, wh));
+        float cosc = Dot(wo, n);
+        if(kdfresnel)
+            return (1.0f - fr(cosb, ri)) * kd * (1.0f / pi) * cost + ks * g(wi, wo, n) * fr(cosb, ri) * d(cosa) / (4.0f * cosc);
+        else
+            return kd * (1.0f / pi) * cost + ks * g(wi, wo, n) * d(cosa) / (4.0f * cosc);
+    }
+
+    void BRDFTorranceSparrow::EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float ri, Vector3f *results)
+    {
+        DirectionChunk wis, wos, ns;
+        for (int start = 0; start < count; start += batchChunkSize)
         {
-            Vector3f wh = Normalize(wi + wo);
-            float cosa = std::max(0.0f, Dot(n, wh));
-            float cosb = std::max(0.0f, Dot(wo, wh));
-            float cosc = Dot(wo, n);
-            if(kdfresnel)
-                return (1.0f - fr(cosb, ri)) * kd * (1.0f / pi) * cost + ks * g(wi, wo, n) * fr(cosb, ri) * d(cosa) / (4.0f * cosc);
-            else
-                return kd * (1.0f / pi) * cost + ks * g(wi, wo, n) * d(cosa) / (4.0f * cosc);
+            int chunkCount = std::min(batchChunkSize, count - start);
+            wis.Load(wi + start, chunkCount);
+            wos.Load(wo + start, chunkCount);
+            ns.Load(n + start, chunkCount);
+
+            float costs[batchChunkSize];
+            float cosas[batchChunkSize];
+            float cosbs[batchChunkSize];
+            float cosWoNs[batchChunkSize];
+            float geometryTerms[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                float hx = wis.x[i] + wos.x[i];
+                float hy = wis.y[i] + wos.y[i];
+                float hz = wis.z[i] + wos.z[i];
+                float inverseLength = 1.0f / std::sqrt(hx * hx + hy * hy + hz * hz);
+
+                float cosWhN = (ns.x[i] * hx + ns.y[i] * hy + ns.z[i] * hz) * inverseLength;
+                float cosWhWo = (wos.x[i] * hx + wos.y[i] * hy + wos.z[i] * hz) * inverseLength;
+
+                costs[i] = Dot(ns, wis, i);
+                cosWoNs[i] = Dot(wos, ns, i);
+                cosas[i] = std::max(0.0f, cosWhN);
+                cosbs[i] = std::max(0.0f, cosWhWo);
+                geometryTerms[i] = std::min(1.0f, cosWhN * 2.0f / cosWhWo * std::min(cosWoNs[i], costs[i]));
+            }
+
+            // Distribution term
+            PowSpecularBatch(cosas, chunkCount);
+
+            float fresnels[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+                fresnels[i] = kdfresnel ? fr(cosbs[i], ri) : 1.0f;
+
+            float diffuseFactors[batchChunkSize];
+            float specularFactors[batchChunkSize];
+            float distributionScale = (specularPhong + 2) / (2.0f * pi);
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                bool isLit = costs[i] > 0;
+                float diffuseScale = kdfresnel ? 1.0f - fresnels[i] : 1.0f;
+
+                diffuseFactors[i] = isLit ? diffuseScale * (1.0f / pi) * costs[i] : 0.0f;
+                specularFactors[i] = isLit ? geometryTerms[i] * fresnels[i] * cosas[i] * distributionScale / (4.0f * cosWoNs[i]) : 0.0f;
+            }
+
+            CombineBatchFactors(chunkCount, diffuseFactors, specularFactors, kd, ks, results + start);
         }
-
-        return Vector3f{};
     }
 
+    // --
+
     void BRDFBlinnPhongModified::NormalizedCalculation(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, Vector3f& result)
     {
         float cost = Dot(wi, n);
 
-        if(cost < 0)
+        if(cost <= 0)
             return;
-        
-        if(std::acos(cost) < pi / 2.0)
-            result = (kd * (1.0f / pi) + (ks * (specularPhong + 8) * std::pow(std::max(0.0f, Dot(n, Normalize(wi + wo))), specularPhong) / (8 * pi))) * cost;
+
+        result = (kd * (1.0f / pi) + (ks * (specularPhong + 8) * PowSpecular(std::max(0.0f, Dot(n, Normalize(wi + wo)))) / (8 * pi))) * cost;
     }
 
     void BRDFBlinnPhongModified::ClassicCalculation(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, Vector3f &result)
     {
         float cost = Dot(wi, n);
 
-        if (cost < 0)
+        if (cost <= 0)
             return;
 
-        if (std::acos(cost) < pi / 2.0)
-            result = (kd + ks * std::pow(std::max(0.0f, Dot(n, Normalize(wi + wo))), specularPhong)) * cost;
+        result = (kd + ks * PowSpecular(std::max(0.0f, Dot(n, Normalize(wi + wo))))) * cost;
     }
 
     Vector3f BRDFBlinnPhongModified::f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float)
@@ -109,30 +255,65 @@ namespace actracer {
             ClassicCalculation(wi, wo, n, kd, ks, result);
 
         return result;
-        
+
     }
 
+    void BRDFBlinnPhongModified::EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float, Vector3f *results)
+    {
+        float diffuseScale = normalized ? 1.0f / pi : 1.0f;
+        float specularScale = normalized ? (specularPhong + 8) / (8 * pi) : 1.0f;
+
+        DirectionChunk wis, wos, ns;
+        for (int start = 0; start < count; start += batchChunkSize)
+        {
+            int chunkCount = std::min(batchChunkSize, count - start);
+            wis.Load(wi + start, chunkCount);
+            wos.Load(wo + start, chunkCount);
+            ns.Load(n + start, chunkCount);
+
+            float costs[batchChunkSize];
+            float cosHalfs[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                costs[i] = Dot(wis, ns, i);
+                cosHalfs[i] = std::max(0.0f, CosHalfVector(wis, wos, ns, i));
+            }
+
+            PowSpecularBatch(cosHalfs, chunkCount);
+
+            float diffuseFactors[batchChunkSize];
+            float specularFactors[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                float cost = costs[i] > 0 ? costs[i] : 0.0f;
+                diffuseFactors[i] = diffuseScale * cost;
+                specularFactors[i] = specularScale * cosHalfs[i] * cost;
+            }
+
+            CombineBatchFactors(chunkCount, diffuseFactors, specularFactors, kd, ks, results + start);
+        }
+    }
+
+    // --
+
     void BRDFPhongModified::NormalizedCalculation(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, Vector3f &result)
     {
         float cost = Dot(wi, n);
 
-        if (cost < 0.0f)
+        if (cost <= 0.0f)
             return;
 
-        if (std::acos(cost) < pi / 2.0)
-            result = (kd * (1.0f / pi) + ks * (specularPhong + 2) * std::pow(Dot(wo, wi - 2.0f * n * cost), specularPhong) / (2.0f * pi)) * cost;
+        result = (kd * (1.0f / pi) + ks * (specularPhong + 2) * PowSpecular(Dot(wo, wi - 2.0f * n * cost)) / (2.0f * pi)) * cost;
     }
 
     void BRDFPhongModified::ClassicCalculation(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, Vector3f &result)
     {
         float cost = Dot(wi, n);
 
-        if(cost < 0.0f)
+        if(cost <= 0.0f)
             return;
 
-        if(std::acos(cost) < pi / 2.0)
-            result = (kd + ks * std::pow(Dot(wo, wi - 2.0f * n * cost), specularPhong)) * cost;
-        
+        result = (kd + ks * PowSpecular(Dot(wo, wi - 2.0f * n * cost))) * cost;
     }
 
     Vector3f BRDFPhongModified::f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float)
@@ -147,6 +328,46 @@ namespace actracer {
         return result;
     }
 
+    void BRDFPhongModified::EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float, Vector3f *results)
+    {
+        float diffuseScale = normalized ? 1.0f / pi : 1.0f;
+        float specularScale = normalized ? (specularPhong + 2) / (2.0f * pi) : 1.0f;
+
+        DirectionChunk wis, wos, ns;
+        for (int start = 0; start < count; start += batchChunkSize)
+        {
+            int chunkCount = std::min(batchChunkSize, count - start);
+            wis.Load(wi + start, chunkCount);
+            wos.Load(wo + start, chunkCount);
+            ns.Load(n + start, chunkCount);
+
+            float costs[batchChunkSize];
+            float cosReflections[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                // Dot(wo, wi - 2 * n * cost)
+                costs[i] = Dot(wis, ns, i);
+                cosReflections[i] = Dot(wos, wis, i) - 2.0f * costs[i] * Dot(wos, ns, i);
+            }
+
+            PowSpecularBatch(cosReflections, chunkCount);
+
+            float diffuseFactors[batchChunkSize];
+            float specularFactors[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                // Reflection cosine may be negative below the surface, selected so its pow does not leak a nan
+                bool isLit = costs[i] > 0;
+                diffuseFactors[i] = isLit ? diffuseScale * costs[i] : 0.0f;
+                specularFactors[i] = isLit ? specularScale * cosReflections[i] * costs[i] : 0.0f;
+            }
+
+            CombineBatchFactors(chunkCount, diffuseFactors, specularFactors, kd, ks, results + start);
+        }
+    }
+
+    // --
+
     Vector3f BRDFBlinnPhongOriginal::f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float)
     {
         float cost = Dot(wi, n);
@@ -154,18 +375,90 @@ namespace actracer {
         if (cost <= 0)
             return Vector3f{};
 
-        return kd * cost + ks * std::pow(std::max(0.0f, Dot(n, Normalize(wi + wo))), specularPhong);
-        // if (std::acos(cost) < pi / 2.0) 
+        return kd * cost + ks * PowSpecular(std::max(0.0f, Dot(n, Normalize(wi + wo))));
     }
 
+    void BRDFBlinnPhongOriginal::EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float, Vector3f *results)
+    {
+        DirectionChunk wis, wos, ns;
+        for (int start = 0; start < count; start += batchChunkSize)
+        {
+            int chunkCount = std::min(batchChunkSize, count - start);
+            wis.Load(wi + start, chunkCount);
+            wos.Load(wo + start, chunkCount);
+            ns.Load(n + start, chunkCount);
+
+            float costs[batchChunkSize];
+            float cosHalfs[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                costs[i] = Dot(wis, ns, i);
+                cosHalfs[i] = std::max(0.0f, CosHalfVector(wis, wos, ns, i));
+            }
+
+            PowSpecularBatch(cosHalfs, chunkCount);
+
+            float diffuseFactors[batchChunkSize];
+            float specularFactors[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                bool isLit = costs[i] > 0;
+                diffuseFactors[i] = isLit ? costs[i] : 0.0f;
+                specularFactors[i] = isLit ? cosHalfs[i] : 0.0f;
+            }
+
+            CombineBatchFactors(chunkCount, diffuseFactors, specularFactors, kd, ks, results + start);
+        }
+    }
+
+    // --
+
     Vector3f BRDFPhongOriginal::f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float)
     {
         float cost = Dot(wi, n);
 
-        if (cost < 0.0f)
+        if (cost <= 0.0f)
             return Vector3f{};
 
-        if (std::acos(cost) < pi / 2.0)
-            return kd * cost + ks * std::pow(Dot(wo, Normalize(wi - 2.0f * n * cost)), specularPhong);
+        return kd * cost + ks * PowSpecular(Dot(wo, Normalize(wi - 2.0f * n * cost)));
+    }
+
+    void BRDFPhongOriginal::EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float, Vector3f *results)
+    {
+        DirectionChunk wis, wos, ns;
+        for (int start = 0; start < count; start += batchChunkSize)
+        {
+            int chunkCount = std::min(batchChunkSize, count - start);
+            wis.Load(wi + start, chunkCount);
+            wos.Load(wo + start, chunkCount);
+            ns.Load(n + start, chunkCount);
+
+            float costs[batchChunkSize];
+            float cosReflections[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                // Dot(wo, Normalize(r)) with r = wi - 2 * n * cost
+                float cost = Dot(wis, ns, i);
+                float rx = wis.x[i] - 2.0f * ns.x[i] * cost;
+                float ry = wis.y[i] - 2.0f * ns.y[i] * cost;
+                float rz = wis.z[i] - 2.0f * ns.z[i] * cost;
+
+                costs[i] = cost;
+                cosReflections[i] = (wos.x[i] * rx + wos.y[i] * ry + wos.z[i] * rz) / std::sqrt(rx * rx + ry * ry + rz * rz);
+            }
+
+            PowSpecularBatch(cosReflections, chunkCount);
+
+            float diffuseFactors[batchChunkSize];
+            float specularFactors[batchChunkSize];
+            for (int i = 0; i < chunkCount; ++i)
+            {
+                bool isLit = costs[i] > 0;
+                diffuseFactors[i] = isLit ? costs[i] : 0.0f;
+                specularFactors[i] = isLit ? cosReflections[i] : 0.0f;
+            }
+
+            CombineBatchFactors(chunkCount, diffuseFactors, specularFactors, kd, ks, results + start);
+        }
     }
-}
\ No newline at end of file
+}
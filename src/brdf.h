@@ -7,15 +7,45 @@
 namespace actracer {
 
 class BRDFBase {
+public:
+    static constexpr int batchChunkSize = 16; // Batches are evaluated chunk by chunk in flat arrays of this size
 protected:
     float specularPhong;
+    bool isSpecularPhongInteger; // Integer exponents are computed with multiplications instead of std::pow
+    int integerSpecularPhong;
+protected:
+    float PowSpecular(float base) const;
+    // PowSpecular for each of the values, in place
+    void PowSpecularBatch(float *values, int count) const;
 public:
     float ai;
     virtual Vector3f f(const Vector3f& wi, const Vector3f& wo, const Vector3f& n, const Vector3f& kd, const Vector3f& ks, float ri = 0.0f) = 0;
-
-    BRDFBase(float phong) : specularPhong(phong) { }
+    /*
+     * Evaluates f for count (wi, wo, n) tuples on a surface with the same coefficients,
+     * results[i] = f(wi[i], wo[i], n[i], kd, ks, ri)
+     * Default implementation calls f for each tuple
+     */
+    virtual void EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float ri, Vector3f *results);
+
+    BRDFBase(float phong);
 };
 
+inline float BRDFBase::PowSpecular(float base) const
+{
+    if (!isSpecularPhongInteger)
+        return std::pow(base, specularPhong);
+
+    float result = 1.0f;
+    for (int exponent = integerSpecularPhong; exponent > 0; exponent >>= 1)
+    {
+        if (exponent & 1)
+            result *= base;
+        base *= base;
+    }
+
+    return result;
+}
+
 class BRDFBlinnPhongModified : public BRDFBase{
 private:
     bool normalized;
@@ -25,6 +55,8 @@ private:
 public:
     virtual Vector3f f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float ri = 0.0f) override;
 
+    virtual void EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float ri, Vector3f *results) override;
+
     BRDFBlinnPhongModified(float phong, bool _normalized = false) : BRDFBase(phong), normalized(_normalized) { }
 };
 
@@ -33,6 +65,8 @@ class BRDFBlinnPhongOriginal : public BRDFBase {
 public:
     virtual Vector3f f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float ri = 0.0f) override;
 
+    virtual void EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float ri, Vector3f *results) override;
+
     BRDFBlinnPhongOriginal(float phong) : BRDFBase(phong) {}
 };
 
@@ -46,6 +80,8 @@ private:
 public:
     virtual Vector3f f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float ri = 0.0f) override;
 
+    virtual void EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float ri, Vector3f *results) override;
+
     BRDFPhongModified(float phong, bool _normalized = false) : BRDFBase(phong), normalized(_normalized) {}
 };
 
@@ -54,6 +90,8 @@ class BRDFPhongOriginal : public BRDFBase {
 public:
     virtual Vector3f f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float ri = 0.0f) override;
 
+    virtual void EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float ri, Vector3f *results) override;
+
     BRDFPhongOriginal(float phong) : BRDFBase(phong) {}
 };
 
@@ -70,6 +108,8 @@ private:
 public:
     virtual Vector3f f(const Vector3f &wi, const Vector3f &wo, const Vector3f &n, const Vector3f &kd, const Vector3f &ks, float ri = 0.0f) override;
 
+    virtual void EvaluateBatch(int count, const Vector3f *wi, const Vector3f *wo, const Vector3f *n, const Vector3f &kd, const Vector3f &ks, float ri, Vector3f *results) override;
+
     BRDFTorranceSparrow(float phong, bool _kdfresnel = false) : BRDFBase(phong), kdfresnel(_kdfresnel) {}
 };
 
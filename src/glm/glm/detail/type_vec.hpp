@@ -13,7 +13,7 @@ namespace detail
 	struct storage
 	{
 		typedef struct type {
-			uint8 data[size];
+			T data[size / sizeof(T)];
 		} type;
 	};
 
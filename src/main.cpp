@@ -8,21 +8,37 @@
 
 #include "SceneParser.h"
 
-#include "DefaultRenderer.h"
+#include "RenderStrategyFactory.h"
+#include "Tracer.h"
+
+#include <cstring>
 
 using namespace actracer;
 
 int main(int argc, char* argv[])
 {
     const char *xmlPath = argv[1];
+
+    // raytracer scene.xml --trace trace.json writes the timeline of the run
+    const char *tracePath = nullptr;
+    if (argc > 3 && strcmp(argv[2], "--trace") == 0)
+    {
+        tracePath = argv[3];
+        Tracer::Enable();
+    }
     
 	Scene* currentScene = currentScene = SceneParser::CreateSceneFromXML(xmlPath);
-    RenderStrategy* renderer = new DefaultRenderer();
+    RenderStrategy* renderer = RenderStrategyFactory::CreateRenderStrategy(currentScene->GetRenderStrategyCode());
 	std::cout << "Scene is parsed\n";
 	system("pause");
     renderer->RenderSceneIntoPPM(currentScene); // Main method call
     system("pause");
 
+    if (tracePath && !Tracer::WriteChromeTrace(tracePath))
+    {
+        std::cout << "Could not write trace to " << tracePath << "\n";
+    }
+
 	delete renderer;
 	delete currentScene;
 
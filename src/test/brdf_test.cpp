@@ -0,0 +1,142 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+#include "brdf.h"
+
+using namespace actracer;
+
+/*
+ * Compares EvaluateBatch of each BRDF against f called tuple by tuple on random directions.
+ * Batches are computed with reordered arithmetic, results are compared with a relative tolerance.
+ * Returns the number of the failed cases
+ */
+namespace
+{
+
+struct TestCase
+{
+    const char *name;
+    BRDFBase *brdf;
+};
+
+Vector3f RandomDirection(std::mt19937 &generator)
+{
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    while (true)
+    {
+        Vector3f direction{distribution(generator), distribution(generator), distribution(generator)};
+        float lengthSquared = Dot(direction, direction);
+        if (lengthSquared > 1e-4f && lengthSquared <= 1.0f)
+            return Normalize(direction);
+    }
+}
+
+bool IsClose(float a, float b)
+{
+    if (std::isnan(a) || std::isnan(b))
+        return std::isnan(a) && std::isnan(b);
+
+    return std::fabs(a - b) <= 1e-3f * std::max(std::fabs(a), std::fabs(b)) + 1e-5f;
+}
+
+bool IsClose(const Vector3f &a, const Vector3f &b)
+{
+    return IsClose(a.x, b.x) && IsClose(a.y, b.y) && IsClose(a.z, b.z);
+}
+
+/*
+ * Directions are random over the whole sphere, so about half of the tuples have the light below the surface
+ * and half have the viewer below it. Returns the number of the tuples whose results differ
+ */
+int CompareBatch(BRDFBase *brdf, int count, std::mt19937 &generator, int &backFacingCount)
+{
+    std::vector<Vector3f> wi(count), wo(count), n(count);
+    for (int i = 0; i < count; ++i)
+    {
+        wi[i] = RandomDirection(generator);
+        wo[i] = RandomDirection(generator);
+        n[i] = RandomDirection(generator);
+        if (Dot(wi[i], n[i]) <= 0)
+            ++backFacingCount;
+    }
+
+    Vector3f kd{0.6f, 0.3f, 0.1f};
+    Vector3f ks{0.2f, 0.5f, 0.9f};
+    float ri = 1.5f;
+
+    std::vector<Vector3f> results(count);
+    brdf->EvaluateBatch(count, wi.data(), wo.data(), n.data(), kd, ks, ri, results.data());
+
+    int mismatchCount = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        Vector3f expected = brdf->f(wi[i], wo[i], n[i], kd, ks, ri);
+        if (!IsClose(expected, results[i]))
+        {
+            if (mismatchCount == 0)
+                std::cout << "    tuple " << i << ": f = (" << expected.x << ", " << expected.y << ", " << expected.z
+                          << "), batch = (" << results[i].x << ", " << results[i].y << ", " << results[i].z << ")\n";
+            ++mismatchCount;
+        }
+    }
+
+    return mismatchCount;
+}
+
+}
+
+int main()
+{
+    const float exponents[] = {1.0f, 50.0f, 12.5f}; // 12.5 takes the std::pow path
+    const int counts[] = {1, 15, 16, 37, 100};       // Partial chunks and chunk multiples
+
+    std::mt19937 generator(1);
+    int failedCount = 0;
+    int caseCount = 0;
+
+    for (float exponent : exponents)
+    {
+        std::vector<TestCase> cases = {
+            {"BlinnPhongOriginal", new BRDFBlinnPhongOriginal(exponent)},
+            {"BlinnPhongModified", new BRDFBlinnPhongModified(exponent)},
+            {"BlinnPhongModifiedNormalized", new BRDFBlinnPhongModified(exponent, true)},
+            {"PhongOriginal", new BRDFPhongOriginal(exponent)},
+            {"PhongModified", new BRDFPhongModified(exponent)},
+            {"PhongModifiedNormalized", new BRDFPhongModified(exponent, true)},
+            {"TorranceSparrow", new BRDFTorranceSparrow(exponent)},
+            {"TorranceSparrowKdFresnel", new BRDFTorranceSparrow(exponent, true)}
+        };
+
+        for (TestCase &testCase : cases)
+        {
+            testCase.brdf->ai = 0.0f;
+            for (int count : counts)
+            {
+                int backFacingCount = 0;
+                int mismatchCount = CompareBatch(testCase.brdf, count, generator, backFacingCount);
+                ++caseCount;
+
+                if (mismatchCount > 0)
+                {
+                    ++failedCount;
+                    std::cout << "FAIL " << testCase.name << " exponent " << exponent << " count " << count
+                              << ": " << mismatchCount << " tuples differ\n";
+                }
+                else if (count > 1 && backFacingCount == 0)
+                {
+                    ++failedCount;
+                    std::cout << "FAIL " << testCase.name << " count " << count << ": no back-facing tuples were drawn\n";
+                }
+            }
+
+            delete testCase.brdf;
+        }
+    }
+
+    std::cout << caseCount - failedCount << "/" << caseCount << " BRDF batch cases passed\n";
+
+    return failedCount;
+}